@@ -3,8 +3,13 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#include <atomic>
+
+#include "Nixie_Tube_Driver.h"
+#include "animation.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/semphr.h"
+#include "util.h"
 
 #define ONES(x) x % 10
 #define TENS(x) (x / 10) % 10
@@ -42,12 +47,28 @@
 
 #define NIXIE_SMOOTH_TRANSITION_TIME_MS 980
 
-#define LEFT_DISPLAY(nixie_digit) (nixie_digit << 4)
-#define RIGHT_DISPLAY(nixie_digit) (nixie_digit)
-#define DUAL_DISPLAY(left_nixie_digit, right_nixie_digit) \
-  (LEFT_DISPLAY(left_nixie_digit) | RIGHT_DISPLAY(right_nixie_digit))
+// Brightness levels are perceptually linear. Level 0 turns the tubes off
+#define NIXIE_MAX_BRIGHTNESS 10
+#define NIXIE_BRIGHTNESS_RAMP_TIME_MS 3000
+
+typedef enum {
+  NIXIE_NUMBER_OK,
+  NIXIE_NUMBER_OVERFLOW,    // Saturated at the largest value that fits
+  NIXIE_NUMBER_BAD_FORMAT,
+} nixie_number_result_t;
+
+// BCD codes of the IN-12 tube driver ICs, indexed by digit position
+struct In12_Encoding {
+  static constexpr uint8_t codes[NUM_NIXIE_DIGITS] = {
+      NIXIE_ZERO,  NIXIE_ONE,  NIXIE_TWO,       NIXIE_THREE,
+      NIXIE_FOUR,  NIXIE_FIVE, NIXIE_SIX,       NIXIE_SEVEN,
+      NIXIE_EIGHT, NIXIE_NINE, NIXIE_BLANK_CODE};
+};
 
-#define NIXIE_BLANK NUM_ELEMENTS(nixie_digits)
+// The NIXIE_DOTS_* values above match the dot register wiring of this board
+struct In12_Dot_Layout {
+  static constexpr uint8_t map(uint8_t dots) { return dots; }
+};
 
 class Nixie_Display {
  public:
@@ -63,12 +84,49 @@ class Nixie_Display {
 
   static const size_t num_display_digits = 6;
 
+  // A complete frame. Writers compose one in a local back buffer and publish
+  // it to the front buffer all at once
+  struct Display_Buffer {
+    uint8_t digits[num_display_digits];
+    uint8_t dots;
+  };
+
+  // How a fixed-point number is laid out on the tubes. The tubes have no sign
+  // or decimal point, so both are shown with the dot separators
+  struct Number_Format {
+    // 0, 2 or 4. The decimal point is the bottom dot after the minutes or
+    // hours tubes
+    uint8_t decimal_places;
+    // Leading zeros are blanked, keeping at least this many integer digits
+    uint8_t min_integer_digits;
+    uint8_t negative_dots;
+    // Shown when the value is too large and the tubes are saturated at 9s
+    uint8_t overflow_dots;
+  };
+
   // Transition from whatever is currently on the display to the new value
   void smooth_display_value(size_t transition_time_ms, int8_t hours,
                             int8_t minutes, int8_t seconds,
                             uint8_t nixie_dots = NIXIE_DOTS_ALL,
                             bool blank_all = true);
 
+  // Transition from whatever is currently on the display to the new frame.
+  // Unless blank_all is set, only the tubes that change fade through blank
+  void smooth_display_buffer(size_t transition_time_ms,
+                             const Display_Buffer& next,
+                             bool blank_all = true);
+
+  // Show value / 10^value_places, rounded half away from zero to the
+  // format's decimal places
+  nixie_number_result_t display_number(int32_t value, uint8_t value_places,
+                                       const Number_Format& format);
+
+  nixie_number_result_t smooth_display_number(size_t transition_time_ms,
+                                              int32_t value,
+                                              uint8_t value_places,
+                                              const Number_Format& format,
+                                              bool blank_all = true);
+
   // Shift out the current time transitioning to the time 1 second from now
   void smooth_display_time(const struct tm& current_time,
                            bool twelve_hour_format = true,
@@ -84,28 +142,59 @@ class Nixie_Display {
 
   void display_timer_select(uint8_t digit_pair_pos, uint8_t value);
 
-  void display_slot_machine_cycle(const struct tm& current_time,
-                                  bool twelve_hour_format = true);
+  // Play the slot machine animation, ending on the time it finishes at
+  void display_slot_machine_cycle(
+      const struct tm& current_time, bool twelve_hour_format = true,
+      const uint8_t* animation = c_animation_slot_machine,
+      size_t animation_size = c_animation_slot_machine_size);
+
+  // Run an animation program, starting from whatever is on the display.
+  // See animation.h for the format
+  animation_error_t play_animation(const uint8_t* program, size_t size);
 
   void display_value(uint8_t hours, uint8_t minutes, uint8_t seconds,
                      uint8_t nixie_dots = NIXIE_DOTS_ALL);
 
+  // Show digit positions (0-9 or NIXIE_BLANK_POS) on each tube directly
+  void display_digits(const uint8_t digits[num_display_digits],
+                      uint8_t nixie_dots = NIXIE_DOTS_NONE);
+
   // Get the current state of the dot separtors
-  uint8_t get_dot_separators() const { return m_dots; }
+  uint8_t get_dot_separators() const { return read_front_buffer().dots; }
 
-  // Update the dot separators on the display, keeping all other digits the same
+  // Update the dot separators on the display, keeping all other digits the
+  // same. Safe to call without the display mutex
   void set_dot_separators(uint8_t nixie_dots) {
-    m_dots = nixie_dots;
-    show();
+    modify_and_publish(
+        [nixie_dots](Display_Buffer* buffer) { buffer->dots = nixie_dots; });
   }
 
   // Get the digits and dots that are currently being displayed
   void get_current_display(uint8_t* hours, uint8_t* minutes, uint8_t* seconds,
                            uint8_t* dots) const;
 
+  // Lock-free, consistent copy of the frame on the display
+  static Display_Buffer read_front_buffer() {
+    return unpack_buffer(m_front_buffer.load(std::memory_order_acquire));
+  }
+
+  // Ramp the global brightness to the given level using the hardware PWM on
+  // the output enable pin. Independent of anything being shown on the display
+  static void set_brightness(
+      uint8_t level, size_t ramp_time_ms = NIXIE_BRIGHTNESS_RAMP_TIME_MS);
+
+  static uint8_t get_brightness() { return m_brightness; }
+
   static void get_offset_time(struct tm* offset_time,
                               const struct tm& current_time, int time_delta);
 
+  // Lay out a fixed-point number as a frame, using integer arithmetic only.
+  // The frame is left unchanged if the format is invalid
+  static nixie_number_result_t render_number(int32_t value,
+                                             uint8_t value_places,
+                                             const Number_Format& format,
+                                             Display_Buffer* buffer);
+
   static void set_digit_array_from_value(
       uint8_t digit_array[num_display_digits], int8_t hours, int8_t minutes,
       int8_t seconds);
@@ -113,9 +202,57 @@ class Nixie_Display {
   static SemaphoreHandle_t display_mutex;
 
  private:
-  // Put the contents of the display onto the nixie tubes
+  typedef Nixie_Tube_Driver<num_display_digits, In12_Encoding,
+                            Register_Order::first_tube_farthest,
+                            In12_Dot_Layout>
+      Tube_Driver;
+
+  // Put the front buffer onto the nixie tubes. Every publish ends with a
+  // show, so whichever show runs last always outputs the latest frame
   void show() const;
 
+  // Replace the front buffer with a complete frame and show it
+  void publish(const Display_Buffer& buffer) {
+    m_front_buffer.store(pack_buffer(buffer), std::memory_order_release);
+    show();
+  }
+
+  // Change part of the front buffer. The change is applied to a copy and
+  // retried if another producer published in the meantime, so concurrent
+  // partial updates (e.g. dots and digits) are never lost
+  template <typename Update>
+  void modify_and_publish(Update update) {
+    uint32_t front = m_front_buffer.load(std::memory_order_acquire);
+    uint32_t back;
+    do {
+      Display_Buffer buffer = unpack_buffer(front);
+      update(&buffer);
+      back = pack_buffer(buffer);
+    } while (!m_front_buffer.compare_exchange_weak(front, back,
+                                                   std::memory_order_acq_rel,
+                                                   std::memory_order_acquire));
+    show();
+  }
+
+  // 4 bits per tube from the left, then 4 bits of dots
+  static uint32_t pack_buffer(const Display_Buffer& buffer) {
+    uint32_t packed = 0;
+    for (size_t i = 0; i < num_display_digits; ++i) {
+      packed |= (uint32_t)(buffer.digits[i] & 0x0f) << (4 * i);
+    }
+    packed |= (uint32_t)(buffer.dots & 0x0f) << (4 * num_display_digits);
+    return packed;
+  }
+
+  static Display_Buffer unpack_buffer(uint32_t packed) {
+    Display_Buffer buffer;
+    for (size_t i = 0; i < num_display_digits; ++i) {
+      buffer.digits[i] = (packed >> (4 * i)) & 0x0f;
+    }
+    buffer.dots = (packed >> (4 * num_display_digits)) & 0x0f;
+    return buffer;
+  }
+
   static inline uint8_t convert_24_hour_to_12_hour(uint8_t hours) {
     hours = hours % 12;
     return hours == 0 ? 12 : hours;
@@ -130,24 +267,27 @@ class Nixie_Display {
   Nixie_Display(Nixie_Display&&) = delete;
   Nixie_Display& operator=(Nixie_Display&&) = delete;
 
-  static const uint8_t nixie_digits[];
-
-  static const int clock_pin;
-  static const int latch_pin;
   static const int output_enable_pin;
-  static const int data_pin;
 
-  static uint8_t m_digits[num_display_digits];
-  static uint8_t m_dots;
+  static const uint32_t brightness_duty[NIXIE_MAX_BRIGHTNESS + 1];
+  static uint8_t m_brightness;
 
-  void smooth_display_transition(
-      const uint8_t current_digits[num_display_digits],
-      const uint8_t next_digits[num_display_digits], uint8_t current_nixie_dots,
-      uint8_t next_nixie_dots, size_t transition_time_ms);
+  // Paces the frames of transitions and animations
+  static Deadline_Timer frame_timer;
 
-  void slot_machine_cycle_phase(const struct tm& end_time,
-                                int num_cycling_digits, double phase_ms,
-                                bool twelve_hour_format);
+  static const Tube_Driver tube_driver;
+
+  // The packed frame on the display. Only ever replaced as a whole
+  static std::atomic<uint32_t> m_front_buffer;
+  static portMUX_TYPE output_mux;
+
+  void smooth_display_transition(const Display_Buffer& current,
+                                 const Display_Buffer& next,
+                                 size_t transition_time_ms);
+
+  // Cross-fade each tube over its own duration. Returns the end deadline
+  int64_t play_animation_fade(const uint8_t* operands, Display_Buffer* buffer,
+                              int64_t start_us);
 
   static void set_time_in_array(uint8_t array[num_display_digits],
                                 const struct tm& time_info,
@@ -0,0 +1,122 @@
+#pragma once
+
+#include <Arduino.h>
+#include <soc/gpio_struct.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Order of the tube registers in the shift register chain. The register that
+// is shifted out first ends up farthest from the MCU
+enum class Register_Order {
+  first_tube_farthest,
+  first_tube_nearest,
+};
+
+// Shift register driver for a chain of nixie tubes, parameterized at compile
+// time on the board layout:
+//   - NumTubes: number of tubes. Each 8 bit register drives a pair of tubes,
+//     the left tube on the upper nibble
+//   - Encoding: provides codes[], the 4 bit BCD code for each digit position
+//   - Order: order of the tube registers in the chain
+//   - Dot_Layout: provides map(), translating the logical dot separators into
+//     the bits of the dot register, which is always nearest the MCU
+//
+// Every write shifts out and latches a complete frame, so partial frames are
+// never visible on the tubes
+template <size_t NumTubes, typename Encoding, Register_Order Order,
+          typename Dot_Layout>
+class Nixie_Tube_Driver {
+ public:
+  static_assert(NumTubes > 0 && NumTubes % 2 == 0,
+                "Each shift register drives a pair of tubes");
+
+  static constexpr size_t num_tubes = NumTubes;
+
+  // One register per pair of tubes plus one for the dot separators
+  static constexpr size_t num_frame_bytes = (NumTubes / 2) + 1;
+
+  // A frame in the order it is shifted out. Every byte is shifted out least
+  // significant bit first
+  struct Frame {
+    uint8_t bytes[num_frame_bytes];
+  };
+
+  constexpr Nixie_Tube_Driver(int clock_pin, int latch_pin, int data_pin)
+      : m_clock_mask(1UL << clock_pin),
+        m_latch_mask(1UL << latch_pin),
+        m_data_mask(1UL << data_pin),
+        m_clock_pin(clock_pin),
+        m_latch_pin(latch_pin),
+        m_data_pin(data_pin) {}
+
+  void setup() const {
+    // Only the first GPIO bank is driven directly
+    configASSERT(m_clock_pin < 32 && m_latch_pin < 32 && m_data_pin < 32);
+
+    pinMode(m_clock_pin, OUTPUT);
+    pinMode(m_latch_pin, OUTPUT);
+    pinMode(m_data_pin, OUTPUT);
+  }
+
+  // Pack the digit positions (indices into Encoding::codes) and dots into a
+  // frame that is ready to be shifted out
+  static constexpr Frame pack(const uint8_t (&digit_positions)[NumTubes],
+                              uint8_t dots) {
+    Frame frame{};
+
+    for (size_t pair = 0; pair < NumTubes / 2; ++pair) {
+      size_t byte_index = (Order == Register_Order::first_tube_farthest)
+                              ? pair
+                              : (NumTubes / 2) - 1 - pair;
+
+      frame.bytes[byte_index] =
+          (Encoding::codes[digit_positions[2 * pair]] << 4) |
+          Encoding::codes[digit_positions[(2 * pair) + 1]];
+    }
+
+    // The dot register is wired most significant bit first
+    frame.bytes[num_frame_bytes - 1] = reverse_bits(Dot_Layout::map(dots));
+
+    return frame;
+  }
+
+  // Shift out and latch a complete frame
+  void write_frame(const Frame& frame) const {
+    GPIO.out_w1tc = m_latch_mask;
+
+    for (size_t i = 0; i < num_frame_bytes; ++i) {
+      uint8_t value = frame.bytes[i];
+      for (uint8_t bit = 0; bit < 8; ++bit) {
+        if (value & (1 << bit)) {
+          GPIO.out_w1ts = m_data_mask;
+        } else {
+          GPIO.out_w1tc = m_data_mask;
+        }
+
+        GPIO.out_w1ts = m_clock_mask;
+        GPIO.out_w1tc = m_clock_mask;
+      }
+    }
+
+    GPIO.out_w1ts = m_latch_mask;
+  }
+
+ private:
+  static constexpr uint8_t reverse_bits(uint8_t value) {
+    uint8_t reversed = 0;
+    for (uint8_t bit = 0; bit < 8; ++bit) {
+      if (value & (1 << bit)) {
+        reversed |= 1 << (7 - bit);
+      }
+    }
+    return reversed;
+  }
+
+  const uint32_t m_clock_mask;
+  const uint32_t m_latch_mask;
+  const uint32_t m_data_mask;
+
+  const int m_clock_pin;
+  const int m_latch_pin;
+  const int m_data_pin;
+};
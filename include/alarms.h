@@ -0,0 +1,38 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "executor.h"
+
+#define MAX_ALARMS 8
+
+// Repeat masks. Bit n is set for day n of the week (0 = Sunday). An empty
+// mask is a one-shot alarm that disables itself once it fires
+#define ALARM_ONE_SHOT 0x00
+#define ALARM_DAILY 0x7f
+#define ALARM_WEEKDAYS 0x3e
+#define ALARM_WEEKENDS 0x41
+
+typedef struct {
+  bool enabled;
+  uint8_t hour;
+  uint8_t minute;
+  uint8_t weekday_mask;
+} alarm_t;
+
+// Alarms are kept in a min-heap of their next fire times, with a single timer
+// armed for the earliest one. Nothing polls the clock. The timer callback
+// sounds the buzzer and a job on the executor reschedules the fired alarms
+void setup_alarms(executor_t* executor);
+
+void get_alarm(size_t index, alarm_t* alarm);
+
+// Store an alarm in the EEPROM and reschedule
+void set_alarm(size_t index, const alarm_t& alarm);
+
+// Recompute all of the fire times. Must be called when the clock is stepped
+void reschedule_alarms();
+
+// Time left until the next alarm. Returns false if no alarm is scheduled
+bool get_next_alarm_remaining(int64_t* remaining_us);
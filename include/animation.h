@@ -0,0 +1,92 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Display animations are compact bytecode programs run by
+// Nixie_Display::play_animation(). A program starts with a 3 byte header
+// (ANIMATION_MAGIC_0, ANIMATION_MAGIC_1, ANIMATION_VERSION) followed by
+// instructions. Each instruction is an opcode byte followed by its operands.
+// Multi-byte operands are little endian.
+//
+// Digits are 0-9, NIXIE_BLANK_POS (10) for a blank tube or ANIMATION_KEEP to
+// leave the tube as it is. Tube masks have bit i set for tube i, where tube 0
+// is the leftmost tube.
+//
+// tools/animation_tool.py assembles, validates and times programs on the host
+#define ANIMATION_MAGIC_0 'N'
+#define ANIMATION_MAGIC_1 'A'
+#define ANIMATION_VERSION 1
+#define ANIMATION_HEADER_SIZE 3
+
+#define ANIMATION_KEEP 0xff
+
+#define ANIMATION_NUM_TUBES 6
+#define ANIMATION_ALL_TUBES 0x3f
+
+#define ANIMATION_MAX_LOOP_DEPTH 4
+
+// Fades are multiplexed with this period, like smooth transitions
+#define ANIMATION_FADE_PERIOD_MS 10
+
+// Per-tube fade durations are in units of this many milliseconds
+#define ANIMATION_FADE_UNIT_MS 10
+
+// Largest program that can be loaded from the filesystem
+#define ANIMATION_MAX_FILE_SIZE 512
+
+enum animation_opcode_t : uint8_t {
+  ANIMATION_OP_END = 0x00,
+  // digits[6], dots: show a frame immediately
+  ANIMATION_OP_FRAME = 0x01,
+  // uint16 duration_ms: hold the current frame
+  ANIMATION_OP_HOLD = 0x02,
+  // digits[6], dots, durations[6]: cross-fade each tube to its target over
+  // its own duration (in ANIMATION_FADE_UNIT_MS). The dots fade over the
+  // longest of the tube durations
+  ANIMATION_OP_FADE = 0x03,
+  // dots: set the dot separators
+  ANIMATION_OP_DOTS = 0x04,
+  // count: repeat the instructions up to the matching LOOP_END count times
+  ANIMATION_OP_LOOP = 0x05,
+  ANIMATION_OP_LOOP_END = 0x06,
+  // mask: show random digits on the masked tubes
+  ANIMATION_OP_RANDOM = 0x07,
+  // mask: advance the digits on the masked tubes by one
+  ANIMATION_OP_CYCLE = 0x08,
+};
+
+enum animation_error_t {
+  ANIMATION_OK = 0,
+  ANIMATION_ERROR_BAD_HEADER,
+  ANIMATION_ERROR_BAD_OPCODE,
+  ANIMATION_ERROR_TRUNCATED,
+  ANIMATION_ERROR_BAD_OPERAND,
+  ANIMATION_ERROR_LOOP_DEPTH,
+  ANIMATION_ERROR_UNMATCHED_LOOP,
+  ANIMATION_ERROR_NO_END,
+  ANIMATION_ERROR_TOO_LONG,
+  ANIMATION_ERROR_FILE,
+};
+
+typedef struct {
+  uint32_t duration_ms;
+  uint32_t num_instructions;  // Executed, including loop iterations
+} animation_info_t;
+
+// Spins all of the tubes and stops them one at a time from the left,
+// starting and ending on the frame that is already on the display
+extern const uint8_t c_animation_slot_machine[];
+extern const size_t c_animation_slot_machine_size;
+
+// Number of operand bytes following the opcode, or -1 for an unknown opcode
+int get_animation_operand_size(uint8_t opcode);
+
+// Check that a program is well formed, so that the interpreter never has to.
+// Optionally reports how long the program runs for
+animation_error_t validate_animation(const uint8_t* program, size_t size,
+                                     animation_info_t* info = NULL);
+
+// Load a program from LittleFS into the buffer and validate it
+animation_error_t load_animation_file(const char* path, uint8_t* buffer,
+                                      size_t buffer_size, size_t* size);
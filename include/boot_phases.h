@@ -0,0 +1,25 @@
+#pragma once
+
+#include <stdint.h>
+
+// Milestones of the boot sequence, in the order they are normally reached
+typedef enum {
+  BOOT_PHASE_SETUP,
+  BOOT_PHASE_DISPLAY_READY,
+  BOOT_PHASE_TIME_RESTORED,  // Only after a warm reset
+  BOOT_PHASE_FIRST_CORRECT_TIME,
+  BOOT_PHASE_TASKS_STARTED,
+  BOOT_PHASE_NTP_SYNCED,
+  NUM_BOOT_PHASES,
+} boot_phase_t;
+
+// Record when a phase was reached. Only the first time counts
+void mark_boot_phase(boot_phase_t phase);
+
+// Microseconds since esp_timer started, which excludes the bootloader, or -1
+// if the phase hasn't been reached
+int64_t get_boot_phase_us(boot_phase_t phase);
+
+const char* get_boot_phase_name(boot_phase_t phase);
+
+void print_boot_phases();
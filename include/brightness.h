@@ -0,0 +1,10 @@
+#pragma once
+
+#include <stdint.h>
+#include <time.h>
+
+// Whether the configured night schedule applies at the given time
+bool is_night_time(const struct tm& time_info);
+
+// The configured brightness level for the given time of day
+uint8_t get_scheduled_brightness(const struct tm& time_info);
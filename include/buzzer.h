@@ -0,0 +1,36 @@
+#pragma once
+
+#include <stdint.h>
+
+typedef struct {
+  uint16_t frequency_hz;  // Zero is silence
+  uint16_t duration_ms;
+} buzzer_note_t;
+
+typedef struct {
+  const buzzer_note_t* notes;
+  uint8_t num_notes;
+  uint8_t num_repeats;
+} buzzer_pattern_t;
+
+extern const int c_buzzer_pin;
+
+extern const buzzer_pattern_t c_buzzer_pattern_click;
+extern const buzzer_pattern_t c_buzzer_pattern_alarm;
+extern const buzzer_pattern_t c_buzzer_pattern_hour_chime;
+
+void setup_buzzer();
+
+// Queue a pattern to be played. Never blocks: the pattern is dropped if the
+// queue is full. Safe to call from esp_timer callbacks
+bool buzzer_play(const buzzer_pattern_t* pattern);
+
+// Stop the pattern that is playing and drop all of the queued ones
+void buzzer_stop();
+
+// buzzer_stop() if the pattern is the one playing. Returns whether it was
+bool buzzer_stop_pattern(const buzzer_pattern_t* pattern);
+
+// Blocks until a pattern is queued and plays it on the LEDC hardware. Called
+// from the buzzer task
+void play_queued_buzzer_pattern();
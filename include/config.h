@@ -3,9 +3,12 @@
 #include <FreeRTOS.h>
 #include <stdint.h>
 
+#include "coroutine.h"
+#include "executor.h"
+
 class Nixie_Display;
 
-#define EEPROM_SIZE 10
+#define EEPROM_SIZE 64
 
 #define EEPROM_SENTINEL_ADDRESS 0
 #define EEPROM_INITIALIZED 1
@@ -28,13 +31,85 @@ class Nixie_Display;
 #define EEPROM_SPECIAL_MODES_ADDRESS 4
 #define EEPROM_SPECIAL_MODES_DEFAULT 0
 #define EEPROM_SPECIAL_MODES_LOWER_BOUND 0
-#define EEPROM_SPECIAL_MODES_UPPER_BOUND 1
+#define EEPROM_SPECIAL_MODES_UPPER_BOUND 4
 
 #define EEPROM_LOCAL_TEMPERATURE_DISPLAY_FREQUENCY_ADDRESS 5
 #define EEPROM_LOCAL_TEMPERATURE_DISPLAY_FREQUENCY_DEFAULT 5
 #define EEPROM_LOCAL_TEMPERATURE_DISPLAY_FREQUENCY_LOWER_BOUND 5
 #define EEPROM_LOCAL_TEMPERATURE_DISPLAY_FREQUENCY_UPPER_BOUND 99
 
+#define EEPROM_DAY_BRIGHTNESS_ADDRESS 6
+#define EEPROM_DAY_BRIGHTNESS_DEFAULT NIXIE_MAX_BRIGHTNESS
+#define EEPROM_DAY_BRIGHTNESS_LOWER_BOUND 1
+#define EEPROM_DAY_BRIGHTNESS_UPPER_BOUND NIXIE_MAX_BRIGHTNESS
+
+#define EEPROM_NIGHT_BRIGHTNESS_ADDRESS 7
+#define EEPROM_NIGHT_BRIGHTNESS_DEFAULT 4
+#define EEPROM_NIGHT_BRIGHTNESS_LOWER_BOUND 1
+#define EEPROM_NIGHT_BRIGHTNESS_UPPER_BOUND NIXIE_MAX_BRIGHTNESS
+
+// The night brightness applies from the start hour up to (but not including)
+// the end hour. Setting both to the same hour disables night dimming
+#define EEPROM_NIGHT_START_HOUR_ADDRESS 8
+#define EEPROM_NIGHT_START_HOUR_DEFAULT 22
+#define EEPROM_NIGHT_START_HOUR_LOWER_BOUND 0
+#define EEPROM_NIGHT_START_HOUR_UPPER_BOUND 23
+
+#define EEPROM_NIGHT_END_HOUR_ADDRESS 9
+#define EEPROM_NIGHT_END_HOUR_DEFAULT 7
+#define EEPROM_NIGHT_END_HOUR_LOWER_BOUND 0
+#define EEPROM_NIGHT_END_HOUR_UPPER_BOUND 23
+
+// The tubes are turned off and the MCU sleeps from the start hour up to (but
+// not including) the end hour. Setting both to the same hour disables it
+#define EEPROM_TUBES_OFF_START_HOUR_ADDRESS 10
+#define EEPROM_TUBES_OFF_START_HOUR_DEFAULT 0
+#define EEPROM_TUBES_OFF_START_HOUR_LOWER_BOUND 0
+#define EEPROM_TUBES_OFF_START_HOUR_UPPER_BOUND 23
+
+#define EEPROM_TUBES_OFF_END_HOUR_ADDRESS 11
+#define EEPROM_TUBES_OFF_END_HOUR_DEFAULT 0
+#define EEPROM_TUBES_OFF_END_HOUR_LOWER_BOUND 0
+#define EEPROM_TUBES_OFF_END_HOUR_UPPER_BOUND 23
+
+// How long the time is shown when woken up by the encoder switch
+#define EEPROM_TUBES_OFF_WAKE_DURATION_ADDRESS 12
+#define EEPROM_TUBES_OFF_WAKE_DURATION_DEFAULT 10  // In seconds
+#define EEPROM_TUBES_OFF_WAKE_DURATION_LOWER_BOUND 1
+#define EEPROM_TUBES_OFF_WAKE_DURATION_UPPER_BOUND 99
+
+// Play a chime at the top of every hour
+#define EEPROM_HOUR_CHIME_ADDRESS 13
+#define EEPROM_HOUR_CHIME_DEFAULT 0
+#define EEPROM_HOUR_CHIME_LOWER_BOUND 0
+#define EEPROM_HOUR_CHIME_UPPER_BOUND 1
+
+// Listen for temperatures pushed by a sensor hub on the LAN. While enabled,
+// the WiFi session stays up, so the clock no longer sleeps between fetches
+#define EEPROM_SENSOR_HUB_ADDRESS 14
+#define EEPROM_SENSOR_HUB_DEFAULT 0
+#define EEPROM_SENSOR_HUB_LOWER_BOUND 0
+#define EEPROM_SENSOR_HUB_UPPER_BOUND 1
+
+// 0: the night brightness follows the night start and end hours
+// 1: the night brightness applies from sunset to sunrise
+// 2: as 1, and the tubes also come on at sunrise if it is before the tubes
+//    off end hour
+// Sunrise and sunset need the location, which the first weather fetch finds
+#define EEPROM_SOLAR_SCHEDULE_ADDRESS 15
+#define EEPROM_SOLAR_SCHEDULE_DEFAULT 0
+#define EEPROM_SOLAR_SCHEDULE_LOWER_BOUND 0
+#define EEPROM_SOLAR_SCHEDULE_UPPER_BOUND 2
+
+// The location for sunrise and sunset: a valid marker followed by the
+// latitude and longitude in hundredths of a degree (int16, little endian)
+#define EEPROM_LOCATION_ADDRESS 16
+#define EEPROM_LOCATION_VALID 0x4c  // 'L'
+
+// Alarms are stored compactly after the config options. See alarms.cpp
+#define EEPROM_ALARMS_ADDRESS 32
+#define EEPROM_ALARM_SIZE 3
+
 // For 1 hour, the nixie display will cycle all of its digits very frequently.
 // By default, this period is scheduled for the early morning as to not be
 // inconvenient or distracting.
@@ -46,21 +121,37 @@ extern const int c_rotary_encoder_clk_pin;
 
 extern SemaphoreHandle_t g_semaphore_configure;
 
+// esp_timer time of the last encoder switch press, taken in the ISR
+extern volatile int64_t g_rotary_encoder_switch_press_us;
+
 void setup_eeprom();
 
 void default_initialize_config_values(bool force = false);
 
-void handle_configuration();
-
-uint8_t get_config_value(uint8_t option_number, uint8_t initial_value,
-                         uint8_t lower_bound, uint8_t upper_bound,
-                         void (Nixie_Display::*display_handler)(uint8_t,
-                                                                uint8_t));
+// Coroutine that steps through each of the options. The caller holds the
+// display. The frame is freed with coroutine_frame_free()
+typedef struct configuration_frame_t configuration_frame_t;
+configuration_frame_t *start_configuration();
+coroutine_status_t handle_configuration(configuration_frame_t *frame);
+
+// Poll the rotary encoder, once a tick. Returns the direction of a completed
+// step (1 or -1) or 0. state holds the debounce filter and must start at zero
+int8_t read_rotary_encoder_step(uint16_t *state);
+
+// Coroutine that selects a value with the encoder until the switch is
+// pressed. finish_config_value() returns the value and frees the frame
+typedef struct config_value_frame_t config_value_frame_t;
+config_value_frame_t *start_config_value(
+    uint8_t option_number, uint8_t initial_value, uint8_t lower_bound,
+    uint8_t upper_bound,
+    void (Nixie_Display::*display_handler)(uint8_t, uint8_t));
+coroutine_status_t get_config_value(config_value_frame_t *frame);
+uint8_t finish_config_value(config_value_frame_t *frame);
 
 typedef struct {
   uint8_t option_number;
   uint8_t initial_value;
   uint8_t lower_bound;
   uint8_t upper_bound;
-  TaskHandle_t *task_handle;
+  executor_job_t *job;
 } eeprom_option_t;
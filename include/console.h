@@ -0,0 +1,11 @@
+#pragma once
+
+#include "executor.h"
+
+// Longest command line, including the terminator
+#define CONSOLE_MAX_LINE_LENGTH 64
+
+// Line based commands on the serial port (e.g. "events" to dump the event
+// log). Output is printed whether or not ARDUINO_DEBUG is set. Received data
+// schedules a job on the executor, which runs the commands
+void setup_console(executor_t* executor);
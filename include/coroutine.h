@@ -0,0 +1,104 @@
+#pragma once
+
+#include <esp_timer.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+// Stackless coroutines for the UI flows, so that several of them can share a
+// single task. A coroutine is a function taking its frame, which holds
+// everything that has to survive an await. Awaiting returns to the scheduler
+// and the next call resumes from the await, like a protothread:
+//
+//   coroutine_status_t flow(flow_frame_t* frame) {
+//     COROUTINE_BEGIN(&frame->co);
+//     COROUTINE_AWAIT(&frame->co, coroutine_take_input_event());
+//     COROUTINE_DELAY(&frame->co, frame->deadline_us, 500);
+//     COROUTINE_END(&frame->co);
+//   }
+//
+// Locals don't survive an await, and must be declared in a nested block if
+// they are initialized between awaits. Only one await may be on each line.
+// The scheduler sleeps until a deadline or an input event, so awaits must be on
+// the awaitables below, or on state set by the roots resumed before them.
+//
+// Frames come from a fixed arena instead of the heap and are freed in the
+// reverse order they were allocated, as nested flows finish.
+#define COROUTINE_ARENA_SIZE 512
+
+// How often the display mutex is polled while a coroutine waits for it
+#define COROUTINE_DISPLAY_POLL_MS 10
+
+typedef enum {
+  COROUTINE_WAITING,
+  COROUTINE_DONE,
+} coroutine_status_t;
+
+typedef struct {
+  uint16_t resume_point;  // Line of the last await, zero to start over
+} coroutine_t;
+
+#define COROUTINE_BEGIN(co)    \
+  switch ((co)->resume_point) { \
+    case 0:
+
+#define COROUTINE_END(co) \
+  }                       \
+  (co)->resume_point = 0; \
+  return COROUTINE_DONE
+
+#define COROUTINE_AWAIT(co, condition) \
+  do {                                 \
+    (co)->resume_point = __LINE__;     \
+    case __LINE__:                     \
+      if (!(condition)) {              \
+        return COROUTINE_WAITING;      \
+      }                                \
+  } while (0)
+
+// deadline_us must be a member of the frame
+#define COROUTINE_DELAY(co, deadline_us, delay_ms)                           \
+  do {                                                                       \
+    (deadline_us) = esp_timer_get_time() + (int64_t)(delay_ms) * 1000;       \
+    COROUTINE_AWAIT(co, coroutine_wait_until(deadline_us));                  \
+  } while (0)
+
+// Run a nested coroutine to completion
+#define COROUTINE_CALL(co, call) \
+  COROUTINE_AWAIT(co, (call) == COROUTINE_DONE)
+
+typedef coroutine_status_t (*coroutine_function_t)(void* frame);
+
+typedef struct {
+  coroutine_function_t function;
+  void* frame;  // Zero initialized
+} coroutine_root_t;
+
+// Awaitables. Each returns true once the coroutine can continue
+
+// Whether the deadline has passed
+bool coroutine_wait_until(int64_t deadline_us);
+
+// Consume a pending input event
+bool coroutine_take_input_event();
+
+// Take the display mutex, polling until it is free
+bool coroutine_take_display();
+
+// Drop pending input events that shouldn't be acted on
+void coroutine_clear_input_event();
+
+// Zero initialized frame from the arena. The arena is sized for the deepest
+// nesting of UI flows, so running out is a bug
+void* coroutine_frame_alloc(size_t size);
+
+// Must be the most recently allocated frame
+void coroutine_frame_free(void* frame);
+
+// Resume the root coroutines whenever one of them may continue. Root
+// coroutines start over once they are done. An input event that silences
+// the alarm buzzer isn't passed on. Never returns
+void run_coroutine_scheduler(const coroutine_root_t* roots, size_t num_roots,
+                             SemaphoreHandle_t input_event);
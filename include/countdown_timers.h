@@ -0,0 +1,22 @@
+#pragma once
+
+#include <stdint.h>
+
+#define MAX_COUNTDOWN_TIMERS 4
+
+// The final seconds of a countdown are overlaid on the clock
+#define COUNTDOWN_TIMER_OVERLAY_S 60
+
+// Countdown timers run in the background against absolute esp_timer
+// deadlines, so they fire exactly on time regardless of what the display
+// tasks are doing. The timer callback sounds the buzzer
+void setup_countdown_timers();
+
+// Returns false if all of the timers are already running
+bool start_countdown_timer(uint32_t duration_s);
+
+void cancel_countdown_timers();
+
+// Time left on the timer that expires next. Returns false if no timer is
+// running
+bool get_next_countdown_timer_remaining(int64_t* remaining_us);
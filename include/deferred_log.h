@@ -0,0 +1,67 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <type_traits>
+
+// Debug output from ISRs and timing sensitive code. A log call copies the
+// format string pointer, which doubles as the message ID, and up to
+// DEFERRED_LOG_MAX_ARGS raw 32-bit arguments into a lock-free ring and
+// returns. The deferred log task formats the messages and writes them to the
+// serial port later, at a low priority. Messages are dropped and counted
+// rather than blocking the caller when the ring is full.
+//
+// Arguments must be integers, enums or pointers of at most 32 bits. Pointers
+// passed for %s must stay valid until the message is printed, i.e. be string
+// literals or other static strings. 64-bit values must be narrowed first
+#define DEFERRED_LOG_RING_SIZE 64  // Must be a power of 2
+#define DEFERRED_LOG_MAX_ARGS 4
+
+// Longest formatted message, including the terminator
+#define DEFERRED_LOG_MAX_LINE_LENGTH 128
+
+// Like debug_serial_printfln(), but deferred. The format is checked against
+// the arguments by the compiler, and nothing is logged unless ARDUINO_DEBUG
+// is set
+#define deferred_printfln(format, ...)                           \
+  do {                                                           \
+    if (false) deferred_log_check_format(format, ##__VA_ARGS__); \
+    if (ARDUINO_DEBUG) deferred_log(format, ##__VA_ARGS__);      \
+  } while (0)
+
+// Safe to call from any task or ISR, on either core
+void deferred_log_push(const char* format,
+                       const uint32_t args[DEFERRED_LOG_MAX_ARGS]);
+
+// Messages dropped because the ring was full, since boot
+uint32_t get_deferred_log_dropped();
+
+// Format and print messages as they are pushed. Never returns
+void run_deferred_log();
+
+static inline void deferred_log_check_format(const char* format, ...)
+    __attribute__((format(printf, 1, 2)));
+static inline void deferred_log_check_format(const char* format, ...) {}
+
+template <typename T>
+inline uint32_t deferred_log_word(T value) {
+  static_assert(std::is_integral<T>::value || std::is_enum<T>::value ||
+                    std::is_pointer<T>::value,
+                "Deferred log arguments must be integers or pointers");
+  static_assert(sizeof(T) <= sizeof(uint32_t),
+                "Deferred log arguments must be at most 32 bits");
+  if constexpr (std::is_pointer<T>::value) {
+    return reinterpret_cast<uintptr_t>(value);
+  } else {
+    return static_cast<uint32_t>(value);
+  }
+}
+
+template <typename... Args>
+inline void deferred_log(const char* format, Args... args) {
+  static_assert(sizeof...(Args) <= DEFERRED_LOG_MAX_ARGS,
+                "Too many deferred log arguments");
+  const uint32_t words[DEFERRED_LOG_MAX_ARGS] = {deferred_log_word(args)...};
+  deferred_log_push(format, words);
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "executor.h"
+
+// Failures and other notable events are kept in a binary log on the eventlog
+// flash partition (see partitions.csv), so they survive resets and can be
+// read without a laptop attached at the time.
+//
+// The partition is a ring of 4 KB sectors. Each sector starts with a header
+// holding a sequence number, in the first record slot, followed by fixed-size
+// records. Events are batched in RAM and appended to the current sector, so
+// each record is programmed once and each sector is erased once per trip
+// around the ring. A write never crosses a 256-byte flash page, and a batch is
+// written as soon as it would finish the page being written, so the writes
+// after it program whole pages from their start.
+// A record or header torn by a reset fails its CRC and is skipped, and a
+// sector whose header never made it is erased again. Slots a failed write
+// left erased are skipped too, and never programmed afterwards.
+//
+// All values are little endian. Sector header (16 bytes):
+//   0  uint32 EVENT_LOG_MAGIC
+//   4  uint32 sequence number, incremented for each sector
+//   8  uint16 EVENT_LOG_VERSION
+//   10 uint16 record size
+//   12 uint16 reserved, 0xffff
+//   14 uint16 CRC-16/CCITT-FALSE of bytes 0 to 13
+//
+// Record (16 bytes):
+//   0  uint32 Unix time, or seconds since boot if the clock wasn't set yet
+//   4  int32 first argument
+//   8  int32 second argument
+//   12 uint16 event ID
+//   14 uint16 CRC-16/CCITT-FALSE of bytes 0 to 13
+//
+// tools/event_log_tool.py decodes a dump of the partition or the console's
+// "events raw" output. Keep its event names in sync with event_id_t
+#define EVENT_LOG_PARTITION_LABEL "eventlog"
+#define EVENT_LOG_MAGIC 0x4c45584e  // "NXEL"
+#define EVENT_LOG_VERSION 1
+
+#define EVENT_LOG_SECTOR_SIZE 4096
+#define EVENT_LOG_PAGE_SIZE 256
+
+// Events that haven't been written yet. Enough to finish the current page are
+// written straight away, anything less after EVENT_LOG_FLUSH_DELAY_MS so that
+// bursts share a write
+#define EVENT_LOG_BUFFER_RECORDS 32
+#define EVENT_LOG_FLUSH_DELAY_MS (60 * 1000)
+
+// Timestamps below this are seconds since boot
+#define EVENT_LOG_MIN_EPOCH 1600000000
+
+typedef enum {
+  EVENT_BOOT = 1,             // esp_reset_reason_t
+  EVENT_LOG_DROPPED,          // Events dropped while the buffer was full
+  EVENT_WIFI_CONNECT_FAILED,  // wl_status_t
+  EVENT_NTP_SYNCED,           // Clock step in ms, saturated
+  EVENT_NTP_SYNC_FAILED,      // Attempts
+  EVENT_WEATHER_HTTP_ERROR,   // Request (0 location, 1 weather), HTTP status
+  EVENT_TASK_STALLED,         // heartbeat_id_t, ms without a heartbeat
+} event_id_t;
+
+typedef struct {
+  uint32_t timestamp;
+  int32_t args[2];
+  uint16_t event_id;
+  uint16_t crc;
+} event_log_record_t;
+
+// Find the end of the log and add the flush job to the executor
+void setup_event_log(executor_t* executor);
+
+// Safe to call from any task (but not from ISRs) and before setup
+void log_event(event_id_t event_id, int32_t arg0 = 0, int32_t arg1 = 0);
+
+// Write the buffered events
+void flush_event_log();
+
+typedef void (*event_log_visitor_t)(const event_log_record_t& record,
+                                    void* context);
+
+// Visit the flushed records, oldest first, skipping torn ones. Returns the
+// number of records visited
+size_t read_event_log(event_log_visitor_t visitor, void* context);
+
+// NULL for unknown IDs
+const char* get_event_name(uint16_t event_id);
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+// Executors run periodic and one-shot jobs on a single worker task, so
+// features that only wake up every few minutes don't each need a stack.
+// Jobs are kept in a hierarchical timer wheel: level 0 has a slot per tick,
+// and each higher level has a slot per revolution of the level below it.
+// Jobs cascade down a level when the wheel reaches their slot, so scheduling,
+// cancelling and expiring are constant time and the worker sleeps until the
+// next occupied slot.
+//
+// Jobs run to completion, so a job that blocks (e.g. holding the display)
+// delays the other jobs on its executor. Jobs that are due on the same tick
+// run in priority order.
+#define EXECUTOR_TICK_MS 100
+#define EXECUTOR_WHEEL_LEVELS 3
+#define EXECUTOR_WHEEL_SLOT_BITS 6
+#define EXECUTOR_WHEEL_SLOTS (1 << EXECUTOR_WHEEL_SLOT_BITS)
+
+// Longest delay the wheel holds directly (about 7 hours). Longer delays are
+// parked in the top level and cascaded again until they are due
+#define EXECUTOR_WHEEL_SPAN_TICKS                                    \
+  ((uint32_t)1 << (EXECUTOR_WHEEL_SLOT_BITS * EXECUTOR_WHEEL_LEVELS))
+
+// Returned by a job that should not run again until it is rescheduled
+#define EXECUTOR_JOB_STOP UINT32_MAX
+
+struct executor_t;
+
+// Runs the job. Returns the delay until the next run in milliseconds, or
+// EXECUTOR_JOB_STOP. Periodic jobs return their period, which is measured
+// from when the job was due, so the period doesn't drift
+typedef uint32_t (*executor_job_function_t)(void* argument);
+
+typedef struct executor_job_t {
+  executor_job_function_t function;
+  void* argument;
+  const char* name;
+  uint8_t priority;  // Higher runs first
+
+  // Private, zero initialized
+  executor_t* executor;
+  executor_job_t* next;
+  uint32_t expiry_tick;
+  uint8_t wheel_level;  // EXECUTOR_WHEEL_LEVELS when on the ready list
+  uint8_t wheel_slot;
+  bool scheduled;
+  bool running;
+  bool cancelled;  // While running
+} executor_job_t;
+
+typedef struct executor_t {
+  const char* name;
+
+  // Private, set up by setup_executor()
+  portMUX_TYPE mux;
+  TaskHandle_t worker;
+  uint32_t current_tick;  // The last tick whose jobs have been made ready
+  executor_job_t* wheel[EXECUTOR_WHEEL_LEVELS][EXECUTOR_WHEEL_SLOTS];
+  uint64_t occupied[EXECUTOR_WHEEL_LEVELS];  // Bit per non-empty slot
+  executor_job_t* ready;  // Due jobs, highest priority first
+} executor_t;
+
+void setup_executor(executor_t* executor, const char* name);
+
+// Add a job to an executor and schedule its first run after phase_ms. Jobs
+// added with EXECUTOR_JOB_STOP only run once they are scheduled
+void add_job(executor_t* executor, executor_job_t* job, uint32_t phase_ms);
+
+// Run the job after delay_ms, replacing any earlier schedule. Safe to call
+// from any task, including from the job itself
+void schedule_job(executor_job_t* job, uint32_t delay_ms);
+
+void cancel_job(executor_job_t* job);
+
+// Whether the job is scheduled or running
+bool is_job_active(const executor_job_t* job);
+
+// The worker task's loop. Never returns
+void run_executor(executor_t* executor);
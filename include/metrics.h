@@ -0,0 +1,51 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "util.h"
+
+#define MAX_METRICS_TASKS 20
+
+// Health counters kept by the firmware and served by the status server
+typedef struct {
+  uint32_t ntp_syncs;
+  uint32_t ntp_failures;
+  int64_t last_ntp_sync_epoch;
+  int64_t last_ntp_offset_us;  // How far the clock was stepped
+
+  uint32_t weather_fetches;
+  uint32_t weather_failures;
+  int64_t last_weather_fetch_epoch;
+  double last_temperature;
+
+  uint32_t sensor_hub_readings;
+  uint32_t sensor_hub_rejected;  // Malformed, stale or out of sequence
+  int64_t last_sensor_hub_reading_epoch;
+
+  // Over the last reporting period of the display time task
+  jitter_stats_t transition_jitter_idle;
+  jitter_stats_t transition_jitter_weather_fetch;
+} metrics_t;
+
+// Register a task so its stack margin is reported
+void register_task_metrics(const char* name, TaskHandle_t task_handle);
+
+void record_ntp_sync(bool success, int64_t offset_us);
+
+void record_weather_fetch(bool success, double temperature);
+
+void record_sensor_hub_datagram(bool accepted, double temperature);
+
+void record_transition_jitter(const jitter_stats_t& idle,
+                              const jitter_stats_t& weather_fetch);
+
+void get_metrics(metrics_t* metrics);
+
+// Render the current metrics into the buffer, in the Prometheus text format
+// or as JSON. The output is always null terminated. Returns the length of the
+// output, or zero if it doesn't fit: a cut short response wouldn't parse
+size_t render_metrics(char* buffer, size_t size);
+size_t render_status(char* buffer, size_t size);
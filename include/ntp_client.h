@@ -0,0 +1,68 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// A small SNTP client that asks several servers at once and only trusts the
+// majority. Each server is sampled a few times and the sample with the
+// shortest round trip is kept, since queuing on a busy WiFi network only ever
+// adds delay. Each kept sample bounds the true offset to an interval of its
+// root distance either side. Servers whose interval doesn't overlap the
+// majority's intersection (Marzullo's algorithm, as in NTP's selection
+// algorithm) are falsetickers and are dropped. The rest are averaged,
+// weighted by how tight their bound is.
+
+// Servers queried on each sync, as "host" or "host:port". Each pool name
+// resolves to a different member. Override with a build flag, e.g. to try
+// the stand-in servers of tools/ntp_tool.py:
+// -D 'NTP_SERVERS="192.168.1.2:12300", "192.168.1.2:12301"'
+#ifndef NTP_SERVERS
+#define NTP_SERVERS \
+  "0.pool.ntp.org", "1.pool.ntp.org", "2.pool.ntp.org", "3.pool.ntp.org"
+#endif
+
+#define NTP_PORT 123
+#define NTP_MAX_SERVERS 8
+#define NTP_PACKET_SIZE 48
+
+// Requests to a server are at least 2 seconds apart, as the pool asks
+#define NTP_SAMPLES_PER_SERVER 4
+#define NTP_SAMPLE_INTERVAL_MS 2000
+#define NTP_RESPONSE_TIMEOUT_MS 1500
+
+// Samples whose bound is looser than this are useless (NTP's MAXDIST)
+#define NTP_MAX_ROOT_DISTANCE_US 1500000
+
+typedef struct {
+  int64_t offset_us;         // To add to the system clock
+  int64_t delay_us;          // Round trip, less the server's processing time
+  int64_t root_distance_us;  // Bound on the error of the offset
+  uint8_t stratum;
+} ntp_sample_t;
+
+typedef struct {
+  int64_t offset_us;
+  // The intersection of the truechimers' intervals
+  int64_t low_us;
+  int64_t high_us;
+  size_t num_truechimers;
+  size_t num_samples;
+} ntp_selection_t;
+
+// Parse a server's response to a request whose transmit timestamp was
+// origin_cookie, sent at local time t1_us and received at t4_us (Unix epoch
+// microseconds). Returns false if it isn't a usable answer to that request
+bool parse_ntp_response(const uint8_t* packet, size_t size,
+                        uint64_t origin_cookie, int64_t t1_us, int64_t t4_us,
+                        ntp_sample_t* sample);
+
+// Find the largest group of samples, more than half of them, whose intervals
+// [offset - root distance, offset + root distance] intersect, and combine
+// them. Returns false if no majority agrees
+bool select_ntp_offset(const ntp_sample_t* samples, size_t num_samples,
+                       ntp_selection_t* selection);
+
+// Query the NTP_SERVERS and select the offset of the system clock. The WiFi
+// session must be up. Takes about
+// NTP_SAMPLES_PER_SERVER * NTP_SAMPLE_INTERVAL_MS
+bool query_ntp_servers(ntp_selection_t* selection);
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <stdint.h>
+
+typedef enum {
+  // Timing critical display output. Keeps the CPU at its maximum frequency
+  // and prevents automatic light sleep
+  POWER_LOCK_DISPLAY,
+  // WiFi and TLS. Keeps the CPU at its maximum frequency
+  POWER_LOCK_NETWORK,
+  NUM_POWER_LOCKS,
+} power_lock_t;
+
+typedef struct {
+  int64_t max_frequency_us;     // Time with any power lock held
+  int64_t scaled_frequency_us;  // Time awake without a power lock held
+  int64_t light_sleep_us;       // Time in explicit light sleep
+} power_residency_t;
+
+// Enable dynamic frequency scaling and automatic light sleep. Between frame
+// updates the CPU is clocked down, unless a power lock is held
+void setup_power_management();
+
+// Power locks are counting and may be nested
+void acquire_power_lock(power_lock_t lock);
+void release_power_lock(power_lock_t lock);
+
+// Returns false if power management is disabled in this build
+// (CONFIG_PM_ENABLE). The CPU then never leaves its maximum frequency, and
+// there is no residency to report
+bool get_power_residency(power_residency_t* residency);
+
+void print_power_residency();
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <stdint.h>
+
+// The RTC timer and RTC slow memory survive every reset except power on, so
+// the time can be restored from the last NTP sync without the network
+
+// Retained time older than this is too inaccurate to show
+#define RETAINED_TIME_MAX_AGE_S (24 * 60 * 60)
+
+// The drift of the RTC slow clock is only estimated over at least this long
+#define RETAINED_TIME_MIN_DRIFT_INTERVAL_S (60 * 60)
+
+// Set the system time from RTC memory after a warm reset (watchdog, panic,
+// brownout or software). Returns whether the time was restored
+bool restore_retained_time();
+
+// Retain the current system time. Called after it has been set from NTP,
+// which also refines the estimate of the RTC slow clock drift
+void retain_time();
+
+// Parts per million that the RTC slow clock runs slow by
+int32_t get_retained_time_drift_ppm();
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Readings pushed by a sensor hub on the LAN, as UDP datagrams (usually
+// broadcast) to this port. Override with a build flag
+#ifndef SENSOR_HUB_PORT
+#define SENSOR_HUB_PORT 4210
+#endif
+
+// Binary datagrams are 12 bytes, little endian:
+//   0  SENSOR_HUB_MAGIC_0, SENSOR_HUB_MAGIC_1
+//   2  SENSOR_HUB_VERSION
+//   3  Reserved, zero
+//   4  uint32 sequence number
+//   8  int16 temperature in hundredths of a degree Fahrenheit
+//   10 uint16 age of the reading in seconds
+//
+// JSON datagrams are a single object, e.g.
+//   {"seq": 42, "temp_f": 71.25, "age_s": 3}
+// with "temp_c" accepted in place of "temp_f" and "age_s" defaulting to 0.
+//
+// tools/sensor_hub_tool.py sends both formats from the host
+#define SENSOR_HUB_MAGIC_0 'N'
+#define SENSOR_HUB_MAGIC_1 'T'
+#define SENSOR_HUB_VERSION 1
+#define SENSOR_HUB_BINARY_SIZE 12
+
+#define SENSOR_HUB_MAX_DATAGRAM_SIZE 128
+
+// Readings older than this are rejected, and the cloud fetch is used once the
+// last reading is this old
+#define SENSOR_HUB_MAX_AGE_S (10 * 60)
+
+typedef struct {
+  uint32_t sequence;
+  double temperature;  // Fahrenheit
+  uint16_t age_s;
+} sensor_hub_reading_t;
+
+// Returns false if the datagram is in neither format
+bool parse_sensor_hub_datagram(const uint8_t* datagram, size_t size,
+                               sensor_hub_reading_t* reading);
+
+// Keep a parsed reading if it is newer than the last one. A hub that restarts
+// its sequence numbers is accepted again once the last reading has expired
+bool accept_sensor_hub_reading(const sensor_hub_reading_t& reading);
+
+// The latest reading, if it is younger than SENSOR_HUB_MAX_AGE_S
+bool get_sensor_hub_temperature(double* temperature);
+
+// Open the UDP socket. The WiFi session must be up
+bool open_sensor_hub_socket();
+
+void close_sensor_hub_socket();
+
+// Block for up to timeout_ms for a datagram, or only take one that is already
+// waiting if timeout_ms is 0. Returns true if one was received and accepted
+bool receive_sensor_hub_reading(uint32_t timeout_ms,
+                                sensor_hub_reading_t* reading);
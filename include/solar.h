@@ -0,0 +1,52 @@
+#pragma once
+
+#include <stdint.h>
+#include <time.h>
+
+// Sunrise and sunset from the date and the location alone, so the night
+// schedule can follow daylight without a network call. The sunrise equation
+// (NOAA's approximation) is evaluated in fixed point: angles are binary
+// angles (2^32 per turn) and sines are Q30. Good to about a minute between
+// the polar circles
+
+// The location is cached in the EEPROM (see EEPROM_LOCATION_ADDRESS) from the
+// weather fetch's IP geolocation. A fixed location can be set with build
+// flags instead, in hundredths of a degree, e.g.
+// -D SOLAR_LATITUDE=4071 -D SOLAR_LONGITUDE=-7401
+
+typedef enum {
+  SOLAR_DAY_NORMAL,
+  SOLAR_DAY_POLAR_NIGHT,   // The Sun doesn't rise
+  SOLAR_DAY_MIDNIGHT_SUN,  // The Sun doesn't set
+} solar_day_type_t;
+
+typedef struct {
+  solar_day_type_t type;
+  // UTC. Only set for SOLAR_DAY_NORMAL
+  time_t sunrise;
+  time_t sunset;
+} solar_day_t;
+
+// Sunrise and sunset on a date (month 1 to 12) at a location in hundredths of
+// a degree, north and east positive. No floating point
+void compute_solar_day(int year, int month, int day, int16_t latitude,
+                       int16_t longitude, solar_day_t* solar_day);
+
+// Cache the location, writing the EEPROM only if it moved
+void set_location(int16_t latitude, int16_t longitude);
+
+// Returns false until a location is known
+bool get_location(int16_t* latitude, int16_t* longitude);
+
+// Sunrise and sunset on the local date of the time, at the cached location.
+// Computed once per day. Returns false until a location is known
+bool get_solar_day(const struct tm& time_info, solar_day_t* solar_day);
+
+// Whether the Sun is down at the given local time. False until a location is
+// known
+bool is_sun_down(const struct tm& time_info);
+
+// Time left until the next sunrise or sunset. Returns false if there is none
+// today after the given local time, or no location is known
+bool get_next_solar_event_remaining(const struct tm& time_info,
+                                    int64_t* remaining_us);
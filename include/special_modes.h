@@ -1,3 +1,32 @@
 #pragma once
 
-void timer_mode();
+#include <stdint.h>
+
+#include "coroutine.h"
+
+// Values of the special modes option
+typedef enum {
+  SPECIAL_MODE_NONE,
+  // Select a duration and start a background countdown timer. A zero duration
+  // cancels all of the running timers
+  SPECIAL_MODE_TIMER,
+  // Stopwatch with hundredths of a second. A press starts it, a short press
+  // records a lap and a long press stops it. Once stopped, the encoder browses
+  // the laps and a press exits
+  SPECIAL_MODE_STOPWATCH,
+  // Select an alarm and set its time and repeat (off, once, daily, weekdays or
+  // weekends)
+  SPECIAL_MODE_ALARM,
+  // Each tube rolls through random digits, slowing down exponentially on its
+  // own schedule until it locks, then the result is held for a while
+  SPECIAL_MODE_DIVERGENCE_METER,
+} special_mode_t;
+
+// Coroutine that runs a special mode on the UI task. The caller holds the
+// display. The frame is freed with coroutine_frame_free()
+typedef struct special_mode_frame_t special_mode_frame_t;
+special_mode_frame_t* start_special_mode(uint8_t mode);
+coroutine_status_t run_special_mode(special_mode_frame_t* frame);
+
+// The divergence meter animation. Deterministic for a given seed
+void run_divergence_meter(uint32_t seed);
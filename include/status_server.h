@@ -0,0 +1,14 @@
+#pragma once
+
+#define STATUS_SERVER_PORT 80
+
+// Large enough for /metrics with every task registered, which comes to about
+// 4 KB
+#define STATUS_SERVER_BUFFER_SIZE 5120
+
+// Serves /metrics (Prometheus text format) and /status (JSON). Only runs
+// while the WiFi session is up: started and stopped by connect_to_wifi() and
+// disconnect_from_wifi()
+void start_status_server();
+
+void stop_status_server();
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+// The supervisor task only resets the task watchdog while every supervised
+// task is alive. Each supervised task registers a deadline and sends
+// heartbeats as it makes progress. Once a task goes longer than its deadline
+// without one, the supervisor records which task stalled and for how long,
+// then stops resetting the watchdog so that it resets the chip.
+//
+// The stall is kept in RTC memory, which survives the reset, and is logged as
+// EVENT_TASK_STALLED straight away. If the event log can't be written in
+// time (e.g. the stalled task holds it), it is logged on the next boot
+// instead.
+
+// Stall records and the event log refer to tasks by these, so only append.
+// Keep tools/event_log_tool.py's names in sync
+typedef enum {
+  HEARTBEAT_TIME_SERVICE,  // Unused since the snapshot is published by timer
+  HEARTBEAT_DISPLAY_TIME,
+  HEARTBEAT_UI,
+  HEARTBEAT_DISPLAY_JOBS,
+  HEARTBEAT_NETWORK_JOBS,
+  HEARTBEAT_TUBES_OFF,  // Unused since the window runs as a display job
+  NUM_HEARTBEATS,
+} heartbeat_id_t;
+
+#define SUPERVISOR_CHECK_PERIOD_MS 1000
+
+// The watchdog resets the chip this long after the supervisor's last reset
+#define SUPERVISOR_WATCHDOG_TIMEOUT_S 5
+
+typedef struct {
+  uint32_t deadline_ms;
+  int64_t max_gap_us;  // Worst time between heartbeats since boot
+  int64_t gap_us;      // Since the last heartbeat
+} heartbeat_stats_t;
+
+// Reconfigure the task watchdog to reset the chip, and log a stall that
+// caused the last reset if it didn't make it into the event log
+void setup_supervisor();
+
+// Supervise the calling task from now on. It must send a heartbeat at least
+// every deadline_ms
+void register_heartbeat(heartbeat_id_t id, uint32_t deadline_ms);
+
+// From the calling task. Does nothing if the task isn't supervised
+void heartbeat();
+
+// How long the calling task can block and still send its next heartbeat in
+// time. portMAX_DELAY if the task isn't supervised
+TickType_t get_heartbeat_timeout();
+
+// Take a semaphore, sending heartbeats while it is held by someone else.
+// Waiting on another task isn't a stall of this one. Returns pdTRUE, like
+// xSemaphoreTake() with portMAX_DELAY
+BaseType_t take_with_heartbeats(SemaphoreHandle_t semaphore);
+
+// Stop supervising a task that is suspended. Its next heartbeat resumes
+// supervision
+void pause_heartbeat(heartbeat_id_t id);
+
+// Around an explicit light sleep, which stops every task. The time asleep
+// doesn't count towards anyone's deadline
+void pause_supervision();
+void resume_supervision();
+
+// Returns false if the task hasn't registered
+bool get_heartbeat_stats(heartbeat_id_t id, heartbeat_stats_t* stats);
+
+const char* get_heartbeat_name(heartbeat_id_t id);
+
+// The supervisor task's loop. Never returns
+void run_supervisor();
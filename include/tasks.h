@@ -2,9 +2,32 @@
 
 #include <Arduino.h>
 
-extern TaskHandle_t g_task_special_modes_handle;
-extern TaskHandle_t g_task_configure_handle;
-extern TaskHandle_t g_task_blink_dot_separators_handle;
+#include "executor.h"
+
+// The WiFi/TLS stack runs on the PRO CPU, so networking tasks are kept there
+// and the busy-wait display rendering is pinned to the APP CPU where it
+// cannot be preempted by radio interrupts and protocol processing
+#define NETWORK_CORE 0
+#define DISPLAY_CORE 1
+
+typedef struct {
+  TaskFunction_t task_function;
+  const char *name;
+  uint32_t stack_depth;
+  UBaseType_t priority;
+  BaseType_t core_id;
+  TaskHandle_t *task_handle;
+} task_config_t;
+
+extern TaskHandle_t g_task_ui_handle;
 extern TaskHandle_t g_task_display_time_handle;
-extern TaskHandle_t g_task_display_date_handle;
-extern TaskHandle_t g_task_display_local_temperature_handle;
+
+// Set by the UI coroutines while a value is being selected
+extern bool g_blink_dot_separators;
+
+extern executor_t g_display_executor;
+extern executor_t g_network_executor;
+
+extern executor_job_t g_job_display_date;
+extern executor_job_t g_job_display_local_temperature;
+extern executor_job_t g_job_fetch_local_temperature;
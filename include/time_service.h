@@ -0,0 +1,44 @@
+#pragma once
+
+#include <stdint.h>
+#include <time.h>
+
+// Published a little after each second edge, so the new second is certain to
+// have started
+#define TIME_SERVICE_EDGE_MARGIN_US 1000
+
+typedef struct {
+  struct tm local_time;
+  time_t epoch;
+  int64_t second_start_us;  // esp_timer time at which this second started
+  bool valid;               // False until the clock has been set
+} time_snapshot_t;
+
+// Publish a snapshot now and then just after each second edge, from an
+// esp_timer callback. The conversion is short enough for the esp_timer task
+void setup_time_service();
+
+// Convert the current time and publish it to readers. Returns the esp_timer
+// time to publish the next snapshot at. Only the time service's timer (and
+// setup, before the timer starts) may call this
+int64_t publish_time_snapshot();
+
+// Copy the latest snapshot. Readers never block or take a lock: the snapshot
+// is published through a seqlock and the copy is retried in the rare case
+// that it overlaps a publish. Returns the validity flag
+bool get_time_snapshot(time_snapshot_t* snapshot);
+
+// The local time of the latest snapshot. Returns false until the clock has
+// been set
+bool get_snapshot_local_time(struct tm* time_info);
+
+// Like get_snapshot_local_time(), but first waits (a tick at a time) for the
+// time service to catch up if the snapshot is from an earlier second, e.g.
+// right after waking up from light sleep
+bool get_current_local_time(struct tm* time_info);
+
+// Microseconds into the current second
+inline int64_t get_subsecond_us(const time_snapshot_t& snapshot,
+                                int64_t now_us) {
+  return now_us - snapshot.second_start_us;
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <stdint.h>
+#include <time.h>
+
+// POSIX TZ string of the clock's time zone. Override with a build flag, e.g.
+// -D 'TIME_ZONE="CET-1CEST,M3.5.0,M10.5.0/3"'
+#ifndef TIME_ZONE
+#define TIME_ZONE "EST5EDT,M3.2.0,M11.1.0"
+#endif
+
+// Times before 2020 mean the clock hasn't been set yet
+#define LOCAL_TIME_MIN_VALID_EPOCH 1577836800
+
+typedef enum {
+  TIME_ZONE_RULE_MONTH,       // Mm.w.d: day d of week w (5 is last) of month m
+  TIME_ZONE_RULE_JULIAN,      // Jn: day n (1-365), never counting Feb 29
+  TIME_ZONE_RULE_ZERO_BASED,  // n: day n (0-365), counting Feb 29
+} time_zone_rule_type_t;
+
+typedef struct {
+  time_zone_rule_type_t type;
+  uint8_t month;
+  uint8_t week;
+  uint8_t weekday;
+  uint16_t day;
+  int32_t time_s;  // Local time of the transition, may be negative or > 24 h
+} time_zone_rule_t;
+
+typedef struct {
+  int32_t std_offset_s;  // East of UTC
+  int32_t dst_offset_s;
+  bool has_dst;
+  time_zone_rule_t dst_start;
+  time_zone_rule_t dst_end;
+} time_zone_t;
+
+// A stretch of time with a constant UTC offset. Local time is a single offset
+// lookup until valid_until
+typedef struct {
+  int64_t valid_from;  // Inclusive, UTC
+  int64_t valid_until;  // Exclusive, UTC
+  int32_t offset_s;
+  bool is_dst;
+} time_zone_span_t;
+
+// Returns false if the string is not a valid POSIX TZ string
+bool parse_time_zone(const char* posix_tz, time_zone_t* zone);
+
+// Find the span containing the UTC time. The DST transitions are computed for
+// the UTC year of the time, so a span never crosses New Year
+void get_time_zone_span(const time_zone_t& zone, int64_t utc,
+                        time_zone_span_t* span);
+
+// Days from 1970-01-01 in the proleptic Gregorian calendar (month 1 to 12)
+int64_t days_from_civil(int64_t year, unsigned month, unsigned day);
+
+// Convert a UTC time to broken-down time at a fixed offset
+void offset_time_to_tm(int64_t utc, int32_t offset_s, bool is_dst,
+                       struct tm* time_info);
+
+// Set the time zone used by local_time() and by newlib (mktime, etc). Falls
+// back to newlib's conversion if the string can't be parsed
+void set_time_zone(const char* posix_tz = TIME_ZONE);
+
+// Drop-in replacement for localtime_r()
+void local_time(time_t utc, struct tm* time_info);
+
+// Non-blocking replacement for Arduino's getLocalTime(). Returns false until
+// the clock has been set
+bool get_local_time(struct tm* time_info);
@@ -0,0 +1,15 @@
+#pragma once
+
+#include <stdint.h>
+#include <time.h>
+
+// Whether the given time falls within the configured tubes off window
+bool is_tubes_off_time(const struct tm& time_info);
+
+// Turn the tubes off and light sleep until the end of the tubes off window.
+// The encoder switch wakes the clock up to show the time for the configured
+// duration. Must be called with the display mutex held
+void run_tubes_off_window();
+
+// Total time spent in light sleep since boot
+int64_t get_light_sleep_time_us();
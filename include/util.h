@@ -1,24 +1,62 @@
 #pragma once
 
-#include <soc/timer_group_reg.h>
-#include <soc/timer_group_struct.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
 #include <stddef.h>
+#include <stdint.h>
 
 extern const size_t c_minute_freertos;
 #define MINUTE_FREERTOS c_minute_freertos
+#define MINUTE_MS (60 * 1000)
 
 #define MILLISECOND_TO_MICROSECONDS 1000
 
 #define NUM_ELEMENTS(x) \
   ((sizeof(x) / sizeof(0 [x])) / ((size_t)(!(sizeof(x) % sizeof(0 [x])))))
 
-extern const int c_buzzer_pin;
+typedef struct {
+  uint32_t num_samples;
+  int32_t min_us;
+  int32_t max_us;
+  int64_t sum_us;
+} jitter_stats_t;
 
-void buzzer_click();
+// Blocks the calling task until an absolute esp_timer deadline. Instead of
+// busy-waiting, the task blocks on an esp_timer so the CPU can idle (and be
+// clocked down) and only spins for the last few microseconds.
+// Only one task may wait on a Deadline_Timer at a time
+class Deadline_Timer {
+ public:
+  Deadline_Timer() : m_timer(NULL), m_semaphore(NULL) {}
 
-inline void reset_watchdog_timer() {
-  // Feed the watchdog timer so that the MCU isn't reset
-  TIMERG0.wdt_wprotect = TIMG_WDT_WKEY_VALUE;
-  TIMERG0.wdt_feed = 1;
-  TIMERG0.wdt_wprotect = 0;
+  void sleep_until(int64_t deadline_us);
+
+ private:
+  static void on_timeout(void *arg);
+
+  esp_timer_handle_t m_timer;
+  SemaphoreHandle_t m_semaphore;
+  StaticSemaphore_t m_semaphore_buffer;
+};
+
+// Marsaglia's xorshift32 PRNG. The state must be seeded with a non-zero value
+inline uint32_t xorshift32(uint32_t *state) {
+  uint32_t x = *state;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  *state = x;
+  return x;
 }
+
+// Whether the hour is within [start_hour, end_hour), wrapping around midnight.
+// An empty window (start_hour == end_hour) never matches
+bool is_hour_in_window(int hour, int start_hour, int end_hour);
+
+void reset_jitter_stats(jitter_stats_t *stats);
+
+// Record the deviation of a timing sample from its nominal value
+void record_jitter_sample(jitter_stats_t *stats, int32_t deviation_us);
+
+void print_jitter_stats(const char *label, const jitter_stats_t &stats);
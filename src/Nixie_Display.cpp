@@ -1,36 +1,89 @@
 #include "Nixie_Display.h"
 
 #include <Arduino.h>
+#include <driver/ledc.h>
+#include <esp_system.h>
 
+#include "arduino_debug.h"
+#include "power.h"
+#include "supervisor.h"
+#include "time_zone.h"
 #include "util.h"
 
-const uint8_t Nixie_Display::nixie_digits[NUM_NIXIE_DIGITS] = {
-    NIXIE_ZERO,  NIXIE_ONE,  NIXIE_TWO,       NIXIE_THREE,
-    NIXIE_FOUR,  NIXIE_FIVE, NIXIE_SIX,       NIXIE_SEVEN,
-    NIXIE_EIGHT, NIXIE_NINE, NIXIE_BLANK_CODE};
-
-const int Nixie_Display::clock_pin = 12;
-const int Nixie_Display::latch_pin = 14;
 const int Nixie_Display::output_enable_pin = 27;
-const int Nixie_Display::data_pin = 26;
 
-uint8_t Nixie_Display::m_digits[num_display_digits] = {NIXIE_ZERO};
-uint8_t Nixie_Display::m_dots = NIXIE_DOTS_ALL;
+#define NIXIE_BRIGHTNESS_LEDC_MODE LEDC_HIGH_SPEED_MODE
+#define NIXIE_BRIGHTNESS_LEDC_TIMER LEDC_TIMER_0
+#define NIXIE_BRIGHTNESS_LEDC_CHANNEL LEDC_CHANNEL_0
+#define NIXIE_BRIGHTNESS_PWM_FREQUENCY_HZ 1000
+
+// Gamma corrected (2.2) duty cycles for each brightness level at 12 bit
+// resolution: duty = min + (max - min) * (level / max_level)^2.2
+// The minimum duty keeps the tubes reliably ionized at the lowest level
+const uint32_t Nixie_Display::brightness_duty[NIXIE_MAX_BRIGHTNESS + 1] = {
+    0, 107, 198, 366, 617, 955, 1386, 1913, 2538, 3265, 4095};
+
+uint8_t Nixie_Display::m_brightness = NIXIE_MAX_BRIGHTNESS;
+
+Deadline_Timer Nixie_Display::frame_timer;
+
+// Clock, latch and data pins
+const Nixie_Display::Tube_Driver Nixie_Display::tube_driver(12, 14, 26);
+
+std::atomic<uint32_t> Nixie_Display::m_front_buffer(
+    (uint32_t)NIXIE_DOTS_ALL << (4 * num_display_digits));
+portMUX_TYPE Nixie_Display::output_mux = portMUX_INITIALIZER_UNLOCKED;
 
 SemaphoreHandle_t Nixie_Display::display_mutex = NULL;
 
 void Nixie_Display::setup_nixie_display() {
   // Set the pin modes
-  pinMode(clock_pin, OUTPUT);
-  pinMode(latch_pin, OUTPUT);
-  pinMode(output_enable_pin, OUTPUT);
-  pinMode(data_pin, OUTPUT);
-
-  digitalWrite(output_enable_pin, LOW);  // Enables output
+  tube_driver.setup();
+
+  // The output enable pin is driven by PWM to set the global brightness
+  ledc_timer_config_t timer_config = {};
+  timer_config.speed_mode = NIXIE_BRIGHTNESS_LEDC_MODE;
+  timer_config.duty_resolution = LEDC_TIMER_12_BIT;
+  timer_config.timer_num = NIXIE_BRIGHTNESS_LEDC_TIMER;
+  timer_config.freq_hz = NIXIE_BRIGHTNESS_PWM_FREQUENCY_HZ;
+  timer_config.clk_cfg = LEDC_AUTO_CLK;
+  ledc_timer_config(&timer_config);
+
+  ledc_channel_config_t channel_config = {};
+  channel_config.gpio_num = output_enable_pin;
+  channel_config.speed_mode = NIXIE_BRIGHTNESS_LEDC_MODE;
+  channel_config.channel = NIXIE_BRIGHTNESS_LEDC_CHANNEL;
+  channel_config.timer_sel = NIXIE_BRIGHTNESS_LEDC_TIMER;
+  channel_config.duty = brightness_duty[m_brightness];
+  channel_config.hpoint = 0;
+  channel_config.flags.output_invert = 1;  // Output enable is active low
+  ledc_channel_config(&channel_config);
+
+  // Ramps between brightness levels are done by the LEDC fade hardware
+  ledc_fade_func_install(0);
 
   display_mutex = xSemaphoreCreateMutex();
 }
 
+void Nixie_Display::set_brightness(uint8_t level, size_t ramp_time_ms) {
+  if (level > NIXIE_MAX_BRIGHTNESS) {
+    level = NIXIE_MAX_BRIGHTNESS;
+  }
+
+  m_brightness = level;
+
+  if (ramp_time_ms) {
+    ledc_set_fade_time_and_start(
+        NIXIE_BRIGHTNESS_LEDC_MODE, NIXIE_BRIGHTNESS_LEDC_CHANNEL,
+        brightness_duty[level], ramp_time_ms, LEDC_FADE_NO_WAIT);
+  } else {
+    ledc_set_duty(NIXIE_BRIGHTNESS_LEDC_MODE, NIXIE_BRIGHTNESS_LEDC_CHANNEL,
+                  brightness_duty[level]);
+    ledc_update_duty(NIXIE_BRIGHTNESS_LEDC_MODE,
+                     NIXIE_BRIGHTNESS_LEDC_CHANNEL);
+  }
+}
+
 void Nixie_Display::smooth_display_time(const struct tm& current_time,
                                         bool twelve_hour_format,
                                         uint8_t nixie_dots) {
@@ -54,111 +107,114 @@ void Nixie_Display::smooth_display_value(size_t transition_time_ms,
                                          int8_t hours, int8_t minutes,
                                          int8_t seconds, uint8_t nixie_dots,
                                          bool blank_all) {
-  uint8_t current_value_arr[num_display_digits];
+  Display_Buffer next;
+  set_digit_array_from_value(next.digits, hours, minutes, seconds);
+  next.dots = nixie_dots;
+
+  smooth_display_buffer(transition_time_ms, next, blank_all);
+}
+
+void Nixie_Display::smooth_display_buffer(size_t transition_time_ms,
+                                          const Display_Buffer& next,
+                                          bool blank_all) {
+  Display_Buffer current = read_front_buffer();
   // We need to create an intermediate time struct. If any digit changed
   // from the current second to the next, that digit needs to fade to blank
   // first before the new digit appears
-  uint8_t intermediate_blanked_arr[num_display_digits];
-  uint8_t next_value_arr[num_display_digits];
-
-  memcpy(current_value_arr, m_digits, sizeof(m_digits));
-  set_digit_array_from_value(next_value_arr, hours, minutes, seconds);
-
-  uint8_t current_dots = m_dots;
-  uint8_t intermediate_dots = nixie_dots;
+  Display_Buffer intermediate_blanked;
 
   if (blank_all) {
-    memset(intermediate_blanked_arr, NIXIE_BLANK_POS,
-           sizeof(intermediate_blanked_arr));
-    intermediate_dots = NIXIE_DOTS_NONE;
+    memset(intermediate_blanked.digits, NIXIE_BLANK_POS,
+           sizeof(intermediate_blanked.digits));
+    intermediate_blanked.dots = NIXIE_DOTS_NONE;
   } else {
     // Determine which digits changed from the current time to the next time,
     // and thus need to be blanked
-    set_digit_array_from_value(intermediate_blanked_arr, hours, minutes,
-                               seconds);
+    intermediate_blanked = next;
     for (size_t i = 0; i < num_display_digits; ++i) {
-      if (current_value_arr[i] != next_value_arr[i]) {
-        intermediate_blanked_arr[i] = NIXIE_BLANK_POS;
+      if (current.digits[i] != next.digits[i]) {
+        intermediate_blanked.digits[i] = NIXIE_BLANK_POS;
       }
     }
-    if (current_dots != nixie_dots) {
-      intermediate_dots = NIXIE_DOTS_NONE;
+    if (current.dots != next.dots) {
+      intermediate_blanked.dots = NIXIE_DOTS_NONE;
     }
   }
 
-  smooth_display_transition(current_value_arr, intermediate_blanked_arr,
-                            current_dots, intermediate_dots,
+  acquire_power_lock(POWER_LOCK_DISPLAY);
+  smooth_display_transition(current, intermediate_blanked,
                             transition_time_ms / 2);
-  smooth_display_transition(intermediate_blanked_arr, next_value_arr,
-                            intermediate_dots, nixie_dots,
+  smooth_display_transition(intermediate_blanked, next,
                             transition_time_ms / 2);
+  release_power_lock(POWER_LOCK_DISPLAY);
 }
 
-void Nixie_Display::smooth_display_transition(
-    const uint8_t current_digits[num_display_digits],
-    const uint8_t next_digits[num_display_digits], uint8_t current_nixie_dots,
-    uint8_t next_nixie_dots, size_t transition_time_ms) {
+void Nixie_Display::smooth_display_transition(const Display_Buffer& current,
+                                              const Display_Buffer& next,
+                                              size_t transition_time_ms) {
   size_t multiplex_count = 100;
-  double single_digit_transition_time =
-      transition_time_ms / (double)multiplex_count;
+  int64_t single_digit_transition_time_us =
+      (transition_time_ms * MILLISECOND_TO_MICROSECONDS) / multiplex_count;
+
+  // Each frame is shown until an absolute deadline, so the CPU can idle
+  // between frames and timing errors do not accumulate over the transition
+  int64_t transition_start_us = esp_timer_get_time();
 
   for (size_t i = 0; i < multiplex_count; ++i) {
     double current_digit_display_proportion =
         0.5 * (cos(PI * (i / (double)multiplex_count)) + 1);
-    double next_digit_display_proportion = 1 - current_digit_display_proportion;
-
-    memcpy(m_digits, current_digits, sizeof(m_digits));
-    m_dots = current_nixie_dots;
-    show();
-    delayMicroseconds(
-        (current_digit_display_proportion * single_digit_transition_time) *
-        MILLISECOND_TO_MICROSECONDS);
-
-    memcpy(m_digits, next_digits, sizeof(m_digits));
-    m_dots = next_nixie_dots;
-    show();
-    delayMicroseconds(
-        (next_digit_display_proportion * single_digit_transition_time) *
-        MILLISECOND_TO_MICROSECONDS);
+    int64_t multiplex_start_us =
+        transition_start_us + (i * single_digit_transition_time_us);
+
+    publish(current);
+    frame_timer.sleep_until(
+        multiplex_start_us +
+        (int64_t)(current_digit_display_proportion *
+                  single_digit_transition_time_us));
+
+    publish(next);
+    frame_timer.sleep_until(multiplex_start_us +
+                            single_digit_transition_time_us);
   }
 }
 
 void Nixie_Display::display_time(const struct tm& time_info,
                                  bool twelve_hour_format, uint8_t nixie_dots) {
-  set_time_in_array(m_digits, time_info, twelve_hour_format);
+  Display_Buffer buffer;
+  set_time_in_array(buffer.digits, time_info, twelve_hour_format);
 
-  m_dots = nixie_dots;
+  buffer.dots = nixie_dots;
 
-  show();
+  publish(buffer);
 }
 
 void Nixie_Display::display_date(const struct tm& time_info,
                                  uint8_t nixie_dots) {
   uint8_t month = time_info.tm_mon + 1;  // tm_month starts at 0
 
-  set_digit_array_from_value(m_digits, month, time_info.tm_mday,
+  Display_Buffer buffer;
+  set_digit_array_from_value(buffer.digits, month, time_info.tm_mday,
                              time_info.tm_year);
 
-  m_dots = nixie_dots;
+  buffer.dots = nixie_dots;
 
-  show();
+  publish(buffer);
 }
 
 void Nixie_Display::display_config_value(uint8_t option_number, uint8_t value) {
-  m_digits[0] = TENS(option_number);
-  m_digits[1] = ONES(option_number);
-
-  m_digits[2] = NIXIE_BLANK_POS;
-  m_digits[3] = NIXIE_BLANK_POS;
-
-  // Blank the leading digit of the value if it is zero
-  uint8_t value_tens = TENS(value);
-  m_digits[4] = value_tens == 0 ? NIXIE_BLANK_POS : value_tens;
-  m_digits[5] = ONES(value);
-
-  // Leave dots the same
-
-  show();
+  // Leave dots the same, since they may be blinking
+  modify_and_publish([option_number, value](Display_Buffer* buffer) {
+    buffer->digits[0] = TENS(option_number);
+    buffer->digits[1] = ONES(option_number);
+
+    buffer->digits[2] = NIXIE_BLANK_POS;
+    buffer->digits[3] = NIXIE_BLANK_POS;
+
+    // Blank the leading digit of the value if it is zero
+    uint8_t value_tens = TENS(value);
+    buffer->digits[4] = value_tens == 0 ? NIXIE_BLANK_POS : value_tens;
+    buffer->digits[5] = ONES(value);
+  });
 }
 
 void Nixie_Display::display_timer_select(uint8_t digit_pair_pos,
@@ -189,91 +245,273 @@ void Nixie_Display::display_timer_select(uint8_t digit_pair_pos,
       break;
   }
 
-  uint8_t value_tens = TENS(value);
-  m_digits[left_digit] = value_tens == 0 ? NIXIE_BLANK_POS : value_tens;
-  m_digits[right_digit] = ONES(value);
-
-  show();
+  modify_and_publish([=](Display_Buffer* buffer) {
+    uint8_t value_tens = TENS(value);
+    buffer->digits[left_digit] =
+        value_tens == 0 ? NIXIE_BLANK_POS : value_tens;
+    buffer->digits[right_digit] = ONES(value);
+  });
 }
 
 void Nixie_Display::display_slot_machine_cycle(const struct tm& current_time,
-                                               bool twelve_hour_format) {
-  static const int slot_machine_cycle_duration = 7;  // In seconds
-  static const int slot_machine_num_phases = 10;
-  const double slot_machine_phase_duration_ms =
-      (slot_machine_cycle_duration * 1000) / (double)slot_machine_num_phases;
+                                               bool twelve_hour_format,
+                                               const uint8_t* animation,
+                                               size_t animation_size) {
+  animation_info_t info;
+  if (validate_animation(animation, animation_size, &info) != ANIMATION_OK) {
+    debug_serial_println("Invalid slot machine animation");
+    return;
+  }
 
+  // Every tube cycles back to the digit it started on, so start on the time
+  // the animation will end at, to the nearest second
   struct tm end_time;
-  get_offset_time(&end_time, current_time, slot_machine_cycle_duration);
+  get_offset_time(&end_time, current_time, (info.duration_ms + 500) / 1000);
+  Display_Buffer buffer = read_front_buffer();
+  set_time_in_array(buffer.digits, end_time, twelve_hour_format);
+  publish(buffer);
 
-  for (size_t i = slot_machine_num_phases; i > 0; --i) {
-    slot_machine_cycle_phase(end_time, i, slot_machine_phase_duration_ms,
-                             twelve_hour_format);
-    reset_watchdog_timer();
-  }
+  play_animation(animation, animation_size);
 }
 
 void Nixie_Display::display_value(uint8_t hours, uint8_t minutes,
                                   uint8_t seconds, uint8_t nixie_dots) {
-  set_digit_array_from_value(m_digits, hours, minutes, seconds);
+  Display_Buffer buffer;
+  set_digit_array_from_value(buffer.digits, hours, minutes, seconds);
 
-  m_dots = nixie_dots;
+  buffer.dots = nixie_dots;
 
-  show();
+  publish(buffer);
 }
 
-void Nixie_Display::slot_machine_cycle_phase(const struct tm& end_time,
-                                             int num_cycling_digits,
-                                             double phase_ms,
-                                             bool twelve_hour_format) {
-  // Show the time where the display is supposed to end.
-  // This will lock in place the digits that are no longer cycling.
-  // The digits that are still cycling will quickly be updated so that the
-  // current time isn't seen
-  set_time_in_array(m_digits, end_time, twelve_hour_format);
-  show();
-
-  static const int num_iterations = 10;
-  const double iteration_duration_us =
-      (phase_ms / (double)num_iterations) * 1000;
-
-  for (size_t i = 0; i < num_iterations; ++i) {
-    // The cascade behavior of this switch statement is desired here
-    switch (num_cycling_digits) {
-      default:  // Any number larger than 6 automatically cycles all digits
-      case 6:
-        m_digits[0] = CYCLE(m_digits[0]);
-      case 5:
-        m_digits[1] = CYCLE(m_digits[1]);
-      case 4:
-        m_digits[2] = CYCLE(m_digits[2]);
-      case 3:
-        m_digits[3] = CYCLE(m_digits[3]);
-      case 2:
-        m_digits[4] = CYCLE(m_digits[4]);
-      case 1:
-        m_digits[5] = CYCLE(m_digits[5]);
-    }
+nixie_number_result_t Nixie_Display::display_number(
+    int32_t value, uint8_t value_places, const Number_Format& format) {
+  Display_Buffer buffer;
+  nixie_number_result_t result =
+      render_number(value, value_places, format, &buffer);
+  if (result != NIXIE_NUMBER_BAD_FORMAT) {
+    publish(buffer);
+  }
 
-    show();
-    delayMicroseconds(iteration_duration_us);
+  return result;
+}
+
+nixie_number_result_t Nixie_Display::smooth_display_number(
+    size_t transition_time_ms, int32_t value, uint8_t value_places,
+    const Number_Format& format, bool blank_all) {
+  Display_Buffer buffer;
+  nixie_number_result_t result =
+      render_number(value, value_places, format, &buffer);
+  if (result != NIXIE_NUMBER_BAD_FORMAT) {
+    smooth_display_buffer(transition_time_ms, buffer, blank_all);
   }
+
+  return result;
 }
 
-void Nixie_Display::show() const {
-  digitalWrite(latch_pin, LOW);
+void Nixie_Display::display_digits(const uint8_t digits[num_display_digits],
+                                   uint8_t nixie_dots) {
+  Display_Buffer buffer;
+  memcpy(buffer.digits, digits, sizeof(buffer.digits));
 
-  // Shift out each pair of digits
-  for (size_t i = 0; i < num_display_digits - 1; i += 2) {
-    shiftOut(data_pin, clock_pin, LSBFIRST,
-             LEFT_DISPLAY(nixie_digits[m_digits[i]]) |
-                 RIGHT_DISPLAY(nixie_digits[m_digits[i + 1]]));
+  buffer.dots = nixie_dots;
+
+  publish(buffer);
+}
+
+animation_error_t Nixie_Display::play_animation(const uint8_t* program,
+                                                size_t size) {
+  // The interpreter trusts the program from here on
+  animation_error_t error = validate_animation(program, size);
+  if (error != ANIMATION_OK) {
+    debug_serial_printfln("Invalid animation: %d", error);
+    return error;
+  }
+
+  struct {
+    const uint8_t* body;
+    uint8_t remaining;
+  } loops[ANIMATION_MAX_LOOP_DEPTH];
+  size_t depth = 0;
+
+  uint32_t random_state = esp_random() | 1;
+
+  // Frames are timed from the start of the animation, so the time spent
+  // interpreting instructions does not accumulate
+  int64_t deadline_us = esp_timer_get_time();
+
+  // The animation composes each frame in its own back buffer
+  Display_Buffer buffer = read_front_buffer();
+
+  acquire_power_lock(POWER_LOCK_DISPLAY);
+
+  const uint8_t* pc = program + ANIMATION_HEADER_SIZE;
+  while (*pc != ANIMATION_OP_END) {
+    uint8_t opcode = *pc++;
+    const uint8_t* operands = pc;
+    pc += get_animation_operand_size(opcode);
+
+    switch (opcode) {
+      case ANIMATION_OP_FRAME:
+        for (size_t i = 0; i < num_display_digits; ++i) {
+          if (operands[i] != ANIMATION_KEEP) {
+            buffer.digits[i] = operands[i];
+          }
+        }
+        buffer.dots = operands[num_display_digits];
+        publish(buffer);
+        break;
+
+      case ANIMATION_OP_HOLD:
+        deadline_us += (operands[0] | (operands[1] << 8)) *
+                       (int64_t)MILLISECOND_TO_MICROSECONDS;
+        frame_timer.sleep_until(deadline_us);
+        heartbeat();
+        break;
+
+      case ANIMATION_OP_FADE:
+        deadline_us = play_animation_fade(operands, &buffer, deadline_us);
+        heartbeat();
+        break;
+
+      case ANIMATION_OP_DOTS:
+        buffer.dots = operands[0];
+        publish(buffer);
+        break;
+
+      case ANIMATION_OP_LOOP:
+        loops[depth].body = pc;
+        loops[depth].remaining = operands[0];
+        ++depth;
+        break;
+
+      case ANIMATION_OP_LOOP_END:
+        if (--loops[depth - 1].remaining) {
+          pc = loops[depth - 1].body;
+        } else {
+          --depth;
+        }
+        break;
+
+      case ANIMATION_OP_RANDOM:
+        for (size_t i = 0; i < num_display_digits; ++i) {
+          if (operands[0] & (1 << i)) {
+            buffer.digits[i] = xorshift32(&random_state) % 10;
+          }
+        }
+        publish(buffer);
+        break;
+
+      case ANIMATION_OP_CYCLE:
+        for (size_t i = 0; i < num_display_digits; ++i) {
+          if (operands[0] & (1 << i)) {
+            buffer.digits[i] = CYCLE(buffer.digits[i]);
+          }
+        }
+        publish(buffer);
+        break;
+    }
   }
 
-  // Shift out the dot separators
-  shiftOut(data_pin, clock_pin, MSBFIRST, m_dots);
+  release_power_lock(POWER_LOCK_DISPLAY);
 
-  digitalWrite(latch_pin, HIGH);
+  return ANIMATION_OK;
+}
+
+int64_t Nixie_Display::play_animation_fade(const uint8_t* operands,
+                                           Display_Buffer* buffer,
+                                           int64_t start_us) {
+  // The tubes are channels 0-5 and the dots are channel 6. The dots fade over
+  // the longest of the tube fades
+  static const size_t num_channels = num_display_digits + 1;
+  uint8_t* channels[num_channels] = {
+      &buffer->digits[0], &buffer->digits[1], &buffer->digits[2],
+      &buffer->digits[3], &buffer->digits[4], &buffer->digits[5],
+      &buffer->dots};
+  uint8_t from[num_channels];
+  uint8_t to[num_channels];
+  int64_t fade_us[num_channels];
+
+  int64_t longest_fade_us = 0;
+  for (size_t i = 0; i < num_display_digits; ++i) {
+    from[i] = buffer->digits[i];
+    to[i] = operands[i] == ANIMATION_KEEP ? buffer->digits[i] : operands[i];
+    fade_us[i] = operands[num_display_digits + 1 + i] *
+                 ANIMATION_FADE_UNIT_MS * (int64_t)MILLISECOND_TO_MICROSECONDS;
+    if (fade_us[i] > longest_fade_us) {
+      longest_fade_us = fade_us[i];
+    }
+  }
+  from[num_display_digits] = buffer->dots;
+  to[num_display_digits] = operands[num_display_digits];
+  fade_us[num_display_digits] = longest_fade_us;
+
+  const int64_t period_us =
+      ANIMATION_FADE_PERIOD_MS * (int64_t)MILLISECOND_TO_MICROSECONDS;
+  int64_t elapsed_us = 0;
+
+  for (; elapsed_us < longest_fade_us; elapsed_us += period_us) {
+    // Each channel shows its old value for the start of the period and its
+    // new value for the rest, with the same cosine profile as
+    // smooth_display_transition(). Channels are switched in order of time
+    int64_t switch_us[num_channels];
+    uint8_t order[num_channels];
+
+    for (size_t i = 0; i < num_channels; ++i) {
+      if (elapsed_us >= fade_us[i]) {
+        switch_us[i] = 0;
+      } else {
+        double old_proportion =
+            0.5 * (cos(PI * (elapsed_us / (double)fade_us[i])) + 1);
+        switch_us[i] = old_proportion * period_us;
+      }
+      *channels[i] = switch_us[i] ? from[i] : to[i];
+
+      size_t j = i;
+      for (; j > 0 && switch_us[order[j - 1]] > switch_us[i]; --j) {
+        order[j] = order[j - 1];
+      }
+      order[j] = i;
+    }
+    publish(*buffer);
+
+    int64_t period_start_us = start_us + elapsed_us;
+    for (size_t i = 0; i < num_channels;) {
+      int64_t channel_switch_us = switch_us[order[i]];
+      if (!channel_switch_us) {
+        ++i;
+        continue;
+      }
+
+      frame_timer.sleep_until(period_start_us + channel_switch_us);
+
+      // Channels that switch at the same time share a frame
+      for (; i < num_channels && switch_us[order[i]] == channel_switch_us;
+           ++i) {
+        *channels[order[i]] = to[order[i]];
+      }
+      publish(*buffer);
+    }
+
+    frame_timer.sleep_until(period_start_us + period_us);
+  }
+
+  for (size_t i = 0; i < num_channels; ++i) {
+    *channels[i] = to[i];
+  }
+  publish(*buffer);
+
+  return start_us + elapsed_us;
+}
+
+void Nixie_Display::show() const {
+  // Both cores may publish, so the shift register is written by one at a
+  // time. The front buffer is read inside the critical section so the last
+  // write always has the latest frame
+  portENTER_CRITICAL(&output_mux);
+  Display_Buffer front = read_front_buffer();
+  tube_driver.write_frame(Tube_Driver::pack(front.digits, front.dots));
+  portEXIT_CRITICAL(&output_mux);
 }
 
 void Nixie_Display::set_time_in_array(uint8_t array[num_display_digits],
@@ -289,10 +527,11 @@ void Nixie_Display::set_time_in_array(uint8_t array[num_display_digits],
 
 void Nixie_Display::get_current_display(uint8_t* hours, uint8_t* minutes,
                                         uint8_t* seconds, uint8_t* dots) const {
-  *hours = (10 * m_digits[0]) + m_digits[1];
-  *minutes = (10 * m_digits[2]) + m_digits[3];
-  *seconds = (10 * m_digits[4]) + m_digits[5];
-  *dots = m_dots;
+  Display_Buffer front = read_front_buffer();
+  *hours = (10 * front.digits[0]) + front.digits[1];
+  *minutes = (10 * front.digits[2]) + front.digits[3];
+  *seconds = (10 * front.digits[4]) + front.digits[5];
+  *dots = front.dots;
 }
 
 void Nixie_Display::get_offset_time(struct tm* offset_time,
@@ -305,7 +544,68 @@ void Nixie_Display::get_offset_time(struct tm* offset_time,
   // hours, etc at 60 seconds)
   time_t next_time_epoch = mktime(offset_time);
 
-  localtime_r(&next_time_epoch, offset_time);
+  local_time(next_time_epoch, offset_time);
+}
+
+nixie_number_result_t Nixie_Display::render_number(int32_t value,
+                                                   uint8_t value_places,
+                                                   const Number_Format& format,
+                                                   Display_Buffer* buffer) {
+  static const uint32_t c_powers_of_ten[] = {
+      1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000,
+      1000000000};
+  static const uint32_t c_max_magnitude = 999999;
+
+  size_t integer_digits = num_display_digits - format.decimal_places;
+  if ((format.decimal_places != 0 && format.decimal_places != 2 &&
+       format.decimal_places != 4) ||
+      format.min_integer_digits > integer_digits ||
+      value_places >= NUM_ELEMENTS(c_powers_of_ten)) {
+    return NIXIE_NUMBER_BAD_FORMAT;
+  }
+
+  // The magnitude in units of the last displayed digit. 64 bits, so neither
+  // INT32_MIN nor scaling up can overflow
+  bool negative = value < 0;
+  uint64_t magnitude = negative ? -(int64_t)value : value;
+  if (value_places > format.decimal_places) {
+    uint32_t divisor = c_powers_of_ten[value_places - format.decimal_places];
+    magnitude = (magnitude + divisor / 2) / divisor;
+  } else {
+    magnitude *= c_powers_of_ten[format.decimal_places - value_places];
+  }
+
+  nixie_number_result_t result = NIXIE_NUMBER_OK;
+  if (magnitude > c_max_magnitude) {
+    magnitude = c_max_magnitude;
+    result = NIXIE_NUMBER_OVERFLOW;
+  }
+
+  // Small negative values that round to zero are shown without a sign
+  negative = negative && magnitude != 0;
+
+  for (size_t i = num_display_digits; i-- > 0;) {
+    buffer->digits[i] = magnitude % 10;
+    magnitude /= 10;
+  }
+
+  for (size_t i = 0;
+       i + format.min_integer_digits < integer_digits && buffer->digits[i] == 0;
+       ++i) {
+    buffer->digits[i] = NIXIE_BLANK_POS;
+  }
+
+  buffer->dots = format.decimal_places == 2   ? NIXIE_DOTS_BOTTOM_RIGHT
+                 : format.decimal_places == 4 ? NIXIE_DOTS_BOTTOM_LEFT
+                                              : NIXIE_DOTS_NONE;
+  if (negative) {
+    buffer->dots |= format.negative_dots;
+  }
+  if (result == NIXIE_NUMBER_OVERFLOW) {
+    buffer->dots |= format.overflow_dots;
+  }
+
+  return result;
 }
 
 void Nixie_Display::set_digit_array_from_value(
@@ -0,0 +1,292 @@
+#include "alarms.h"
+
+#include <Arduino.h>
+#include <EEPROM.h>
+#include <esp_timer.h>
+#include <time.h>
+
+#include "arduino_debug.h"
+#include "buzzer.h"
+#include "config.h"
+#include "deferred_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "time_zone.h"
+#include "util.h"
+
+// Each alarm is stored in EEPROM_ALARM_SIZE bytes:
+//   0: enabled flag (bit 7) and hour
+//   1: minute
+//   2: weekday mask
+#define ALARM_ENABLED_FLAG 0x80
+#define ALARM_HOUR_MASK 0x1f
+
+typedef struct {
+  time_t fire_time;
+  uint8_t alarm_index;
+} alarm_heap_entry_t;
+
+static alarm_heap_entry_t s_alarm_heap[MAX_ALARMS];
+static size_t s_alarm_heap_size = 0;
+
+// esp_timer time at which the alarm timer fires. Zero when not armed
+static int64_t s_alarm_timer_deadline_us = 0;
+
+// The fire time of the alarms the timer is armed for
+static time_t s_alarm_timer_fire_time = 0;
+
+static esp_timer_handle_t s_alarm_timer = NULL;
+static SemaphoreHandle_t s_alarms_mutex = NULL;
+
+static uint32_t job_reschedule_fired_alarms(void* argument);
+
+static executor_job_t s_job_reschedule_fired_alarms = {
+    job_reschedule_fired_alarms, NULL, "reschedule_fired_alarms", 13};
+
+static bool get_next_fire_time(const alarm_t& alarm, time_t now,
+                               time_t* fire_time);
+static void alarm_heap_push(time_t fire_time, uint8_t alarm_index);
+static alarm_heap_entry_t alarm_heap_pop();
+static void rebuild_alarm_heap();
+static void arm_alarm_timer();
+static void on_alarm_timer(void* arg);
+
+void setup_alarms(executor_t* executor) {
+  s_alarms_mutex = xSemaphoreCreateMutex();
+  add_job(executor, &s_job_reschedule_fired_alarms, EXECUTOR_JOB_STOP);
+
+  esp_timer_create_args_t timer_args = {};
+  timer_args.callback = on_alarm_timer;
+  timer_args.name = "alarm_timer";
+  esp_timer_create(&timer_args, &s_alarm_timer);
+
+  reschedule_alarms();
+}
+
+void get_alarm(size_t index, alarm_t* alarm) {
+  size_t address = EEPROM_ALARMS_ADDRESS + (index * EEPROM_ALARM_SIZE);
+  uint8_t flags_and_hour = EEPROM.read(address);
+
+  alarm->enabled = flags_and_hour & ALARM_ENABLED_FLAG;
+  alarm->hour = flags_and_hour & ALARM_HOUR_MASK;
+  alarm->minute = EEPROM.read(address + 1);
+  alarm->weekday_mask = EEPROM.read(address + 2) & ALARM_DAILY;
+
+  // Uninitialized or corrupted alarms are disabled
+  if (alarm->hour > 23 || alarm->minute > 59) {
+    alarm->enabled = false;
+    alarm->hour = 0;
+    alarm->minute = 0;
+  }
+}
+
+void set_alarm(size_t index, const alarm_t& alarm) {
+  size_t address = EEPROM_ALARMS_ADDRESS + (index * EEPROM_ALARM_SIZE);
+
+  EEPROM.write(address, (alarm.enabled ? ALARM_ENABLED_FLAG : 0) |
+                            (alarm.hour & ALARM_HOUR_MASK));
+  EEPROM.write(address + 1, alarm.minute);
+  EEPROM.write(address + 2, alarm.weekday_mask & ALARM_DAILY);
+  EEPROM.commit();
+
+  debug_serial_printfln("Alarm %u: enabled: %d\t%02d:%02d\tweekdays: 0x%02x",
+                        index, alarm.enabled, alarm.hour, alarm.minute,
+                        alarm.weekday_mask);
+
+  reschedule_alarms();
+}
+
+void reschedule_alarms() {
+  xSemaphoreTake(s_alarms_mutex, portMAX_DELAY);
+  rebuild_alarm_heap();
+  arm_alarm_timer();
+  xSemaphoreGive(s_alarms_mutex);
+}
+
+bool get_next_alarm_remaining(int64_t* remaining_us) {
+  xSemaphoreTake(s_alarms_mutex, portMAX_DELAY);
+  int64_t deadline_us = s_alarm_timer_deadline_us;
+  xSemaphoreGive(s_alarms_mutex);
+
+  if (!deadline_us) {
+    return false;
+  }
+
+  *remaining_us = deadline_us - esp_timer_get_time();
+  if (*remaining_us < 0) {
+    *remaining_us = 0;
+  }
+
+  return true;
+}
+
+// The alarm has already sounded from the timer callback. This only takes
+// the fired alarms off the heap, which writes the EEPROM for one-shot alarms
+static uint32_t job_reschedule_fired_alarms(void* argument) {
+  xSemaphoreTake(s_alarms_mutex, portMAX_DELAY);
+
+  // Nothing has fired if the alarms were rescheduled in the meantime
+  if (!s_alarm_timer_deadline_us ||
+      esp_timer_get_time() < s_alarm_timer_deadline_us) {
+    xSemaphoreGive(s_alarms_mutex);
+    return EXECUTOR_JOB_STOP;
+  }
+
+  // The timer runs on the monotonic clock, so it may fire slightly before
+  // the wall clock fire time. The alarms it was armed for are due either way
+  time_t fire_time = s_alarm_timer_fire_time;
+  while (s_alarm_heap_size && s_alarm_heap[0].fire_time <= fire_time) {
+    alarm_heap_entry_t entry = alarm_heap_pop();
+
+    alarm_t alarm;
+    get_alarm(entry.alarm_index, &alarm);
+    debug_serial_printfln("Alarm %u fired", entry.alarm_index);
+
+    if (alarm.weekday_mask == ALARM_ONE_SHOT) {
+      alarm.enabled = false;
+      size_t address =
+          EEPROM_ALARMS_ADDRESS + (entry.alarm_index * EEPROM_ALARM_SIZE);
+      EEPROM.write(address, alarm.hour & ALARM_HOUR_MASK);
+      EEPROM.commit();
+      continue;
+    }
+
+    // From the fire time rather than now, which may still be before it
+    time_t next_fire_time;
+    if (get_next_fire_time(alarm, entry.fire_time, &next_fire_time)) {
+      alarm_heap_push(next_fire_time, entry.alarm_index);
+    }
+  }
+
+  arm_alarm_timer();
+
+  xSemaphoreGive(s_alarms_mutex);
+
+  return EXECUTOR_JOB_STOP;
+}
+
+static bool get_next_fire_time(const alarm_t& alarm, time_t now,
+                               time_t* fire_time) {
+  struct tm now_info;
+  local_time(now, &now_info);
+
+  // Look up to a week ahead for the first matching day
+  for (int day_offset = 0; day_offset <= 7; ++day_offset) {
+    struct tm candidate = now_info;
+    candidate.tm_mday += day_offset;
+    candidate.tm_hour = alarm.hour;
+    candidate.tm_min = alarm.minute;
+    candidate.tm_sec = 0;
+    candidate.tm_isdst = -1;  // Let mktime determine DST for that day
+
+    time_t candidate_time = mktime(&candidate);
+    if (candidate_time <= now) {
+      continue;
+    }
+
+    if (alarm.weekday_mask == ALARM_ONE_SHOT ||
+        (alarm.weekday_mask & (1 << candidate.tm_wday))) {
+      *fire_time = candidate_time;
+      return true;
+    }
+  }
+
+  return false;
+}
+
+static void alarm_heap_push(time_t fire_time, uint8_t alarm_index) {
+  size_t child = s_alarm_heap_size++;
+  s_alarm_heap[child] = {fire_time, alarm_index};
+
+  // Sift up
+  while (child > 0) {
+    size_t parent = (child - 1) / 2;
+    if (s_alarm_heap[parent].fire_time <= s_alarm_heap[child].fire_time) {
+      break;
+    }
+
+    alarm_heap_entry_t temp = s_alarm_heap[parent];
+    s_alarm_heap[parent] = s_alarm_heap[child];
+    s_alarm_heap[child] = temp;
+    child = parent;
+  }
+}
+
+static alarm_heap_entry_t alarm_heap_pop() {
+  alarm_heap_entry_t top = s_alarm_heap[0];
+  s_alarm_heap[0] = s_alarm_heap[--s_alarm_heap_size];
+
+  // Sift down
+  size_t parent = 0;
+  for (;;) {
+    size_t smallest = parent;
+    size_t left = (2 * parent) + 1;
+    size_t right = left + 1;
+
+    if (left < s_alarm_heap_size &&
+        s_alarm_heap[left].fire_time < s_alarm_heap[smallest].fire_time) {
+      smallest = left;
+    }
+    if (right < s_alarm_heap_size &&
+        s_alarm_heap[right].fire_time < s_alarm_heap[smallest].fire_time) {
+      smallest = right;
+    }
+    if (smallest == parent) {
+      break;
+    }
+
+    alarm_heap_entry_t temp = s_alarm_heap[parent];
+    s_alarm_heap[parent] = s_alarm_heap[smallest];
+    s_alarm_heap[smallest] = temp;
+    parent = smallest;
+  }
+
+  return top;
+}
+
+static void rebuild_alarm_heap() {
+  s_alarm_heap_size = 0;
+
+  time_t now = time(NULL);
+  if (now < LOCAL_TIME_MIN_VALID_EPOCH) {
+    // The clock has not been set yet. NTP reschedules once it is
+    return;
+  }
+
+  for (size_t i = 0; i < MAX_ALARMS; ++i) {
+    alarm_t alarm;
+    get_alarm(i, &alarm);
+
+    time_t fire_time;
+    if (alarm.enabled && get_next_fire_time(alarm, now, &fire_time)) {
+      alarm_heap_push(fire_time, i);
+    }
+  }
+}
+
+static void arm_alarm_timer() {
+  esp_timer_stop(s_alarm_timer);
+
+  if (!s_alarm_heap_size) {
+    s_alarm_timer_deadline_us = 0;
+    s_alarm_timer_fire_time = 0;
+    return;
+  }
+
+  int64_t delay_s = s_alarm_heap[0].fire_time - time(NULL);
+  int64_t delay_us = delay_s > 0 ? delay_s * 1000 * MILLISECOND_TO_MICROSECONDS
+                                 : 1;
+
+  s_alarm_timer_deadline_us = esp_timer_get_time() + delay_us;
+  s_alarm_timer_fire_time = s_alarm_heap[0].fire_time;
+  esp_timer_start_once(s_alarm_timer, delay_us);
+}
+
+// Sounds the alarm straight away. The deadline is left in the past until the
+// job has rescheduled, so the tubes off window doesn't sleep through the next
+// alarm meanwhile
+static void on_alarm_timer(void* arg) {
+  deferred_printfln("Alarm timer fired");
+  buzzer_play(&c_buzzer_pattern_alarm);
+  schedule_job(&s_job_reschedule_fired_alarms, 0);
+}
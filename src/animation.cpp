@@ -0,0 +1,193 @@
+#include "animation.h"
+
+#include <Arduino.h>
+#include <LittleFS.h>
+
+#include "Nixie_Display.h"
+#include "arduino_debug.h"
+
+#define HOLD_MS(ms) ANIMATION_OP_HOLD, ((ms)&0xff), ((ms) >> 8)
+
+#define SLOT_MACHINE_PHASE(mask)                                  \
+  ANIMATION_OP_LOOP, 10, ANIMATION_OP_CYCLE, (mask), HOLD_MS(70), \
+      ANIMATION_OP_LOOP_END
+
+// Cycling a tube ten times brings it back to the digit it started on, so each
+// 700 ms phase ends on the starting frame with one more tube locked in place
+const uint8_t c_animation_slot_machine[] = {
+    ANIMATION_MAGIC_0,
+    ANIMATION_MAGIC_1,
+    ANIMATION_VERSION,
+    ANIMATION_OP_LOOP,
+    5,
+    SLOT_MACHINE_PHASE(0x3f),
+    ANIMATION_OP_LOOP_END,
+    SLOT_MACHINE_PHASE(0x3e),
+    SLOT_MACHINE_PHASE(0x3c),
+    SLOT_MACHINE_PHASE(0x38),
+    SLOT_MACHINE_PHASE(0x30),
+    SLOT_MACHINE_PHASE(0x20),
+    ANIMATION_OP_END,
+};
+const size_t c_animation_slot_machine_size = sizeof(c_animation_slot_machine);
+
+static bool is_valid_digit(uint8_t digit) {
+  return digit <= NIXIE_BLANK_POS || digit == ANIMATION_KEEP;
+}
+
+int get_animation_operand_size(uint8_t opcode) {
+  switch (opcode) {
+    case ANIMATION_OP_END:
+    case ANIMATION_OP_LOOP_END:
+      return 0;
+    case ANIMATION_OP_DOTS:
+    case ANIMATION_OP_LOOP:
+    case ANIMATION_OP_RANDOM:
+    case ANIMATION_OP_CYCLE:
+      return 1;
+    case ANIMATION_OP_HOLD:
+      return 2;
+    case ANIMATION_OP_FRAME:
+      return ANIMATION_NUM_TUBES + 1;
+    case ANIMATION_OP_FADE:
+      return 2 * ANIMATION_NUM_TUBES + 1;
+    default:
+      return -1;
+  }
+}
+
+animation_error_t validate_animation(const uint8_t* program, size_t size,
+                                     animation_info_t* info) {
+  if (size < ANIMATION_HEADER_SIZE || program[0] != ANIMATION_MAGIC_0 ||
+      program[1] != ANIMATION_MAGIC_1 || program[2] != ANIMATION_VERSION) {
+    return ANIMATION_ERROR_BAD_HEADER;
+  }
+
+  // Duration and instruction count of the body of each open loop. Entry 0
+  // is the top level of the program
+  uint64_t duration_ms[ANIMATION_MAX_LOOP_DEPTH + 1] = {0};
+  uint64_t num_instructions[ANIMATION_MAX_LOOP_DEPTH + 1] = {0};
+  uint8_t loop_counts[ANIMATION_MAX_LOOP_DEPTH + 1] = {0};
+  size_t depth = 0;
+
+  size_t pc = ANIMATION_HEADER_SIZE;
+  while (pc < size) {
+    uint8_t opcode = program[pc];
+    int operand_size = get_animation_operand_size(opcode);
+    if (operand_size < 0) {
+      return ANIMATION_ERROR_BAD_OPCODE;
+    }
+    if (pc + 1 + operand_size > size) {
+      return ANIMATION_ERROR_TRUNCATED;
+    }
+
+    const uint8_t* operands = &program[pc + 1];
+    ++num_instructions[depth];
+
+    switch (opcode) {
+      case ANIMATION_OP_END:
+        if (depth != 0) {
+          return ANIMATION_ERROR_UNMATCHED_LOOP;
+        }
+        if (info) {
+          info->duration_ms = duration_ms[0];
+          info->num_instructions = num_instructions[0];
+        }
+        return ANIMATION_OK;
+
+      case ANIMATION_OP_FRAME:
+      case ANIMATION_OP_FADE:
+        for (size_t i = 0; i < ANIMATION_NUM_TUBES; ++i) {
+          if (!is_valid_digit(operands[i])) {
+            return ANIMATION_ERROR_BAD_OPERAND;
+          }
+        }
+        if (operands[ANIMATION_NUM_TUBES] > NIXIE_DOTS_ALL) {
+          return ANIMATION_ERROR_BAD_OPERAND;
+        }
+        if (opcode == ANIMATION_OP_FADE) {
+          uint8_t longest_fade = 0;
+          for (size_t i = 0; i < ANIMATION_NUM_TUBES; ++i) {
+            if (operands[ANIMATION_NUM_TUBES + 1 + i] > longest_fade) {
+              longest_fade = operands[ANIMATION_NUM_TUBES + 1 + i];
+            }
+          }
+          duration_ms[depth] += longest_fade * ANIMATION_FADE_UNIT_MS;
+        }
+        break;
+
+      case ANIMATION_OP_HOLD:
+        duration_ms[depth] += operands[0] | (operands[1] << 8);
+        break;
+
+      case ANIMATION_OP_DOTS:
+        if (operands[0] > NIXIE_DOTS_ALL) {
+          return ANIMATION_ERROR_BAD_OPERAND;
+        }
+        break;
+
+      case ANIMATION_OP_RANDOM:
+      case ANIMATION_OP_CYCLE:
+        if (operands[0] > ANIMATION_ALL_TUBES) {
+          return ANIMATION_ERROR_BAD_OPERAND;
+        }
+        break;
+
+      case ANIMATION_OP_LOOP:
+        if (operands[0] == 0) {
+          return ANIMATION_ERROR_BAD_OPERAND;
+        }
+        if (depth == ANIMATION_MAX_LOOP_DEPTH) {
+          return ANIMATION_ERROR_LOOP_DEPTH;
+        }
+        ++depth;
+        loop_counts[depth] = operands[0];
+        duration_ms[depth] = 0;
+        num_instructions[depth] = 0;
+        break;
+
+      case ANIMATION_OP_LOOP_END:
+        if (depth == 0) {
+          return ANIMATION_ERROR_UNMATCHED_LOOP;
+        }
+        duration_ms[depth - 1] += duration_ms[depth] * loop_counts[depth];
+        num_instructions[depth - 1] +=
+            num_instructions[depth] * loop_counts[depth];
+        --depth;
+        if (duration_ms[depth] > UINT32_MAX ||
+            num_instructions[depth] > UINT32_MAX) {
+          return ANIMATION_ERROR_TOO_LONG;
+        }
+        break;
+    }
+
+    pc += 1 + operand_size;
+  }
+
+  return ANIMATION_ERROR_NO_END;
+}
+
+animation_error_t load_animation_file(const char* path, uint8_t* buffer,
+                                      size_t buffer_size, size_t* size) {
+  if (!LittleFS.begin()) {
+    debug_serial_println("Failed to mount LittleFS");
+    return ANIMATION_ERROR_FILE;
+  }
+
+  File file = LittleFS.open(path, "r");
+  if (!file) {
+    debug_serial_printfln("Failed to open animation: %s", path);
+    return ANIMATION_ERROR_FILE;
+  }
+
+  *size = file.read(buffer, buffer_size);
+  bool fits = !file.available();
+  file.close();
+
+  if (!fits) {
+    debug_serial_printfln("Animation too large: %s", path);
+    return ANIMATION_ERROR_TOO_LONG;
+  }
+
+  return validate_animation(buffer, *size);
+}
@@ -0,0 +1,41 @@
+#include "boot_phases.h"
+
+#include <esp_timer.h>
+
+#include "arduino_debug.h"
+
+static const char* const c_boot_phase_names[NUM_BOOT_PHASES] = {
+    "setup", "display_ready", "time_restored", "first_correct_time",
+    "tasks_started", "ntp_synced"};
+
+static volatile int64_t s_boot_phase_us[NUM_BOOT_PHASES] = {-1, -1, -1,
+                                                             -1, -1, -1};
+
+void mark_boot_phase(boot_phase_t phase) {
+  if (s_boot_phase_us[phase] >= 0) {
+    return;
+  }
+
+  s_boot_phase_us[phase] = esp_timer_get_time();
+  debug_serial_printfln("Boot phase %s: %lld ms", c_boot_phase_names[phase],
+                        s_boot_phase_us[phase] / 1000);
+}
+
+int64_t get_boot_phase_us(boot_phase_t phase) {
+  return s_boot_phase_us[phase];
+}
+
+const char* get_boot_phase_name(boot_phase_t phase) {
+  return c_boot_phase_names[phase];
+}
+
+void print_boot_phases() {
+  for (size_t i = 0; i < NUM_BOOT_PHASES; ++i) {
+    if (s_boot_phase_us[i] < 0) {
+      debug_serial_printfln("\t%s: not reached", c_boot_phase_names[i]);
+    } else {
+      debug_serial_printfln("\t%s: %lld ms", c_boot_phase_names[i],
+                            s_boot_phase_us[i] / 1000);
+    }
+  }
+}
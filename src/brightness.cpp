@@ -0,0 +1,27 @@
+#include "brightness.h"
+
+#include <EEPROM.h>
+
+#include "config.h"
+#include "solar.h"
+#include "util.h"
+
+bool is_night_time(const struct tm& time_info) {
+  // Follow sunset and sunrise once the weather fetch has found the location
+  int16_t latitude;
+  int16_t longitude;
+  if (EEPROM.read(EEPROM_SOLAR_SCHEDULE_ADDRESS) != 0 &&
+      get_location(&latitude, &longitude)) {
+    return is_sun_down(time_info);
+  }
+
+  return is_hour_in_window(time_info.tm_hour,
+                           EEPROM.read(EEPROM_NIGHT_START_HOUR_ADDRESS),
+                           EEPROM.read(EEPROM_NIGHT_END_HOUR_ADDRESS));
+}
+
+uint8_t get_scheduled_brightness(const struct tm& time_info) {
+  return EEPROM.read(is_night_time(time_info)
+                         ? EEPROM_NIGHT_BRIGHTNESS_ADDRESS
+                         : EEPROM_DAY_BRIGHTNESS_ADDRESS);
+}
@@ -0,0 +1,127 @@
+#include "buzzer.h"
+
+#include <Arduino.h>
+#include <driver/ledc.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "util.h"
+
+#define BUZZER_LEDC_MODE LEDC_HIGH_SPEED_MODE
+#define BUZZER_LEDC_TIMER LEDC_TIMER_1
+#define BUZZER_LEDC_CHANNEL LEDC_CHANNEL_1
+#define BUZZER_LEDC_RESOLUTION LEDC_TIMER_10_BIT
+#define BUZZER_LEDC_HALF_DUTY (1 << (BUZZER_LEDC_RESOLUTION - 1))
+
+#define BUZZER_QUEUE_LENGTH 8
+
+const int c_buzzer_pin = 18;
+
+// A single 1 ms high pulse, like the original bit-banged click
+static const buzzer_note_t c_click_notes[] = {{500, 2}};
+const buzzer_pattern_t c_buzzer_pattern_click = {
+    c_click_notes, NUM_ELEMENTS(c_click_notes), 1};
+
+// Double beep, repeated for 10 seconds
+static const buzzer_note_t c_alarm_notes[] = {
+    {2000, 100}, {0, 100}, {2000, 100}, {0, 700}};
+const buzzer_pattern_t c_buzzer_pattern_alarm = {
+    c_alarm_notes, NUM_ELEMENTS(c_alarm_notes), 10};
+
+// Descending G6, E6, C6
+static const buzzer_note_t c_hour_chime_notes[] = {
+    {1568, 150}, {0, 50}, {1319, 150}, {0, 50}, {1047, 300}};
+const buzzer_pattern_t c_buzzer_pattern_hour_chime = {
+    c_hour_chime_notes, NUM_ELEMENTS(c_hour_chime_notes), 1};
+
+static QueueHandle_t s_buzzer_queue = NULL;
+static TaskHandle_t s_buzzer_player_task = NULL;
+static volatile bool s_buzzer_stop_requested = false;
+static const buzzer_pattern_t* volatile s_playing_pattern = NULL;
+
+static void set_buzzer_note(uint16_t frequency_hz);
+
+void setup_buzzer() {
+  s_buzzer_queue = xQueueCreate(BUZZER_QUEUE_LENGTH, sizeof(buzzer_pattern_t*));
+
+  ledc_timer_config_t timer_config = {};
+  timer_config.speed_mode = BUZZER_LEDC_MODE;
+  timer_config.duty_resolution = BUZZER_LEDC_RESOLUTION;
+  timer_config.timer_num = BUZZER_LEDC_TIMER;
+  timer_config.freq_hz = 1000;
+  timer_config.clk_cfg = LEDC_AUTO_CLK;
+  ledc_timer_config(&timer_config);
+
+  ledc_channel_config_t channel_config = {};
+  channel_config.gpio_num = c_buzzer_pin;
+  channel_config.speed_mode = BUZZER_LEDC_MODE;
+  channel_config.channel = BUZZER_LEDC_CHANNEL;
+  channel_config.timer_sel = BUZZER_LEDC_TIMER;
+  channel_config.duty = 0;
+  channel_config.hpoint = 0;
+  ledc_channel_config(&channel_config);
+}
+
+bool buzzer_play(const buzzer_pattern_t* pattern) {
+  return xQueueSend(s_buzzer_queue, &pattern, 0) == pdTRUE;
+}
+
+void buzzer_stop() {
+  xQueueReset(s_buzzer_queue);
+
+  s_buzzer_stop_requested = true;
+  if (s_buzzer_player_task) {
+    xTaskNotifyGive(s_buzzer_player_task);
+  }
+}
+
+bool buzzer_stop_pattern(const buzzer_pattern_t* pattern) {
+  if (s_playing_pattern != pattern) {
+    return false;
+  }
+
+  buzzer_stop();
+  return true;
+}
+
+void play_queued_buzzer_pattern() {
+  s_buzzer_player_task = xTaskGetCurrentTaskHandle();
+
+  const buzzer_pattern_t* pattern;
+  xQueueReceive(s_buzzer_queue, &pattern, portMAX_DELAY);
+
+  // Discard a stop request for an earlier pattern
+  s_buzzer_stop_requested = false;
+  ulTaskNotifyTake(pdTRUE, 0);
+  s_playing_pattern = pattern;
+
+  for (uint8_t repeat = 0; repeat < pattern->num_repeats; ++repeat) {
+    for (uint8_t i = 0; i < pattern->num_notes; ++i) {
+      set_buzzer_note(pattern->notes[i].frequency_hz);
+
+      // Blocks rather than spins, and wakes up early on buzzer_stop()
+      TickType_t duration_ticks =
+          pattern->notes[i].duration_ms / portTICK_PERIOD_MS;
+      ulTaskNotifyTake(pdTRUE, duration_ticks ? duration_ticks : 1);
+
+      if (s_buzzer_stop_requested) {
+        s_playing_pattern = NULL;
+        set_buzzer_note(0);
+        return;
+      }
+    }
+  }
+
+  s_playing_pattern = NULL;
+  set_buzzer_note(0);
+}
+
+static void set_buzzer_note(uint16_t frequency_hz) {
+  if (frequency_hz) {
+    ledc_set_freq(BUZZER_LEDC_MODE, BUZZER_LEDC_TIMER, frequency_hz);
+  }
+
+  ledc_set_duty(BUZZER_LEDC_MODE, BUZZER_LEDC_CHANNEL,
+                frequency_hz ? BUZZER_LEDC_HALF_DUTY : 0);
+  ledc_update_duty(BUZZER_LEDC_MODE, BUZZER_LEDC_CHANNEL);
+}
@@ -5,6 +5,8 @@
 
 #include "Nixie_Display.h"
 #include "arduino_debug.h"
+#include "buzzer.h"
+#include "deferred_log.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/semphr.h"
 #include "tasks.h"
@@ -15,38 +17,74 @@ const int c_rotary_encoder_dt_pin = 17;
 const int c_rotary_encoder_clk_pin = 5;
 
 static const eeprom_option_t c_eeprom_options[] = {
-    // A NULL value for task_handle means that config will disallow vTaskSuspend
-    // and vTaskResume and treat all values as potential config values.
-    // A non-NULL task_handle will allow config to suspend the task if the
-    // entered value is zero and enable the task if the entered value is
-    // non-zero
+    // A non-NULL job is started if a non-zero value is entered. The job stops
+    // itself when it finds a value of zero
     {EEPROM_12_HOUR_FORMAT_ADDRESS, EEPROM_12_HOUR_FORMAT_DEFAULT,
-     EEPROM_12_HOUR_FORMAT_LOWER_BOUND, EEPROM_12_HOUR_FORMAT_UPPER_BOUND,
-     NULL},
+     EEPROM_12_HOUR_FORMAT_LOWER_BOUND, EEPROM_12_HOUR_FORMAT_UPPER_BOUND},
     {EEPROM_DATE_DISPLAY_FREQUENCY_ADDRESS,
      EEPROM_DATE_DISPLAY_FREQUENCY_DEFAULT,
      EEPROM_DATE_DISPLAY_FREQUENCY_LOWER_BOUND,
-     EEPROM_DATE_DISPLAY_FREQUENCY_UPPER_BOUND, &g_task_display_date_handle},
+     EEPROM_DATE_DISPLAY_FREQUENCY_UPPER_BOUND, &g_job_display_date},
     {EEPROM_SLOT_MACHINE_CYCLE_FREQUENCY_ADDRESS,
      EEPROM_SLOT_MACHINE_CYCLE_FREQUENCY_DEFAULT,
      EEPROM_SLOT_MACHINE_CYCLE_FREQUENCY_LOWER_BOUND,
-     EEPROM_SLOT_MACHINE_CYCLE_FREQUENCY_UPPER_BOUND, NULL},
+     EEPROM_SLOT_MACHINE_CYCLE_FREQUENCY_UPPER_BOUND},
     {EEPROM_SPECIAL_MODES_ADDRESS, EEPROM_SPECIAL_MODES_DEFAULT,
-     EEPROM_SPECIAL_MODES_LOWER_BOUND, EEPROM_SPECIAL_MODES_UPPER_BOUND,
-     &g_task_special_modes_handle},
+     EEPROM_SPECIAL_MODES_LOWER_BOUND, EEPROM_SPECIAL_MODES_UPPER_BOUND},
     {EEPROM_LOCAL_TEMPERATURE_DISPLAY_FREQUENCY_ADDRESS,
      EEPROM_LOCAL_TEMPERATURE_DISPLAY_FREQUENCY_DEFAULT,
      EEPROM_LOCAL_TEMPERATURE_DISPLAY_FREQUENCY_LOWER_BOUND,
      EEPROM_LOCAL_TEMPERATURE_DISPLAY_FREQUENCY_UPPER_BOUND,
-     &g_task_display_local_temperature_handle},
+     &g_job_fetch_local_temperature},
+    {EEPROM_DAY_BRIGHTNESS_ADDRESS, EEPROM_DAY_BRIGHTNESS_DEFAULT,
+     EEPROM_DAY_BRIGHTNESS_LOWER_BOUND, EEPROM_DAY_BRIGHTNESS_UPPER_BOUND},
+    {EEPROM_NIGHT_BRIGHTNESS_ADDRESS, EEPROM_NIGHT_BRIGHTNESS_DEFAULT,
+     EEPROM_NIGHT_BRIGHTNESS_LOWER_BOUND, EEPROM_NIGHT_BRIGHTNESS_UPPER_BOUND},
+    {EEPROM_NIGHT_START_HOUR_ADDRESS, EEPROM_NIGHT_START_HOUR_DEFAULT,
+     EEPROM_NIGHT_START_HOUR_LOWER_BOUND, EEPROM_NIGHT_START_HOUR_UPPER_BOUND},
+    {EEPROM_NIGHT_END_HOUR_ADDRESS, EEPROM_NIGHT_END_HOUR_DEFAULT,
+     EEPROM_NIGHT_END_HOUR_LOWER_BOUND, EEPROM_NIGHT_END_HOUR_UPPER_BOUND},
+    {EEPROM_TUBES_OFF_START_HOUR_ADDRESS, EEPROM_TUBES_OFF_START_HOUR_DEFAULT,
+     EEPROM_TUBES_OFF_START_HOUR_LOWER_BOUND,
+     EEPROM_TUBES_OFF_START_HOUR_UPPER_BOUND},
+    {EEPROM_TUBES_OFF_END_HOUR_ADDRESS, EEPROM_TUBES_OFF_END_HOUR_DEFAULT,
+     EEPROM_TUBES_OFF_END_HOUR_LOWER_BOUND,
+     EEPROM_TUBES_OFF_END_HOUR_UPPER_BOUND},
+    {EEPROM_TUBES_OFF_WAKE_DURATION_ADDRESS,
+     EEPROM_TUBES_OFF_WAKE_DURATION_DEFAULT,
+     EEPROM_TUBES_OFF_WAKE_DURATION_LOWER_BOUND,
+     EEPROM_TUBES_OFF_WAKE_DURATION_UPPER_BOUND},
+    {EEPROM_HOUR_CHIME_ADDRESS, EEPROM_HOUR_CHIME_DEFAULT,
+     EEPROM_HOUR_CHIME_LOWER_BOUND, EEPROM_HOUR_CHIME_UPPER_BOUND},
+    {EEPROM_SENSOR_HUB_ADDRESS, EEPROM_SENSOR_HUB_DEFAULT,
+     EEPROM_SENSOR_HUB_LOWER_BOUND, EEPROM_SENSOR_HUB_UPPER_BOUND},
+    {EEPROM_SOLAR_SCHEDULE_ADDRESS, EEPROM_SOLAR_SCHEDULE_DEFAULT,
+     EEPROM_SOLAR_SCHEDULE_LOWER_BOUND, EEPROM_SOLAR_SCHEDULE_UPPER_BOUND},
 };
 
 SemaphoreHandle_t g_semaphore_configure = xSemaphoreCreateBinary();
 
-static void set_eeprom_config_value(uint8_t option_number,
-                                    uint8_t initial_value, uint8_t lower_bound,
-                                    uint8_t upper_bound,
-                                    TaskHandle_t *task_handle);
+volatile int64_t g_rotary_encoder_switch_press_us = 0;
+
+struct configuration_frame_t {
+  coroutine_t co;
+  size_t option_index;
+  config_value_frame_t *value_frame;
+};
+
+struct config_value_frame_t {
+  coroutine_t co;
+  uint8_t option_number;
+  uint8_t lower_bound;
+  uint8_t upper_bound;
+  void (Nixie_Display::*display_handler)(uint8_t, uint8_t);
+  uint16_t encoder_state;
+  int counter;
+  int64_t deadline_us;
+};
+
+static void store_eeprom_config_value(const eeprom_option_t &option,
+                                      uint8_t config_value);
 
 void setup_eeprom() {
   EEPROM.begin(EEPROM_SIZE);
@@ -83,6 +121,25 @@ void default_initialize_config_values(bool force) {
     EEPROM.commit();
   }
 
+  // Options added after the EEPROM was initialized (or corrupted ones) are
+  // out of bounds. Default initialize only those
+  bool out_of_bounds_option = false;
+  for (size_t i = 0; i < NUM_ELEMENTS(c_eeprom_options); ++i) {
+    uint8_t value = EEPROM.read(c_eeprom_options[i].option_number);
+    if (value < c_eeprom_options[i].lower_bound ||
+        value > c_eeprom_options[i].upper_bound) {
+      debug_serial_printfln("Default intializing out of bounds option: %d",
+                            c_eeprom_options[i].option_number);
+      EEPROM.write(c_eeprom_options[i].option_number,
+                   c_eeprom_options[i].initial_value);
+      out_of_bounds_option = true;
+    }
+  }
+
+  if (out_of_bounds_option) {
+    EEPROM.commit();
+  }
+
   if (ARDUINO_DEBUG) {
     // Print out the value of each EEPROM address
     Serial.println("EEPROM default initialised");
@@ -94,87 +151,116 @@ void default_initialize_config_values(bool force) {
   }
 }
 
-void handle_configuration() {
+configuration_frame_t *start_configuration() {
+  return static_cast<configuration_frame_t *>(
+      coroutine_frame_alloc(sizeof(configuration_frame_t)));
+}
+
+coroutine_status_t handle_configuration(configuration_frame_t *frame) {
+  COROUTINE_BEGIN(&frame->co);
+
   debug_serial_println("Configuration Menu:");
   // Go through all the entries in EEPROM to configure them
-  // Note: for condition is "NUM_EEPROM_CONFIG_VALUES + 1" since i starts at 1,
-  // The first address fro config values
-  for (size_t i = 0; i < NUM_ELEMENTS(c_eeprom_options); ++i) {
-    set_eeprom_config_value(
-        c_eeprom_options[i].option_number, c_eeprom_options[i].initial_value,
-        c_eeprom_options[i].lower_bound, c_eeprom_options[i].upper_bound,
-        c_eeprom_options[i].task_handle);
+  for (frame->option_index = 0;
+       frame->option_index < NUM_ELEMENTS(c_eeprom_options);
+       ++frame->option_index) {
+    {
+      const eeprom_option_t &option = c_eeprom_options[frame->option_index];
+      uint8_t config_value = EEPROM.read(option.option_number);
+      debug_serial_printf("\tCurrent option: %d value: %d\n",
+                          option.option_number, config_value);
+      frame->value_frame = start_config_value(
+          option.option_number, config_value, option.lower_bound,
+          option.upper_bound, &Nixie_Display::display_config_value);
+    }
+    COROUTINE_CALL(&frame->co, get_config_value(frame->value_frame));
+
+    store_eeprom_config_value(c_eeprom_options[frame->option_index],
+                              finish_config_value(frame->value_frame));
   }
   EEPROM.commit();  // Still need to commit the changes
+
+  COROUTINE_END(&frame->co);
 }
 
-static void set_eeprom_config_value(uint8_t option_number,
-                                    uint8_t initial_value, uint8_t lower_bound,
-                                    uint8_t upper_bound,
-                                    TaskHandle_t *task_handle) {
-  uint8_t config_value = EEPROM.read(option_number);
-  debug_serial_printf("\tCurrent option: %d value: %d\n", option_number,
+static void store_eeprom_config_value(const eeprom_option_t &option,
+                                      uint8_t config_value) {
+  if (option.job && config_value && !is_job_active(option.job)) {
+    schedule_job(option.job, 0);
+  }
+
+  debug_serial_printf("\tStoring option: %d value: %d\n", option.option_number,
                       config_value);
-  config_value =
-      get_config_value(option_number, config_value, lower_bound, upper_bound,
-                       &Nixie_Display::display_config_value);
+  EEPROM.write(option.option_number, config_value);
+}
 
-  if (task_handle) {
-    config_value ? vTaskResume(*task_handle) : vTaskSuspend(*task_handle);
+int8_t read_rotary_encoder_step(uint16_t *state) {
+  // Debounce filtering for the rotary encoder. The callers poll once a tick
+  // (1 ms), so a step is a high sample followed by 3 low ones. Any longer and
+  // the detents of a fast turn run together
+  *state = (*state << 1) | digitalRead(c_rotary_encoder_clk_pin) | 0xfff0;
+
+  if (*state != 0xfff8) {
+    return 0;
   }
 
-  debug_serial_printf("\tStoring option: %d value: %d\n", option_number,
-                      config_value);
-  EEPROM.write(option_number, config_value);
+  *state = 0x0000;
+  return digitalRead(c_rotary_encoder_dt_pin) ? 1 : -1;
 }
 
-uint8_t get_config_value(uint8_t option_number, uint8_t initial_value,
-                         uint8_t lower_bound, uint8_t upper_bound,
-                         void (Nixie_Display::*display_handler)(uint8_t,
-                                                                uint8_t)) {
-  uint16_t state = 0;
-  int counter = initial_value;
-
-  buzzer_click();
-
-  while (true) {
-    // Feed the watchdog timer so that the MCU isn't reset
-    reset_watchdog_timer();
-
-    // Debounce filtering for the rotary encoder
-    state = (state << 1) | digitalRead(c_rotary_encoder_clk_pin) | 0xe000;
-
-    if (state == 0xf000) {
-      state = 0x0000;
-      if (digitalRead(c_rotary_encoder_dt_pin)) {
-        counter++;
-        // Maximum value 1 nixie tube can display
-        if (counter > upper_bound) {
-          counter = upper_bound;
-        }
-      } else {
-        counter--;
-        // Minimum value nixie tubes can display
-        if (counter < lower_bound) {
-          counter = lower_bound;
-        }
+config_value_frame_t *start_config_value(
+    uint8_t option_number, uint8_t initial_value, uint8_t lower_bound,
+    uint8_t upper_bound,
+    void (Nixie_Display::*display_handler)(uint8_t, uint8_t)) {
+  config_value_frame_t *frame = static_cast<config_value_frame_t *>(
+      coroutine_frame_alloc(sizeof(config_value_frame_t)));
+  frame->option_number = option_number;
+  frame->lower_bound = lower_bound;
+  frame->upper_bound = upper_bound;
+  frame->display_handler = display_handler;
+  frame->counter = initial_value;
+  return frame;
+}
+
+coroutine_status_t get_config_value(config_value_frame_t *frame) {
+  COROUTINE_BEGIN(&frame->co);
+
+  buzzer_play(&c_buzzer_pattern_click);
+
+  for (;;) {
+    if (int8_t step = read_rotary_encoder_step(&frame->encoder_state)) {
+      frame->counter += step;
+      // Maximum value 1 nixie tube can display
+      if (frame->counter > frame->upper_bound) {
+        frame->counter = frame->upper_bound;
+      }
+      // Minimum value nixie tubes can display
+      if (frame->counter < frame->lower_bound) {
+        frame->counter = frame->lower_bound;
       }
 
-      buzzer_click();
+      buzzer_play(&c_buzzer_pattern_click);
 
-      debug_serial_print(" -- Value: ");
-      debug_serial_println(counter);
+      deferred_printfln(" -- Value: %d", frame->counter);
     }
 
-    (Nixie_Display::get_instance().*display_handler)(option_number, counter);
+    (Nixie_Display::get_instance().*frame->display_handler)(
+        frame->option_number, frame->counter);
 
-    // Poll the semaphore to see if the encoder switch was pressed
-    if (xSemaphoreTake(g_semaphore_configure, 0) == pdTRUE) {
-      buzzer_click();
-      return counter;
+    if (coroutine_take_input_event()) {
+      buzzer_play(&c_buzzer_pattern_click);
+      break;
     }
 
-    // Yield to higher priority tasks, otherwise keep running
-    vTaskDelay(0);
+    // Poll the encoder every tick
+    COROUTINE_DELAY(&frame->co, frame->deadline_us, 1);
   }
+
+  COROUTINE_END(&frame->co);
+}
+
+uint8_t finish_config_value(config_value_frame_t *frame) {
+  uint8_t value = frame->counter;
+  coroutine_frame_free(frame);
+  return value;
 }
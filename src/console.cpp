@@ -0,0 +1,146 @@
+#include "console.h"
+
+#include <Arduino.h>
+#include <string.h>
+#include <time.h>
+
+#include "event_log.h"
+#include "supervisor.h"
+#include "util.h"
+
+typedef struct {
+  const char* name;
+  const char* help;
+  void (*handler)(const char* arguments);
+} console_command_t;
+
+static void command_help(const char* arguments);
+static void command_events(const char* arguments);
+static void command_heartbeats(const char* arguments);
+
+static const console_command_t c_console_commands[] = {
+    {"help", "List the commands", command_help},
+    {"events",
+     "Print the event log. \"events raw\" prints the records in hex for "
+     "tools/event_log_tool.py",
+     command_events},
+    {"heartbeats",
+     "Print each supervised task's deadline and longest time between "
+     "heartbeats",
+     command_heartbeats},
+};
+
+static uint32_t job_console(void* argument);
+
+static executor_job_t s_job_console = {job_console, NULL, "console", 5};
+
+// The line so far, kept between runs of the job
+static char s_line[CONSOLE_MAX_LINE_LENGTH];
+static size_t s_length = 0;
+
+static void run_console_command(char* line) {
+  char* arguments = strchr(line, ' ');
+  if (arguments) {
+    *arguments++ = '\0';
+  } else {
+    arguments = line + strlen(line);
+  }
+
+  for (size_t i = 0; i < NUM_ELEMENTS(c_console_commands); ++i) {
+    if (strcmp(line, c_console_commands[i].name) == 0) {
+      c_console_commands[i].handler(arguments);
+      return;
+    }
+  }
+
+  Serial.printf("Unknown command: %s. Try \"help\"\n", line);
+}
+
+void setup_console(executor_t* executor) {
+  add_job(executor, &s_job_console, EXECUTOR_JOB_STOP);
+
+  // Called from the UART's event task
+  Serial.onReceive([]() { schedule_job(&s_job_console, 0); });
+}
+
+static uint32_t job_console(void* argument) {
+  while (Serial.available()) {
+    int c = Serial.read();
+    if (c == '\r' || c == '\n') {
+      if (s_length) {
+        s_line[s_length] = '\0';
+        run_console_command(s_line);
+        s_length = 0;
+      }
+    } else if (s_length < sizeof(s_line) - 1) {
+      s_line[s_length++] = c;
+    }
+  }
+
+  return EXECUTOR_JOB_STOP;
+}
+
+static void command_help(const char* arguments) {
+  for (size_t i = 0; i < NUM_ELEMENTS(c_console_commands); ++i) {
+    Serial.printf("%s\t%s\n", c_console_commands[i].name,
+                  c_console_commands[i].help);
+  }
+}
+
+static void print_event(const event_log_record_t& record, void* context) {
+  bool raw = *static_cast<bool*>(context);
+
+  if (raw) {
+    const uint8_t* bytes = reinterpret_cast<const uint8_t*>(&record);
+    for (size_t i = 0; i < sizeof(record); ++i) {
+      Serial.printf("%02x", bytes[i]);
+    }
+    Serial.println();
+    return;
+  }
+
+  if (record.timestamp >= EVENT_LOG_MIN_EPOCH) {
+    time_t timestamp = record.timestamp;
+    struct tm time_info;
+    char time_string[32];
+    localtime_r(&timestamp, &time_info);
+    strftime(time_string, sizeof(time_string), "%Y-%m-%d %H:%M:%S",
+             &time_info);
+    Serial.print(time_string);
+  } else {
+    Serial.printf("boot+%us", record.timestamp);
+  }
+
+  const char* name = get_event_name(record.event_id);
+  if (name) {
+    Serial.printf("\t%s", name);
+  } else {
+    Serial.printf("\tevent_%u", record.event_id);
+  }
+  Serial.printf("\t%d\t%d\n", record.args[0], record.args[1]);
+}
+
+static void command_events(const char* arguments) {
+  bool raw = strcmp(arguments, "raw") == 0;
+
+  // Include the events that are still buffered
+  flush_event_log();
+
+  size_t num_records = read_event_log(print_event, &raw);
+  Serial.printf("%u events\n", num_records);
+}
+
+static void command_heartbeats(const char* arguments) {
+  for (size_t i = 0; i < NUM_HEARTBEATS; ++i) {
+    heartbeat_id_t id = (heartbeat_id_t)i;
+    heartbeat_stats_t stats;
+    if (!get_heartbeat_stats(id, &stats)) {
+      Serial.printf("%s\tnot registered\n", get_heartbeat_name(id));
+      continue;
+    }
+
+    Serial.printf("%s\tdeadline: %u ms\tmax gap: %lld ms\tlast: %lld ms ago\n",
+                  get_heartbeat_name(id), stats.deadline_ms,
+                  stats.max_gap_us / 1000, stats.gap_us / 1000);
+  }
+}
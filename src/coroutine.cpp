@@ -0,0 +1,112 @@
+#include "coroutine.h"
+
+#include <string.h>
+
+#include "Nixie_Display.h"
+#include "buzzer.h"
+#include "supervisor.h"
+
+// Every frame is preceded by its size, so frames can be freed in order
+#define COROUTINE_FRAME_ALIGNMENT 8
+#define COROUTINE_FRAME_HEADER_SIZE COROUTINE_FRAME_ALIGNMENT
+
+static uint8_t s_arena[COROUTINE_ARENA_SIZE]
+    __attribute__((aligned(COROUTINE_FRAME_ALIGNMENT)));
+static size_t s_arena_top = 0;
+
+// Only touched by the scheduler's task
+static SemaphoreHandle_t s_input_event = NULL;
+static int64_t s_next_deadline_us = INT64_MAX;
+static bool s_input_event_pending = false;
+
+bool coroutine_wait_until(int64_t deadline_us) {
+  if (esp_timer_get_time() >= deadline_us) {
+    return true;
+  }
+
+  if (deadline_us < s_next_deadline_us) {
+    s_next_deadline_us = deadline_us;
+  }
+  return false;
+}
+
+bool coroutine_take_input_event() {
+  // Input events always wake the scheduler, so there is nothing to record
+  bool pending = s_input_event_pending;
+  s_input_event_pending = false;
+  return pending;
+}
+
+void coroutine_clear_input_event() {
+  s_input_event_pending = false;
+  xSemaphoreTake(s_input_event, 0);
+}
+
+bool coroutine_take_display() {
+  if (xSemaphoreTake(Nixie_Display::display_mutex, 0) == pdTRUE) {
+    return true;
+  }
+
+  coroutine_wait_until(esp_timer_get_time() +
+                       COROUTINE_DISPLAY_POLL_MS * 1000);
+  return false;
+}
+
+void* coroutine_frame_alloc(size_t size) {
+  size_t frame_size = (size + COROUTINE_FRAME_ALIGNMENT - 1) &
+                      ~(size_t)(COROUTINE_FRAME_ALIGNMENT - 1);
+  configASSERT(s_arena_top + COROUTINE_FRAME_HEADER_SIZE + frame_size <=
+               sizeof(s_arena));
+
+  uint8_t* header = s_arena + s_arena_top;
+  memcpy(header, &frame_size, sizeof(frame_size));
+  uint8_t* frame = header + COROUTINE_FRAME_HEADER_SIZE;
+  memset(frame, 0, frame_size);
+
+  s_arena_top += COROUTINE_FRAME_HEADER_SIZE + frame_size;
+  return frame;
+}
+
+void coroutine_frame_free(void* frame) {
+  uint8_t* header = static_cast<uint8_t*>(frame) - COROUTINE_FRAME_HEADER_SIZE;
+  size_t frame_size;
+  memcpy(&frame_size, header, sizeof(frame_size));
+  configASSERT(header + COROUTINE_FRAME_HEADER_SIZE + frame_size ==
+               s_arena + s_arena_top);
+
+  s_arena_top = header - s_arena;
+}
+
+void run_coroutine_scheduler(const coroutine_root_t* roots, size_t num_roots,
+                             SemaphoreHandle_t input_event) {
+  s_input_event = input_event;
+
+  for (;;) {
+    heartbeat();
+
+    s_next_deadline_us = INT64_MAX;
+    for (size_t i = 0; i < num_roots; ++i) {
+      roots[i].function(roots[i].frame);
+    }
+
+    // Sleep until the earliest deadline or an input event, or until the next
+    // heartbeat is due
+    TickType_t timeout = get_heartbeat_timeout();
+    if (s_next_deadline_us != INT64_MAX) {
+      const int64_t tick_us = portTICK_PERIOD_MS * 1000;
+      int64_t wait_us = s_next_deadline_us - esp_timer_get_time();
+      TickType_t deadline_timeout =
+          wait_us > 0 ? (wait_us + tick_us - 1) / tick_us : 0;
+      if (deadline_timeout < timeout) {
+        timeout = deadline_timeout;
+      }
+    }
+
+    // A press while an alarm or countdown timer is sounding only silences
+    // it, so it can't also open the menu or act on the flow that is running
+    if (xSemaphoreTake(s_input_event, timeout) == pdTRUE &&
+        !buzzer_stop_pattern(&c_buzzer_pattern_alarm)) {
+      s_input_event_pending = true;
+    }
+  }
+}
@@ -0,0 +1,101 @@
+#include "countdown_timers.h"
+
+#include <Arduino.h>
+#include <esp_timer.h>
+
+#include "arduino_debug.h"
+#include "buzzer.h"
+#include "deferred_log.h"
+#include "freertos/FreeRTOS.h"
+#include "util.h"
+
+typedef struct {
+  esp_timer_handle_t handle;
+  int64_t deadline_us;  // Zero when the timer is not running
+} countdown_timer_t;
+
+static countdown_timer_t s_countdown_timers[MAX_COUNTDOWN_TIMERS];
+static portMUX_TYPE s_countdown_timers_mux = portMUX_INITIALIZER_UNLOCKED;
+
+static void on_countdown_timer_expired(void* arg);
+
+void setup_countdown_timers() {
+  for (size_t i = 0; i < MAX_COUNTDOWN_TIMERS; ++i) {
+    esp_timer_create_args_t timer_args = {};
+    timer_args.callback = on_countdown_timer_expired;
+    timer_args.arg = &s_countdown_timers[i];
+    timer_args.name = "countdown_timer";
+    esp_timer_create(&timer_args, &s_countdown_timers[i].handle);
+    s_countdown_timers[i].deadline_us = 0;
+  }
+}
+
+bool start_countdown_timer(uint32_t duration_s) {
+  int64_t duration_us =
+      (int64_t)duration_s * 1000 * MILLISECOND_TO_MICROSECONDS;
+
+  for (size_t i = 0; i < MAX_COUNTDOWN_TIMERS; ++i) {
+    countdown_timer_t* timer = &s_countdown_timers[i];
+
+    portENTER_CRITICAL(&s_countdown_timers_mux);
+    bool available = !timer->deadline_us;
+    if (available) {
+      timer->deadline_us = esp_timer_get_time() + duration_us;
+    }
+    portEXIT_CRITICAL(&s_countdown_timers_mux);
+
+    if (available) {
+      esp_timer_start_once(timer->handle, duration_us);
+      debug_serial_printfln("Countdown timer %u started: %u s", i, duration_s);
+      return true;
+    }
+  }
+
+  return false;
+}
+
+void cancel_countdown_timers() {
+  for (size_t i = 0; i < MAX_COUNTDOWN_TIMERS; ++i) {
+    esp_timer_stop(s_countdown_timers[i].handle);
+
+    portENTER_CRITICAL(&s_countdown_timers_mux);
+    s_countdown_timers[i].deadline_us = 0;
+    portEXIT_CRITICAL(&s_countdown_timers_mux);
+  }
+}
+
+bool get_next_countdown_timer_remaining(int64_t* remaining_us) {
+  int64_t next_deadline_us = 0;
+
+  portENTER_CRITICAL(&s_countdown_timers_mux);
+  for (size_t i = 0; i < MAX_COUNTDOWN_TIMERS; ++i) {
+    int64_t deadline_us = s_countdown_timers[i].deadline_us;
+    if (deadline_us && (!next_deadline_us || deadline_us < next_deadline_us)) {
+      next_deadline_us = deadline_us;
+    }
+  }
+  portEXIT_CRITICAL(&s_countdown_timers_mux);
+
+  if (!next_deadline_us) {
+    return false;
+  }
+
+  *remaining_us = next_deadline_us - esp_timer_get_time();
+  if (*remaining_us < 0) {
+    *remaining_us = 0;
+  }
+
+  return true;
+}
+
+static void on_countdown_timer_expired(void* arg) {
+  countdown_timer_t* timer = static_cast<countdown_timer_t*>(arg);
+
+  portENTER_CRITICAL(&s_countdown_timers_mux);
+  timer->deadline_us = 0;
+  portEXIT_CRITICAL(&s_countdown_timers_mux);
+
+  deferred_printfln("Countdown timer %u expired",
+                    (unsigned)(timer - s_countdown_timers));
+  buzzer_play(&c_buzzer_pattern_alarm);
+}
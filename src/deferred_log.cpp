@@ -0,0 +1,150 @@
+#include "deferred_log.h"
+
+#include <Arduino.h>
+#include <stdio.h>
+
+#include <atomic>
+
+#include "arduino_debug.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#define DEFERRED_LOG_RING_MASK (DEFERRED_LOG_RING_SIZE - 1)
+
+static_assert((DEFERRED_LOG_RING_SIZE & DEFERRED_LOG_RING_MASK) == 0,
+              "DEFERRED_LOG_RING_SIZE must be a power of 2");
+
+// A bounded multi-producer ring (Vyukov's). Each slot's sequence says whose
+// turn it is: equal to a position, the slot is free for the producer claiming
+// that position. One past it, the message is ready for the consumer. The
+// sequence is stored less the slot index so that the zero initialized ring is
+// all free, with no setup needed before the first push
+typedef struct {
+  std::atomic<uint32_t> sequence;
+  const char* format;
+  uint32_t args[DEFERRED_LOG_MAX_ARGS];
+} deferred_log_entry_t;
+
+static deferred_log_entry_t s_ring[DEFERRED_LOG_RING_SIZE];
+static std::atomic<uint32_t> s_enqueue_position(0);
+static uint32_t s_dequeue_position = 0;  // Only used by the log task
+
+static std::atomic<uint32_t> s_dropped(0);
+
+// Set by the log task just before it sleeps. Producers only notify the task
+// when they clear it, so a burst of messages costs one wake up. Clear until
+// the task starts, since there is nobody to notify
+static std::atomic<bool> s_log_task_idle(false);
+static TaskHandle_t s_log_task = NULL;
+
+static inline uint32_t get_sequence(const deferred_log_entry_t& entry,
+                                    uint32_t index) {
+  return entry.sequence.load(std::memory_order_acquire) + index;
+}
+
+static inline void set_sequence(deferred_log_entry_t* entry, uint32_t index,
+                                uint32_t sequence) {
+  entry->sequence.store(sequence - index, std::memory_order_release);
+}
+
+void IRAM_ATTR deferred_log_push(const char* format,
+                                 const uint32_t args[DEFERRED_LOG_MAX_ARGS]) {
+  uint32_t position = s_enqueue_position.load(std::memory_order_relaxed);
+  deferred_log_entry_t* entry;
+  uint32_t index;
+  for (;;) {
+    index = position & DEFERRED_LOG_RING_MASK;
+    entry = &s_ring[index];
+    int32_t difference = get_sequence(*entry, index) - position;
+    if (difference == 0) {
+      if (s_enqueue_position.compare_exchange_weak(
+              position, position + 1, std::memory_order_relaxed)) {
+        break;
+      }
+      // position now holds the other producer's claim
+    } else if (difference < 0) {
+      // The log task hasn't caught up with the previous lap
+      s_dropped.fetch_add(1, std::memory_order_relaxed);
+      return;
+    } else {
+      position = s_enqueue_position.load(std::memory_order_relaxed);
+    }
+  }
+
+  entry->format = format;
+  for (size_t i = 0; i < DEFERRED_LOG_MAX_ARGS; ++i) {
+    entry->args[i] = args[i];
+  }
+  set_sequence(entry, index, position + 1);
+
+  // Pairs with the log task's fence between setting the idle flag and its
+  // last look at the ring: either it sees this message or this sees the flag
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (s_log_task_idle.load(std::memory_order_relaxed) &&
+      s_log_task_idle.exchange(false)) {
+    // The log task runs at a low priority, so there's no point in yielding
+    // to it from an ISR
+    if (xPortInIsrContext()) {
+      vTaskNotifyGiveFromISR(s_log_task, NULL);
+    } else {
+      xTaskNotifyGive(s_log_task);
+    }
+  }
+}
+
+uint32_t get_deferred_log_dropped() {
+  return s_dropped.load(std::memory_order_relaxed);
+}
+
+static bool is_message_ready() {
+  uint32_t index = s_dequeue_position & DEFERRED_LOG_RING_MASK;
+  return get_sequence(s_ring[index], index) == s_dequeue_position + 1;
+}
+
+static void print_message() {
+  uint32_t index = s_dequeue_position & DEFERRED_LOG_RING_MASK;
+  deferred_log_entry_t* entry = &s_ring[index];
+
+  const char* format = entry->format;
+  uint32_t args[DEFERRED_LOG_MAX_ARGS];
+  for (size_t i = 0; i < DEFERRED_LOG_MAX_ARGS; ++i) {
+    args[i] = entry->args[i];
+  }
+
+  // Hand the slot back before the slow part
+  set_sequence(entry, index, s_dequeue_position + DEFERRED_LOG_RING_SIZE);
+  ++s_dequeue_position;
+
+  // Integers and pointers are all passed as 32-bit words on the ESP32, so the
+  // raw arguments can be handed to any conversion the format asks for
+  char line[DEFERRED_LOG_MAX_LINE_LENGTH];
+  snprintf(line, sizeof(line), format, args[0], args[1], args[2], args[3]);
+  debug_serial_println(line);
+}
+
+void run_deferred_log() {
+  s_log_task = xTaskGetCurrentTaskHandle();
+  uint32_t reported_dropped = 0;
+
+  for (;;) {
+    while (is_message_ready()) {
+      print_message();
+    }
+
+    uint32_t dropped = get_deferred_log_dropped();
+    if (dropped != reported_dropped) {
+      debug_serial_printfln("%u deferred log messages dropped",
+                            dropped - reported_dropped);
+      reported_dropped = dropped;
+    }
+
+    s_log_task_idle.store(true, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    // A message pushed before the flag was set didn't notify. If one is
+    // there, take the flag back, unless a producer got to it first and is
+    // notifying
+    if (!is_message_ready() || !s_log_task_idle.exchange(false)) {
+      ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    }
+  }
+}
@@ -0,0 +1,380 @@
+#include "event_log.h"
+
+#include <esp_partition.h>
+#include <esp_timer.h>
+#include <stddef.h>
+#include <string.h>
+#include <time.h>
+
+#include "arduino_debug.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "util.h"
+
+#define EVENT_LOG_RECORD_SIZE sizeof(event_log_record_t)
+#define EVENT_LOG_RECORDS_PER_PAGE (EVENT_LOG_PAGE_SIZE / EVENT_LOG_RECORD_SIZE)
+
+typedef struct {
+  uint32_t magic;
+  uint32_t sequence;
+  uint16_t version;
+  uint16_t record_size;
+  uint16_t reserved;
+  uint16_t crc;
+} event_log_header_t;
+
+// The header takes the first record slot, and records never straddle a page
+static_assert(sizeof(event_log_header_t) == 16, "Unexpected header size");
+static_assert(sizeof(event_log_record_t) == 16, "Unexpected record size");
+
+// Indexed by event_id_t
+static const char* const c_event_names[] = {
+    NULL,
+    "boot",
+    "log_dropped",
+    "wifi_connect_failed",
+    "ntp_synced",
+    "ntp_sync_failed",
+    "weather_http_error",
+    "task_stalled",
+};
+
+static uint32_t job_flush_event_log(void* argument);
+
+static executor_job_t s_job_flush_event_log = {job_flush_event_log, NULL,
+                                               "flush_event_log", 11};
+
+// Events waiting to be written. Shared by all tasks
+static portMUX_TYPE s_buffer_mux = portMUX_INITIALIZER_UNLOCKED;
+static event_log_record_t s_buffer[EVENT_LOG_BUFFER_RECORDS];
+static size_t s_num_buffered = 0;
+static uint32_t s_num_dropped = 0;
+// Records that would finish the page being written
+static size_t s_page_room = EVENT_LOG_RECORDS_PER_PAGE;
+
+// The flash side of the log. Only touched with the mutex held
+static SemaphoreHandle_t s_flash_mutex = xSemaphoreCreateMutex();
+static const esp_partition_t* s_partition = NULL;
+static size_t s_num_sectors = 0;
+static size_t s_sector = 0;
+static uint32_t s_sequence = 0;
+static size_t s_write_offset = 0;  // Within the partition
+static event_log_record_t s_flush_records[EVENT_LOG_BUFFER_RECORDS + 1];
+
+static uint16_t crc16_ccitt(const void* data, size_t size) {
+  const uint8_t* bytes = static_cast<const uint8_t*>(data);
+  uint16_t crc = 0xffff;
+  for (size_t i = 0; i < size; ++i) {
+    crc ^= (uint16_t)bytes[i] << 8;
+    for (int bit = 0; bit < 8; ++bit) {
+      crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+    }
+  }
+  return crc;
+}
+
+static bool is_erased(const void* data, size_t size) {
+  const uint8_t* bytes = static_cast<const uint8_t*>(data);
+  for (size_t i = 0; i < size; ++i) {
+    if (bytes[i] != 0xff) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Sequence numbers are compared with serial number arithmetic, so they may
+// wrap
+static bool is_sequence_after(uint32_t sequence, uint32_t other_sequence) {
+  return (int32_t)(sequence - other_sequence) > 0;
+}
+
+static bool is_record_valid(const event_log_record_t& record) {
+  return record.crc ==
+         crc16_ccitt(&record, offsetof(event_log_record_t, crc));
+}
+
+static bool read_sector_header(size_t sector, event_log_header_t* header) {
+  return esp_partition_read(s_partition, sector * EVENT_LOG_SECTOR_SIZE,
+                            header, sizeof(*header)) == ESP_OK &&
+         header->magic == EVENT_LOG_MAGIC &&
+         header->version == EVENT_LOG_VERSION &&
+         header->record_size == EVENT_LOG_RECORD_SIZE &&
+         header->crc ==
+             crc16_ccitt(header, offsetof(event_log_header_t, crc));
+}
+
+// Erase the sector and make it the current one
+static bool start_sector(size_t sector, uint32_t sequence) {
+  size_t sector_offset = sector * EVENT_LOG_SECTOR_SIZE;
+
+  // The header is written last, so an interrupted erase is erased again
+  event_log_header_t header = {EVENT_LOG_MAGIC, sequence, EVENT_LOG_VERSION,
+                               EVENT_LOG_RECORD_SIZE, 0xffff, 0};
+  header.crc = crc16_ccitt(&header, offsetof(event_log_header_t, crc));
+
+  esp_err_t err = esp_partition_erase_range(s_partition, sector_offset,
+                                            EVENT_LOG_SECTOR_SIZE);
+  if (err == ESP_OK) {
+    err = esp_partition_write(s_partition, sector_offset, &header,
+                              sizeof(header));
+  }
+  if (err != ESP_OK) {
+    debug_serial_printfln("Failed to start event log sector %u: %s", sector,
+                          esp_err_to_name(err));
+    return false;
+  }
+
+  s_sector = sector;
+  s_sequence = sequence;
+  s_write_offset = sector_offset + sizeof(header);
+  return true;
+}
+
+// Offset just past the last programmed record slot in the sector, or the end
+// of the sector if it is full. Scanned back from the end, since a failed write
+// leaves erased slots before the records written after it
+static size_t find_sector_end(size_t sector) {
+  size_t sector_start =
+      sector * EVENT_LOG_SECTOR_SIZE + sizeof(event_log_header_t);
+  size_t offset = (sector + 1) * EVENT_LOG_SECTOR_SIZE;
+
+  for (; offset > sector_start; offset -= EVENT_LOG_RECORD_SIZE) {
+    // A slot that can't be read counts as used, so it is never programmed
+    event_log_record_t record;
+    if (esp_partition_read(s_partition, offset - EVENT_LOG_RECORD_SIZE,
+                           &record, sizeof(record)) != ESP_OK ||
+        !is_erased(&record, sizeof(record))) {
+      break;
+    }
+  }
+
+  return offset;
+}
+
+// Each write programs part of one page and the next picks up where it left
+// off, so a flush of s_page_room records ends on a page boundary and every
+// page after it is written whole
+static void write_records(const event_log_record_t* records,
+                          size_t num_records) {
+  size_t sector_end = (s_sector + 1) * EVENT_LOG_SECTOR_SIZE;
+
+  for (size_t i = 0; i < num_records;) {
+    if (s_write_offset + EVENT_LOG_RECORD_SIZE > sector_end) {
+      // The oldest sector is overwritten
+      if (!start_sector((s_sector + 1) % s_num_sectors, s_sequence + 1)) {
+        return;
+      }
+      sector_end = (s_sector + 1) * EVENT_LOG_SECTOR_SIZE;
+    }
+
+    size_t count = num_records - i;
+    size_t page_end =
+        (s_write_offset / EVENT_LOG_PAGE_SIZE + 1) * EVENT_LOG_PAGE_SIZE;
+    size_t room = (page_end - s_write_offset) / EVENT_LOG_RECORD_SIZE;
+    if (count > room) {
+      count = room;
+    }
+
+    esp_err_t err = esp_partition_write(s_partition, s_write_offset,
+                                        &records[i],
+                                        count * EVENT_LOG_RECORD_SIZE);
+    // The slots are used up even if the write failed, so that they are never
+    // programmed twice
+    s_write_offset += count * EVENT_LOG_RECORD_SIZE;
+    if (err != ESP_OK) {
+      debug_serial_printfln("Failed to write the event log: %s",
+                            esp_err_to_name(err));
+      return;
+    }
+
+    i += count;
+  }
+}
+
+// Called with the flash mutex held, after s_write_offset moves
+static void update_page_room() {
+  size_t offset = s_write_offset;
+  if (offset % EVENT_LOG_SECTOR_SIZE == 0) {
+    // The next sector's header comes first
+    offset += sizeof(event_log_header_t);
+  }
+  size_t room = (EVENT_LOG_PAGE_SIZE - offset % EVENT_LOG_PAGE_SIZE) /
+                EVENT_LOG_RECORD_SIZE;
+
+  portENTER_CRITICAL(&s_buffer_mux);
+  s_page_room = room;
+  portEXIT_CRITICAL(&s_buffer_mux);
+}
+
+static void make_record(event_log_record_t* record, event_id_t event_id,
+                        int32_t arg0, int32_t arg1) {
+  time_t now = time(NULL);
+  record->timestamp = now >= EVENT_LOG_MIN_EPOCH
+                          ? (uint32_t)now
+                          : (uint32_t)(esp_timer_get_time() / 1000000);
+  record->args[0] = arg0;
+  record->args[1] = arg1;
+  record->event_id = event_id;
+  record->crc = crc16_ccitt(record, offsetof(event_log_record_t, crc));
+}
+
+void setup_event_log(executor_t* executor) {
+  add_job(executor, &s_job_flush_event_log, EXECUTOR_JOB_STOP);
+
+  const esp_partition_t* partition = esp_partition_find_first(
+      ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY,
+      EVENT_LOG_PARTITION_LABEL);
+  if (!partition || partition->size < 2 * EVENT_LOG_SECTOR_SIZE) {
+    debug_serial_println(
+        "No event log partition. Events are not kept");
+    return;
+  }
+
+  xSemaphoreTake(s_flash_mutex, portMAX_DELAY);
+
+  s_partition = partition;
+  s_num_sectors = partition->size / EVENT_LOG_SECTOR_SIZE;
+
+  // The current sector has the latest sequence number
+  bool found = false;
+  for (size_t sector = 0; sector < s_num_sectors; ++sector) {
+    event_log_header_t header;
+    if (read_sector_header(sector, &header) &&
+        (!found || is_sequence_after(header.sequence, s_sequence))) {
+      found = true;
+      s_sector = sector;
+      s_sequence = header.sequence;
+    }
+  }
+
+  if (found) {
+    s_write_offset = find_sector_end(s_sector);
+  } else {
+    debug_serial_println("Formatting the event log");
+    start_sector(0, 1);
+  }
+  update_page_room();
+
+  debug_serial_printfln("Event log: sector %u of %u, sequence %u, offset %u",
+                        s_sector, s_num_sectors, s_sequence,
+                        s_write_offset - s_sector * EVENT_LOG_SECTOR_SIZE);
+
+  xSemaphoreGive(s_flash_mutex);
+
+  // Events logged during boot are written straight away, in case the boot
+  // doesn't get much further
+  portENTER_CRITICAL(&s_buffer_mux);
+  bool buffered = s_num_buffered > 0;
+  portEXIT_CRITICAL(&s_buffer_mux);
+  if (buffered) {
+    schedule_job(&s_job_flush_event_log, 0);
+  }
+}
+
+void log_event(event_id_t event_id, int32_t arg0, int32_t arg1) {
+  event_log_record_t record;
+  make_record(&record, event_id, arg0, arg1);
+
+  portENTER_CRITICAL(&s_buffer_mux);
+  if (s_num_buffered < EVENT_LOG_BUFFER_RECORDS) {
+    s_buffer[s_num_buffered++] = record;
+  } else {
+    ++s_num_dropped;
+  }
+  size_t num_buffered = s_num_buffered;
+  size_t page_room = s_page_room;
+  portEXIT_CRITICAL(&s_buffer_mux);
+
+  // Before setup, the flush is scheduled by setup_event_log()
+  if (!s_job_flush_event_log.executor) {
+    return;
+  }
+
+  if (num_buffered >= page_room) {
+    schedule_job(&s_job_flush_event_log, 0);
+  } else if (!is_job_active(&s_job_flush_event_log)) {
+    schedule_job(&s_job_flush_event_log, EVENT_LOG_FLUSH_DELAY_MS);
+  }
+}
+
+void flush_event_log() {
+  xSemaphoreTake(s_flash_mutex, portMAX_DELAY);
+
+  portENTER_CRITICAL(&s_buffer_mux);
+  size_t num_records = s_num_buffered;
+  memcpy(s_flush_records, s_buffer, num_records * sizeof(s_buffer[0]));
+  s_num_buffered = 0;
+  uint32_t num_dropped = s_num_dropped;
+  s_num_dropped = 0;
+  portEXIT_CRITICAL(&s_buffer_mux);
+
+  if (num_dropped) {
+    make_record(&s_flush_records[num_records++], EVENT_LOG_DROPPED,
+                num_dropped, 0);
+  }
+
+  if (s_partition && num_records) {
+    write_records(s_flush_records, num_records);
+    update_page_room();
+  }
+
+  xSemaphoreGive(s_flash_mutex);
+}
+
+static uint32_t job_flush_event_log(void* argument) {
+  flush_event_log();
+
+  // Events logged during the flush
+  portENTER_CRITICAL(&s_buffer_mux);
+  bool buffered = s_num_buffered > 0;
+  portEXIT_CRITICAL(&s_buffer_mux);
+
+  return buffered ? EVENT_LOG_FLUSH_DELAY_MS : EXECUTOR_JOB_STOP;
+}
+
+size_t read_event_log(event_log_visitor_t visitor, void* context) {
+  if (!s_partition) {
+    return 0;
+  }
+
+  xSemaphoreTake(s_flash_mutex, portMAX_DELAY);
+
+  // The sector after the current one is the oldest
+  size_t num_records = 0;
+  for (size_t i = 1; i <= s_num_sectors; ++i) {
+    size_t sector = (s_sector + i) % s_num_sectors;
+    event_log_header_t header;
+    if (!read_sector_header(sector, &header)) {
+      continue;
+    }
+
+    // Erased slots left by a failed write are skipped, not taken as the end
+    size_t sector_end = sector == s_sector
+                            ? s_write_offset
+                            : (sector + 1) * EVENT_LOG_SECTOR_SIZE;
+    for (size_t offset =
+             sector * EVENT_LOG_SECTOR_SIZE + sizeof(event_log_header_t);
+         offset < sector_end; offset += EVENT_LOG_RECORD_SIZE) {
+      event_log_record_t record;
+      if (esp_partition_read(s_partition, offset, &record, sizeof(record)) !=
+          ESP_OK) {
+        break;
+      }
+
+      if (!is_erased(&record, sizeof(record)) && is_record_valid(record)) {
+        visitor(record, context);
+        ++num_records;
+      }
+    }
+  }
+
+  xSemaphoreGive(s_flash_mutex);
+
+  return num_records;
+}
+
+const char* get_event_name(uint16_t event_id) {
+  return event_id < NUM_ELEMENTS(c_event_names) ? c_event_names[event_id]
+                                                 : NULL;
+}
@@ -0,0 +1,293 @@
+#include "executor.h"
+
+#include <esp_timer.h>
+#include <string.h>
+
+#include "supervisor.h"
+
+#define EXECUTOR_READY_LEVEL EXECUTOR_WHEEL_LEVELS
+#define EXECUTOR_TICK_US (EXECUTOR_TICK_MS * 1000)
+
+static uint32_t get_current_tick() {
+  return esp_timer_get_time() / EXECUTOR_TICK_US;
+}
+
+static uint32_t ms_to_ticks(uint32_t ms) {
+  uint32_t ticks = (ms + EXECUTOR_TICK_MS - 1) / EXECUTOR_TICK_MS;
+  return ticks ? ticks : 1;
+}
+
+static uint64_t rotate_right(uint64_t value, unsigned shift) {
+  return (value >> shift) | (value << ((64 - shift) & 63));
+}
+
+// Ticks are compared with serial number arithmetic, so they may wrap
+static bool is_tick_before(uint32_t tick, uint32_t other_tick) {
+  return (int32_t)(tick - other_tick) < 0;
+}
+
+static void add_to_ready_list(executor_t* executor, executor_job_t* job) {
+  executor_job_t** link = &executor->ready;
+  while (*link && (*link)->priority >= job->priority) {
+    link = &(*link)->next;
+  }
+
+  job->next = *link;
+  *link = job;
+  job->wheel_level = EXECUTOR_READY_LEVEL;
+}
+
+static void insert_job(executor_t* executor, executor_job_t* job) {
+  uint32_t delta = job->expiry_tick - executor->current_tick;
+  uint32_t slot_tick = job->expiry_tick;
+  unsigned level = 0;
+
+  if (delta >= EXECUTOR_WHEEL_SPAN_TICKS) {
+    // Parked until the top level comes round again
+    slot_tick = executor->current_tick + EXECUTOR_WHEEL_SPAN_TICKS - 1;
+    level = EXECUTOR_WHEEL_LEVELS - 1;
+  } else {
+    while (level + 1 < EXECUTOR_WHEEL_LEVELS &&
+           delta >= ((uint32_t)1 << (EXECUTOR_WHEEL_SLOT_BITS * (level + 1)))) {
+      ++level;
+    }
+  }
+
+  unsigned slot = (slot_tick >> (EXECUTOR_WHEEL_SLOT_BITS * level)) &
+                  (EXECUTOR_WHEEL_SLOTS - 1);
+  job->next = executor->wheel[level][slot];
+  executor->wheel[level][slot] = job;
+  executor->occupied[level] |= (uint64_t)1 << slot;
+  job->wheel_level = level;
+  job->wheel_slot = slot;
+}
+
+static void remove_job(executor_t* executor, executor_job_t* job) {
+  executor_job_t** link =
+      job->wheel_level == EXECUTOR_READY_LEVEL
+          ? &executor->ready
+          : &executor->wheel[job->wheel_level][job->wheel_slot];
+  while (*link && *link != job) {
+    link = &(*link)->next;
+  }
+  if (*link) {
+    *link = job->next;
+  }
+
+  if (job->wheel_level != EXECUTOR_READY_LEVEL &&
+      !executor->wheel[job->wheel_level][job->wheel_slot]) {
+    executor->occupied[job->wheel_level] &= ~((uint64_t)1 << job->wheel_slot);
+  }
+  job->next = NULL;
+}
+
+// The next tick after the current one at which a job is due or a slot has to
+// be cascaded. Returns false if the wheel is empty
+static bool get_next_event_tick(const executor_t* executor, uint32_t* tick) {
+  bool found = false;
+
+  for (unsigned level = 0; level < EXECUTOR_WHEEL_LEVELS; ++level) {
+    if (!executor->occupied[level]) {
+      continue;
+    }
+
+    // Distance in slots from the current slot to the next occupied one. The
+    // current slot itself is a whole revolution away
+    unsigned shift = EXECUTOR_WHEEL_SLOT_BITS * level;
+    uint32_t current_slot = executor->current_tick >> shift;
+    uint64_t following = rotate_right(
+        executor->occupied[level],
+        (current_slot + 1) & (EXECUTOR_WHEEL_SLOTS - 1));
+    uint32_t distance = __builtin_ctzll(following) + 1;
+    uint32_t event_tick = (current_slot + distance) << shift;
+
+    if (!found || is_tick_before(event_tick, *tick)) {
+      *tick = event_tick;
+      found = true;
+    }
+  }
+
+  return found;
+}
+
+// Move the jobs in a slot down to the lower levels
+static void cascade_slot(executor_t* executor, unsigned level, unsigned slot) {
+  executor_job_t* job = executor->wheel[level][slot];
+  executor->wheel[level][slot] = NULL;
+  executor->occupied[level] &= ~((uint64_t)1 << slot);
+
+  while (job) {
+    executor_job_t* next = job->next;
+    insert_job(executor, job);
+    job = next;
+  }
+}
+
+// Turn the wheel to the tick, moving the jobs that are due to the ready
+// list. Only the ticks with something to do are visited
+static void advance_wheel(executor_t* executor, uint32_t tick) {
+  uint32_t event_tick;
+  while (get_next_event_tick(executor, &event_tick) &&
+         !is_tick_before(tick, event_tick)) {
+    executor->current_tick = event_tick;
+
+    // Higher levels first, so their jobs can cascade all the way down
+    for (unsigned level = EXECUTOR_WHEEL_LEVELS - 1; level > 0; --level) {
+      unsigned shift = EXECUTOR_WHEEL_SLOT_BITS * level;
+      if ((event_tick & (((uint32_t)1 << shift) - 1)) == 0) {
+        cascade_slot(executor, level,
+                     (event_tick >> shift) & (EXECUTOR_WHEEL_SLOTS - 1));
+      }
+    }
+
+    unsigned slot = event_tick & (EXECUTOR_WHEEL_SLOTS - 1);
+    executor_job_t* job = executor->wheel[0][slot];
+    executor->wheel[0][slot] = NULL;
+    executor->occupied[0] &= ~((uint64_t)1 << slot);
+    while (job) {
+      executor_job_t* next = job->next;
+      add_to_ready_list(executor, job);
+      job = next;
+    }
+  }
+
+  if (is_tick_before(executor->current_tick, tick)) {
+    executor->current_tick = tick;
+  }
+}
+
+// Called with the executor locked and the wheel advanced
+static void schedule_job_locked(executor_job_t* job, uint32_t expiry_tick) {
+  executor_t* executor = job->executor;
+
+  if (job->scheduled) {
+    remove_job(executor, job);
+  }
+
+  if (!is_tick_before(executor->current_tick, expiry_tick)) {
+    expiry_tick = executor->current_tick + 1;
+  }
+
+  job->expiry_tick = expiry_tick;
+  job->scheduled = true;
+  job->cancelled = false;
+  insert_job(executor, job);
+}
+
+void setup_executor(executor_t* executor, const char* name) {
+  memset(executor, 0, sizeof(*executor));
+  executor->name = name;
+  portMUX_INITIALIZE(&executor->mux);
+  executor->current_tick = get_current_tick();
+}
+
+void add_job(executor_t* executor, executor_job_t* job, uint32_t phase_ms) {
+  job->executor = executor;
+  if (phase_ms != EXECUTOR_JOB_STOP) {
+    schedule_job(job, phase_ms);
+  }
+}
+
+void schedule_job(executor_job_t* job, uint32_t delay_ms) {
+  executor_t* executor = job->executor;
+
+  portENTER_CRITICAL(&executor->mux);
+  advance_wheel(executor, get_current_tick());
+  schedule_job_locked(job, executor->current_tick + ms_to_ticks(delay_ms));
+  TaskHandle_t worker = executor->worker;
+  portEXIT_CRITICAL(&executor->mux);
+
+  // The worker may be asleep until a later job
+  if (worker && worker != xTaskGetCurrentTaskHandle()) {
+    xTaskNotifyGive(worker);
+  }
+}
+
+void cancel_job(executor_job_t* job) {
+  executor_t* executor = job->executor;
+
+  portENTER_CRITICAL(&executor->mux);
+  if (job->scheduled) {
+    remove_job(executor, job);
+    job->scheduled = false;
+  }
+  job->cancelled = job->running;
+  portEXIT_CRITICAL(&executor->mux);
+}
+
+bool is_job_active(const executor_job_t* job) {
+  executor_t* executor = job->executor;
+
+  portENTER_CRITICAL(&executor->mux);
+  bool active = job->scheduled || job->running;
+  portEXIT_CRITICAL(&executor->mux);
+
+  return active;
+}
+
+void run_executor(executor_t* executor) {
+  portENTER_CRITICAL(&executor->mux);
+  executor->worker = xTaskGetCurrentTaskHandle();
+  portEXIT_CRITICAL(&executor->mux);
+
+  for (;;) {
+    heartbeat();
+
+    portENTER_CRITICAL(&executor->mux);
+    advance_wheel(executor, get_current_tick());
+
+    executor_job_t* job = executor->ready;
+    uint32_t due_tick = 0;
+    if (job) {
+      executor->ready = job->next;
+      job->next = NULL;
+      job->scheduled = false;
+      job->running = true;
+      due_tick = job->expiry_tick;
+    }
+
+    uint32_t next_event_tick;
+    bool has_next_event = get_next_event_tick(executor, &next_event_tick);
+    portEXIT_CRITICAL(&executor->mux);
+
+    if (job) {
+      uint32_t delay_ms = job->function(job->argument);
+
+      portENTER_CRITICAL(&executor->mux);
+      job->running = false;
+      // Unless the job was rescheduled or cancelled while it ran
+      if (!job->scheduled && !job->cancelled && delay_ms != EXECUTOR_JOB_STOP) {
+        advance_wheel(executor, get_current_tick());
+
+        // Runs that were missed while other jobs ran are skipped rather than
+        // caught up
+        uint32_t delay_ticks = ms_to_ticks(delay_ms);
+        uint32_t expiry_tick = due_tick + delay_ticks;
+        if (!is_tick_before(executor->current_tick, expiry_tick)) {
+          expiry_tick = executor->current_tick + delay_ticks;
+        }
+        schedule_job_locked(job, expiry_tick);
+      }
+      job->cancelled = false;
+      portEXIT_CRITICAL(&executor->mux);
+      continue;
+    }
+
+    // Wake up for the next heartbeat even when no job is due
+    TickType_t timeout = get_heartbeat_timeout();
+    if (has_next_event) {
+      // In ticks first, since the tick count wraps
+      int64_t now_us = esp_timer_get_time();
+      int32_t wait_ticks =
+          next_event_tick - (uint32_t)(now_us / EXECUTOR_TICK_US);
+      int64_t wait_us =
+          (int64_t)wait_ticks * EXECUTOR_TICK_US - now_us % EXECUTOR_TICK_US;
+      TickType_t event_timeout =
+          wait_us > 0 ? wait_us / (portTICK_PERIOD_MS * 1000) + 1 : 0;
+      if (event_timeout < timeout) {
+        timeout = event_timeout;
+      }
+    }
+    ulTaskNotifyTake(pdTRUE, timeout);
+  }
+}
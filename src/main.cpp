@@ -1,14 +1,37 @@
 #include <Arduino.h>
 #include <EEPROM.h>
+#include <esp_system.h>
+#include <esp_timer.h>
+
+#include <atomic>
 
 #include "Nixie_Display.h"
+#include "alarms.h"
 #include "arduino_debug.h"
+#include "boot_phases.h"
+#include "brightness.h"
+#include "buzzer.h"
 #include "config.h"
+#include "console.h"
+#include "coroutine.h"
+#include "countdown_timers.h"
+#include "deferred_log.h"
+#include "event_log.h"
+#include "executor.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/semphr.h"
+#include "metrics.h"
 #include "ntp.h"
+#include "power.h"
+#include "retained_time.h"
+#include "sensor_hub.h"
+#include "solar.h"
 #include "special_modes.h"
+#include "supervisor.h"
 #include "tasks.h"
+#include "time_service.h"
+#include "time_zone.h"
+#include "tubes_off.h"
 #include "util.h"
 #include "weather.h"
 
@@ -16,31 +39,145 @@
 #define DEBOUNCE_TIME_TICKS (DEBOUNCE_TIME_MS / portTICK_PERIOD_MS)
 volatile TickType_t previous_tick_count = 0;
 
-TaskHandle_t g_task_special_modes_handle = NULL;
-TaskHandle_t g_task_configure_handle = NULL;
-TaskHandle_t g_task_blink_dot_separators_handle = NULL;
+// Set while the network core is fetching the local temperature so that the
+// display timing can be compared with and without radio activity
+volatile bool weather_fetch_in_progress = false;
+
+// The latest temperature fetched in hundredths of a degree, handed from the
+// network core to the display core. A double can't be written atomically
+static std::atomic<int32_t> s_latest_local_temperature(0);
+
+#define DISPLAY_TIME_JITTER_REPORT_PERIOD 60  // In samples
+
+// How often the sensor hub job takes the datagrams waiting on its socket, and
+// the most it takes at a time
+#define SENSOR_HUB_POLL_PERIOD_MS 1000
+#define SENSOR_HUB_MAX_DATAGRAMS_PER_POLL 8
+
+// Pushed temperatures are shown straight away when they change, but no more
+// often than this
+#define SENSOR_HUB_MIN_DISPLAY_INTERVAL_US (60 * 1000000LL)
+
+// A chime job that runs later than this into the hour, e.g. after light sleep,
+// stays quiet rather than chiming late
+#define HOUR_CHIME_MAX_LATE_S 2
+
+TaskHandle_t g_task_ui_handle = NULL;
 TaskHandle_t g_task_display_time_handle = NULL;
-TaskHandle_t g_task_display_date_handle = NULL;
-TaskHandle_t g_task_display_local_temperature_handle = NULL;
 
-void task_display_slot_machine_cycle(void* pvParameters);
+bool g_blink_dot_separators = false;
+
 void task_display_time(void* pvParameters);
-void task_display_date(void* pvParameters);
-void task_display_local_temperature(void* pvParameters);
 void task_cycle_digit(void* pvParameters);
-void task_configure(void* pvParameters);
-void task_special_modes(void* pvParameters);
-void task_set_time_from_ntp(void* pvParameters);
-void task_blink_dot_separators(void* pvParameters);
+void task_ui(void* pvParameters);
+void task_buzzer(void* pvParameters);
+void task_display_jobs(void* pvParameters);
+void task_network_jobs(void* pvParameters);
+void task_deferred_log(void* pvParameters);
+void task_supervisor(void* pvParameters);
+
+uint32_t job_display_slot_machine_cycle(void* argument);
+uint32_t job_display_date(void* argument);
+uint32_t job_display_local_temperature(void* argument);
+uint32_t job_update_brightness(void* argument);
+uint32_t job_tubes_off(void* argument);
+uint32_t job_hour_chime(void* argument);
+uint32_t job_fetch_local_temperature(void* argument);
+uint32_t job_set_time_from_ntp(void* argument);
+uint32_t job_sensor_hub(void* argument);
+
+coroutine_status_t run_ui_menu(void* frame);
+coroutine_status_t blink_dot_separators(void* frame);
+
+// Features that only wake up now and then share a worker task per core.
+// Job priorities follow the task priorities they replaced
+executor_t g_display_executor;
+executor_t g_network_executor;
+
+static executor_job_t s_job_display_slot_machine_cycle = {
+    job_display_slot_machine_cycle, NULL, "slot_machine_cycle", 17};
+executor_job_t g_job_display_date = {job_display_date, NULL, "display_date",
+                                     15};
+executor_job_t g_job_display_local_temperature = {
+    job_display_local_temperature, NULL, "display_local_temperature", 14};
+static executor_job_t s_job_update_brightness = {
+    job_update_brightness, NULL, "update_brightness", 12};
+static executor_job_t s_job_tubes_off = {job_tubes_off, NULL, "tubes_off",
+                                         21};
+
+static executor_job_t s_job_set_time_from_ntp = {
+    job_set_time_from_ntp, NULL, "set_time_from_ntp", 16};
+static executor_job_t s_job_hour_chime = {job_hour_chime, NULL, "hour_chime",
+                                          18};
+executor_job_t g_job_fetch_local_temperature = {
+    job_fetch_local_temperature, NULL, "fetch_local_temperature", 14};
+static executor_job_t s_job_sensor_hub = {job_sensor_hub, NULL, "sensor_hub",
+                                          13};
 
 void rotary_encoder_switch_isr();
 
+// e.g. 71.25 as __71.25 and -3.5 as ___3.50 with the top left dot lit
+static const Nixie_Display::Number_Format c_temperature_format = {
+    2, 1, NIXIE_DOTS_TOP_LEFT, NIXIE_DOTS_TOP_RIGHT};
+
+static const char* const c_slot_machine_animation_path = "/slot_machine.anim";
+
+// Task topology. Everything that drives the display is pinned to the display
+// core and everything that touches the radio is pinned to the network core.
+// Note: ESP32 FreeRTOS stack depths are in bytes and priorities must be less
+// than configMAX_PRIORITIES
+// The time service runs on an esp_timer, and the console and the sensor hub
+// are network jobs, so only refresh, input and the supervisor keep their own
+// stacks
+static const task_config_t c_tasks[] = {
+    // Resets the watchdog while every supervised task sends heartbeats
+    {task_supervisor, "supervisor", 3000, 24, NETWORK_CORE, NULL},
+    {task_buzzer, "buzzer", 2000, 22, DISPLAY_CORE, NULL},
+    // The configuration menu, the special modes and the blinking dots are
+    // coroutines sharing a stack
+    {task_ui, "ui", 3000, 19, DISPLAY_CORE, &g_task_ui_handle},
+    // The workers need the stack of their hungriest job: the slot machine and
+    // TLS
+    {task_display_jobs, "display_jobs", 4000, 17, DISPLAY_CORE, NULL},
+    {task_network_jobs, "network_jobs", 10000, 16, NETWORK_CORE, NULL},
+    {task_display_time, "display_time", 4000, 10, DISPLAY_CORE,
+     &g_task_display_time_handle},
+    // Only formats one line at a time
+    {task_deferred_log, "deferred_log", 2500, 4, NETWORK_CORE, NULL},
+};
+
 void setup() {
+  mark_boot_phase(BOOT_PHASE_SETUP);
+
+  // Buffered until the event log is set up
+  log_event(EVENT_BOOT, esp_reset_reason());
+
   // Nixie display setup
   Nixie_Display::setup_nixie_display();
+  mark_boot_phase(BOOT_PHASE_DISPLAY_READY);
+
+  Serial.begin(BAUD_RATE);
+
+  // Reports a stall that caused the last reset
+  setup_supervisor();
+
+  // EEPROM setup
+  setup_eeprom();
 
-  // Zero the display
-  Nixie_Display::get_instance().display_value(0, 0, 0, NIXIE_DOTS_ALL);
+  // After a warm reset the time is still known, so show it straight away.
+  // NTP corrects it in the background. Otherwise zero the display until the
+  // first sync
+  set_time_zone();
+  struct tm time_info;
+  if (restore_retained_time() && get_local_time(&time_info)) {
+    mark_boot_phase(BOOT_PHASE_TIME_RESTORED);
+    Nixie_Display::get_instance().display_time(
+        time_info, EEPROM.read(EEPROM_12_HOUR_FORMAT_ADDRESS));
+    mark_boot_phase(BOOT_PHASE_FIRST_CORRECT_TIME);
+    publish_time_snapshot();
+  } else {
+    Nixie_Display::get_instance().display_value(0, 0, 0, NIXIE_DOTS_ALL);
+  }
 
   // Rotary encode setup
   pinMode(c_rotary_encoder_switch_pin, INPUT_PULLUP);
@@ -50,90 +187,128 @@ void setup() {
   pinMode(c_rotary_encoder_clk_pin, INPUT);
 
   // Buzzer setup
-  pinMode(c_buzzer_pin, OUTPUT);
-
-  Serial.begin(BAUD_RATE);
+  setup_buzzer();
 
   if (ARDUINO_DEBUG) {
     // Wait for the serial monitor to properly attach to display output
     delay(1000);
   }
 
-  // EEPROM setup
-  setup_eeprom();
-
-  // RTC Setup
-  set_time_from_ntp();
-
-  xTaskCreate(task_blink_dot_separators, "blink_dot_separators", 2000, NULL, 80,
-              &g_task_blink_dot_separators_handle);
-
-  xTaskCreate(task_configure, "configure", 2000, NULL, 70,
-              &g_task_configure_handle);
-
-  xTaskCreate(task_special_modes, "special_modes", 2000, NULL, 60,
-              &g_task_special_modes_handle);
-
-  xTaskCreate(task_display_slot_machine_cycle, "slot_machine_cycle", 2000, NULL,
-              50, NULL);
-
-  xTaskCreate(task_set_time_from_ntp, "set_time_from_ntp", 5000, NULL, 40,
-              NULL);
-
-  xTaskCreate(task_display_date, "display_date", 2000, NULL, 30,
-              &g_task_display_date_handle);
-
-  xTaskCreate(task_display_local_temperature, "display_local_temperature",
-              10000, NULL, 20, &g_task_display_local_temperature_handle);
-
-  xTaskCreate(task_display_time, "display_time", 4000, NULL, 10,
-              &g_task_display_time_handle);
+  // Dynamic frequency scaling and automatic light sleep
+  setup_power_management();
+
+  setup_countdown_timers();
+
+  setup_time_service();
+
+  // The slot machine plays straight away. The date waits so that it doesn't
+  // cut in before the slot machine. The RTC is set from NTP by its job, so
+  // setup never waits on the network
+  setup_executor(&g_display_executor, "display");
+  add_job(&g_display_executor, &s_job_tubes_off, 0);
+  add_job(&g_display_executor, &s_job_display_slot_machine_cycle, 0);
+  add_job(&g_display_executor, &g_job_display_date, 15 * 1000);
+  add_job(&g_display_executor, &s_job_update_brightness, 0);
+  add_job(&g_display_executor, &g_job_display_local_temperature,
+          EXECUTOR_JOB_STOP);
+
+  setup_executor(&g_network_executor, "network");
+  add_job(&g_network_executor, &s_job_set_time_from_ntp, 0);
+  add_job(&g_network_executor, &g_job_fetch_local_temperature, 0);
+  // The chime used to follow the time display, and was skipped whenever
+  // something else held the display at the top of the hour
+  add_job(&g_network_executor, &s_job_hour_chime, 0);
+  add_job(&g_network_executor, &s_job_sensor_hub, 0);
+  setup_console(&g_network_executor);
+
+  // Alarms are rescheduled whenever NTP sets the RTC. Not on the display
+  // executor, which the tubes off window holds for the night
+  setup_alarms(&g_network_executor);
+
+  // Flushed by a job on the network executor
+  setup_event_log(&g_network_executor);
+
+  uint32_t total_stack_depth = 0;
+  for (size_t i = 0; i < NUM_ELEMENTS(c_tasks); ++i) {
+    // The handle is written before the task can run
+    TaskHandle_t local_task_handle = NULL;
+    TaskHandle_t* task_handle =
+        c_tasks[i].task_handle ? c_tasks[i].task_handle : &local_task_handle;
+    xTaskCreatePinnedToCore(c_tasks[i].task_function, c_tasks[i].name,
+                            c_tasks[i].stack_depth, NULL, c_tasks[i].priority,
+                            task_handle, c_tasks[i].core_id);
+
+    register_task_metrics(c_tasks[i].name, *task_handle);
+    total_stack_depth += c_tasks[i].stack_depth;
+  }
+  debug_serial_printfln("Task stacks: %u bytes", total_stack_depth);
+  mark_boot_phase(BOOT_PHASE_TASKS_STARTED);
 }
 
-// Idle task
-void loop() {}
-
-void task_display_slot_machine_cycle(void* pvParameters) {
-  for (;;) {
-    TickType_t previous_wake_time;
-    struct tm time_info;
-
-    if (xSemaphoreTake(Nixie_Display::display_mutex, portMAX_DELAY) == pdTRUE) {
-      previous_wake_time = xTaskGetTickCount();
-
-      if (!getLocalTime(&time_info)) {
-        debug_serial_println("Failed to obtain time");
-        xSemaphoreGive(Nixie_Display::display_mutex);
-        vTaskDelay(1000 / portTICK_PERIOD_MS);
-        continue;
-      }
+// The Arduino loop task would otherwise spin forever and keep the CPU from
+// ever idling, so remove it
+void loop() { vTaskDelete(NULL); }
+
+uint32_t job_display_slot_machine_cycle(void* argument) {
+  // The built in slot machine can be replaced by uploading an animation to
+  // the filesystem
+  static uint8_t animation_file[ANIMATION_MAX_FILE_SIZE];
+  static const uint8_t* animation = NULL;
+  static size_t animation_size = 0;
+  if (!animation) {
+    if (load_animation_file(c_slot_machine_animation_path, animation_file,
+                            sizeof(animation_file),
+                            &animation_size) == ANIMATION_OK) {
+      debug_serial_println("Using the slot machine animation from LittleFS");
+      animation = animation_file;
+    } else {
+      animation = c_animation_slot_machine;
+      animation_size = c_animation_slot_machine_size;
+    }
+  }
 
-      // Use the configured hour format
-      uint8_t hour_format = EEPROM.read(EEPROM_12_HOUR_FORMAT_ADDRESS);
-      Nixie_Display::get_instance().display_slot_machine_cycle(time_info,
-                                                               hour_format);
+  struct tm time_info;
+  if (take_with_heartbeats(Nixie_Display::display_mutex) == pdTRUE) {
+    if (!get_snapshot_local_time(&time_info)) {
+      debug_serial_println("Failed to obtain time");
       xSemaphoreGive(Nixie_Display::display_mutex);
+      return 1000;
     }
 
-    // vTaskDelay((30 * 1000) / portTICK_PERIOD_MS);
-
-    uint8_t slot_machine_cycle_frequency =
-        EEPROM.read(EEPROM_SLOT_MACHINE_CYCLE_FREQUENCY_ADDRESS);
+    // Use the configured hour format
+    uint8_t hour_format = EEPROM.read(EEPROM_12_HOUR_FORMAT_ADDRESS);
+    Nixie_Display::get_instance().display_slot_machine_cycle(
+        time_info, hour_format, animation, animation_size);
+    xSemaphoreGive(Nixie_Display::display_mutex);
+  }
 
-    TickType_t delay_length =
-        (time_info.tm_hour == MANDATORY_CATHODE_POISONING_PREVENTION_HOUR)
-            ? (30 * 1000 / portTICK_PERIOD_MS)
-            : (slot_machine_cycle_frequency * MINUTE_FREERTOS);
+  uint8_t slot_machine_cycle_frequency =
+      EEPROM.read(EEPROM_SLOT_MACHINE_CYCLE_FREQUENCY_ADDRESS);
 
-    vTaskDelayUntil(&previous_wake_time, delay_length);
-  }
+  return (time_info.tm_hour == MANDATORY_CATHODE_POISONING_PREVENTION_HOUR)
+             ? 30 * 1000
+             : slot_machine_cycle_frequency * MINUTE_MS;
 }
 
 void task_display_time(void* pvParameters) {
+  // Measure the jitter of the start of each transition relative to the
+  // nominal 1 second period, separately for when a weather fetch is running
+  // on the network core
+  jitter_stats_t idle_jitter;
+  jitter_stats_t weather_fetch_jitter;
+  reset_jitter_stats(&idle_jitter);
+  reset_jitter_stats(&weather_fetch_jitter);
+  int64_t previous_transition_start_us = 0;
+
+  // Waits for the display with heartbeats, so a stall here is the loop itself
+  register_heartbeat(HEARTBEAT_DISPLAY_TIME, 5 * 1000);
+
   for (;;) {
+    heartbeat();
+
     TickType_t previous_wake_time;
 
-    if (xSemaphoreTake(Nixie_Display::display_mutex, portMAX_DELAY) == pdTRUE) {
+    if (take_with_heartbeats(Nixie_Display::display_mutex) == pdTRUE) {
       // vTaskDelayUntil has an odd quirk in that it if the previous wake up
       // time is initialized outside of the for(;;) loop and the task misses
       // several instances where it should have woken up, FreeRTOS it will
@@ -144,7 +319,7 @@ void task_display_time(void* pvParameters) {
       previous_wake_time = xTaskGetTickCount();
 
       struct tm time_info;
-      if (!getLocalTime(&time_info)) {
+      if (!get_snapshot_local_time(&time_info)) {
         debug_serial_println("Failed to obtain time");
         xSemaphoreGive(Nixie_Display::display_mutex);
         vTaskDelay(1000 / portTICK_PERIOD_MS);
@@ -154,190 +329,397 @@ void task_display_time(void* pvParameters) {
       // Use the configured hour format
       uint8_t hour_format = EEPROM.read(EEPROM_12_HOUR_FORMAT_ADDRESS);
 
-      // Nixie_Display::get_instance().display_time(time_info, hour_format);
-      Nixie_Display::get_instance().smooth_display_time(time_info, hour_format);
+      int64_t timer_remaining_us;
+      bool timer_running =
+          get_next_countdown_timer_remaining(&timer_remaining_us);
+
+      int64_t transition_start_us = esp_timer_get_time();
+
+      const int64_t overlay_us =
+          COUNTDOWN_TIMER_OVERLAY_S * 1000 * MILLISECOND_TO_MICROSECONDS;
+
+      if (timer_running && timer_remaining_us < overlay_us) {
+        // Show what the countdown will read at the end of the transition
+        int64_t remaining_ms =
+            (timer_remaining_us / MILLISECOND_TO_MICROSECONDS) -
+            NIXIE_SMOOTH_TRANSITION_TIME_MS;
+        int8_t remaining_s = remaining_ms > 0 ? (remaining_ms + 999) / 1000 : 0;
+
+        Nixie_Display::get_instance().smooth_display_value(
+            NIXIE_SMOOTH_TRANSITION_TIME_MS, NIXIE_BLANK_DIGIT,
+            remaining_s / 60, remaining_s % 60, NIXIE_DOTS_TOP, false);
+      } else {
+        // Only the top dots are lit while countdown timers are running
+        // Nixie_Display::get_instance().display_time(time_info, hour_format);
+        Nixie_Display::get_instance().smooth_display_time(
+            time_info, hour_format,
+            timer_running ? NIXIE_DOTS_TOP : NIXIE_DOTS_ALL);
+
+        // The snapshot is only valid once the time has been set
+        mark_boot_phase(BOOT_PHASE_FIRST_CORRECT_TIME);
+      }
       xSemaphoreGive(Nixie_Display::display_mutex);
+
+      // Only consecutive seconds are compared. Another task holding the
+      // display (date, temperature, configuration, etc) is not jitter
+      int64_t period_us = transition_start_us - previous_transition_start_us;
+      if (period_us < 2 * 1000 * MILLISECOND_TO_MICROSECONDS) {
+        record_jitter_sample(
+            weather_fetch_in_progress ? &weather_fetch_jitter : &idle_jitter,
+            period_us - 1000 * MILLISECOND_TO_MICROSECONDS);
+      }
+      previous_transition_start_us = transition_start_us;
+
+      if (idle_jitter.num_samples + weather_fetch_jitter.num_samples >=
+          DISPLAY_TIME_JITTER_REPORT_PERIOD) {
+        print_jitter_stats("Transition jitter (idle)", idle_jitter);
+        print_jitter_stats("Transition jitter (weather fetch)",
+                           weather_fetch_jitter);
+        print_power_residency();
+        record_transition_jitter(idle_jitter, weather_fetch_jitter);
+        reset_jitter_stats(&idle_jitter);
+        reset_jitter_stats(&weather_fetch_jitter);
+      }
     }
 
     // vTaskDelay(45 / portTICK_PERIOD_MS);
-    reset_watchdog_timer();
     vTaskDelayUntil(&previous_wake_time, 1000 / portTICK_PERIOD_MS);
   }
 }
 
-void task_display_date(void* pvParameters) {
-  // Upon startup or reset of the clock, the slot machine transition into
-  // the time display should be seen. To prevent this task from preempting
-  // those task, sleep this task when it first starts
-  vTaskDelay(15 * 1000 / portTICK_PERIOD_MS);
-
-  // Since this task can be suspended during configuration if a value of zero
-  // is entered for EEPROM_DATE_DISPLAY_FREQUENCY, we need to make sure
-  // this task suspends itself if zero is set. Otherwise, we will be calling
-  // vTaskDelayUntil with a 0 tick delay
-  if (!EEPROM.read(EEPROM_DATE_DISPLAY_FREQUENCY_ADDRESS)) {
-    vTaskSuspend(NULL);
+uint32_t job_display_date(void* argument) {
+  // The job is stopped if zero is entered for
+  // EEPROM_DATE_DISPLAY_FREQUENCY during configuration. The configuration
+  // starts it again
+  uint8_t date_display_frequency =
+      EEPROM.read(EEPROM_DATE_DISPLAY_FREQUENCY_ADDRESS);
+  if (!date_display_frequency) {
+    return EXECUTOR_JOB_STOP;
   }
 
-  for (;;) {
-    TickType_t previous_wake_time;
-    if (xSemaphoreTake(Nixie_Display::display_mutex, portMAX_DELAY) == pdTRUE) {
-      previous_wake_time = xTaskGetTickCount();
-
-      struct tm time_info;
-      if (!getLocalTime(&time_info)) {
-        debug_serial_println("Failed to obtain time");
-        xSemaphoreGive(Nixie_Display::display_mutex);
-        vTaskDelay(1000 / portTICK_PERIOD_MS);
-        continue;
-      }
-
-      Nixie_Display::get_instance().display_date(time_info);
-      vTaskDelay(8 * 1000 / portTICK_PERIOD_MS);  // Keep date on display
+  if (take_with_heartbeats(Nixie_Display::display_mutex) == pdTRUE) {
+    struct tm time_info;
+    if (!get_snapshot_local_time(&time_info)) {
+      debug_serial_println("Failed to obtain time");
       xSemaphoreGive(Nixie_Display::display_mutex);
+      return 1000;
     }
 
-    uint8_t date_display_frequency =
-        EEPROM.read(EEPROM_DATE_DISPLAY_FREQUENCY_ADDRESS);
+    Nixie_Display::get_instance().display_date(time_info);
+    vTaskDelay(8 * 1000 / portTICK_PERIOD_MS);  // Keep date on display
+    xSemaphoreGive(Nixie_Display::display_mutex);
+  }
+
+  return date_display_frequency * MINUTE_MS;
+}
+
+// Scheduled by the fetch job and the sensor hub job with a new temperature
+uint32_t job_display_local_temperature(void* argument) {
+  int32_t temperature = s_latest_local_temperature.load();
+
+  deferred_printfln("Temperature: %d hundredths", temperature);
+
+  if (take_with_heartbeats(Nixie_Display::display_mutex) == pdTRUE) {
+    Nixie_Display::get_instance().smooth_display_number(
+        500, temperature, 2, c_temperature_format, true);
+
+    vTaskDelay(20 * 1000 / portTICK_PERIOD_MS);
 
-    vTaskDelayUntil(&previous_wake_time,
-                    date_display_frequency * MINUTE_FREERTOS);
+    xSemaphoreGive(Nixie_Display::display_mutex);
   }
+
+  return EXECUTOR_JOB_STOP;
 }
 
-void task_display_local_temperature(void* pvParameters) {
-  if (!EEPROM.read(EEPROM_LOCAL_TEMPERATURE_DISPLAY_FREQUENCY_ADDRESS)) {
-    vTaskSuspend(NULL);
+uint32_t job_fetch_local_temperature(void* argument) {
+  // Stopped and started by the configuration, like the date
+  uint8_t local_temperature_display_frequency =
+      EEPROM.read(EEPROM_LOCAL_TEMPERATURE_DISPLAY_FREQUENCY_ADDRESS);
+  if (!local_temperature_display_frequency) {
+    return EXECUTOR_JOB_STOP;
   }
 
-  for (;;) {
-    double temperature;
-    if (!get_local_temperature(&temperature)) {
-      vTaskDelay(10 * MINUTE_FREERTOS);
-      continue;
-    }
+  // A fresh reading from the sensor hub saves the round trip to the cloud
+  double temperature = 0;
+  bool got_temperature = get_sensor_hub_temperature(&temperature);
 
-    size_t rounded_temperature = static_cast<size_t>(temperature);
+  if (!got_temperature) {
+    weather_fetch_in_progress = true;
+    got_temperature = get_local_temperature(&temperature);
+    weather_fetch_in_progress = false;
 
-    // Shift the decimals 2 places to the left
-    double decimal_f = temperature - rounded_temperature;
-    uint8_t decimal = static_cast<uint8_t>(decimal_f * 100);
+    record_weather_fetch(got_temperature, temperature);
+  }
 
-    uint8_t tens_and_ones =
-        (10 * ((uint8_t)(rounded_temperature / (double)10) % 10)) +
-        (rounded_temperature % 10);
+  if (!got_temperature) {
+    return 10 * MINUTE_MS;
+  }
 
-    uint8_t thousands_and_hundreds =
-        (10 * ((uint8_t)(rounded_temperature / (double)1000)) % 10) +
-        ((uint8_t)(rounded_temperature / (double)100) % 10);
+  s_latest_local_temperature.store(lround(temperature * 100));
+  schedule_job(&g_job_display_local_temperature, 0);
 
-    debug_serial_printf(
-        "thousands_and_hundreds: %hhu\ttens_and_ones: %hhu\tdecimal: %hhu\n",
-        thousands_and_hundreds, tens_and_ones, decimal);
+  return local_temperature_display_frequency * MINUTE_MS;
+}
 
-    if (xSemaphoreTake(Nixie_Display::display_mutex, portMAX_DELAY) == pdTRUE) {
-      Nixie_Display::get_instance().smooth_display_value(
-          500,
-          thousands_and_hundreds == 0 ? NIXIE_BLANK_DIGIT
-                                      : thousands_and_hundreds,
-          tens_and_ones, decimal, NIXIE_DOTS_BOTTOM_RIGHT, true);
+// Light sleep needs the WiFi off, so the listener lets go of the session
+// during the tubes off window. Readings pushed meanwhile are missed, which
+// costs nothing since no temperature is shown until the tubes come back on,
+// and the first push after that is accepted as the last one has expired
+static bool is_sensor_hub_listening() {
+  struct tm time_info;
+  return EEPROM.read(EEPROM_SENSOR_HUB_ADDRESS) &&
+         !(get_snapshot_local_time(&time_info) &&
+           is_tubes_off_time(time_info));
+}
 
-      vTaskDelay(20 * 1000 / portTICK_PERIOD_MS);
+// Holds the WiFi session, and with it POWER_LOCK_NETWORK, for as long as the
+// listener runs. Datagrams wait in the socket's buffer between polls
+uint32_t job_sensor_hub(void* argument) {
+  static bool listening = false;
+  static int64_t last_display_us = 0;
+
+  if (!is_sensor_hub_listening()) {
+    if (listening) {
+      close_sensor_hub_socket();
+      disconnect_from_wifi();
+      listening = false;
+    }
+    return MINUTE_MS;
+  }
 
-      xSemaphoreGive(Nixie_Display::display_mutex);
+  if (!listening) {
+    if (!connect_to_wifi()) {
+      return 10 * MINUTE_MS;
     }
+    if (!open_sensor_hub_socket()) {
+      disconnect_from_wifi();
+      return MINUTE_MS;
+    }
+    listening = true;
+  }
 
-    uint8_t local_temperature_display_frequency =
-        EEPROM.read(EEPROM_LOCAL_TEMPERATURE_DISPLAY_FREQUENCY_ADDRESS);
+  for (int i = 0; i < SENSOR_HUB_MAX_DATAGRAMS_PER_POLL; ++i) {
+    sensor_hub_reading_t reading;
+    if (!receive_sensor_hub_reading(0, &reading)) {
+      continue;
+    }
 
-    vTaskDelay(local_temperature_display_frequency * MINUTE_FREERTOS);
+    int32_t temperature = lround(reading.temperature * 100);
+    bool changed =
+        s_latest_local_temperature.exchange(temperature) != temperature;
+
+    // Only shown when temperatures are shown at all
+    int64_t now_us = esp_timer_get_time();
+    if (changed &&
+        EEPROM.read(EEPROM_LOCAL_TEMPERATURE_DISPLAY_FREQUENCY_ADDRESS) &&
+        (last_display_us == 0 ||
+         now_us - last_display_us >= SENSOR_HUB_MIN_DISPLAY_INTERVAL_US)) {
+      last_display_us = now_us;
+      schedule_job(&g_job_display_local_temperature, 0);
+    }
   }
+
+  return SENSOR_HUB_POLL_PERIOD_MS;
 }
 
-void task_configure(void* pvParameters) {
-  for (;;) {
-    if (xSemaphoreTake(g_semaphore_configure, portMAX_DELAY) == pdTRUE) {
-      // Do not allow any other tasks to output to the display while
-      // configuration is taking place
-      xSemaphoreTake(Nixie_Display::display_mutex, portMAX_DELAY);
+typedef struct {
+  coroutine_t co;
+  uint8_t special_mode;
+  configuration_frame_t* configuration;
+  special_mode_frame_t* special_mode_frame;
+} ui_menu_frame_t;
+
+typedef struct {
+  coroutine_t co;
+  int64_t deadline_us;
+} blink_frame_t;
+
+void task_ui(void* pvParameters) {
+  static ui_menu_frame_t ui_menu_frame;
+  static blink_frame_t blink_frame;
+
+  // The menu runs first so the dots start blinking on the same pass
+  static const coroutine_root_t roots[] = {
+      {run_ui_menu, &ui_menu_frame},
+      {blink_dot_separators, &blink_frame},
+  };
+
+  // The scheduler sends a heartbeat on each pass. Nothing a coroutine does
+  // between yields takes more than a moment
+  register_heartbeat(HEARTBEAT_UI, 10 * 1000);
+
+  run_coroutine_scheduler(roots, NUM_ELEMENTS(roots), g_semaphore_configure);
+}
 
-      vTaskResume(g_task_blink_dot_separators_handle);
-      handle_configuration();
-      vTaskSuspend(g_task_blink_dot_separators_handle);
+coroutine_status_t run_ui_menu(void* frame) {
+  ui_menu_frame_t* menu = static_cast<ui_menu_frame_t*>(frame);
 
-      xSemaphoreGive(Nixie_Display::display_mutex);
-    }
+  COROUTINE_BEGIN(&menu->co);
+
+  COROUTINE_AWAIT(&menu->co, coroutine_take_input_event());
+
+  // Do not allow any other tasks to output to the display while
+  // configuration is taking place
+  COROUTINE_AWAIT(&menu->co, coroutine_take_display());
+
+  g_blink_dot_separators = true;
+  menu->configuration = start_configuration();
+  COROUTINE_CALL(&menu->co, handle_configuration(menu->configuration));
+  coroutine_frame_free(menu->configuration);
+  g_blink_dot_separators = false;
+
+  // Set the config value back to zero to resume normal clock operation once
+  // the special mode is done
+  menu->special_mode = EEPROM.read(EEPROM_SPECIAL_MODES_ADDRESS);
+  if (menu->special_mode != SPECIAL_MODE_NONE) {
+    EEPROM.write(EEPROM_SPECIAL_MODES_ADDRESS, SPECIAL_MODE_NONE);
+    EEPROM.commit();
+
+    menu->special_mode_frame = start_special_mode(menu->special_mode);
+    COROUTINE_CALL(&menu->co, run_special_mode(menu->special_mode_frame));
+    coroutine_frame_free(menu->special_mode_frame);
   }
-}
 
-void task_special_modes(void* pvParameters) {
-  for (;;) {
-    vTaskSuspend(NULL);
+  xSemaphoreGive(Nixie_Display::display_mutex);
 
-    if (xSemaphoreTake(Nixie_Display::display_mutex, portMAX_DELAY) == pdTRUE) {
-      // We need to suspend the configuration task so that it doesn't
-      // interfere with g_semaphore_configure while one of the special modes
-      // is receiving input
-      vTaskSuspend(g_task_configure_handle);
+  COROUTINE_END(&menu->co);
+}
 
-      uint8_t eeprom_special_mode = EEPROM.read(EEPROM_SPECIAL_MODES_ADDRESS);
+uint32_t job_set_time_from_ntp(void* argument) {
+  // Periodically correct the RTC drift
+  set_time_from_ntp();
 
-      // Set the config value back to zero to resume normal clock operation
-      // Once the special mode is done
-      EEPROM.write(EEPROM_SPECIAL_MODES_ADDRESS, 0);
-      EEPROM.commit();
+  return 15 * MINUTE_MS;
+}
 
-      switch (eeprom_special_mode) {
-        case 1:
-          timer_mode();
-          break;
+coroutine_status_t blink_dot_separators(void* frame) {
+  blink_frame_t* blink = static_cast<blink_frame_t*>(frame);
 
-        default:
-          break;
-      }
+  COROUTINE_BEGIN(&blink->co);
 
-      vTaskResume(g_task_configure_handle);
-      xSemaphoreGive(Nixie_Display::display_mutex);
+  // Only blinks while the UI holds the display mutex. The dots are changed
+  // without the mutex, which is safe since set_dot_separators() atomically
+  // updates only the dots of the front buffer
+  for (;;) {
+    COROUTINE_AWAIT(&blink->co, g_blink_dot_separators);
+
+    {
+      uint8_t dot_separators =
+          Nixie_Display::get_instance().get_dot_separators();
+      dot_separators =
+          (dot_separators == NIXIE_DOTS_ALL) ? NIXIE_DOTS_NONE : NIXIE_DOTS_ALL;
+      Nixie_Display::get_instance().set_dot_separators(dot_separators);
     }
+
+    COROUTINE_DELAY(&blink->co, blink->deadline_us, 1000);
   }
+
+  COROUTINE_END(&blink->co);
+}
+
+void task_display_jobs(void* pvParameters) {
+  // The temperature holds the display for 20 seconds. The tubes off window
+  // runs for hours, sending heartbeats as it goes
+  register_heartbeat(HEARTBEAT_DISPLAY_JOBS, MINUTE_MS);
+  run_executor(&g_display_executor);
+}
+
+void task_network_jobs(void* pvParameters) {
+  // An NTP sync can take a 30 second WiFi connection, three rounds of
+  // samples and the retry delays between them
+  register_heartbeat(HEARTBEAT_NETWORK_JOBS, 3 * MINUTE_MS);
+  run_executor(&g_network_executor);
+}
+
+void task_supervisor(void* pvParameters) {
+  run_supervisor();
 }
 
-void task_set_time_from_ntp(void* pvParameters) {
-  // setup_time_from_ntp is called from setup, so immediately wait
-  // for next time to configure the RTC
+void task_deferred_log(void* pvParameters) {
+  run_deferred_log();
+}
+
+void task_buzzer(void* pvParameters) {
   for (;;) {
-    vTaskDelay(15 * MINUTE_FREERTOS);
+    play_queued_buzzer_pattern();
+  }
+}
 
-    set_time_from_ntp();
+uint32_t job_update_brightness(void* argument) {
+  // The brightness ramps are done by the PWM hardware, so following the
+  // schedule costs nothing per frame
+  struct tm time_info;
+  // The tubes off window manages the brightness itself
+  if (get_snapshot_local_time(&time_info) && !is_tubes_off_time(time_info)) {
+    uint8_t brightness = get_scheduled_brightness(time_info);
+    if (brightness != Nixie_Display::get_brightness()) {
+      debug_serial_printfln("Brightness: %d", brightness);
+      Nixie_Display::set_brightness(brightness);
+    }
+
+    // Switch at sunrise or sunset to the second rather than up to 30 s late
+    int64_t solar_event_remaining_us;
+    if (get_next_solar_event_remaining(time_info, &solar_event_remaining_us) &&
+        solar_event_remaining_us < 30 * 1000000LL) {
+      return solar_event_remaining_us / 1000 + 1;
+    }
   }
+
+  return 30 * 1000;
 }
 
-void task_blink_dot_separators(void* pvParameters) {
-  // Suspend by default. The configuration task will resume this task
-  vTaskSuspend(NULL);
+// Runs the whole window, so the other display jobs wait until the tubes are
+// back on. They would be waiting for the display anyway
+uint32_t job_tubes_off(void* argument) {
+  struct tm time_info;
+  if (get_snapshot_local_time(&time_info) && is_tubes_off_time(time_info)) {
+    // Holding the display stops all of the render tasks while the tubes
+    // are off
+    if (take_with_heartbeats(Nixie_Display::display_mutex) == pdTRUE) {
+      vTaskSuspend(g_task_ui_handle);
+      pause_heartbeat(HEARTBEAT_UI);
+      run_tubes_off_window();
+      vTaskResume(g_task_ui_handle);
 
-  // Since this function is currently only resumed from the configuration task,
-  // it is unnecessary for this function to lock the display mutex.
-  // The configuration task already holds the display mutex and the
-  // configuration task does not modify the dot separators; It lets this task
-  // handle that...
-  for (;;) {
-    TickType_t previous_wake_time = xTaskGetTickCount();
+      xSemaphoreGive(Nixie_Display::display_mutex);
+    }
+  }
+
+  return 30 * 1000;
+}
 
-    uint8_t dot_separators = Nixie_Display::get_instance().get_dot_separators();
-    dot_separators =
-        (dot_separators == NIXIE_DOTS_ALL) ? NIXIE_DOTS_NONE : NIXIE_DOTS_ALL;
-    Nixie_Display::get_instance().set_dot_separators(dot_separators);
+// Runs at the top of each local hour, so DST changes and half hour zones
+// chime on their own hours
+uint32_t job_hour_chime(void* argument) {
+  time_snapshot_t snapshot;
+  if (!get_time_snapshot(&snapshot)) {
+    return 60 * 1000;
+  }
 
-    vTaskDelayUntil(&previous_wake_time, 1000 / portTICK_PERIOD_MS);
+  const struct tm& time_info = snapshot.local_time;
+  // Quiet while the tubes are off, as when the chime followed the display
+  if (time_info.tm_min == 0 && time_info.tm_sec <= HOUR_CHIME_MAX_LATE_S &&
+      EEPROM.read(EEPROM_HOUR_CHIME_ADDRESS) &&
+      !is_tubes_off_time(time_info)) {
+    buzzer_play(&c_buzzer_pattern_hour_chime);
   }
+
+  // Just after the snapshot of the next hour is published. If this one is
+  // stale the job runs again straight away and sees the new hour
+  int64_t into_hour_ms =
+      (time_info.tm_min * 60 + time_info.tm_sec) * 1000LL +
+      get_subsecond_us(snapshot, esp_timer_get_time()) / 1000;
+  int64_t remaining_ms = 3600 * 1000LL - into_hour_ms +
+                         TIME_SERVICE_EDGE_MARGIN_US / 1000 + 1;
+  return remaining_ms > 0 ? remaining_ms : 1;
 }
 
 void rotary_encoder_switch_isr() {
   TickType_t current_tick_count = xTaskGetTickCountFromISR();
   if (current_tick_count - previous_tick_count > DEBOUNCE_TIME_TICKS) {
     previous_tick_count = current_tick_count;
-    debug_serial_println("rotary_encoder_switch_isr");
+    g_rotary_encoder_switch_press_us = esp_timer_get_time();
+    deferred_printfln("rotary_encoder_switch_isr");
     xSemaphoreGiveFromISR(g_semaphore_configure, NULL);
     portYIELD_FROM_ISR();
   }
@@ -0,0 +1,326 @@
+#include "metrics.h"
+
+#include <esp_heap_caps.h>
+#include <esp_timer.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "boot_phases.h"
+#include "deferred_log.h"
+#include "power.h"
+#include "supervisor.h"
+
+typedef struct {
+  const char* name;
+  TaskHandle_t handle;
+} task_metrics_t;
+
+static metrics_t s_metrics = {};
+static task_metrics_t s_tasks[MAX_METRICS_TASKS];
+static size_t s_num_tasks = 0;
+static portMUX_TYPE s_metrics_mux = portMUX_INITIALIZER_UNLOCKED;
+
+// Appends formatted text to a fixed buffer, so responses never allocate.
+// Once a write doesn't fit, the writer is marked as truncated and ignores the
+// rest
+typedef struct {
+  char* buffer;
+  size_t size;
+  size_t length;
+  bool truncated;
+} text_writer_t;
+
+static void write_text(text_writer_t* writer, const char* format, ...)
+    __attribute__((format(printf, 2, 3)));
+
+static void write_text(text_writer_t* writer, const char* format, ...) {
+  if (writer->truncated) {
+    return;
+  }
+  if (writer->length + 1 >= writer->size) {
+    writer->truncated = true;
+    return;
+  }
+
+  va_list args;
+  va_start(args, format);
+  int written = vsnprintf(writer->buffer + writer->length,
+                          writer->size - writer->length, format, args);
+  va_end(args);
+
+  if (written < 0 || writer->length + written >= writer->size) {
+    writer->truncated = true;
+    return;
+  }
+  writer->length += written;
+}
+
+// The length of the output, or zero and an empty buffer if it was cut short
+static size_t finish_text(text_writer_t* writer) {
+  if (!writer->truncated) {
+    return writer->length;
+  }
+
+  if (writer->size) {
+    writer->buffer[0] = '\0';
+  }
+  return 0;
+}
+
+void register_task_metrics(const char* name, TaskHandle_t task_handle) {
+  portENTER_CRITICAL(&s_metrics_mux);
+  if (s_num_tasks < MAX_METRICS_TASKS) {
+    s_tasks[s_num_tasks].name = name;
+    s_tasks[s_num_tasks].handle = task_handle;
+    ++s_num_tasks;
+  }
+  portEXIT_CRITICAL(&s_metrics_mux);
+}
+
+void record_ntp_sync(bool success, int64_t offset_us) {
+  time_t now = time(NULL);
+
+  portENTER_CRITICAL(&s_metrics_mux);
+  if (success) {
+    ++s_metrics.ntp_syncs;
+    s_metrics.last_ntp_sync_epoch = now;
+    s_metrics.last_ntp_offset_us = offset_us;
+  } else {
+    ++s_metrics.ntp_failures;
+  }
+  portEXIT_CRITICAL(&s_metrics_mux);
+}
+
+void record_weather_fetch(bool success, double temperature) {
+  time_t now = time(NULL);
+
+  portENTER_CRITICAL(&s_metrics_mux);
+  if (success) {
+    ++s_metrics.weather_fetches;
+    s_metrics.last_weather_fetch_epoch = now;
+    s_metrics.last_temperature = temperature;
+  } else {
+    ++s_metrics.weather_failures;
+  }
+  portEXIT_CRITICAL(&s_metrics_mux);
+}
+
+void record_sensor_hub_datagram(bool accepted, double temperature) {
+  time_t now = time(NULL);
+
+  portENTER_CRITICAL(&s_metrics_mux);
+  if (accepted) {
+    ++s_metrics.sensor_hub_readings;
+    s_metrics.last_sensor_hub_reading_epoch = now;
+    s_metrics.last_temperature = temperature;
+  } else {
+    ++s_metrics.sensor_hub_rejected;
+  }
+  portEXIT_CRITICAL(&s_metrics_mux);
+}
+
+void record_transition_jitter(const jitter_stats_t& idle,
+                              const jitter_stats_t& weather_fetch) {
+  portENTER_CRITICAL(&s_metrics_mux);
+  s_metrics.transition_jitter_idle = idle;
+  s_metrics.transition_jitter_weather_fetch = weather_fetch;
+  portEXIT_CRITICAL(&s_metrics_mux);
+}
+
+void get_metrics(metrics_t* metrics) {
+  portENTER_CRITICAL(&s_metrics_mux);
+  *metrics = s_metrics;
+  portEXIT_CRITICAL(&s_metrics_mux);
+}
+
+static int32_t get_mean_us(const jitter_stats_t& stats) {
+  return stats.num_samples ? stats.sum_us / stats.num_samples : 0;
+}
+
+static void write_jitter_metrics(text_writer_t* writer, const char* load,
+                                 const jitter_stats_t& stats) {
+  if (!stats.num_samples) {
+    return;
+  }
+
+  write_text(writer,
+             "nixie_transition_jitter_seconds{load=\"%s\",stat=\"min\"} "
+             "%.6f\n"
+             "nixie_transition_jitter_seconds{load=\"%s\",stat=\"max\"} "
+             "%.6f\n"
+             "nixie_transition_jitter_seconds{load=\"%s\",stat=\"mean\"} "
+             "%.6f\n",
+             load, stats.min_us / 1e6, load, stats.max_us / 1e6, load,
+             get_mean_us(stats) / 1e6);
+}
+
+size_t render_metrics(char* buffer, size_t size) {
+  text_writer_t writer = {buffer, size, 0, false};
+  if (size) {
+    buffer[0] = '\0';
+  }
+
+  metrics_t metrics;
+  get_metrics(&metrics);
+
+  write_text(&writer, "# TYPE nixie_uptime_seconds gauge\n"
+                      "nixie_uptime_seconds %.3f\n",
+             esp_timer_get_time() / 1e6);
+
+  write_text(&writer,
+             "# TYPE nixie_ntp_syncs_total counter\n"
+             "nixie_ntp_syncs_total %u\n"
+             "# TYPE nixie_ntp_failures_total counter\n"
+             "nixie_ntp_failures_total %u\n"
+             "# TYPE nixie_ntp_last_sync_timestamp_seconds gauge\n"
+             "nixie_ntp_last_sync_timestamp_seconds %lld\n"
+             "# TYPE nixie_ntp_last_offset_seconds gauge\n"
+             "nixie_ntp_last_offset_seconds %.6f\n",
+             metrics.ntp_syncs, metrics.ntp_failures,
+             metrics.last_ntp_sync_epoch, metrics.last_ntp_offset_us / 1e6);
+
+  write_text(&writer,
+             "# TYPE nixie_weather_fetches_total counter\n"
+             "nixie_weather_fetches_total %u\n"
+             "# TYPE nixie_weather_failures_total counter\n"
+             "nixie_weather_failures_total %u\n"
+             "# TYPE nixie_weather_last_fetch_timestamp_seconds gauge\n"
+             "nixie_weather_last_fetch_timestamp_seconds %lld\n"
+             "# TYPE nixie_temperature_fahrenheit gauge\n"
+             "nixie_temperature_fahrenheit %.2f\n",
+             metrics.weather_fetches, metrics.weather_failures,
+             metrics.last_weather_fetch_epoch, metrics.last_temperature);
+
+  write_text(&writer,
+             "# TYPE nixie_sensor_hub_readings_total counter\n"
+             "nixie_sensor_hub_readings_total %u\n"
+             "# TYPE nixie_sensor_hub_rejected_total counter\n"
+             "nixie_sensor_hub_rejected_total %u\n"
+             "# TYPE nixie_sensor_hub_last_reading_timestamp_seconds gauge\n"
+             "nixie_sensor_hub_last_reading_timestamp_seconds %lld\n",
+             metrics.sensor_hub_readings, metrics.sensor_hub_rejected,
+             metrics.last_sensor_hub_reading_epoch);
+
+  write_text(&writer, "# TYPE nixie_transition_jitter_seconds gauge\n");
+  write_jitter_metrics(&writer, "idle", metrics.transition_jitter_idle);
+  write_jitter_metrics(&writer, "weather_fetch",
+                       metrics.transition_jitter_weather_fetch);
+
+  write_text(&writer, "# TYPE nixie_task_stack_free_bytes gauge\n");
+  for (size_t i = 0; i < s_num_tasks; ++i) {
+    write_text(&writer, "nixie_task_stack_free_bytes{task=\"%s\"} %u\n",
+               s_tasks[i].name, uxTaskGetStackHighWaterMark(s_tasks[i].handle));
+  }
+
+  write_text(&writer, "# TYPE nixie_task_heartbeat_max_gap_seconds gauge\n");
+  for (size_t i = 0; i < NUM_HEARTBEATS; ++i) {
+    heartbeat_stats_t stats;
+    if (get_heartbeat_stats((heartbeat_id_t)i, &stats)) {
+      write_text(&writer,
+                 "nixie_task_heartbeat_max_gap_seconds{task=\"%s\"} %.3f\n",
+                 get_heartbeat_name((heartbeat_id_t)i), stats.max_gap_us / 1e6);
+    }
+  }
+
+  size_t free_bytes = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+  size_t largest_free_block = heap_caps_get_largest_free_block(MALLOC_CAP_8BIT);
+  write_text(&writer,
+             "# TYPE nixie_heap_free_bytes gauge\n"
+             "nixie_heap_free_bytes %u\n"
+             "# TYPE nixie_heap_min_free_bytes gauge\n"
+             "nixie_heap_min_free_bytes %u\n"
+             "# TYPE nixie_heap_largest_free_block_bytes gauge\n"
+             "nixie_heap_largest_free_block_bytes %u\n"
+             "# TYPE nixie_heap_fragmentation_ratio gauge\n"
+             "nixie_heap_fragmentation_ratio %.3f\n",
+             free_bytes, heap_caps_get_minimum_free_size(MALLOC_CAP_8BIT),
+             largest_free_block,
+             free_bytes ? 1.0 - (double)largest_free_block / free_bytes : 0.0);
+
+  // Without power management the CPU stays at its maximum frequency, and
+  // there are no residency samples
+  power_residency_t residency;
+  bool power_management = get_power_residency(&residency);
+  write_text(&writer,
+             "# TYPE nixie_power_management_enabled gauge\n"
+             "nixie_power_management_enabled %d\n"
+             "# TYPE nixie_power_residency_seconds counter\n",
+             power_management);
+  if (power_management) {
+    write_text(&writer,
+               "nixie_power_residency_seconds{state=\"max_frequency\"} %.3f\n"
+               "nixie_power_residency_seconds{state=\"scaled_frequency\"} "
+               "%.3f\n"
+               "nixie_power_residency_seconds{state=\"light_sleep\"} %.3f\n",
+               residency.max_frequency_us / 1e6,
+               residency.scaled_frequency_us / 1e6,
+               residency.light_sleep_us / 1e6);
+  }
+
+  write_text(&writer,
+             "# TYPE nixie_deferred_log_dropped_total counter\n"
+             "nixie_deferred_log_dropped_total %u\n",
+             get_deferred_log_dropped());
+
+  write_text(&writer, "# TYPE nixie_boot_phase_seconds gauge\n");
+  for (size_t i = 0; i < NUM_BOOT_PHASES; ++i) {
+    int64_t phase_us = get_boot_phase_us((boot_phase_t)i);
+    if (phase_us >= 0) {
+      write_text(&writer, "nixie_boot_phase_seconds{phase=\"%s\"} %.3f\n",
+                 get_boot_phase_name((boot_phase_t)i), phase_us / 1e6);
+    }
+  }
+
+  return finish_text(&writer);
+}
+
+size_t render_status(char* buffer, size_t size) {
+  text_writer_t writer = {buffer, size, 0, false};
+  if (size) {
+    buffer[0] = '\0';
+  }
+
+  metrics_t metrics;
+  get_metrics(&metrics);
+
+  write_text(&writer,
+             "{\"uptime_s\":%lld,"
+             "\"ntp\":{\"syncs\":%u,\"failures\":%u,\"last_sync\":%lld,"
+             "\"last_offset_us\":%lld},"
+             "\"weather\":{\"fetches\":%u,\"failures\":%u,\"last_fetch\":%lld,"
+             "\"temperature_f\":%.2f},",
+             esp_timer_get_time() / 1000000, metrics.ntp_syncs,
+             metrics.ntp_failures, metrics.last_ntp_sync_epoch,
+             metrics.last_ntp_offset_us, metrics.weather_fetches,
+             metrics.weather_failures, metrics.last_weather_fetch_epoch,
+             metrics.last_temperature);
+
+  write_text(&writer,
+             "\"sensor_hub\":{\"readings\":%u,\"rejected\":%u,"
+             "\"last_reading\":%lld},",
+             metrics.sensor_hub_readings, metrics.sensor_hub_rejected,
+             metrics.last_sensor_hub_reading_epoch);
+
+  const jitter_stats_t& jitter = metrics.transition_jitter_idle;
+  write_text(&writer,
+             "\"transition_jitter_us\":{\"samples\":%u,\"min\":%d,\"max\":%d,"
+             "\"mean\":%d},",
+             jitter.num_samples, jitter.min_us, jitter.max_us,
+             get_mean_us(jitter));
+
+  write_text(&writer, "\"heap\":{\"free\":%u,\"min_free\":%u,"
+                      "\"largest_free_block\":%u},",
+             heap_caps_get_free_size(MALLOC_CAP_8BIT),
+             heap_caps_get_minimum_free_size(MALLOC_CAP_8BIT),
+             heap_caps_get_largest_free_block(MALLOC_CAP_8BIT));
+
+  write_text(&writer, "\"task_stack_free\":{");
+  for (size_t i = 0; i < s_num_tasks; ++i) {
+    write_text(&writer, "%s\"%s\":%u", i ? "," : "", s_tasks[i].name,
+               uxTaskGetStackHighWaterMark(s_tasks[i].handle));
+  }
+  write_text(&writer, "}}\n");
+
+  return finish_text(&writer);
+}
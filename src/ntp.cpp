@@ -2,43 +2,112 @@
 
 #include <Arduino.h>
 #include <WiFi.h>
+#include <sys/time.h>
 
+#include "alarms.h"
 #include "arduino_debug.h"
+#include "boot_phases.h"
 #include "credentials.h"
+#include "event_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "metrics.h"
+#include "ntp_client.h"
+#include "power.h"
+#include "retained_time.h"
+#include "status_server.h"
 #include "time.h"
+#include "time_zone.h"
 
-const char* const c_ntp_server = "pool.ntp.org";
-const long int c_gmt_offset_sec = -18000;
-const int c_daylight_offset_sec = 3600;
+// Each attempt samples every server, so a failed one means the servers
+// couldn't be reached or didn't agree
+#define NTP_SYNC_ATTEMPTS 3
+#define NTP_SYNC_RETRY_DELAY_MS (10 * 1000)
+
+// The WiFi session is shared by the NTP and weather tasks. It is connected by
+// the first user and disconnected by the last one
+static SemaphoreHandle_t s_wifi_session_mutex = xSemaphoreCreateMutex();
+static int s_wifi_session_users = 0;
+
+static int64_t get_epoch_us() {
+  struct timeval now;
+  gettimeofday(&now, NULL);
+  return (int64_t)now.tv_sec * 1000000 + now.tv_usec;
+}
 
 void set_time_from_ntp() {
   if (!connect_to_wifi()) {
+    record_ntp_sync(false, 0);
     return;
   }
 
-  // Init and get the time
+  ntp_selection_t selection;
   bool ntp_time_configured = false;
-  for (int i = 1; i <= 30; ++i) {
-    configTime(c_gmt_offset_sec, c_daylight_offset_sec, c_ntp_server);
-    vTaskDelay((250 * i) / portTICK_PERIOD_MS);  // Linear backoff
-
-    if (print_local_time() == NTP_OK) {
+  for (int i = 1; i <= NTP_SYNC_ATTEMPTS; ++i) {
+    if (query_ntp_servers(&selection)) {
       ntp_time_configured = true;
       break;
     }
+    if (i < NTP_SYNC_ATTEMPTS) {
+      vTaskDelay(NTP_SYNC_RETRY_DELAY_MS / portTICK_PERIOD_MS);
+    }
   }
 
-  if (!ntp_time_configured) {
+  int64_t offset_us = 0;
+  if (ntp_time_configured) {
+    // The offset is relative to the system clock, so it can be applied now
+    offset_us = selection.offset_us;
+    int64_t epoch_us = get_epoch_us() + offset_us;
+    struct timeval now;
+    now.tv_sec = epoch_us / 1000000;
+    now.tv_usec = epoch_us % 1000000;
+    settimeofday(&now, NULL);
+
     debug_serial_printfln(
-        "Failed to configure the time from the provided NTP server: "
-        "%s",
-        c_ntp_server);
+        "NTP offset %lld us, within [%lld, %lld] us, from %u of %u servers",
+        offset_us, selection.low_us, selection.high_us,
+        selection.num_truechimers, selection.num_samples);
+    print_local_time();
+  }
+  record_ntp_sync(ntp_time_configured, offset_us);
+
+  if (ntp_time_configured) {
+    // The first sync after a cold boot steps the clock by decades
+    int64_t offset_ms = offset_us / 1000;
+    if (offset_ms > INT32_MAX) {
+      offset_ms = INT32_MAX;
+    } else if (offset_ms < INT32_MIN) {
+      offset_ms = INT32_MIN;
+    }
+    log_event(EVENT_NTP_SYNCED, offset_ms);
+  } else {
+    log_event(EVENT_NTP_SYNC_FAILED, NTP_SYNC_ATTEMPTS);
+    debug_serial_println(
+        "Failed to configure the time from the NTP servers. Keeping the "
+        "current time");
+  }
+
+  // The clock may have been stepped
+  if (ntp_time_configured) {
+    reschedule_alarms();
+
+    // Keep the time across warm resets
+    retain_time();
+
+    if (get_boot_phase_us(BOOT_PHASE_NTP_SYNCED) < 0) {
+      mark_boot_phase(BOOT_PHASE_NTP_SYNCED);
+      debug_serial_println("Boot phases:");
+      print_boot_phases();
+    }
   }
+
+  // Keep the radio off between syncs so the clock can sleep
+  disconnect_from_wifi();
 }
 
 int print_local_time() {
   struct tm timeinfo;
-  if (!getLocalTime(&timeinfo)) {
+  if (!get_local_time(&timeinfo)) {
     Serial.println("Failed to obtain time");
     return NTP_ERROR;
   }
@@ -48,6 +117,18 @@ int print_local_time() {
 }
 
 bool connect_to_wifi() {
+  xSemaphoreTake(s_wifi_session_mutex, portMAX_DELAY);
+
+  if (s_wifi_session_users > 0) {
+    ++s_wifi_session_users;
+    xSemaphoreGive(s_wifi_session_mutex);
+    return true;
+  }
+
+  // Networking and TLS run at the maximum CPU frequency. The lock is released
+  // when the last user disconnects
+  acquire_power_lock(POWER_LOCK_NETWORK);
+
   // Connect to WiFi
   debug_serial_printf("Connecting to %s ", c_wifi_ssid);
   WiFi.begin(c_wifi_ssid, c_wifi_password);
@@ -57,6 +138,9 @@ bool connect_to_wifi() {
     switch (WiFi.status()) {
       case WL_CONNECTED:
         debug_serial_println(" CONNECTED");
+        ++s_wifi_session_users;
+        start_status_server();
+        xSemaphoreGive(s_wifi_session_mutex);
         return true;
 
       default:
@@ -68,12 +152,27 @@ bool connect_to_wifi() {
 
   // If not connected, just use the previously set time
   debug_serial_println(" FAILED");
+  log_event(EVENT_WIFI_CONNECT_FAILED, WiFi.status());
   debug_serial_printfln(
       "Failed to connect to wifi to set time from NTP. Defaulting to "
       "previously set time\n\tssid: %s\n\tpassword: %s\n",
       c_wifi_ssid, c_wifi_password);
 
+  WiFi.disconnect(true);
+  release_power_lock(POWER_LOCK_NETWORK);
+  xSemaphoreGive(s_wifi_session_mutex);
+
   return false;
 }
 
-void disconnect_from_wifi() { WiFi.disconnect(true); }
+void disconnect_from_wifi() {
+  xSemaphoreTake(s_wifi_session_mutex, portMAX_DELAY);
+
+  if (s_wifi_session_users > 0 && --s_wifi_session_users == 0) {
+    stop_status_server();
+    WiFi.disconnect(true);
+    release_power_lock(POWER_LOCK_NETWORK);
+  }
+
+  xSemaphoreGive(s_wifi_session_mutex);
+}
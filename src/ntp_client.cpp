@@ -0,0 +1,398 @@
+#include "ntp_client.h"
+
+#include <esp_system.h>
+#include <esp_timer.h>
+#include <lwip/netdb.h>
+#include <lwip/sockets.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "arduino_debug.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "util.h"
+
+// Seconds from the NTP era 0 epoch (1900) to the Unix epoch
+#define NTP_UNIX_EPOCH_OFFSET_S 2208988800LL
+
+#define NTP_VERSION 4
+#define NTP_MODE_CLIENT 3
+#define NTP_MODE_SERVER 4
+#define NTP_LEAP_NOT_SYNCHRONIZED 3
+#define NTP_MAX_STRATUM 15
+
+#define NTP_MAX_HOST_LENGTH 64
+
+static const char* const c_ntp_servers[] = {NTP_SERVERS};
+
+typedef struct {
+  struct sockaddr_in address;
+  // The random transmit timestamp of the request in flight, which the server
+  // echoes as the origin timestamp. 0 when there is none
+  uint64_t origin_cookie;
+  int64_t t1_us;
+  bool has_sample;
+  ntp_sample_t sample;  // The one with the shortest round trip so far
+} ntp_server_t;
+
+static uint32_t read_u32(const uint8_t* p) {
+  return ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+static uint64_t read_u64(const uint8_t* p) {
+  return ((uint64_t)read_u32(p) << 32) | read_u32(p + 4);
+}
+
+static void write_u64(uint8_t* p, uint64_t value) {
+  for (int i = 7; i >= 0; --i) {
+    p[i] = value & 0xff;
+    value >>= 8;
+  }
+}
+
+// NTP timestamps are 32.32 fixed point seconds. Era 1 starts in 2036, so
+// seconds with the top bit clear are taken to be from era 1
+static int64_t ntp_timestamp_to_us(uint64_t timestamp) {
+  int64_t seconds = timestamp >> 32;
+  if (!(seconds & 0x80000000)) {
+    seconds += 1LL << 32;
+  }
+  uint64_t fraction_us = ((timestamp & 0xffffffff) * 1000000) >> 32;
+  return (seconds - NTP_UNIX_EPOCH_OFFSET_S) * 1000000 + fraction_us;
+}
+
+// Root delay and dispersion are 16.16 fixed point seconds
+static int64_t ntp_short_to_us(uint32_t value) {
+  return ((uint64_t)value * 1000000) >> 16;
+}
+
+static int64_t get_epoch_us() {
+  struct timeval now;
+  gettimeofday(&now, NULL);
+  return (int64_t)now.tv_sec * 1000000 + now.tv_usec;
+}
+
+bool parse_ntp_response(const uint8_t* packet, size_t size,
+                        uint64_t origin_cookie, int64_t t1_us, int64_t t4_us,
+                        ntp_sample_t* sample) {
+  if (size < NTP_PACKET_SIZE) {
+    return false;
+  }
+
+  uint8_t leap = packet[0] >> 6;
+  uint8_t version = (packet[0] >> 3) & 0x7;
+  uint8_t mode = packet[0] & 0x7;
+  uint8_t stratum = packet[1];
+  // Stratum 0 is a kiss-o'-death, e.g. to slow down
+  if (mode != NTP_MODE_SERVER || version < 3 || version > NTP_VERSION ||
+      leap == NTP_LEAP_NOT_SYNCHRONIZED || stratum == 0 ||
+      stratum > NTP_MAX_STRATUM) {
+    return false;
+  }
+
+  // Also rejects stale and spoofed responses
+  uint64_t origin = read_u64(packet + 24);
+  uint64_t receive = read_u64(packet + 32);
+  uint64_t transmit = read_u64(packet + 40);
+  if (origin != origin_cookie || !receive || !transmit) {
+    return false;
+  }
+
+  int64_t t2_us = ntp_timestamp_to_us(receive);
+  int64_t t3_us = ntp_timestamp_to_us(transmit);
+
+  sample->offset_us = ((t2_us - t1_us) + (t3_us - t4_us)) / 2;
+  sample->delay_us = (t4_us - t1_us) - (t3_us - t2_us);
+  // The server's clock may be coarser than ours
+  if (sample->delay_us < 0) {
+    sample->delay_us = 0;
+  }
+  sample->root_distance_us = sample->delay_us / 2 +
+                             ntp_short_to_us(read_u32(packet + 4)) / 2 +
+                             ntp_short_to_us(read_u32(packet + 8));
+  sample->stratum = stratum;
+
+  return sample->root_distance_us <= NTP_MAX_ROOT_DISTANCE_US;
+}
+
+typedef struct {
+  int64_t value_us;
+  int8_t type;  // -1 for the low end of an interval, +1 for the high end
+} ntp_endpoint_t;
+
+bool select_ntp_offset(const ntp_sample_t* samples, size_t num_samples,
+                       ntp_selection_t* selection) {
+  selection->num_samples = num_samples;
+  selection->num_truechimers = 0;
+  if (!num_samples || num_samples > NTP_MAX_SERVERS) {
+    return false;
+  }
+
+  ntp_endpoint_t endpoints[2 * NTP_MAX_SERVERS];
+  size_t num_endpoints = 0;
+  for (size_t i = 0; i < num_samples; ++i) {
+    endpoints[num_endpoints++] = {
+        samples[i].offset_us - samples[i].root_distance_us, -1};
+    endpoints[num_endpoints++] = {
+        samples[i].offset_us + samples[i].root_distance_us, +1};
+  }
+
+  // Insertion sort, with low ends first on ties so that touching intervals
+  // intersect
+  for (size_t i = 1; i < num_endpoints; ++i) {
+    ntp_endpoint_t endpoint = endpoints[i];
+    size_t j = i;
+    for (; j > 0 && (endpoints[j - 1].value_us > endpoint.value_us ||
+                     (endpoints[j - 1].value_us == endpoint.value_us &&
+                      endpoints[j - 1].type > endpoint.type));
+         --j) {
+      endpoints[j] = endpoints[j - 1];
+    }
+    endpoints[j] = endpoint;
+  }
+
+  // Allow for more and more falsetickers until the rest agree, as long as
+  // they are a majority
+  int64_t low_us = 0;
+  int64_t high_us = 0;
+  bool found = false;
+  for (size_t falsetickers = 0; 2 * falsetickers < num_samples;
+       ++falsetickers) {
+    int needed = num_samples - falsetickers;
+
+    // The lowest point inside enough intervals
+    int count = 0;
+    bool found_low = false;
+    for (size_t i = 0; i < num_endpoints; ++i) {
+      count -= endpoints[i].type;
+      if (count >= needed) {
+        low_us = endpoints[i].value_us;
+        found_low = true;
+        break;
+      }
+    }
+
+    // And the highest
+    count = 0;
+    bool found_high = false;
+    for (size_t i = num_endpoints; i-- > 0;) {
+      count += endpoints[i].type;
+      if (count >= needed) {
+        high_us = endpoints[i].value_us;
+        found_high = true;
+        break;
+      }
+    }
+
+    if (found_low && found_high && low_us <= high_us) {
+      found = true;
+      break;
+    }
+  }
+
+  if (!found) {
+    return false;
+  }
+
+  // Combine the truechimers, weighted by the inverse of their root distance
+  double weighted_offset_sum = 0;
+  double weight_sum = 0;
+  for (size_t i = 0; i < num_samples; ++i) {
+    const ntp_sample_t& sample = samples[i];
+    if (sample.offset_us + sample.root_distance_us < low_us ||
+        sample.offset_us - sample.root_distance_us > high_us) {
+      continue;
+    }
+
+    double weight = 1.0 / (sample.root_distance_us + 1);
+    weighted_offset_sum += weight * sample.offset_us;
+    weight_sum += weight;
+    ++selection->num_truechimers;
+  }
+
+  selection->offset_us = llround(weighted_offset_sum / weight_sum);
+  selection->low_us = low_us;
+  selection->high_us = high_us;
+  return true;
+}
+
+static bool resolve_ntp_server(const char* server,
+                               struct sockaddr_in* address) {
+  char host[NTP_MAX_HOST_LENGTH];
+  strncpy(host, server, sizeof(host) - 1);
+  host[sizeof(host) - 1] = '\0';
+
+  uint16_t port = NTP_PORT;
+  char* colon = strchr(host, ':');
+  if (colon) {
+    *colon = '\0';
+    port = atoi(colon + 1);
+  }
+
+  struct addrinfo hints;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_DGRAM;
+
+  struct addrinfo* result = NULL;
+  if (getaddrinfo(host, NULL, &hints, &result) != 0 || !result) {
+    debug_serial_printfln("Failed to resolve NTP server %s", host);
+    return false;
+  }
+
+  memcpy(address, result->ai_addr, sizeof(*address));
+  address->sin_port = htons(port);
+  freeaddrinfo(result);
+  return true;
+}
+
+// Pool names may resolve to the same member, which mustn't get two votes
+static ntp_server_t* find_ntp_server(ntp_server_t* servers, size_t num_servers,
+                                     const struct sockaddr_in& address) {
+  for (size_t i = 0; i < num_servers; ++i) {
+    if (servers[i].address.sin_addr.s_addr == address.sin_addr.s_addr &&
+        servers[i].address.sin_port == address.sin_port) {
+      return &servers[i];
+    }
+  }
+  return NULL;
+}
+
+static void send_ntp_request(int socket_fd, ntp_server_t* server) {
+  // Only the transmit timestamp is needed. A random one can't be guessed by
+  // a spoofer and leaks nothing about our clock
+  uint8_t packet[NTP_PACKET_SIZE];
+  memset(packet, 0, sizeof(packet));
+  packet[0] = (NTP_VERSION << 3) | NTP_MODE_CLIENT;
+  server->origin_cookie = ((uint64_t)esp_random() << 32) | esp_random();
+  write_u64(packet + 40, server->origin_cookie);
+
+  server->t1_us = get_epoch_us();
+  if (sendto(socket_fd, packet, sizeof(packet), 0,
+             (struct sockaddr*)&server->address,
+             sizeof(server->address)) < 0) {
+    server->origin_cookie = 0;
+  }
+}
+
+// Collect the answers to a round of requests until they are all in or the
+// timeout expires
+static void receive_ntp_responses(int socket_fd, ntp_server_t* servers,
+                                  size_t num_servers) {
+  int64_t deadline_us = esp_timer_get_time() +
+                        NTP_RESPONSE_TIMEOUT_MS * MILLISECOND_TO_MICROSECONDS;
+
+  for (;;) {
+    size_t num_waiting = 0;
+    for (size_t i = 0; i < num_servers; ++i) {
+      num_waiting += servers[i].origin_cookie != 0;
+    }
+    int64_t remaining_us = deadline_us - esp_timer_get_time();
+    if (!num_waiting || remaining_us <= 0) {
+      return;
+    }
+
+    // lwIP truncates the timeout to whole milliseconds, and 0 ms blocks
+    // forever, so round up
+    int64_t remaining_ms = (remaining_us + 999) / 1000;
+    struct timeval timeout;
+    timeout.tv_sec = remaining_ms / 1000;
+    timeout.tv_usec = (remaining_ms % 1000) * 1000;
+    if (setsockopt(socket_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout,
+                   sizeof(timeout)) != 0) {
+      debug_serial_println("Failed to set the NTP receive timeout");
+      return;
+    }
+
+    uint8_t packet[NTP_PACKET_SIZE * 2];
+    struct sockaddr_in source;
+    socklen_t source_length = sizeof(source);
+    int size = recvfrom(socket_fd, packet, sizeof(packet), 0,
+                        (struct sockaddr*)&source, &source_length);
+    int64_t t4_us = get_epoch_us();
+    if (size <= 0) {
+      continue;
+    }
+
+    // Ignore anything that isn't an answer to the request in flight, e.g. a
+    // late answer from the previous round
+    ntp_server_t* server = find_ntp_server(servers, num_servers, source);
+    if (!server || !server->origin_cookie || size < NTP_PACKET_SIZE ||
+        read_u64(packet + 24) != server->origin_cookie) {
+      continue;
+    }
+
+    ntp_sample_t sample;
+    if (parse_ntp_response(packet, size, server->origin_cookie, server->t1_us,
+                           t4_us, &sample) &&
+        (!server->has_sample || sample.delay_us < server->sample.delay_us)) {
+      server->sample = sample;
+      server->has_sample = true;
+    }
+    server->origin_cookie = 0;
+  }
+}
+
+bool query_ntp_servers(ntp_selection_t* selection) {
+  selection->num_samples = 0;
+  selection->num_truechimers = 0;
+
+  ntp_server_t servers[NTP_MAX_SERVERS];
+  size_t num_servers = 0;
+  for (size_t i = 0;
+       i < NUM_ELEMENTS(c_ntp_servers) && num_servers < NTP_MAX_SERVERS; ++i) {
+    ntp_server_t* server = &servers[num_servers];
+    memset(server, 0, sizeof(*server));
+    if (resolve_ntp_server(c_ntp_servers[i], &server->address) &&
+        !find_ntp_server(servers, num_servers, server->address)) {
+      ++num_servers;
+    }
+  }
+  if (!num_servers) {
+    return false;
+  }
+
+  int socket_fd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+  if (socket_fd < 0) {
+    debug_serial_println("Failed to create the NTP socket");
+    return false;
+  }
+
+  // All servers are asked at once, so a round takes as long as the slowest
+  TickType_t previous_wake_time = xTaskGetTickCount();
+  for (int round = 0; round < NTP_SAMPLES_PER_SERVER; ++round) {
+    if (round) {
+      vTaskDelayUntil(&previous_wake_time,
+                      NTP_SAMPLE_INTERVAL_MS / portTICK_PERIOD_MS);
+    }
+
+    for (size_t i = 0; i < num_servers; ++i) {
+      send_ntp_request(socket_fd, &servers[i]);
+    }
+    receive_ntp_responses(socket_fd, servers, num_servers);
+  }
+
+  close(socket_fd);
+
+  ntp_sample_t samples[NTP_MAX_SERVERS];
+  size_t num_samples = 0;
+  for (size_t i = 0; i < num_servers; ++i) {
+    if (!servers[i].has_sample) {
+      continue;
+    }
+
+    const ntp_sample_t& sample = servers[i].sample;
+    samples[num_samples++] = sample;
+    debug_serial_printfln(
+        "NTP %s: offset %lld us, delay %lld us, distance %lld us, stratum %u",
+        inet_ntoa(servers[i].address.sin_addr), sample.offset_us,
+        sample.delay_us, sample.root_distance_us, sample.stratum);
+  }
+
+  bool selected = select_ntp_offset(samples, num_samples, selection);
+  debug_serial_printfln("NTP: %u of %u servers answered, %u truechimers",
+                        num_samples, num_servers, selection->num_truechimers);
+  return selected;
+}
@@ -0,0 +1,132 @@
+#include "power.h"
+
+#include <Arduino.h>
+#include <esp_pm.h>
+#include <esp_timer.h>
+
+#include "arduino_debug.h"
+#include "tubes_off.h"
+
+#define POWER_MAX_CPU_FREQUENCY_MHZ 240
+#define POWER_MIN_CPU_FREQUENCY_MHZ 80
+
+#if CONFIG_PM_ENABLE
+static const char* const c_power_lock_names[NUM_POWER_LOCKS] = {"display",
+                                                                "network"};
+
+static esp_pm_lock_handle_t s_cpu_frequency_locks[NUM_POWER_LOCKS];
+static esp_pm_lock_handle_t s_display_no_light_sleep_lock;
+#endif
+
+// Residency accounting. Shared by both cores
+static portMUX_TYPE s_residency_mux = portMUX_INITIALIZER_UNLOCKED;
+static uint32_t s_num_power_locks_held = 0;
+static int64_t s_max_frequency_start_us = 0;
+static int64_t s_max_frequency_us = 0;
+
+void setup_power_management() {
+#if CONFIG_PM_ENABLE
+  esp_pm_config_esp32_t pm_config = {};
+  pm_config.max_freq_mhz = POWER_MAX_CPU_FREQUENCY_MHZ;
+  pm_config.min_freq_mhz = POWER_MIN_CPU_FREQUENCY_MHZ;
+#if CONFIG_FREERTOS_USE_TICKLESS_IDLE
+  pm_config.light_sleep_enable = true;
+#endif
+
+  esp_err_t err = esp_pm_configure(&pm_config);
+  if (err != ESP_OK) {
+    debug_serial_printfln("Failed to configure power management: %s",
+                          esp_err_to_name(err));
+  }
+
+  for (size_t i = 0; i < NUM_POWER_LOCKS; ++i) {
+    esp_pm_lock_create(ESP_PM_CPU_FREQ_MAX, 0, c_power_lock_names[i],
+                       &s_cpu_frequency_locks[i]);
+  }
+  esp_pm_lock_create(ESP_PM_NO_LIGHT_SLEEP, 0, "display_no_light_sleep",
+                     &s_display_no_light_sleep_lock);
+#else
+  debug_serial_println(
+      "Power management is disabled in this build (CONFIG_PM_ENABLE). The CPU "
+      "stays at its maximum frequency");
+#endif
+}
+
+void acquire_power_lock(power_lock_t lock) {
+#if CONFIG_PM_ENABLE
+  esp_pm_lock_acquire(s_cpu_frequency_locks[lock]);
+  if (lock == POWER_LOCK_DISPLAY) {
+    esp_pm_lock_acquire(s_display_no_light_sleep_lock);
+  }
+#endif
+
+  portENTER_CRITICAL(&s_residency_mux);
+  if (s_num_power_locks_held++ == 0) {
+    s_max_frequency_start_us = esp_timer_get_time();
+  }
+  portEXIT_CRITICAL(&s_residency_mux);
+}
+
+void release_power_lock(power_lock_t lock) {
+  portENTER_CRITICAL(&s_residency_mux);
+  if (--s_num_power_locks_held == 0) {
+    s_max_frequency_us += esp_timer_get_time() - s_max_frequency_start_us;
+  }
+  portEXIT_CRITICAL(&s_residency_mux);
+
+#if CONFIG_PM_ENABLE
+  if (lock == POWER_LOCK_DISPLAY) {
+    esp_pm_lock_release(s_display_no_light_sleep_lock);
+  }
+  esp_pm_lock_release(s_cpu_frequency_locks[lock]);
+#endif
+}
+
+bool get_power_residency(power_residency_t* residency) {
+#if !CONFIG_PM_ENABLE
+  return false;
+#endif
+
+  portENTER_CRITICAL(&s_residency_mux);
+  int64_t now_us = esp_timer_get_time();
+  residency->max_frequency_us = s_max_frequency_us;
+  if (s_num_power_locks_held) {
+    residency->max_frequency_us += now_us - s_max_frequency_start_us;
+  }
+  portEXIT_CRITICAL(&s_residency_mux);
+
+  residency->light_sleep_us = get_light_sleep_time_us();
+  residency->scaled_frequency_us =
+      now_us - residency->max_frequency_us - residency->light_sleep_us;
+  return true;
+}
+
+void print_power_residency() {
+  power_residency_t residency;
+  if (!get_power_residency(&residency)) {
+    debug_serial_println(
+        "Power residency: unavailable, power management is disabled in this "
+        "build (CONFIG_PM_ENABLE)");
+    return;
+  }
+
+  int64_t total_us = residency.max_frequency_us +
+                     residency.scaled_frequency_us + residency.light_sleep_us;
+  if (!total_us) {
+    return;
+  }
+
+  debug_serial_printfln(
+      "Power residency: %d MHz: %lld s (%lld%%)\t%d MHz or idle: %lld s "
+      "(%lld%%)\tlight sleep: %lld s (%lld%%)",
+      POWER_MAX_CPU_FREQUENCY_MHZ, residency.max_frequency_us / 1000000,
+      (100 * residency.max_frequency_us) / total_us,
+      POWER_MIN_CPU_FREQUENCY_MHZ, residency.scaled_frequency_us / 1000000,
+      (100 * residency.scaled_frequency_us) / total_us,
+      residency.light_sleep_us / 1000000,
+      (100 * residency.light_sleep_us) / total_us);
+
+#if CONFIG_PM_ENABLE && CONFIG_PM_PROFILING
+  esp_pm_dump_locks(stdout);
+#endif
+}
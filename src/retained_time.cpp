@@ -0,0 +1,107 @@
+#include "retained_time.h"
+
+#include <Arduino.h>
+#include <esp32/clk.h>
+#include <esp32/rom/crc.h>
+#include <esp_attr.h>
+#include <esp_system.h>
+#include <stddef.h>
+#include <sys/time.h>
+
+#include "arduino_debug.h"
+
+#define RETAINED_TIME_MAGIC 0x4e495854  // "NIXT"
+
+typedef struct {
+  uint32_t magic;
+  int64_t epoch_us;      // System time when the time was retained
+  uint64_t rtc_time_us;  // RTC timer when the time was retained
+  int32_t drift_ppm;
+  uint32_t crc;
+} retained_time_t;
+
+// Not initialized on reset, so it holds garbage after power on. The CRC tells
+// the two apart
+RTC_NOINIT_ATTR static retained_time_t s_retained_time;
+
+static uint32_t get_retained_time_crc(const retained_time_t& retained_time) {
+  return crc32_le(0, reinterpret_cast<const uint8_t*>(&retained_time),
+                  offsetof(retained_time_t, crc));
+}
+
+static bool is_retained_time_valid() {
+  return s_retained_time.magic == RETAINED_TIME_MAGIC &&
+         s_retained_time.crc == get_retained_time_crc(s_retained_time);
+}
+
+bool restore_retained_time() {
+  esp_reset_reason_t reset_reason = esp_reset_reason();
+  if (reset_reason == ESP_RST_POWERON || !is_retained_time_valid()) {
+    debug_serial_printfln("No retained time (reset reason: %d)",
+                          reset_reason);
+    return false;
+  }
+
+  uint64_t rtc_time_us = esp_clk_rtc_time();
+  if (rtc_time_us < s_retained_time.rtc_time_us) {
+    // The RTC timer was reset as well
+    debug_serial_println("Retained time is ahead of the RTC timer");
+    return false;
+  }
+
+  int64_t elapsed_us = rtc_time_us - s_retained_time.rtc_time_us;
+  if (elapsed_us > RETAINED_TIME_MAX_AGE_S * 1000LL * 1000) {
+    debug_serial_println("Retained time is too old");
+    return false;
+  }
+
+  int64_t epoch_us = s_retained_time.epoch_us + elapsed_us +
+                     (elapsed_us * s_retained_time.drift_ppm) / 1000000;
+
+  struct timeval now = {};
+  now.tv_sec = epoch_us / 1000000;
+  now.tv_usec = epoch_us % 1000000;
+  settimeofday(&now, NULL);
+
+  debug_serial_printfln(
+      "Restored the time retained %lld s ago (reset reason: %d, drift: %d "
+      "ppm)",
+      elapsed_us / 1000000, reset_reason, s_retained_time.drift_ppm);
+
+  return true;
+}
+
+void retain_time() {
+  struct timeval now;
+  gettimeofday(&now, NULL);
+  int64_t epoch_us = (int64_t)now.tv_sec * 1000000 + now.tv_usec;
+  uint64_t rtc_time_us = esp_clk_rtc_time();
+
+  int32_t drift_ppm = 0;
+  if (is_retained_time_valid() && rtc_time_us > s_retained_time.rtc_time_us) {
+    drift_ppm = s_retained_time.drift_ppm;
+
+    // Compare how far the RTC timer moved since the last sync with how far
+    // the time actually moved. Each new measurement is averaged in so a
+    // single bad sync can't throw the estimate off
+    int64_t rtc_elapsed_us = rtc_time_us - s_retained_time.rtc_time_us;
+    if (rtc_elapsed_us >= RETAINED_TIME_MIN_DRIFT_INTERVAL_S * 1000LL * 1000) {
+      int64_t error_us = (epoch_us - s_retained_time.epoch_us) - rtc_elapsed_us;
+      int32_t measured_drift_ppm = (error_us * 1000000) / rtc_elapsed_us;
+      drift_ppm = (3 * drift_ppm + measured_drift_ppm) / 4;
+    } else {
+      // Too soon to measure. Keep the older anchor for a longer baseline
+      return;
+    }
+  }
+
+  s_retained_time.magic = RETAINED_TIME_MAGIC;
+  s_retained_time.epoch_us = epoch_us;
+  s_retained_time.rtc_time_us = rtc_time_us;
+  s_retained_time.drift_ppm = drift_ppm;
+  s_retained_time.crc = get_retained_time_crc(s_retained_time);
+}
+
+int32_t get_retained_time_drift_ppm() {
+  return is_retained_time_valid() ? s_retained_time.drift_ppm : 0;
+}
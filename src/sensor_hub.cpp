@@ -0,0 +1,187 @@
+#include "sensor_hub.h"
+
+#include <ArduinoJson.h>
+#include <esp_timer.h>
+#include <lwip/sockets.h>
+#include <string.h>
+
+#include "arduino_debug.h"
+#include "freertos/FreeRTOS.h"
+#include "metrics.h"
+
+// Range of temperatures accepted, in Fahrenheit
+#define SENSOR_HUB_MIN_TEMPERATURE -100
+#define SENSOR_HUB_MAX_TEMPERATURE 200
+
+static int s_socket = -1;
+
+// The latest accepted reading. Written by the sensor hub job and read by the
+// weather job
+static bool s_has_reading = false;
+static uint32_t s_last_sequence = 0;
+static int64_t s_last_reading_us = 0;  // esp_timer time the reading was taken
+static double s_temperature = 0;
+static portMUX_TYPE s_reading_mux = portMUX_INITIALIZER_UNLOCKED;
+
+static uint16_t read_u16(const uint8_t* p) { return p[0] | (p[1] << 8); }
+
+static uint32_t read_u32(const uint8_t* p) {
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static bool parse_binary_datagram(const uint8_t* datagram, size_t size,
+                                  sensor_hub_reading_t* reading) {
+  if (size != SENSOR_HUB_BINARY_SIZE || datagram[0] != SENSOR_HUB_MAGIC_0 ||
+      datagram[1] != SENSOR_HUB_MAGIC_1 ||
+      datagram[2] != SENSOR_HUB_VERSION) {
+    return false;
+  }
+
+  reading->sequence = read_u32(datagram + 4);
+  reading->temperature = (int16_t)read_u16(datagram + 8) / 100.0;
+  reading->age_s = read_u16(datagram + 10);
+  return true;
+}
+
+static bool parse_json_datagram(const uint8_t* datagram, size_t size,
+                                sensor_hub_reading_t* reading) {
+  StaticJsonDocument<SENSOR_HUB_MAX_DATAGRAM_SIZE * 2> doc;
+  if (deserializeJson(doc, reinterpret_cast<const char*>(datagram), size)) {
+    return false;
+  }
+
+  if (!doc["seq"].is<uint32_t>()) {
+    return false;
+  }
+  reading->sequence = doc["seq"].as<uint32_t>();
+
+  if (doc["temp_f"].is<double>()) {
+    reading->temperature = doc["temp_f"].as<double>();
+  } else if (doc["temp_c"].is<double>()) {
+    reading->temperature = doc["temp_c"].as<double>() * 9 / 5 + 32;
+  } else {
+    return false;
+  }
+
+  reading->age_s = 0;
+  if (!doc["age_s"].isNull()) {
+    if (!doc["age_s"].is<uint16_t>()) {
+      return false;
+    }
+    reading->age_s = doc["age_s"].as<uint16_t>();
+  }
+
+  return true;
+}
+
+bool parse_sensor_hub_datagram(const uint8_t* datagram, size_t size,
+                               sensor_hub_reading_t* reading) {
+  bool parsed = size > 0 && datagram[0] == '{'
+                    ? parse_json_datagram(datagram, size, reading)
+                    : parse_binary_datagram(datagram, size, reading);
+
+  return parsed && reading->temperature >= SENSOR_HUB_MIN_TEMPERATURE &&
+         reading->temperature <= SENSOR_HUB_MAX_TEMPERATURE;
+}
+
+bool accept_sensor_hub_reading(const sensor_hub_reading_t& reading) {
+  if (reading.age_s > SENSOR_HUB_MAX_AGE_S) {
+    return false;
+  }
+
+  int64_t now_us = esp_timer_get_time();
+  int64_t reading_us = now_us - (int64_t)reading.age_s * 1000000;
+
+  portENTER_CRITICAL(&s_reading_mux);
+  bool expired = !s_has_reading ||
+                 now_us - s_last_reading_us >= SENSOR_HUB_MAX_AGE_S * 1000000LL;
+  // Serial number arithmetic, so the sequence may wrap
+  bool accepted =
+      expired || (int32_t)(reading.sequence - s_last_sequence) > 0;
+  if (accepted) {
+    s_has_reading = true;
+    s_last_sequence = reading.sequence;
+    s_last_reading_us = reading_us;
+    s_temperature = reading.temperature;
+  }
+  portEXIT_CRITICAL(&s_reading_mux);
+
+  return accepted;
+}
+
+bool get_sensor_hub_temperature(double* temperature) {
+  int64_t now_us = esp_timer_get_time();
+
+  portENTER_CRITICAL(&s_reading_mux);
+  bool fresh = s_has_reading &&
+               now_us - s_last_reading_us < SENSOR_HUB_MAX_AGE_S * 1000000LL;
+  if (fresh) {
+    *temperature = s_temperature;
+  }
+  portEXIT_CRITICAL(&s_reading_mux);
+
+  return fresh;
+}
+
+bool open_sensor_hub_socket() {
+  if (s_socket >= 0) {
+    return true;
+  }
+
+  s_socket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+  if (s_socket < 0) {
+    debug_serial_println("Failed to create the sensor hub socket");
+    return false;
+  }
+
+  struct sockaddr_in address;
+  memset(&address, 0, sizeof(address));
+  address.sin_family = AF_INET;
+  address.sin_port = htons(SENSOR_HUB_PORT);
+  address.sin_addr.s_addr = htonl(INADDR_ANY);
+
+  if (bind(s_socket, (struct sockaddr*)&address, sizeof(address)) < 0) {
+    debug_serial_printfln("Failed to bind the sensor hub socket to port %d",
+                          SENSOR_HUB_PORT);
+    close_sensor_hub_socket();
+    return false;
+  }
+
+  return true;
+}
+
+void close_sensor_hub_socket() {
+  if (s_socket >= 0) {
+    close(s_socket);
+    s_socket = -1;
+  }
+}
+
+bool receive_sensor_hub_reading(uint32_t timeout_ms,
+                                sensor_hub_reading_t* reading) {
+  if (s_socket < 0) {
+    return false;
+  }
+
+  // A zero SO_RCVTIMEO would block forever
+  int flags = MSG_DONTWAIT;
+  if (timeout_ms) {
+    struct timeval timeout;
+    timeout.tv_sec = timeout_ms / 1000;
+    timeout.tv_usec = (timeout_ms % 1000) * 1000;
+    setsockopt(s_socket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    flags = 0;
+  }
+
+  uint8_t datagram[SENSOR_HUB_MAX_DATAGRAM_SIZE];
+  int size = recv(s_socket, datagram, sizeof(datagram), flags);
+  if (size <= 0) {
+    return false;
+  }
+
+  bool accepted = parse_sensor_hub_datagram(datagram, size, reading) &&
+                  accept_sensor_hub_reading(*reading);
+  record_sensor_hub_datagram(accepted, reading->temperature);
+
+  return accepted;
+}
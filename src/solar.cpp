@@ -0,0 +1,340 @@
+#include "solar.h"
+
+#include <EEPROM.h>
+#include <stdlib.h>
+
+#include "arduino_debug.h"
+#include "config.h"
+#include "freertos/FreeRTOS.h"
+#include "time_zone.h"
+
+// Binary angles wrap around at a full turn, so the reductions modulo 360
+// degrees are free
+typedef uint32_t angle_t;
+
+#define DEGREES(degrees) ((angle_t)(int64_t)((degrees) * 4294967296.0 / 360))
+#define QUARTER_TURN 0x40000000u
+#define HALF_TURN 0x80000000u
+
+#define Q30_ONE (1LL << 30)
+#define Q30(value) ((int64_t)((value) * 1073741824.0))
+
+// Days are Q16 fixed point, counted from J2000.0 (2000-01-01 12:00 UTC)
+#define J2000_UNIX_TIME 946728000
+#define J2000_DAYS_FROM_UNIX_EPOCH 10957
+#define Q16_DAYS(days) ((int64_t)((days) * 65536.0))
+
+// Mean anomaly and mean longitude of the Sun at J2000.0 and their rates in
+// turns per day, Q40. The rates are kept that precise since they are
+// multiplied by thousands of days (the products fit in 64 bits until about
+// 2120). They differ by the precession of the perihelion, which adds minutes
+// of error over the decades if left out. The mean longitude includes the
+// aberration
+#define MEAN_ANOMALY_J2000 DEGREES(357.52911)
+#define MEAN_ANOMALY_RATE_Q40 ((int64_t)(0.98560028 / 360 * 1099511627776.0))
+#define MEAN_LONGITUDE_J2000 DEGREES(280.46646 - 0.00569)
+#define MEAN_LONGITUDE_RATE_Q40 ((int64_t)(0.98564736 / 360 * 1099511627776.0))
+
+static const angle_t c_horizon = DEGREES(-0.833);
+static const int64_t c_sin_obliquity = Q30(0.397771);  // sin(23.4393)
+
+typedef struct {
+  int year;
+  int yday;
+  int16_t latitude;
+  int16_t longitude;
+  solar_day_t solar_day;
+} solar_day_cache_t;
+
+static solar_day_cache_t s_cache = {-1};
+static portMUX_TYPE s_cache_mux = portMUX_INITIALIZER_UNLOCKED;
+
+// Q30. Taylor series to x^11 over the first quadrant, good to 1e-7
+static int64_t sin_q30(angle_t angle) {
+  angle_t quadrant = angle >> 30;
+  angle_t offset = angle & (QUARTER_TURN - 1);
+  if (quadrant & 1) {
+    offset = QUARTER_TURN - offset;
+  }
+
+  // In radians, Q30
+  int64_t x = ((int64_t)offset * Q30(1.5707963267948966)) >> 30;
+  int64_t x2 = (x * x) >> 30;
+  int64_t term = Q30_ONE - x2 / 110;
+  term = Q30_ONE - ((x2 * term) >> 30) / 72;
+  term = Q30_ONE - ((x2 * term) >> 30) / 42;
+  term = Q30_ONE - ((x2 * term) >> 30) / 20;
+  term = Q30_ONE - ((x2 * term) >> 30) / 6;
+  int64_t sine = (x * term) >> 30;
+
+  return quadrant & 2 ? -sine : sine;
+}
+
+static int64_t cos_q30(angle_t angle) { return sin_q30(angle + QUARTER_TURN); }
+
+// In [0, half turn]. Bisection, since it is only needed once a day
+static angle_t acos_q30(int64_t value) {
+  angle_t low = 0;
+  angle_t high = HALF_TURN;
+  while (high - low > 1) {
+    angle_t middle = low + (high - low) / 2;
+    if (cos_q30(middle) > value) {
+      low = middle;
+    } else {
+      high = middle;
+    }
+  }
+  return low;
+}
+
+static uint64_t isqrt(uint64_t value) {
+  uint64_t root = 0;
+  uint64_t bit = 1ULL << 62;
+  while (bit > value) {
+    bit >>= 2;
+  }
+  while (bit) {
+    if (value >= root + bit) {
+      value -= root + bit;
+      root = (root >> 1) + bit;
+    } else {
+      root >>= 1;
+    }
+    bit >>= 2;
+  }
+  return root;
+}
+
+static angle_t centidegrees_to_angle(int16_t centidegrees) {
+  return (angle_t)(((int64_t)centidegrees << 32) / 36000);
+}
+
+static time_t q16_days_to_unix_time(int64_t days) {
+  return J2000_UNIX_TIME + ((days * 86400 + (1 << 15)) >> 16);
+}
+
+typedef struct {
+  int64_t transit;  // Q16 days since J2000.0
+  int64_t cos_hour_angle;
+} solar_position_t;
+
+// The sunrise equation at a time near the day's mean solar noon, which is
+// days Q16 from J2000.0
+static void get_solar_position(int64_t time, int64_t noon,
+                               angle_t latitude_angle,
+                               solar_position_t* position) {
+  angle_t mean_anomaly =
+      MEAN_ANOMALY_J2000 + (angle_t)((MEAN_ANOMALY_RATE_Q40 * time) >> 24);
+  angle_t mean_longitude =
+      MEAN_LONGITUDE_J2000 + (angle_t)((MEAN_LONGITUDE_RATE_Q40 * time) >> 24);
+  int64_t sin_mean_anomaly = sin_q30(mean_anomaly);
+
+  // Equation of the center
+  angle_t center = ((int64_t)DEGREES(1.9148) * sin_mean_anomaly +
+                    (int64_t)DEGREES(0.0200) * sin_q30(2 * mean_anomaly) +
+                    (int64_t)DEGREES(0.0003) * sin_q30(3 * mean_anomaly)) >>
+                   30;
+  angle_t ecliptic_longitude = mean_longitude + center;
+
+  // Solar transit, corrected for the equation of time
+  int64_t sin_twice_longitude = sin_q30(2 * ecliptic_longitude);
+  position->transit = noon + ((Q16_DAYS(0.0053) * sin_mean_anomaly) >> 30) -
+                      ((Q16_DAYS(0.0069) * sin_twice_longitude) >> 30);
+
+  int64_t sin_declination =
+      (sin_q30(ecliptic_longitude) * c_sin_obliquity) >> 30;
+  int64_t cos_declination = isqrt(
+      (uint64_t)(Q30_ONE * Q30_ONE - sin_declination * sin_declination));
+
+  int64_t numerator = sin_q30(c_horizon) -
+                      ((sin_q30(latitude_angle) * sin_declination) >> 30);
+  int64_t denominator = (cos_q30(latitude_angle) * cos_declination) >> 30;
+
+  // Out of [-1, 1] when the Sun doesn't reach the horizon, and at the poles
+  if (denominator <= 0 || numerator >= denominator ||
+      numerator <= -denominator) {
+    position->cos_hour_angle = numerator > 0 ? 2 * Q30_ONE : -2 * Q30_ONE;
+  } else {
+    position->cos_hour_angle = (numerator << 30) / denominator;
+  }
+}
+
+// Q16 days from solar transit to the event
+static int64_t get_half_day(const solar_position_t& position) {
+  return acos_q30(position.cos_hour_angle) >> 16;
+}
+
+void compute_solar_day(int year, int month, int day, int16_t latitude,
+                       int16_t longitude, solar_day_t* solar_day) {
+  // Mean solar noon
+  int64_t days = days_from_civil(year, month, day) - J2000_DAYS_FROM_UNIX_EPOCH;
+  int64_t noon =
+      (days << 16) - ((int32_t)centidegrees_to_angle(longitude) >> 16);
+  angle_t latitude_angle = centidegrees_to_angle(latitude);
+
+  solar_position_t position;
+  get_solar_position(noon, noon, latitude_angle, &position);
+  if (position.cos_hour_angle > Q30_ONE) {
+    solar_day->type = SOLAR_DAY_POLAR_NIGHT;
+    return;
+  }
+  if (position.cos_hour_angle < -Q30_ONE) {
+    solar_day->type = SOLAR_DAY_MIDNIGHT_SUN;
+    return;
+  }
+
+  // The declination moves by up to half a degree over the day, which is
+  // minutes at high latitudes. Take it again at each estimated event
+  int64_t half_day = get_half_day(position);
+  int64_t sunrise = position.transit - half_day;
+  int64_t sunset = position.transit + half_day;
+
+  solar_position_t refined;
+  get_solar_position(sunrise, noon, latitude_angle, &refined);
+  if (refined.cos_hour_angle >= -Q30_ONE &&
+      refined.cos_hour_angle <= Q30_ONE) {
+    sunrise = refined.transit - get_half_day(refined);
+  }
+  get_solar_position(sunset, noon, latitude_angle, &refined);
+  if (refined.cos_hour_angle >= -Q30_ONE &&
+      refined.cos_hour_angle <= Q30_ONE) {
+    sunset = refined.transit + get_half_day(refined);
+  }
+
+  solar_day->type = SOLAR_DAY_NORMAL;
+  solar_day->sunrise = q16_days_to_unix_time(sunrise);
+  solar_day->sunset = q16_days_to_unix_time(sunset);
+}
+
+void set_location(int16_t latitude, int16_t longitude) {
+  int16_t cached_latitude;
+  int16_t cached_longitude;
+  if (get_location(&cached_latitude, &cached_longitude) &&
+      cached_latitude == latitude && cached_longitude == longitude) {
+    return;
+  }
+
+  EEPROM.write(EEPROM_LOCATION_ADDRESS, EEPROM_LOCATION_VALID);
+  EEPROM.write(EEPROM_LOCATION_ADDRESS + 1, latitude & 0xff);
+  EEPROM.write(EEPROM_LOCATION_ADDRESS + 2, (uint16_t)latitude >> 8);
+  EEPROM.write(EEPROM_LOCATION_ADDRESS + 3, longitude & 0xff);
+  EEPROM.write(EEPROM_LOCATION_ADDRESS + 4, (uint16_t)longitude >> 8);
+  EEPROM.commit();
+
+  debug_serial_printfln("Location: %d.%02d, %d.%02d", latitude / 100,
+                        abs(latitude % 100), longitude / 100,
+                        abs(longitude % 100));
+}
+
+bool get_location(int16_t* latitude, int16_t* longitude) {
+#if defined(SOLAR_LATITUDE) && defined(SOLAR_LONGITUDE)
+  *latitude = SOLAR_LATITUDE;
+  *longitude = SOLAR_LONGITUDE;
+  return true;
+#else
+  if (EEPROM.read(EEPROM_LOCATION_ADDRESS) != EEPROM_LOCATION_VALID) {
+    return false;
+  }
+
+  *latitude = EEPROM.read(EEPROM_LOCATION_ADDRESS + 1) |
+              (EEPROM.read(EEPROM_LOCATION_ADDRESS + 2) << 8);
+  *longitude = EEPROM.read(EEPROM_LOCATION_ADDRESS + 3) |
+               (EEPROM.read(EEPROM_LOCATION_ADDRESS + 4) << 8);
+  return true;
+#endif
+}
+
+bool get_solar_day(const struct tm& time_info, solar_day_t* solar_day) {
+  int16_t latitude;
+  int16_t longitude;
+  if (!get_location(&latitude, &longitude)) {
+    return false;
+  }
+
+  portENTER_CRITICAL(&s_cache_mux);
+  bool cached = s_cache.year == time_info.tm_year &&
+                s_cache.yday == time_info.tm_yday &&
+                s_cache.latitude == latitude && s_cache.longitude == longitude;
+  if (cached) {
+    *solar_day = s_cache.solar_day;
+  }
+  portEXIT_CRITICAL(&s_cache_mux);
+
+  if (cached) {
+    return true;
+  }
+
+  compute_solar_day(time_info.tm_year + 1900, time_info.tm_mon + 1,
+                    time_info.tm_mday, latitude, longitude, solar_day);
+
+  portENTER_CRITICAL(&s_cache_mux);
+  s_cache.year = time_info.tm_year;
+  s_cache.yday = time_info.tm_yday;
+  s_cache.latitude = latitude;
+  s_cache.longitude = longitude;
+  s_cache.solar_day = *solar_day;
+  portEXIT_CRITICAL(&s_cache_mux);
+
+  if (solar_day->type == SOLAR_DAY_NORMAL) {
+    struct tm sunrise;
+    struct tm sunset;
+    local_time(solar_day->sunrise, &sunrise);
+    local_time(solar_day->sunset, &sunset);
+    debug_serial_printfln("Sunrise: %02d:%02d\tsunset: %02d:%02d",
+                          sunrise.tm_hour, sunrise.tm_min, sunset.tm_hour,
+                          sunset.tm_min);
+  } else {
+    debug_serial_println(solar_day->type == SOLAR_DAY_POLAR_NIGHT
+                             ? "Polar night"
+                             : "Midnight sun");
+  }
+
+  return true;
+}
+
+// mktime normalizes the fields and accounts for DST
+static time_t get_time(const struct tm& time_info) {
+  struct tm copy = time_info;
+  return mktime(&copy);
+}
+
+bool is_sun_down(const struct tm& time_info) {
+  solar_day_t solar_day;
+  if (!get_solar_day(time_info, &solar_day)) {
+    return false;
+  }
+
+  switch (solar_day.type) {
+    case SOLAR_DAY_POLAR_NIGHT:
+      return true;
+    case SOLAR_DAY_MIDNIGHT_SUN:
+      return false;
+    default:
+      break;
+  }
+
+  time_t now = get_time(time_info);
+  return now < solar_day.sunrise || now >= solar_day.sunset;
+}
+
+bool get_next_solar_event_remaining(const struct tm& time_info,
+                                    int64_t* remaining_us) {
+  solar_day_t solar_day;
+  if (!get_solar_day(time_info, &solar_day) ||
+      solar_day.type != SOLAR_DAY_NORMAL) {
+    return false;
+  }
+
+  time_t now = get_time(time_info);
+  time_t next;
+  if (now < solar_day.sunrise) {
+    next = solar_day.sunrise;
+  } else if (now < solar_day.sunset) {
+    next = solar_day.sunset;
+  } else {
+    return false;
+  }
+
+  *remaining_us = (int64_t)(next - now) * 1000000;
+  return true;
+}
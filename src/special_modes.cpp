@@ -1,79 +1,446 @@
 
 #include "special_modes.h"
 
+#include <Arduino.h>
+#include <esp_system.h>
+#include <esp_timer.h>
 #include <stdint.h>
 
 #include "Nixie_Display.h"
+#include "alarms.h"
 #include "arduino_debug.h"
+#include "buzzer.h"
 #include "config.h"
+#include "countdown_timers.h"
+#include "deferred_log.h"
 #include "tasks.h"
 #include "util.h"
 
-void timer_mode() {
+#define STOPWATCH_MAX_LAPS 10
+#define STOPWATCH_FRAME_PERIOD_MS 10
+#define STOPWATCH_LONG_PRESS_MS 1000
+#define STOPWATCH_LAP_HOLD_MS 2000
+#define STOPWATCH_LAP_NUMBER_HOLD_MS 500
+
+// The first roll interval, how much each roll slows down (in percent) and
+// the random spread added to each interval
+#define DIVERGENCE_METER_INITIAL_INTERVAL_MS 20
+#define DIVERGENCE_METER_INTERVAL_GROWTH_PERCENT 112
+#define DIVERGENCE_METER_INTERVAL_SPREAD_MS 15
+// Tubes lock from left to right, starting after the first lock time. The
+// rolls slow down to at most one every stagger
+#define DIVERGENCE_METER_FIRST_LOCK_MS 1500
+#define DIVERGENCE_METER_LOCK_STAGGER_MS 350
+#define DIVERGENCE_METER_HOLD_MS 10000
+
+// Repeat options selectable in alarm mode. Index 0 turns the alarm off
+static const uint8_t c_alarm_repeat_masks[] = {
+    ALARM_ONE_SHOT, ALARM_ONE_SHOT, ALARM_DAILY, ALARM_WEEKDAYS,
+    ALARM_WEEKENDS};
+
+#define TIMER_SECTIONS 3
+
+typedef struct {
+  uint8_t duration[TIMER_SECTIONS];  // Hours, minutes and seconds
+  size_t section;
+} timer_mode_t;
+
+typedef struct {
+  int64_t start_us;
+  int64_t press_us;
+  int64_t stop_us;
+  int64_t frozen_until_us;
+  int64_t max_latency_us;
+  int64_t next_frame_us;
+  int64_t laps_us[STOPWATCH_MAX_LAPS];
+  size_t num_laps;
+  int position;  // In the lap browser
+  uint16_t encoder_state;
+} stopwatch_mode_t;
+
+typedef struct {
+  uint8_t alarm_number;
+  alarm_t alarm;
+  uint8_t repeat;
+} alarm_mode_t;
+
+// Only the selected mode's state is kept
+struct special_mode_frame_t {
+  coroutine_t co;
+  uint8_t mode;
+  config_value_frame_t* value_frame;
+  int64_t deadline_us;
+  bool pressed;
+  union {
+    timer_mode_t timer;
+    stopwatch_mode_t stopwatch;
+    alarm_mode_t alarm_select;
+  };
+};
+
+static coroutine_status_t timer_mode(special_mode_frame_t* frame);
+static coroutine_status_t stopwatch_mode(special_mode_frame_t* frame);
+static coroutine_status_t alarm_mode(special_mode_frame_t* frame);
+static coroutine_status_t divergence_meter_mode(special_mode_frame_t* frame);
+static void display_stopwatch_time(int64_t elapsed_us, uint8_t nixie_dots);
+static bool read_lap_browser_step(stopwatch_mode_t* stopwatch);
+
+special_mode_frame_t* start_special_mode(uint8_t mode) {
+  special_mode_frame_t* frame = static_cast<special_mode_frame_t*>(
+      coroutine_frame_alloc(sizeof(special_mode_frame_t)));
+  frame->mode = mode;
+  return frame;
+}
+
+coroutine_status_t run_special_mode(special_mode_frame_t* frame) {
+  switch (frame->mode) {
+    case SPECIAL_MODE_TIMER:
+      return timer_mode(frame);
+
+    case SPECIAL_MODE_STOPWATCH:
+      return stopwatch_mode(frame);
+
+    case SPECIAL_MODE_ALARM:
+      return alarm_mode(frame);
+
+    case SPECIAL_MODE_DIVERGENCE_METER:
+      return divergence_meter_mode(frame);
+
+    default:
+      return COROUTINE_DONE;
+  }
+}
+
+static coroutine_status_t timer_mode(special_mode_frame_t* frame) {
+  timer_mode_t& timer = frame->timer;
+
+  COROUTINE_BEGIN(&frame->co);
+
   //  Set the display to all zeros
   Nixie_Display::get_instance().display_value(0, 0, 0);
 
-  static const uint8_t num_timer_sections = 3;
-
   // Configure the timer duration
-  vTaskResume(g_task_blink_dot_separators_handle);
-  uint8_t timer_duration[num_timer_sections];
-  memset(timer_duration, 0, sizeof(timer_duration));
-  for (size_t i = 0; i < num_timer_sections; ++i) {
-    timer_duration[i] =
-        get_config_value(i, 0, 0, 99, &Nixie_Display::display_timer_select);
+  g_blink_dot_separators = true;
+  for (timer.section = 0; timer.section < TIMER_SECTIONS; ++timer.section) {
+    frame->value_frame = start_config_value(
+        timer.section, 0, 0, 99, &Nixie_Display::display_timer_select);
+    COROUTINE_CALL(&frame->co, get_config_value(frame->value_frame));
+    timer.duration[timer.section] = finish_config_value(frame->value_frame);
 
     Nixie_Display::get_instance().display_value(
-        timer_duration[0], timer_duration[1], timer_duration[2]);
+        timer.duration[0], timer.duration[1], timer.duration[2]);
+  }
+  g_blink_dot_separators = false;
+
+  {
+    uint32_t duration_s = (timer.duration[0] * 60 * 60) +
+                          (timer.duration[1] * 60) + timer.duration[2];
+
+    if (!duration_s) {
+      // A zero duration cancels all of the running timers
+      debug_serial_println("Cancelling all countdown timers");
+      cancel_countdown_timers();
+    } else if (!start_countdown_timer(duration_s)) {
+      // The countdown runs in the background so the clock keeps running
+      debug_serial_println("All countdown timers are already running");
+    }
   }
-  vTaskSuspend(g_task_blink_dot_separators_handle);
-
-  // Form the struct to manage the timer countdown
-  // Initialize unused timer struct members to known safe values
-  struct tm timer;
-  timer.tm_yday = 233;
-  timer.tm_wday = 5;
-  timer.tm_year = 120;
-  timer.tm_mon = 7;
-  timer.tm_mday = 21;
-
-  // Initialize the timer struct members that are actually displayed
-  timer.tm_hour = timer_duration[0];
-  timer.tm_min = timer_duration[1];
-  timer.tm_sec = timer_duration[2];
-
-  debug_serial_printf(
-      "timer:\n\ttm_isdst: %d\n\ttm_yday: %d\n\ttm_wday: %d\n\ttm_year: "
-      "%d\n\ttm_mon: %d\n\ttm_mday: %d\n\ttm_hour: %d\n\ttm_min: %d\n\ttm_sec: "
-      "%d\n",
-      timer.tm_isdst, timer.tm_yday, timer.tm_wday, timer.tm_year, timer.tm_mon,
-      timer.tm_mday, timer.tm_hour, timer.tm_min, timer.tm_sec);
-
-  // Countdown the timer
-  while (timer.tm_hour != 0 || timer.tm_min != 0 || timer.tm_sec != 0) {
-    vTaskDelay(1000 / portTICK_PERIOD_MS);
-
-    // Count down a second and normalize the time struct
-    Nixie_Display::get_offset_time(&timer, timer, -1);
-
-    Nixie_Display::get_instance().display_value(timer.tm_hour, timer.tm_min,
-                                                timer.tm_sec);
-
-    // Exit timer mode if the encoder switch was pressed
-    if (xSemaphoreTake(g_semaphore_configure, 0) == pdTRUE) {
-      buzzer_click();
-      return;
+
+  COROUTINE_END(&frame->co);
+}
+
+static coroutine_status_t stopwatch_mode(special_mode_frame_t* frame) {
+  stopwatch_mode_t& stopwatch = frame->stopwatch;
+
+  COROUTINE_BEGIN(&frame->co);
+
+  Nixie_Display::get_instance().display_value(0, 0, 0);
+
+  // Start on the first press
+  COROUTINE_AWAIT(&frame->co, coroutine_take_input_event());
+  stopwatch.start_us = g_rotary_encoder_switch_press_us;
+  buzzer_play(&c_buzzer_pattern_click);
+
+  stopwatch.next_frame_us = esp_timer_get_time();
+  while (!stopwatch.stop_us) {
+    // Sleep until the next frame is due. A press wakes the UI task up
+    // immediately, so the latency to freeze the display is bounded by the ISR
+    // and a context switch rather than by the frame period
+    COROUTINE_AWAIT(&frame->co,
+                    (frame->pressed = coroutine_take_input_event()) ||
+                        coroutine_wait_until(stopwatch.next_frame_us));
+
+    if (frame->pressed) {
+      {
+        // Laps and the stop time come from the timestamp taken in the ISR
+        stopwatch.press_us = g_rotary_encoder_switch_press_us;
+        display_stopwatch_time(stopwatch.press_us - stopwatch.start_us,
+                               NIXIE_DOTS_BOTTOM);
+
+        int64_t latency_us = esp_timer_get_time() - stopwatch.press_us;
+        if (latency_us > stopwatch.max_latency_us) {
+          stopwatch.max_latency_us = latency_us;
+        }
+        deferred_printfln("Stopwatch ISR to freeze latency: %d us",
+                          (int32_t)latency_us);
+      }
+
+      buzzer_play(&c_buzzer_pattern_click);
+
+      // A long press stops the stopwatch, a short one records a lap
+      COROUTINE_DELAY(&frame->co, frame->deadline_us, STOPWATCH_LONG_PRESS_MS);
+      if (digitalRead(c_rotary_encoder_switch_pin) == LOW) {
+        stopwatch.stop_us = stopwatch.press_us;
+      } else {
+        if (stopwatch.num_laps < STOPWATCH_MAX_LAPS) {
+          stopwatch.laps_us[stopwatch.num_laps++] =
+              stopwatch.press_us - stopwatch.start_us;
+        }
+        stopwatch.frozen_until_us =
+            stopwatch.press_us +
+            (STOPWATCH_LAP_HOLD_MS * MILLISECOND_TO_MICROSECONDS);
+      }
+
+      stopwatch.next_frame_us = esp_timer_get_time();
+      continue;
     }
+
+    {
+      int64_t now_us = esp_timer_get_time();
+      if (now_us >= stopwatch.frozen_until_us) {
+        display_stopwatch_time(now_us - stopwatch.start_us, NIXIE_DOTS_ALL);
+      }
+
+      stopwatch.next_frame_us +=
+          STOPWATCH_FRAME_PERIOD_MS * MILLISECOND_TO_MICROSECONDS;
+      if (stopwatch.next_frame_us < now_us) {
+        // Fell behind. Skip the missed frames rather than catching up
+        stopwatch.next_frame_us = now_us;
+      }
+    }
+  }
+
+  debug_serial_printfln(
+      "Stopwatch stopped: %lld us\tmax ISR to freeze latency: %lld us",
+      stopwatch.stop_us - stopwatch.start_us, stopwatch.max_latency_us);
+
+  // The release of the long press must not exit the lap browser
+  coroutine_clear_input_event();
+
+  // Position 0 is the total time, followed by each of the laps
+  stopwatch.position = 0;
+  display_stopwatch_time(stopwatch.stop_us - stopwatch.start_us,
+                         NIXIE_DOTS_ALL);
+
+  while (!coroutine_take_input_event()) {
+    if (read_lap_browser_step(&stopwatch)) {
+      buzzer_play(&c_buzzer_pattern_click);
+
+      if (stopwatch.position == 0) {
+        display_stopwatch_time(stopwatch.stop_us - stopwatch.start_us,
+                               NIXIE_DOTS_ALL);
+      } else {
+        // Show the lap number before the lap time
+        Nixie_Display::get_instance().display_config_value(stopwatch.position,
+                                                           0);
+        COROUTINE_DELAY(&frame->co, frame->deadline_us,
+                        STOPWATCH_LAP_NUMBER_HOLD_MS);
+        display_stopwatch_time(stopwatch.laps_us[stopwatch.position - 1],
+                               NIXIE_DOTS_BOTTOM);
+      }
+    }
+
+    COROUTINE_DELAY(&frame->co, frame->deadline_us, 1);
   }
 
-  // Countdown is finished. Sound the buzzer and exit
-  const size_t timer_buzzer_duration_ms = 10 * 1000;
-  const size_t num_buzzer_cycles = 150;
-  double buzzer_cycle_delay_ms =
-      timer_buzzer_duration_ms / (double)num_buzzer_cycles;
+  buzzer_play(&c_buzzer_pattern_click);
+
+  COROUTINE_END(&frame->co);
+}
+
+static void display_stopwatch_time(int64_t elapsed_us, uint8_t nixie_dots) {
+  int64_t hundredths = elapsed_us / (10 * MILLISECOND_TO_MICROSECONDS);
+  int64_t seconds = hundredths / 100;
+
+  if (seconds < 60 * 60) {
+    // Minutes, seconds and hundredths
+    Nixie_Display::get_instance().display_value(
+        seconds / 60, seconds % 60, hundredths % 100, nixie_dots);
+  } else {
+    // Hours, minutes and seconds
+    Nixie_Display::get_instance().display_value(
+        (seconds / (60 * 60)) % 100, (seconds / 60) % 60, seconds % 60,
+        nixie_dots == NIXIE_DOTS_ALL ? NIXIE_DOTS_TOP : nixie_dots);
+  }
+}
+
+// Move through the laps with the encoder. Returns true on a step
+static bool read_lap_browser_step(stopwatch_mode_t* stopwatch) {
+  int8_t step = read_rotary_encoder_step(&stopwatch->encoder_state);
+  if (!step) {
+    return false;
+  }
+
+  stopwatch->position += step;
+  if (stopwatch->position < 0) {
+    stopwatch->position = 0;
+  }
+  if (stopwatch->position > (int)stopwatch->num_laps) {
+    stopwatch->position = stopwatch->num_laps;
+  }
+  return true;
+}
+
+static coroutine_status_t alarm_mode(special_mode_frame_t* frame) {
+  alarm_mode_t& alarm_select = frame->alarm_select;
+
+  COROUTINE_BEGIN(&frame->co);
+
+  g_blink_dot_separators = true;
+
+  frame->value_frame = start_config_value(
+      1, 1, 1, MAX_ALARMS, &Nixie_Display::display_config_value);
+  COROUTINE_CALL(&frame->co, get_config_value(frame->value_frame));
+  alarm_select.alarm_number = finish_config_value(frame->value_frame);
+
+  get_alarm(alarm_select.alarm_number - 1, &alarm_select.alarm);
+
+  frame->value_frame =
+      start_config_value(2, alarm_select.alarm.hour, 0, 23,
+                         &Nixie_Display::display_config_value);
+  COROUTINE_CALL(&frame->co, get_config_value(frame->value_frame));
+  alarm_select.alarm.hour = finish_config_value(frame->value_frame);
+
+  frame->value_frame =
+      start_config_value(3, alarm_select.alarm.minute, 0, 59,
+                         &Nixie_Display::display_config_value);
+  COROUTINE_CALL(&frame->co, get_config_value(frame->value_frame));
+  alarm_select.alarm.minute = finish_config_value(frame->value_frame);
+
+  alarm_select.repeat = 0;
+  if (alarm_select.alarm.enabled) {
+    // Alarms that don't match an option show up as daily
+    alarm_select.repeat = 2;
+    for (size_t i = 1; i < NUM_ELEMENTS(c_alarm_repeat_masks); ++i) {
+      if (c_alarm_repeat_masks[i] == alarm_select.alarm.weekday_mask) {
+        alarm_select.repeat = i;
+        break;
+      }
+    }
+  }
+  frame->value_frame = start_config_value(
+      4, alarm_select.repeat, 0, NUM_ELEMENTS(c_alarm_repeat_masks) - 1,
+      &Nixie_Display::display_config_value);
+  COROUTINE_CALL(&frame->co, get_config_value(frame->value_frame));
+  alarm_select.repeat = finish_config_value(frame->value_frame);
+
+  g_blink_dot_separators = false;
+
+  alarm_select.alarm.enabled = alarm_select.repeat != 0;
+  alarm_select.alarm.weekday_mask = c_alarm_repeat_masks[alarm_select.repeat];
+  set_alarm(alarm_select.alarm_number - 1, alarm_select.alarm);
+
+  COROUTINE_END(&frame->co);
+}
+
+static coroutine_status_t divergence_meter_mode(special_mode_frame_t* frame) {
+  COROUTINE_BEGIN(&frame->co);
+
+  {
+    // The animation keeps its own frame timing, so it runs to completion
+    uint32_t seed = esp_random();
+    run_divergence_meter(seed ? seed : 1);
+  }
+
+  // Hold the result until it times out or the switch is pressed
+  frame->deadline_us = esp_timer_get_time() +
+                       (DIVERGENCE_METER_HOLD_MS * MILLISECOND_TO_MICROSECONDS);
+  COROUTINE_AWAIT(&frame->co,
+                  (frame->pressed = coroutine_take_input_event()) ||
+                      coroutine_wait_until(frame->deadline_us));
+  if (frame->pressed) {
+    buzzer_play(&c_buzzer_pattern_click);
+  }
+
+  COROUTINE_END(&frame->co);
+}
+
+void run_divergence_meter(uint32_t seed) {
+  static const size_t num_tubes = Nixie_Display::num_display_digits;
+  static Deadline_Timer frame_timer;
+
+  // Each tube has its own PRNG stream so its rolls only depend on the seed,
+  // never on how the frames of the other tubes interleave
+  uint32_t prng_states[num_tubes];
+  uint8_t digits[num_tubes];
+  int64_t intervals_us[num_tubes];
+  int64_t next_roll_us[num_tubes];
+  int64_t lock_us[num_tubes];
+  bool locked[num_tubes];
+
+  int64_t start_us = esp_timer_get_time();
+
+  for (size_t i = 0; i < num_tubes; ++i) {
+    prng_states[i] = seed ^ (0x9e3779b9 * (i + 1));
+    if (!prng_states[i]) {
+      prng_states[i] = 1;
+    }
+
+    digits[i] = xorshift32(&prng_states[i]) % 10;
+    intervals_us[i] =
+        DIVERGENCE_METER_INITIAL_INTERVAL_MS * MILLISECOND_TO_MICROSECONDS;
+    next_roll_us[i] = start_us + intervals_us[i];
+    lock_us[i] = start_us + ((DIVERGENCE_METER_FIRST_LOCK_MS +
+                              (i * DIVERGENCE_METER_LOCK_STAGGER_MS)) *
+                             MILLISECOND_TO_MICROSECONDS);
+    locked[i] = false;
+  }
+
+  Nixie_Display::get_instance().display_digits(digits);
+
+  size_t num_locked = 0;
+  while (num_locked < num_tubes) {
+    // Sleep until the next tube is due to roll
+    int64_t next_frame_us = INT64_MAX;
+    for (size_t i = 0; i < num_tubes; ++i) {
+      if (!locked[i] && next_roll_us[i] < next_frame_us) {
+        next_frame_us = next_roll_us[i];
+      }
+    }
+    frame_timer.sleep_until(next_frame_us);
+
+    for (size_t i = 0; i < num_tubes; ++i) {
+      if (locked[i] || next_roll_us[i] > next_frame_us) {
+        continue;
+      }
+
+      uint32_t random = xorshift32(&prng_states[i]);
+
+      intervals_us[i] =
+          ((intervals_us[i] * DIVERGENCE_METER_INTERVAL_GROWTH_PERCENT) / 100) +
+          ((random >> 8) % (DIVERGENCE_METER_INTERVAL_SPREAD_MS *
+                            MILLISECOND_TO_MICROSECONDS));
+      // No slower than the stagger, so each tube's last roll comes after the
+      // tube to its left has locked
+      if (intervals_us[i] >
+          DIVERGENCE_METER_LOCK_STAGGER_MS * MILLISECOND_TO_MICROSECONDS) {
+        intervals_us[i] =
+            DIVERGENCE_METER_LOCK_STAGGER_MS * MILLISECOND_TO_MICROSECONDS;
+      }
+      next_roll_us[i] += intervals_us[i];
+
+      // The next roll would be past the lock time, so this is the final digit.
+      // The leftmost tube only ever locks on 0 or 1, like a divergence value
+      if (next_roll_us[i] >= lock_us[i]) {
+        locked[i] = true;
+        ++num_locked;
+        digits[i] = (i == 0) ? random % 2 : random % 10;
+      } else {
+        // Always show a different digit so every roll is visible
+        digits[i] = (digits[i] + 1 + (random % 9)) % 10;
+      }
+    }
 
-  for (size_t i = 0; i < num_buzzer_cycles; ++i) {
-    buzzer_click();
-    vTaskDelay(buzzer_cycle_delay_ms / portTICK_PERIOD_MS);
+    Nixie_Display::get_instance().display_digits(digits);
   }
 }
@@ -0,0 +1,80 @@
+#include "status_server.h"
+
+#include <esp_http_server.h>
+
+#include "arduino_debug.h"
+#include "metrics.h"
+#include "tasks.h"
+
+static httpd_handle_t s_server = NULL;
+
+// The server handles one request at a time on its own task, so a single
+// preallocated response buffer is enough
+static char s_response[STATUS_SERVER_BUFFER_SIZE];
+
+// Rather than a response that doesn't parse, when it outgrows the buffer
+static esp_err_t send_too_large(httpd_req_t* request) {
+  debug_serial_printfln("%s doesn't fit in %u bytes", request->uri,
+                        sizeof(s_response));
+  return httpd_resp_send_err(request, HTTPD_500_INTERNAL_SERVER_ERROR,
+                             "Response too large");
+}
+
+static esp_err_t handle_metrics(httpd_req_t* request) {
+  size_t length = render_metrics(s_response, sizeof(s_response));
+  if (!length) {
+    return send_too_large(request);
+  }
+  httpd_resp_set_type(request, "text/plain; version=0.0.4");
+  return httpd_resp_send(request, s_response, length);
+}
+
+static esp_err_t handle_status(httpd_req_t* request) {
+  size_t length = render_status(s_response, sizeof(s_response));
+  if (!length) {
+    return send_too_large(request);
+  }
+  httpd_resp_set_type(request, "application/json");
+  return httpd_resp_send(request, s_response, length);
+}
+
+void start_status_server() {
+  if (s_server) {
+    return;
+  }
+
+  httpd_config_t config = HTTPD_DEFAULT_CONFIG();
+  config.server_port = STATUS_SERVER_PORT;
+  config.core_id = NETWORK_CORE;
+  config.max_open_sockets = 2;
+
+  if (httpd_start(&s_server, &config) != ESP_OK) {
+    debug_serial_println("Failed to start the status server");
+    s_server = NULL;
+    return;
+  }
+
+  httpd_uri_t metrics_uri = {};
+  metrics_uri.uri = "/metrics";
+  metrics_uri.method = HTTP_GET;
+  metrics_uri.handler = handle_metrics;
+  httpd_register_uri_handler(s_server, &metrics_uri);
+
+  httpd_uri_t status_uri = {};
+  status_uri.uri = "/status";
+  status_uri.method = HTTP_GET;
+  status_uri.handler = handle_status;
+  httpd_register_uri_handler(s_server, &status_uri);
+
+  debug_serial_printfln("Status server listening on port %d",
+                        STATUS_SERVER_PORT);
+}
+
+void stop_status_server() {
+  if (!s_server) {
+    return;
+  }
+
+  httpd_stop(s_server);
+  s_server = NULL;
+}
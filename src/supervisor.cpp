@@ -0,0 +1,244 @@
+#include "supervisor.h"
+
+#include <esp32/rom/crc.h>
+#include <esp_attr.h>
+#include <esp_system.h>
+#include <esp_task_wdt.h>
+#include <esp_timer.h>
+#include <stddef.h>
+
+#include "arduino_debug.h"
+#include "event_log.h"
+
+#define STALL_RECORD_MAGIC 0x4e495853  // "NIXS"
+
+typedef struct {
+  TaskHandle_t task;  // NULL until registered
+  uint32_t deadline_ms;
+  int64_t last_us;
+  int64_t max_gap_us;
+  bool active;
+} heartbeat_t;
+
+typedef struct {
+  uint32_t magic;
+  uint32_t heartbeat_id;
+  uint32_t gap_ms;
+  uint32_t deadline_ms;
+  uint32_t logged;  // Whether it made it into the event log before the reset
+  uint32_t crc;
+} stall_record_t;
+
+// Indexed by heartbeat_id_t
+static const char* const c_heartbeat_names[NUM_HEARTBEATS] = {
+    "time_service", "display_time", "ui",
+    "display_jobs", "network_jobs", "tubes_off"};
+
+static heartbeat_t s_heartbeats[NUM_HEARTBEATS];
+static bool s_paused = false;
+static portMUX_TYPE s_heartbeat_mux = portMUX_INITIALIZER_UNLOCKED;
+
+// Only touched by the supervisor task once it runs
+static bool s_stalled = false;
+
+// Not initialized on reset, so it holds garbage after power on. The CRC tells
+// the two apart
+RTC_NOINIT_ATTR static stall_record_t s_stall_record;
+
+static uint32_t get_stall_record_crc(const stall_record_t& record) {
+  return crc32_le(0, reinterpret_cast<const uint8_t*>(&record),
+                  offsetof(stall_record_t, crc));
+}
+
+static bool is_stall_record_valid() {
+  return s_stall_record.magic == STALL_RECORD_MAGIC &&
+         s_stall_record.crc == get_stall_record_crc(s_stall_record) &&
+         s_stall_record.heartbeat_id < NUM_HEARTBEATS;
+}
+
+// With the mux held
+static heartbeat_t* find_heartbeat(TaskHandle_t task) {
+  for (size_t i = 0; i < NUM_HEARTBEATS; ++i) {
+    if (s_heartbeats[i].task == task) {
+      return &s_heartbeats[i];
+    }
+  }
+  return NULL;
+}
+
+void setup_supervisor() {
+  if (esp_reset_reason() != ESP_RST_POWERON && is_stall_record_valid()) {
+    debug_serial_printfln(
+        "Reset after %s stalled: no heartbeat for %u ms (deadline: %u ms)",
+        c_heartbeat_names[s_stall_record.heartbeat_id], s_stall_record.gap_ms,
+        s_stall_record.deadline_ms);
+    if (!s_stall_record.logged) {
+      log_event(EVENT_TASK_STALLED, s_stall_record.heartbeat_id,
+                s_stall_record.gap_ms);
+    }
+  }
+  s_stall_record.magic = 0;
+
+  // The task watchdog only prints a warning by default
+  esp_err_t err = esp_task_wdt_init(SUPERVISOR_WATCHDOG_TIMEOUT_S, true);
+  if (err != ESP_OK) {
+    debug_serial_printfln("Failed to configure the task watchdog: %s",
+                          esp_err_to_name(err));
+  }
+}
+
+void register_heartbeat(heartbeat_id_t id, uint32_t deadline_ms) {
+  portENTER_CRITICAL(&s_heartbeat_mux);
+  s_heartbeats[id].task = xTaskGetCurrentTaskHandle();
+  s_heartbeats[id].deadline_ms = deadline_ms;
+  s_heartbeats[id].last_us = esp_timer_get_time();
+  s_heartbeats[id].active = true;
+  portEXIT_CRITICAL(&s_heartbeat_mux);
+}
+
+void heartbeat() {
+  TaskHandle_t task = xTaskGetCurrentTaskHandle();
+  int64_t now_us = esp_timer_get_time();
+
+  portENTER_CRITICAL(&s_heartbeat_mux);
+  heartbeat_t* heartbeat = find_heartbeat(task);
+  if (heartbeat) {
+    int64_t gap_us = now_us - heartbeat->last_us;
+    if (heartbeat->active && gap_us > heartbeat->max_gap_us) {
+      heartbeat->max_gap_us = gap_us;
+    }
+    heartbeat->last_us = now_us;
+    heartbeat->active = true;
+  }
+  portEXIT_CRITICAL(&s_heartbeat_mux);
+}
+
+TickType_t get_heartbeat_timeout() {
+  TaskHandle_t task = xTaskGetCurrentTaskHandle();
+
+  portENTER_CRITICAL(&s_heartbeat_mux);
+  heartbeat_t* heartbeat = find_heartbeat(task);
+  uint32_t deadline_ms = heartbeat ? heartbeat->deadline_ms : 0;
+  portEXIT_CRITICAL(&s_heartbeat_mux);
+
+  // Half the deadline leaves the other half for the work after waking up
+  return deadline_ms ? deadline_ms / 2 / portTICK_PERIOD_MS : portMAX_DELAY;
+}
+
+BaseType_t take_with_heartbeats(SemaphoreHandle_t semaphore) {
+  TickType_t timeout = get_heartbeat_timeout();
+  while (xSemaphoreTake(semaphore, timeout) != pdTRUE) {
+    heartbeat();
+  }
+  return pdTRUE;
+}
+
+void pause_heartbeat(heartbeat_id_t id) {
+  portENTER_CRITICAL(&s_heartbeat_mux);
+  s_heartbeats[id].active = false;
+  portEXIT_CRITICAL(&s_heartbeat_mux);
+}
+
+void pause_supervision() {
+  portENTER_CRITICAL(&s_heartbeat_mux);
+  s_paused = true;
+  portEXIT_CRITICAL(&s_heartbeat_mux);
+}
+
+void resume_supervision() {
+  int64_t now_us = esp_timer_get_time();
+
+  portENTER_CRITICAL(&s_heartbeat_mux);
+  for (size_t i = 0; i < NUM_HEARTBEATS; ++i) {
+    s_heartbeats[i].last_us = now_us;
+  }
+  s_paused = false;
+  portEXIT_CRITICAL(&s_heartbeat_mux);
+}
+
+bool get_heartbeat_stats(heartbeat_id_t id, heartbeat_stats_t* stats) {
+  int64_t now_us = esp_timer_get_time();
+
+  portENTER_CRITICAL(&s_heartbeat_mux);
+  const heartbeat_t& heartbeat = s_heartbeats[id];
+  bool registered = heartbeat.task != NULL;
+  stats->deadline_ms = heartbeat.deadline_ms;
+  stats->max_gap_us = heartbeat.max_gap_us;
+  stats->gap_us = heartbeat.active ? now_us - heartbeat.last_us : 0;
+  portEXIT_CRITICAL(&s_heartbeat_mux);
+
+  return registered;
+}
+
+const char* get_heartbeat_name(heartbeat_id_t id) {
+  return c_heartbeat_names[id];
+}
+
+static void record_stall(size_t id, int64_t gap_us, uint32_t deadline_ms) {
+  // Into RTC memory first, since logging it may block on the stalled task
+  uint32_t gap_ms = gap_us / 1000;
+  s_stall_record.magic = STALL_RECORD_MAGIC;
+  s_stall_record.heartbeat_id = id;
+  s_stall_record.gap_ms = gap_ms;
+  s_stall_record.deadline_ms = deadline_ms;
+  s_stall_record.logged = false;
+  s_stall_record.crc = get_stall_record_crc(s_stall_record);
+
+  debug_serial_printfln(
+      "%s stalled: no heartbeat for %u ms (deadline: %u ms). Resetting",
+      c_heartbeat_names[id], gap_ms, deadline_ms);
+
+  log_event(EVENT_TASK_STALLED, id, gap_ms > INT32_MAX ? INT32_MAX : gap_ms);
+  flush_event_log();
+
+  s_stall_record.logged = true;
+  s_stall_record.crc = get_stall_record_crc(s_stall_record);
+}
+
+static void check_heartbeats() {
+  int64_t now_us = esp_timer_get_time();
+  size_t stalled_id = NUM_HEARTBEATS;
+  int64_t stalled_gap_us = 0;
+  uint32_t stalled_deadline_ms = 0;
+
+  portENTER_CRITICAL(&s_heartbeat_mux);
+  for (size_t i = 0; i < NUM_HEARTBEATS && !s_paused; ++i) {
+    const heartbeat_t& heartbeat = s_heartbeats[i];
+    int64_t gap_us = now_us - heartbeat.last_us;
+    if (heartbeat.task && heartbeat.active &&
+        gap_us > heartbeat.deadline_ms * 1000LL) {
+      stalled_id = i;
+      stalled_gap_us = gap_us;
+      stalled_deadline_ms = heartbeat.deadline_ms;
+      break;
+    }
+  }
+  portEXIT_CRITICAL(&s_heartbeat_mux);
+
+  if (stalled_id == NUM_HEARTBEATS) {
+    esp_task_wdt_reset();
+    return;
+  }
+
+  // The watchdog resets the chip from here on
+  s_stalled = true;
+  record_stall(stalled_id, stalled_gap_us, stalled_deadline_ms);
+}
+
+void run_supervisor() {
+  // Only this task resets the task watchdog on behalf of the supervised
+  // ones. The idle tasks stay subscribed, so a core starved of idle time
+  // still resets the chip
+  esp_err_t err = esp_task_wdt_add(NULL);
+  if (err != ESP_OK) {
+    debug_serial_printfln("Failed to subscribe to the task watchdog: %s",
+                          esp_err_to_name(err));
+  }
+
+  for (;;) {
+    if (!s_stalled) {
+      check_heartbeats();
+    }
+    vTaskDelay(SUPERVISOR_CHECK_PERIOD_MS / portTICK_PERIOD_MS);
+  }
+}
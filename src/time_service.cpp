@@ -0,0 +1,94 @@
+#include "time_service.h"
+
+#include <esp_timer.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include <atomic>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "time_zone.h"
+
+// Odd while a snapshot is being written
+static std::atomic<uint32_t> s_sequence(0);
+static time_snapshot_t s_snapshot;
+
+// Keeps the writer from being preempted by a reader on its own core, which
+// would otherwise retry forever
+static portMUX_TYPE s_publish_mux = portMUX_INITIALIZER_UNLOCKED;
+
+static esp_timer_handle_t s_second_edge_timer = NULL;
+
+static void on_second_edge(void* arg) {
+  int64_t delay_us = publish_time_snapshot() - esp_timer_get_time();
+  esp_timer_start_once(s_second_edge_timer, delay_us > 0 ? delay_us : 1);
+}
+
+void setup_time_service() {
+  esp_timer_create_args_t timer_args = {};
+  timer_args.callback = on_second_edge;
+  timer_args.name = "time_service";
+  esp_timer_create(&timer_args, &s_second_edge_timer);
+
+  on_second_edge(NULL);
+}
+
+int64_t publish_time_snapshot() {
+  time_snapshot_t snapshot;
+
+  struct timeval now;
+  gettimeofday(&now, NULL);
+  int64_t now_us = esp_timer_get_time();
+
+  snapshot.epoch = now.tv_sec;
+  snapshot.second_start_us = now_us - now.tv_usec;
+  snapshot.valid = now.tv_sec >= LOCAL_TIME_MIN_VALID_EPOCH;
+  local_time(now.tv_sec, &snapshot.local_time);
+
+  portENTER_CRITICAL(&s_publish_mux);
+  uint32_t sequence = s_sequence.load(std::memory_order_relaxed);
+  s_sequence.store(sequence + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  memcpy(&s_snapshot, &snapshot, sizeof(s_snapshot));
+  s_sequence.store(sequence + 2, std::memory_order_release);
+  portEXIT_CRITICAL(&s_publish_mux);
+
+  return snapshot.second_start_us + 1000000 + TIME_SERVICE_EDGE_MARGIN_US;
+}
+
+bool get_time_snapshot(time_snapshot_t* snapshot) {
+  uint32_t sequence;
+  do {
+    sequence = s_sequence.load(std::memory_order_acquire);
+    memcpy(snapshot, &s_snapshot, sizeof(*snapshot));
+    std::atomic_thread_fence(std::memory_order_acquire);
+  } while ((sequence & 1) ||
+           sequence != s_sequence.load(std::memory_order_relaxed));
+
+  return snapshot->valid;
+}
+
+bool get_current_local_time(struct tm* time_info) {
+  time_snapshot_t snapshot;
+  bool valid = get_time_snapshot(&snapshot);
+
+  // Each publish is due TIME_SERVICE_EDGE_MARGIN_US after the second edge
+  for (int i = 0; i < 2000 / portTICK_PERIOD_MS &&
+                  get_subsecond_us(snapshot, esp_timer_get_time()) >
+                      1000000 + 2 * TIME_SERVICE_EDGE_MARGIN_US;
+       ++i) {
+    vTaskDelay(1);
+    valid = get_time_snapshot(&snapshot);
+  }
+
+  *time_info = snapshot.local_time;
+  return valid;
+}
+
+bool get_snapshot_local_time(struct tm* time_info) {
+  time_snapshot_t snapshot;
+  bool valid = get_time_snapshot(&snapshot);
+  *time_info = snapshot.local_time;
+  return valid;
+}
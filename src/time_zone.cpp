@@ -0,0 +1,355 @@
+#include "time_zone.h"
+
+#include <ctype.h>
+#include <stdlib.h>
+
+#include "arduino_debug.h"
+#include "freertos/FreeRTOS.h"
+
+#define SECONDS_PER_DAY 86400
+#define DEFAULT_TRANSITION_TIME_S (2 * 60 * 60)
+
+// Used when a DST name is given without rules, as newlib does
+static const char* const c_default_dst_rules = "M3.2.0,M11.1.0";
+
+static time_zone_t s_time_zone;
+static bool s_time_zone_valid = false;
+
+// The span containing the last converted time. Shared between tasks
+static time_zone_span_t s_span = {0, 0, 0, false};
+static portMUX_TYPE s_span_mux = portMUX_INITIALIZER_UNLOCKED;
+
+// Howard Hinnant's days_from_civil() and civil_from_days()
+int64_t days_from_civil(int64_t year, unsigned month, unsigned day) {
+  year -= month <= 2;
+  const int64_t era = (year >= 0 ? year : year - 399) / 400;
+  const unsigned year_of_era = static_cast<unsigned>(year - era * 400);
+  const unsigned day_of_year =
+      (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+  const unsigned day_of_era =
+      year_of_era * 365 + year_of_era / 4 - year_of_era / 100 + day_of_year;
+  return era * 146097 + static_cast<int64_t>(day_of_era) - 719468;
+}
+
+static void civil_from_days(int64_t days, int64_t* year, unsigned* month,
+                            unsigned* day) {
+  days += 719468;
+  const int64_t era = (days >= 0 ? days : days - 146096) / 146097;
+  const unsigned day_of_era = static_cast<unsigned>(days - era * 146097);
+  const unsigned year_of_era =
+      (day_of_era - day_of_era / 1460 + day_of_era / 36524 -
+       day_of_era / 146096) /
+      365;
+  const unsigned day_of_year =
+      day_of_era - (365 * year_of_era + year_of_era / 4 - year_of_era / 100);
+  const unsigned month_index = (5 * day_of_year + 2) / 153;
+  *day = day_of_year - (153 * month_index + 2) / 5 + 1;
+  *month = month_index < 10 ? month_index + 3 : month_index - 9;
+  *year = static_cast<int64_t>(year_of_era) + era * 400 + (*month <= 2);
+}
+
+// 0 is Sunday
+static unsigned weekday_from_days(int64_t days) {
+  return static_cast<unsigned>(days >= -4 ? (days + 4) % 7
+                                          : (days + 5) % 7 + 6);
+}
+
+static bool is_leap_year(int64_t year) {
+  return (year % 4 == 0 && year % 100 != 0) || year % 400 == 0;
+}
+
+static unsigned days_in_month(int64_t year, unsigned month) {
+  static const uint8_t c_days_in_month[12] = {31, 28, 31, 30, 31, 30,
+                                              31, 31, 30, 31, 30, 31};
+  return c_days_in_month[month - 1] + (month == 2 && is_leap_year(year));
+}
+
+static int64_t floor_divide(int64_t value, int64_t divisor) {
+  return value >= 0 ? value / divisor : -((-value + divisor - 1) / divisor);
+}
+
+static const char* parse_number(const char* p, int min, int max, int* value) {
+  if (!isdigit(static_cast<unsigned char>(*p))) {
+    return NULL;
+  }
+
+  *value = 0;
+  for (int digits = 0; isdigit(static_cast<unsigned char>(*p)); ++digits) {
+    if (digits == 3) {
+      return NULL;
+    }
+    *value = 10 * *value + (*p++ - '0');
+  }
+
+  return *value >= min && *value <= max ? p : NULL;
+}
+
+static const char* parse_name(const char* p) {
+  const char* start = p;
+
+  // Quoted names may contain digits and signs, e.g. <+0330>
+  if (*p == '<') {
+    for (++start, ++p; *p && *p != '>'; ++p) {
+    }
+    return *p == '>' && p - start >= 3 ? p + 1 : NULL;
+  }
+
+  for (; isalpha(static_cast<unsigned char>(*p)); ++p) {
+  }
+  return p - start >= 3 ? p : NULL;
+}
+
+// [+|-]hh[:mm[:ss]]
+static const char* parse_time(const char* p, int max_hours,
+                              int32_t* seconds) {
+  bool negative = *p == '-';
+  if (*p == '+' || *p == '-') {
+    ++p;
+  }
+
+  int hours = 0;
+  int minutes = 0;
+  int secs = 0;
+  p = parse_number(p, 0, max_hours, &hours);
+  if (p && *p == ':') {
+    p = parse_number(p + 1, 0, 59, &minutes);
+    if (p && *p == ':') {
+      p = parse_number(p + 1, 0, 59, &secs);
+    }
+  }
+  if (!p) {
+    return NULL;
+  }
+
+  *seconds = (negative ? -1 : 1) * (hours * 3600 + minutes * 60 + secs);
+  return p;
+}
+
+static const char* parse_rule(const char* p, time_zone_rule_t* rule) {
+  int month = 0;
+  int week = 0;
+  int weekday = 0;
+  int day = 0;
+
+  if (*p == 'M') {
+    rule->type = TIME_ZONE_RULE_MONTH;
+    p = parse_number(p + 1, 1, 12, &month);
+    if (!p || *p != '.' || !(p = parse_number(p + 1, 1, 5, &week)) ||
+        *p != '.' || !(p = parse_number(p + 1, 0, 6, &weekday))) {
+      return NULL;
+    }
+  } else if (*p == 'J') {
+    rule->type = TIME_ZONE_RULE_JULIAN;
+    p = parse_number(p + 1, 1, 365, &day);
+  } else {
+    rule->type = TIME_ZONE_RULE_ZERO_BASED;
+    p = parse_number(p, 0, 365, &day);
+  }
+  if (!p) {
+    return NULL;
+  }
+
+  rule->month = month;
+  rule->week = week;
+  rule->weekday = weekday;
+  rule->day = day;
+
+  rule->time_s = DEFAULT_TRANSITION_TIME_S;
+  if (*p == '/') {
+    p = parse_time(p + 1, 167, &rule->time_s);
+  }
+
+  return p;
+}
+
+bool parse_time_zone(const char* posix_tz, time_zone_t* zone) {
+  const char* p = parse_name(posix_tz);
+  int32_t offset_s;
+  if (!p || !(p = parse_time(p, 24, &offset_s))) {
+    return false;
+  }
+
+  // POSIX offsets are west of UTC
+  zone->std_offset_s = -offset_s;
+  zone->dst_offset_s = zone->std_offset_s;
+  zone->has_dst = false;
+
+  if (!*p) {
+    return true;
+  }
+
+  if (!(p = parse_name(p))) {
+    return false;
+  }
+  zone->has_dst = true;
+  zone->dst_offset_s = zone->std_offset_s + 3600;
+
+  if (*p && *p != ',') {
+    if (!(p = parse_time(p, 24, &offset_s))) {
+      return false;
+    }
+    zone->dst_offset_s = -offset_s;
+  }
+
+  if (!*p) {
+    p = c_default_dst_rules;
+  } else {
+    ++p;  // ','
+  }
+
+  p = parse_rule(p, &zone->dst_start);
+  if (!p || *p != ',') {
+    return false;
+  }
+  p = parse_rule(p + 1, &zone->dst_end);
+
+  return p && !*p;
+}
+
+// Days since the epoch of the day a rule falls on in the year
+static int64_t get_rule_day(const time_zone_rule_t& rule, int64_t year) {
+  int64_t first_day = days_from_civil(year, 1, 1);
+
+  switch (rule.type) {
+    case TIME_ZONE_RULE_JULIAN:
+      return first_day + rule.day - 1 + (is_leap_year(year) && rule.day >= 60);
+
+    case TIME_ZONE_RULE_ZERO_BASED:
+      return first_day + rule.day;
+
+    case TIME_ZONE_RULE_MONTH:
+    default:
+      break;
+  }
+
+  int64_t first_of_month = days_from_civil(year, rule.month, 1);
+  unsigned day = (rule.weekday + 7 - weekday_from_days(first_of_month)) % 7 +
+                 (rule.week - 1) * 7;
+  // Week 5 means the last matching weekday of the month
+  while (day >= days_in_month(year, rule.month)) {
+    day -= 7;
+  }
+
+  return first_of_month + day;
+}
+
+void get_time_zone_span(const time_zone_t& zone, int64_t utc,
+                        time_zone_span_t* span) {
+  if (!zone.has_dst) {
+    span->valid_from = INT64_MIN;
+    span->valid_until = INT64_MAX;
+    span->offset_s = zone.std_offset_s;
+    span->is_dst = false;
+    return;
+  }
+
+  int64_t year;
+  unsigned month;
+  unsigned day;
+  civil_from_days(floor_divide(utc, SECONDS_PER_DAY), &year, &month, &day);
+
+  // The transition table for the year: New Year, the two DST transitions and
+  // the next New Year. The start time is given in standard time and the end
+  // time in daylight time
+  int64_t year_start = days_from_civil(year, 1, 1) * SECONDS_PER_DAY;
+  int64_t year_end = days_from_civil(year + 1, 1, 1) * SECONDS_PER_DAY;
+  int64_t dst_start = get_rule_day(zone.dst_start, year) * SECONDS_PER_DAY +
+                      zone.dst_start.time_s - zone.std_offset_s;
+  int64_t dst_end = get_rule_day(zone.dst_end, year) * SECONDS_PER_DAY +
+                    zone.dst_end.time_s - zone.dst_offset_s;
+
+  // Southern hemisphere zones are in DST over New Year
+  bool dst_over_new_year = dst_end < dst_start;
+  int64_t first = dst_over_new_year ? dst_end : dst_start;
+  int64_t second = dst_over_new_year ? dst_start : dst_end;
+  first = first < year_start ? year_start : first;
+  second = second > year_end ? year_end : second;
+
+  if (utc < first) {
+    span->valid_from = year_start;
+    span->valid_until = first;
+    span->is_dst = dst_over_new_year;
+  } else if (utc < second) {
+    span->valid_from = first;
+    span->valid_until = second;
+    span->is_dst = !dst_over_new_year;
+  } else {
+    span->valid_from = second;
+    span->valid_until = year_end;
+    span->is_dst = dst_over_new_year;
+  }
+
+  span->offset_s = span->is_dst ? zone.dst_offset_s : zone.std_offset_s;
+}
+
+void offset_time_to_tm(int64_t utc, int32_t offset_s, bool is_dst,
+                       struct tm* time_info) {
+  int64_t local = utc + offset_s;
+  int64_t days = floor_divide(local, SECONDS_PER_DAY);
+  int32_t seconds_of_day = local - days * SECONDS_PER_DAY;
+
+  int64_t year;
+  unsigned month;
+  unsigned day;
+  civil_from_days(days, &year, &month, &day);
+
+  time_info->tm_sec = seconds_of_day % 60;
+  time_info->tm_min = (seconds_of_day / 60) % 60;
+  time_info->tm_hour = seconds_of_day / 3600;
+  time_info->tm_mday = day;
+  time_info->tm_mon = month - 1;
+  time_info->tm_year = year - 1900;
+  time_info->tm_wday = weekday_from_days(days);
+  time_info->tm_yday = days - days_from_civil(year, 1, 1);
+  time_info->tm_isdst = is_dst;
+}
+
+void set_time_zone(const char* posix_tz) {
+  // newlib still does the local to UTC conversions (mktime)
+  setenv("TZ", posix_tz, 1);
+  tzset();
+
+  s_time_zone_valid = parse_time_zone(posix_tz, &s_time_zone);
+  if (!s_time_zone_valid) {
+    debug_serial_printfln("Unsupported time zone, using newlib: %s",
+                          posix_tz);
+  }
+
+  portENTER_CRITICAL(&s_span_mux);
+  s_span.valid_from = 0;
+  s_span.valid_until = 0;
+  portEXIT_CRITICAL(&s_span_mux);
+}
+
+void local_time(time_t utc, struct tm* time_info) {
+  if (!s_time_zone_valid) {
+    localtime_r(&utc, time_info);
+    return;
+  }
+
+  time_zone_span_t span;
+  portENTER_CRITICAL(&s_span_mux);
+  span = s_span;
+  portEXIT_CRITICAL(&s_span_mux);
+
+  // Only recomputed at DST transitions and New Year
+  if (utc < span.valid_from || utc >= span.valid_until) {
+    get_time_zone_span(s_time_zone, utc, &span);
+
+    portENTER_CRITICAL(&s_span_mux);
+    s_span = span;
+    portEXIT_CRITICAL(&s_span_mux);
+  }
+
+  offset_time_to_tm(utc, span.offset_s, span.is_dst, time_info);
+}
+
+bool get_local_time(struct tm* time_info) {
+  time_t now = time(NULL);
+  if (now < LOCAL_TIME_MIN_VALID_EPOCH) {
+    return false;
+  }
+
+  local_time(now, time_info);
+  return true;
+}
@@ -0,0 +1,173 @@
+#include "tubes_off.h"
+
+#include <Arduino.h>
+#include <EEPROM.h>
+#include <WiFi.h>
+#include <driver/gpio.h>
+#include <esp_sleep.h>
+#include <esp_timer.h>
+
+#include "Nixie_Display.h"
+#include "alarms.h"
+#include "arduino_debug.h"
+#include "brightness.h"
+#include "config.h"
+#include "countdown_timers.h"
+#include "solar.h"
+#include "supervisor.h"
+#include "time_service.h"
+#include "util.h"
+
+static int64_t s_light_sleep_time_us = 0;
+
+static int64_t get_microseconds_until_hour(const struct tm& time_info,
+                                           int hour);
+static void show_time_on_wake();
+
+static bool is_solar_tubes_off_schedule() {
+  int16_t latitude;
+  int16_t longitude;
+  return EEPROM.read(EEPROM_SOLAR_SCHEDULE_ADDRESS) == 2 &&
+         get_location(&latitude, &longitude);
+}
+
+bool is_tubes_off_time(const struct tm& time_info) {
+  if (!is_hour_in_window(time_info.tm_hour,
+                         EEPROM.read(EEPROM_TUBES_OFF_START_HOUR_ADDRESS),
+                         EEPROM.read(EEPROM_TUBES_OFF_END_HOUR_ADDRESS))) {
+    return false;
+  }
+
+  // The tubes come on at sunrise if it is before the end of the window
+  return !is_solar_tubes_off_schedule() || is_sun_down(time_info);
+}
+
+void run_tubes_off_window() {
+  debug_serial_println("Tubes off");
+
+  Nixie_Display::set_brightness(0);
+  vTaskDelay(NIXIE_BRIGHTNESS_RAMP_TIME_MS / portTICK_PERIOD_MS);
+
+  const gpio_num_t switch_pin = (gpio_num_t)c_rotary_encoder_switch_pin;
+  int64_t window_start_us = esp_timer_get_time();
+  int64_t window_sleep_us = 0;
+
+  for (;;) {
+    heartbeat();
+
+    struct tm time_info;
+    if (!get_current_local_time(&time_info) || !is_tubes_off_time(time_info)) {
+      break;
+    }
+
+    // Light sleep cannot maintain a WiFi connection. Let any NTP sync or
+    // weather fetch on the network core finish first
+    if (WiFi.getMode() != WIFI_OFF) {
+      vTaskDelay(1000 / portTICK_PERIOD_MS);
+      continue;
+    }
+
+    // Wake up at the end of the window (or at sunrise), when the encoder
+    // switch is pressed or when a countdown timer or alarm is due (esp_timer
+    // does not run the chip out of an explicit light sleep)
+    int64_t sleep_us = get_microseconds_until_hour(
+        time_info, EEPROM.read(EEPROM_TUBES_OFF_END_HOUR_ADDRESS));
+    int64_t timer_remaining_us;
+    if (get_next_countdown_timer_remaining(&timer_remaining_us) &&
+        timer_remaining_us < sleep_us) {
+      sleep_us = timer_remaining_us;
+    }
+    if (get_next_alarm_remaining(&timer_remaining_us) &&
+        timer_remaining_us < sleep_us) {
+      sleep_us = timer_remaining_us;
+    }
+    if (is_solar_tubes_off_schedule() &&
+        get_next_solar_event_remaining(time_info, &timer_remaining_us) &&
+        timer_remaining_us < sleep_us) {
+      sleep_us = timer_remaining_us;
+    }
+    esp_sleep_enable_timer_wakeup(sleep_us > 0 ? sleep_us : 1);
+    gpio_wakeup_enable(switch_pin, GPIO_INTR_LOW_LEVEL);
+    esp_sleep_enable_gpio_wakeup();
+
+    int64_t sleep_start_us = esp_timer_get_time();
+    pause_supervision();
+    esp_light_sleep_start();
+    resume_supervision();
+    window_sleep_us += esp_timer_get_time() - sleep_start_us;
+
+    // Restore the edge triggered encoder switch interrupt
+    gpio_wakeup_disable(switch_pin);
+    gpio_set_intr_type(switch_pin, GPIO_INTR_NEGEDGE);
+    esp_sleep_disable_wakeup_source(ESP_SLEEP_WAKEUP_ALL);
+
+    if (esp_sleep_get_wakeup_cause() == ESP_SLEEP_WAKEUP_GPIO) {
+      show_time_on_wake();
+    }
+  }
+
+  s_light_sleep_time_us += window_sleep_us;
+
+  // Presses while the tubes were off should not open the configuration menu
+  xSemaphoreTake(g_semaphore_configure, 0);
+
+  int64_t window_us = esp_timer_get_time() - window_start_us;
+  debug_serial_printfln(
+      "Tubes on. Window: %lld s\tasleep: %lld s (%lld%%)\ttotal asleep since "
+      "boot: %lld s (%lld%% of uptime)",
+      window_us / 1000000, window_sleep_us / 1000000,
+      window_us ? (100 * window_sleep_us) / window_us : 0,
+      s_light_sleep_time_us / 1000000,
+      (100 * s_light_sleep_time_us) / esp_timer_get_time());
+
+  struct tm time_info;
+  Nixie_Display::set_brightness(get_snapshot_local_time(&time_info)
+                                    ? get_scheduled_brightness(time_info)
+                                    : NIXIE_MAX_BRIGHTNESS);
+}
+
+int64_t get_light_sleep_time_us() { return s_light_sleep_time_us; }
+
+static int64_t get_microseconds_until_hour(const struct tm& time_info,
+                                           int hour) {
+  struct tm end_time = time_info;
+  end_time.tm_hour = hour;
+  end_time.tm_min = 0;
+  end_time.tm_sec = 0;
+  if (hour <= time_info.tm_hour) {
+    ++end_time.tm_mday;
+  }
+
+  // mktime normalizes the day of the month and accounts for DST changes
+  struct tm current_time = time_info;
+  int64_t seconds =
+      (int64_t)difftime(mktime(&end_time), mktime(&current_time));
+
+  return (seconds > 0 ? seconds : 1) * 1000000;
+}
+
+static void show_time_on_wake() {
+  // The press that woke the clock up should not open the configuration menu
+  xSemaphoreTake(g_semaphore_configure, 0);
+
+  uint8_t hour_format = EEPROM.read(EEPROM_12_HOUR_FORMAT_ADDRESS);
+  uint8_t wake_duration = EEPROM.read(EEPROM_TUBES_OFF_WAKE_DURATION_ADDRESS);
+
+  for (uint8_t i = 0; i < wake_duration; ++i) {
+    heartbeat();
+    TickType_t previous_wake_time = xTaskGetTickCount();
+
+    struct tm time_info;
+    if (get_current_local_time(&time_info)) {
+      Nixie_Display::get_instance().display_time(time_info, hour_format);
+      if (i == 0) {
+        Nixie_Display::set_brightness(get_scheduled_brightness(time_info), 0);
+      }
+    }
+
+    vTaskDelayUntil(&previous_wake_time, 1000 / portTICK_PERIOD_MS);
+  }
+
+  Nixie_Display::set_brightness(0);
+  vTaskDelay(NIXIE_BRIGHTNESS_RAMP_TIME_MS / portTICK_PERIOD_MS);
+}
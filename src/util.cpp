@@ -2,11 +2,83 @@
 
 #include <Arduino.h>
 
+#include "arduino_debug.h"
+
 const size_t c_minute_freertos = (60 * (1024 / portTICK_PERIOD_MS));
-const int c_buzzer_pin = 18;
 
-void buzzer_click() {
-  digitalWrite(c_buzzer_pin, HIGH);
-  delayMicroseconds(1000);
-  digitalWrite(c_buzzer_pin, LOW);
+// Waits shorter than this are spun. Longer waits block until this much
+// before the deadline to absorb the esp_timer task wake up latency
+#define DEADLINE_TIMER_SPIN_US 150
+
+void Deadline_Timer::sleep_until(int64_t deadline_us) {
+  // Created on first use since esp_timer may not be initialized yet when
+  // static objects are constructed
+  if (!m_timer) {
+    m_semaphore = xSemaphoreCreateBinaryStatic(&m_semaphore_buffer);
+
+    esp_timer_create_args_t timer_args = {};
+    timer_args.callback = on_timeout;
+    timer_args.arg = m_semaphore;
+    timer_args.name = "deadline_timer";
+    esp_timer_create(&timer_args, &m_timer);
+  }
+
+  int64_t remaining_us = deadline_us - esp_timer_get_time();
+  if (remaining_us > 2 * DEADLINE_TIMER_SPIN_US) {
+    esp_timer_start_once(m_timer, remaining_us - DEADLINE_TIMER_SPIN_US);
+    xSemaphoreTake(m_semaphore, portMAX_DELAY);
+  }
+
+  while (esp_timer_get_time() < deadline_us) {
+  }
+}
+
+void Deadline_Timer::on_timeout(void *arg) {
+  xSemaphoreGive(static_cast<SemaphoreHandle_t>(arg));
+}
+
+bool is_hour_in_window(int hour, int start_hour, int end_hour) {
+  if (start_hour == end_hour) {
+    return false;
+  }
+
+  if (start_hour < end_hour) {
+    return hour >= start_hour && hour < end_hour;
+  }
+
+  // The window wraps around midnight
+  return hour >= start_hour || hour < end_hour;
+}
+
+void reset_jitter_stats(jitter_stats_t *stats) {
+  stats->num_samples = 0;
+  stats->min_us = INT32_MAX;
+  stats->max_us = INT32_MIN;
+  stats->sum_us = 0;
+}
+
+void record_jitter_sample(jitter_stats_t *stats, int32_t deviation_us) {
+  ++stats->num_samples;
+  stats->sum_us += deviation_us;
+
+  if (deviation_us < stats->min_us) {
+    stats->min_us = deviation_us;
+  }
+  if (deviation_us > stats->max_us) {
+    stats->max_us = deviation_us;
+  }
+}
+
+void print_jitter_stats(const char *label, const jitter_stats_t &stats) {
+  if (!stats.num_samples) {
+    debug_serial_printfln("%s: no samples", label);
+    return;
+  }
+
+  debug_serial_printfln(
+      "%s: samples: %u\tmin: %d us\tmax: %d us\tmean: %d us\tpeak-to-peak: "
+      "%d us",
+      label, stats.num_samples, stats.min_us, stats.max_us,
+      (int32_t)(stats.sum_us / stats.num_samples),
+      stats.max_us - stats.min_us);
 }
@@ -7,7 +7,9 @@
 
 #include "arduino_debug.h"
 #include "credentials.h"
+#include "event_log.h"
 #include "ntp.h"
+#include "solar.h"
 
 bool get_local_temperature(double *temperature) {
   if (!connect_to_wifi()) {
@@ -22,8 +24,9 @@ bool get_local_temperature(double *temperature) {
   locationHttp.begin("http://ip-api.com/json");
 
   bool got_location = false;
+  int locationHttpCode = 0;
   for (int i = 0; i < 10; i++) {
-    int locationHttpCode = locationHttp.GET();
+    locationHttpCode = locationHttp.GET();
     if (locationHttpCode == 200) {
       got_location = true;
       break;
@@ -33,6 +36,8 @@ bool get_local_temperature(double *temperature) {
 
   if (!got_location) {
     // TODO: error handling
+    log_event(EVENT_WEATHER_HTTP_ERROR, 0, locationHttpCode);
+    disconnect_from_wifi();
     return false;
   }
 
@@ -45,6 +50,12 @@ bool get_local_temperature(double *temperature) {
 
     lat = locationDoc["lat"].as<String>();
     lon = locationDoc["lon"].as<String>();
+
+    // For the sunrise and sunset schedule
+    if (locationDoc["lat"].is<float>() && locationDoc["lon"].is<float>()) {
+      set_location(lroundf(locationDoc["lat"].as<float>() * 100),
+                   lroundf(locationDoc["lon"].as<float>() * 100));
+    }
   }
 
   debug_serial_printf("lat: %s\tlon: %s\n", lat.c_str(), lon.c_str());
@@ -61,8 +72,9 @@ bool get_local_temperature(double *temperature) {
   weatherHttp.begin(https_client, api_url);
 
   bool got_weather = false;
+  int weatherHttpCode = 0;
   for (int i = 0; i < 10; i++) {
-    int weatherHttpCode = weatherHttp.GET();
+    weatherHttpCode = weatherHttp.GET();
     if (weatherHttpCode == 200) {
       got_weather = true;
       break;
@@ -72,6 +84,8 @@ bool get_local_temperature(double *temperature) {
 
   if (!got_weather) {
     // TODO: error handling
+    log_event(EVENT_WEATHER_HTTP_ERROR, 1, weatherHttpCode);
+    disconnect_from_wifi();
     return false;
   }
 
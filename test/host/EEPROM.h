@@ -0,0 +1,32 @@
+#pragma once
+
+// Host stand-in for the Arduino EEPROM library, held in memory. Counts the
+// commits, which wear the flash on the device
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#define HOST_EEPROM_SIZE 512
+
+class EEPROMClass {
+ public:
+  bool begin(size_t size) { return size <= HOST_EEPROM_SIZE; }
+  uint8_t read(int address) { return bytes[address]; }
+  void write(int address, uint8_t value) { bytes[address] = value; }
+  bool commit() {
+    ++num_commits;
+    return true;
+  }
+
+  // Erased flash reads as all ones
+  void clear() {
+    memset(bytes, 0xff, sizeof(bytes));
+    num_commits = 0;
+  }
+
+  uint8_t bytes[HOST_EEPROM_SIZE];
+  size_t num_commits;
+};
+
+inline EEPROMClass EEPROM;
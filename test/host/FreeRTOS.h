@@ -0,0 +1,4 @@
+#pragma once
+
+// The Arduino core also puts FreeRTOS.h on the include path
+#include "freertos/FreeRTOS.h"
@@ -0,0 +1,13 @@
+#pragma once
+
+// Host stand-in for the Arduino WiFi library. Only declared: a test that
+// reaches it decides whether the radio is on
+
+typedef enum { WIFI_OFF, WIFI_STA } wifi_mode_t;
+
+class WiFiClass {
+ public:
+  wifi_mode_t getMode();
+};
+
+extern WiFiClass WiFi;
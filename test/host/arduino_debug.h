@@ -0,0 +1,28 @@
+#pragma once
+
+// Host stand-in for embedded_utilities' debug output, which goes to stdout
+
+#include <stdio.h>
+
+#define debug_serial_print(x)             \
+  do {                                    \
+    if (ARDUINO_DEBUG) printf("%s", (x)); \
+  } while (0)
+
+#define debug_serial_println(x)   \
+  do {                            \
+    if (ARDUINO_DEBUG) puts((x)); \
+  } while (0)
+
+#define debug_serial_printf(...)             \
+  do {                                       \
+    if (ARDUINO_DEBUG) printf(__VA_ARGS__); \
+  } while (0)
+
+#define debug_serial_printfln(...) \
+  do {                             \
+    if (ARDUINO_DEBUG) {           \
+      printf(__VA_ARGS__);         \
+      putchar('\n');               \
+    }                              \
+  } while (0)
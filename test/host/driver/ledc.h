@@ -0,0 +1,64 @@
+#pragma once
+
+// Host stand-in for the LEDC PWM driver. Duty changes go nowhere
+
+#include <stdint.h>
+
+#include "esp_err.h"
+
+typedef enum { LEDC_HIGH_SPEED_MODE, LEDC_LOW_SPEED_MODE } ledc_mode_t;
+typedef enum { LEDC_TIMER_0, LEDC_TIMER_1 } ledc_timer_t;
+typedef enum { LEDC_CHANNEL_0, LEDC_CHANNEL_1 } ledc_channel_t;
+typedef enum { LEDC_TIMER_12_BIT = 12 } ledc_timer_bit_t;
+typedef enum { LEDC_AUTO_CLK } ledc_clk_cfg_t;
+typedef enum { LEDC_FADE_NO_WAIT, LEDC_FADE_WAIT_DONE } ledc_fade_mode_t;
+
+typedef struct {
+  ledc_mode_t speed_mode;
+  ledc_timer_bit_t duty_resolution;
+  ledc_timer_t timer_num;
+  uint32_t freq_hz;
+  ledc_clk_cfg_t clk_cfg;
+} ledc_timer_config_t;
+
+typedef struct {
+  int gpio_num;
+  ledc_mode_t speed_mode;
+  ledc_channel_t channel;
+  ledc_timer_t timer_sel;
+  uint32_t duty;
+  int hpoint;
+  struct {
+    unsigned int output_invert : 1;
+  } flags;
+} ledc_channel_config_t;
+
+inline esp_err_t ledc_timer_config(const ledc_timer_config_t* config) {
+  return ESP_OK;
+}
+
+inline esp_err_t ledc_channel_config(const ledc_channel_config_t* config) {
+  return ESP_OK;
+}
+
+inline esp_err_t ledc_fade_func_install(int intr_alloc_flags) {
+  return ESP_OK;
+}
+
+inline esp_err_t ledc_set_fade_time_and_start(ledc_mode_t speed_mode,
+                                              ledc_channel_t channel,
+                                              uint32_t target_duty,
+                                              uint32_t max_fade_time_ms,
+                                              ledc_fade_mode_t fade_mode) {
+  return ESP_OK;
+}
+
+inline esp_err_t ledc_set_duty(ledc_mode_t speed_mode, ledc_channel_t channel,
+                               uint32_t duty) {
+  return ESP_OK;
+}
+
+inline esp_err_t ledc_update_duty(ledc_mode_t speed_mode,
+                                  ledc_channel_t channel) {
+  return ESP_OK;
+}
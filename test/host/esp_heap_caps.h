@@ -0,0 +1,13 @@
+#pragma once
+
+// Host stand-in for the heap statistics. Only declared: a test that reaches
+// them reports whatever heap it likes
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define MALLOC_CAP_8BIT (1 << 2)
+
+size_t heap_caps_get_free_size(uint32_t caps);
+size_t heap_caps_get_minimum_free_size(uint32_t caps);
+size_t heap_caps_get_largest_free_block(uint32_t caps);
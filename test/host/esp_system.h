@@ -0,0 +1,8 @@
+#pragma once
+
+// Host stand-in for esp_system. Only declared: a test that reaches it defines
+// it to suit the test
+
+#include <stdint.h>
+
+uint32_t esp_random();
@@ -0,0 +1,86 @@
+#pragma once
+
+// Host stand-in for esp_timer. The monotonic clock reads whatever the test
+// sets, and timers never fire on their own: a test that wants them to moves
+// the clock with advance_fake_esp_timer()
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+#define FAKE_ESP_TIMER_MAX_TIMERS 16
+
+inline int64_t g_fake_esp_timer_us = 0;
+
+inline int64_t esp_timer_get_time() { return g_fake_esp_timer_us; }
+
+typedef void (*esp_timer_cb_t)(void* arg);
+typedef struct esp_timer* esp_timer_handle_t;
+
+typedef struct {
+  esp_timer_cb_t callback;
+  void* arg;
+  int dispatch_method;
+  const char* name;
+  bool skip_unhandled_events;
+} esp_timer_create_args_t;
+
+struct esp_timer {
+  esp_timer_cb_t callback;
+  void* arg;
+  bool armed;
+  int64_t deadline_us;
+};
+
+inline esp_timer g_fake_esp_timers[FAKE_ESP_TIMER_MAX_TIMERS];
+inline size_t g_num_fake_esp_timers = 0;
+
+inline esp_err_t esp_timer_create(const esp_timer_create_args_t* args,
+                                  esp_timer_handle_t* handle) {
+  assert(g_num_fake_esp_timers < FAKE_ESP_TIMER_MAX_TIMERS);
+  *handle = &g_fake_esp_timers[g_num_fake_esp_timers++];
+  (*handle)->callback = args->callback;
+  (*handle)->arg = args->arg;
+  (*handle)->armed = false;
+  return ESP_OK;
+}
+
+inline esp_err_t esp_timer_start_once(esp_timer_handle_t timer,
+                                      uint64_t timeout_us) {
+  timer->armed = true;
+  timer->deadline_us = g_fake_esp_timer_us + (int64_t)timeout_us;
+  return ESP_OK;
+}
+
+inline esp_err_t esp_timer_stop(esp_timer_handle_t timer) {
+  timer->armed = false;
+  return ESP_OK;
+}
+
+// Moves the clock up to the time given, stopping at each timer's deadline on
+// the way to run its callback, earliest first
+inline void advance_fake_esp_timer(int64_t until_us) {
+  for (;;) {
+    esp_timer* next = NULL;
+    for (size_t i = 0; i < g_num_fake_esp_timers; ++i) {
+      esp_timer* timer = &g_fake_esp_timers[i];
+      if (timer->armed && timer->deadline_us <= until_us &&
+          (!next || timer->deadline_us < next->deadline_us)) {
+        next = timer;
+      }
+    }
+    if (!next) {
+      break;
+    }
+
+    if (next->deadline_us > g_fake_esp_timer_us) {
+      g_fake_esp_timer_us = next->deadline_us;
+    }
+    next->armed = false;
+    next->callback(next->arg);
+  }
+
+  g_fake_esp_timer_us = until_us;
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+// Host stand-in for the parts of FreeRTOS the modules under test use. The
+// tests run on a single thread, so critical sections do nothing. Calls that
+// block or switch tasks are only declared: a test that reaches one defines
+// it to suit the test
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+typedef unsigned UBaseType_t;
+
+typedef void* TaskHandle_t;
+typedef void (*TaskFunction_t)(void*);
+typedef void* QueueHandle_t;
+typedef void* SemaphoreHandle_t;
+
+#define pdTRUE 1
+#define pdFALSE 0
+#define pdPASS pdTRUE
+#define portMAX_DELAY ((TickType_t)0xffffffff)
+#define portTICK_PERIOD_MS 1
+#define configMAX_PRIORITIES 25
+#define configMAX_TASK_NAME_LEN 16
+#define configASSERT(x) assert(x)
+
+typedef int portMUX_TYPE;
+#define portMUX_INITIALIZER_UNLOCKED 0
+#define portMUX_INITIALIZE(mux) (*(mux) = portMUX_INITIALIZER_UNLOCKED)
+#define portENTER_CRITICAL(mux) ((void)(mux))
+#define portEXIT_CRITICAL(mux) ((void)(mux))
+#define portENTER_CRITICAL_ISR(mux) ((void)(mux))
+#define portEXIT_CRITICAL_ISR(mux) ((void)(mux))
+#define portYIELD_FROM_ISR()
+
+#define IRAM_ATTR
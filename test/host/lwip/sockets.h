@@ -0,0 +1,7 @@
+#pragma once
+
+// lwIP's BSD socket API matches the host's
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
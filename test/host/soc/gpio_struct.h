@@ -0,0 +1,13 @@
+#pragma once
+
+// Host stand-in for the GPIO registers, as plain memory
+
+#include <stdint.h>
+
+typedef struct {
+  uint32_t out;
+  uint32_t out_w1ts;
+  uint32_t out_w1tc;
+} gpio_dev_t;
+
+inline gpio_dev_t GPIO;
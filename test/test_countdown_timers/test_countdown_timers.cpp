@@ -0,0 +1,133 @@
+// Runs the longest timer the menu allows alongside shorter ones on a fake
+// clock that fires the esp_timers at their deadlines
+#include <unity.h>
+
+#include "../../src/countdown_timers.cpp"
+
+#define SECOND_US 1000000LL
+#define HOUR_S 3600
+
+#define TEST_START_US (10 * SECOND_US)
+#define MAX_EXPIRIES 8
+
+const buzzer_pattern_t c_buzzer_pattern_alarm = {NULL, 0, 0};
+
+static int64_t s_expiries_us[MAX_EXPIRIES];
+static size_t s_num_expiries;
+
+// Called by each timer as it expires
+bool buzzer_play(const buzzer_pattern_t* pattern) {
+  TEST_ASSERT_EQUAL_PTR(&c_buzzer_pattern_alarm, pattern);
+  TEST_ASSERT_TRUE(s_num_expiries < MAX_EXPIRIES);
+  s_expiries_us[s_num_expiries++] = g_fake_esp_timer_us;
+  return true;
+}
+
+void deferred_log_push(const char* format,
+                       const uint32_t args[DEFERRED_LOG_MAX_ARGS]) {}
+
+// The earliest of the deadlines still ahead of the clock, or zero
+static int64_t get_next_deadline_us(const int64_t* deadlines_us,
+                                    size_t num_deadlines) {
+  int64_t next_us = 0;
+  for (size_t i = 0; i < num_deadlines; ++i) {
+    if (deadlines_us[i] > g_fake_esp_timer_us &&
+        (!next_us || deadlines_us[i] < next_us)) {
+      next_us = deadlines_us[i];
+    }
+  }
+  return next_us;
+}
+
+void setUp(void) {
+  g_num_fake_esp_timers = 0;
+  g_fake_esp_timer_us = TEST_START_US;
+  s_num_expiries = 0;
+  setup_countdown_timers();
+}
+
+void tearDown(void) {}
+
+// 99 hours, with timers of 45 s, 90 s and 30 min started part way through
+// the first second. The time left is that of the next timer to expire, to
+// the microsecond, at every second of the countdown
+static void test_99_hour_timer_counts_down_each_second() {
+  static const uint32_t c_durations_s[] = {99 * HOUR_S, 90, 45, HOUR_S / 2};
+  int64_t deadlines_us[NUM_ELEMENTS(c_durations_s)];
+
+  for (size_t i = 0; i < NUM_ELEMENTS(c_durations_s); ++i) {
+    advance_fake_esp_timer(TEST_START_US + i * 250 * 1000);
+    TEST_ASSERT_TRUE(start_countdown_timer(c_durations_s[i]));
+    deadlines_us[i] = g_fake_esp_timer_us + c_durations_s[i] * SECOND_US;
+  }
+
+  for (int64_t second = 1; second < 99 * HOUR_S; ++second) {
+    advance_fake_esp_timer(TEST_START_US + second * SECOND_US);
+    int64_t remaining_us;
+    TEST_ASSERT_TRUE(get_next_countdown_timer_remaining(&remaining_us));
+    TEST_ASSERT_EQUAL_INT64(
+        get_next_deadline_us(deadlines_us, NUM_ELEMENTS(deadlines_us)) -
+            g_fake_esp_timer_us,
+        remaining_us);
+  }
+
+  advance_fake_esp_timer(TEST_START_US + 99 * HOUR_S * SECOND_US);
+  int64_t remaining_us;
+  TEST_ASSERT_FALSE(get_next_countdown_timer_remaining(&remaining_us));
+
+  static const int64_t c_expected_expiries_us[] = {
+      TEST_START_US + (500 * 1000) + 45 * SECOND_US,
+      TEST_START_US + (250 * 1000) + 90 * SECOND_US,
+      TEST_START_US + (750 * 1000) + HOUR_S / 2 * SECOND_US,
+      TEST_START_US + 99 * HOUR_S * SECOND_US,
+  };
+  TEST_ASSERT_EQUAL(NUM_ELEMENTS(c_expected_expiries_us), s_num_expiries);
+  TEST_ASSERT_EQUAL_INT64_ARRAY(c_expected_expiries_us, s_expiries_us,
+                                s_num_expiries);
+}
+
+// Not a microsecond early, and the slot is free again straight after
+static void test_timer_expires_at_its_deadline() {
+  TEST_ASSERT_TRUE(start_countdown_timer(99 * HOUR_S));
+  const int64_t deadline_us = TEST_START_US + 99 * HOUR_S * SECOND_US;
+
+  advance_fake_esp_timer(deadline_us - 1);
+  int64_t remaining_us;
+  TEST_ASSERT_TRUE(get_next_countdown_timer_remaining(&remaining_us));
+  TEST_ASSERT_EQUAL_INT64(1, remaining_us);
+  TEST_ASSERT_EQUAL(0, s_num_expiries);
+
+  advance_fake_esp_timer(deadline_us);
+  TEST_ASSERT_EQUAL(1, s_num_expiries);
+  TEST_ASSERT_EQUAL_INT64(deadline_us, s_expiries_us[0]);
+  TEST_ASSERT_FALSE(get_next_countdown_timer_remaining(&remaining_us));
+
+  for (size_t i = 0; i < MAX_COUNTDOWN_TIMERS; ++i) {
+    TEST_ASSERT_TRUE(start_countdown_timer(60));
+  }
+}
+
+// A fifth timer is refused, and cancelled timers never sound
+static void test_full_and_cancelled_timers() {
+  for (size_t i = 0; i < MAX_COUNTDOWN_TIMERS; ++i) {
+    TEST_ASSERT_TRUE(start_countdown_timer(60 * (i + 1)));
+  }
+  TEST_ASSERT_FALSE(start_countdown_timer(10));
+
+  advance_fake_esp_timer(TEST_START_US + 90 * SECOND_US);
+  TEST_ASSERT_EQUAL(1, s_num_expiries);
+
+  cancel_countdown_timers();
+  int64_t remaining_us;
+  TEST_ASSERT_FALSE(get_next_countdown_timer_remaining(&remaining_us));
+  advance_fake_esp_timer(TEST_START_US + HOUR_S * SECOND_US);
+  TEST_ASSERT_EQUAL(1, s_num_expiries);
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_99_hour_timer_counts_down_each_second);
+  RUN_TEST(test_timer_expires_at_its_deadline);
+  RUN_TEST(test_full_and_cancelled_timers);
+  return UNITY_END();
+}
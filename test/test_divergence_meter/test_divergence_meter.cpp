@@ -0,0 +1,199 @@
+// Runs the divergence meter on a fake clock and records every frame it
+// shows, for a fixed seed and a sweep of seeds
+#include <unity.h>
+
+#include "../../src/Nixie_Display.cpp"
+#include "../../src/special_modes.cpp"
+#include "../../src/time_zone.cpp"
+
+#define NUM_TUBES Nixie_Display::num_display_digits
+#define MAX_FRAMES 1024
+#define NUM_SWEEP_SEEDS 1000
+
+#define TEST_SEED 0x5eed1234
+#define TEST_START_US 1000000LL
+
+#define STAGGER_US \
+  ((int64_t)DIVERGENCE_METER_LOCK_STAGGER_MS * MILLISECOND_TO_MICROSECONDS)
+
+typedef struct {
+  int64_t shown_us;
+  uint8_t digits[NUM_TUBES];
+} frame_t;
+
+static frame_t s_frames[MAX_FRAMES];
+static size_t s_num_frames;
+
+// Only reached by the other special modes and the display's animations
+volatile int64_t g_rotary_encoder_switch_press_us = 0;
+bool g_blink_dot_separators = false;
+const int c_rotary_encoder_switch_pin = 16;
+const buzzer_pattern_t c_buzzer_pattern_click = {NULL, 0, 0};
+
+uint32_t esp_random() { return 4; }
+
+SemaphoreHandle_t xSemaphoreCreateMutex() { return NULL; }
+
+void heartbeat() {}
+
+void acquire_power_lock(power_lock_t lock) {}
+
+void release_power_lock(power_lock_t lock) {}
+
+int get_animation_operand_size(uint8_t opcode) { return -1; }
+
+animation_error_t validate_animation(const uint8_t* program, size_t size,
+                                     animation_info_t* info) {
+  return ANIMATION_ERROR_BAD_HEADER;
+}
+
+bool buzzer_play(const buzzer_pattern_t* pattern) { return true; }
+
+bool start_countdown_timer(uint32_t duration_s) { return true; }
+
+void cancel_countdown_timers() {}
+
+void get_alarm(size_t index, alarm_t* alarm) {}
+
+void set_alarm(size_t index, const alarm_t& alarm) {}
+
+bool coroutine_wait_until(int64_t deadline_us) { return true; }
+
+bool coroutine_take_input_event() { return false; }
+
+void coroutine_clear_input_event() {}
+
+void* coroutine_frame_alloc(size_t size) { return NULL; }
+
+int8_t read_rotary_encoder_step(uint16_t* state) { return 0; }
+
+config_value_frame_t* start_config_value(
+    uint8_t option_number, uint8_t initial_value, uint8_t lower_bound,
+    uint8_t upper_bound,
+    void (Nixie_Display::*display_handler)(uint8_t, uint8_t)) {
+  return NULL;
+}
+
+coroutine_status_t get_config_value(config_value_frame_t* frame) {
+  return COROUTINE_DONE;
+}
+
+uint8_t finish_config_value(config_value_frame_t* frame) { return 0; }
+
+static void record_frame() {
+  TEST_ASSERT_TRUE(s_num_frames < MAX_FRAMES);
+  Nixie_Display::Display_Buffer front = Nixie_Display::read_front_buffer();
+  s_frames[s_num_frames].shown_us = g_fake_esp_timer_us;
+  memcpy(s_frames[s_num_frames].digits, front.digits, NUM_TUBES);
+  ++s_num_frames;
+}
+
+// The frame on the display went up at the current time and stays until the
+// deadline
+void Deadline_Timer::sleep_until(int64_t deadline_us) {
+  record_frame();
+  TEST_ASSERT_TRUE(deadline_us > g_fake_esp_timer_us);
+  g_fake_esp_timer_us = deadline_us;
+}
+
+static void run(uint32_t seed) {
+  s_num_frames = 0;
+  g_fake_esp_timer_us = TEST_START_US;
+  run_divergence_meter(seed);
+  record_frame();
+}
+
+static int64_t get_lock_us(size_t tube) {
+  return TEST_START_US + (DIVERGENCE_METER_FIRST_LOCK_MS +
+                          tube * DIVERGENCE_METER_LOCK_STAGGER_MS) *
+                             MILLISECOND_TO_MICROSECONDS;
+}
+
+// When the tube last showed a new digit
+static int64_t get_last_change_us(size_t tube) {
+  int64_t last_change_us = s_frames[0].shown_us;
+  for (size_t i = 1; i < s_num_frames; ++i) {
+    if (s_frames[i].digits[tube] != s_frames[i - 1].digits[tube]) {
+      last_change_us = s_frames[i].shown_us;
+    }
+  }
+  return last_change_us;
+}
+
+void setUp(void) {}
+
+void tearDown(void) {}
+
+// Pinned, so a change to the rolls or the PRNG streams shows up here. For
+// this seed each tube's locking roll shows a new digit, so the lock is seen
+// within the tube's own stagger
+static void test_fixed_seed_locks_left_to_right() {
+  run(TEST_SEED);
+
+  static const uint8_t c_final_digits[NUM_TUBES] = {0, 8, 3, 6, 3, 9};
+  TEST_ASSERT_EQUAL_UINT8_ARRAY(c_final_digits,
+                                s_frames[s_num_frames - 1].digits, NUM_TUBES);
+  for (size_t tube = 0; tube < NUM_TUBES; ++tube) {
+    TEST_ASSERT_INT64_WITHIN(STAGGER_US / 2, get_lock_us(tube) - STAGGER_US / 2,
+                             get_last_change_us(tube));
+  }
+}
+
+static void test_same_seed_shows_the_same_frames() {
+  run(TEST_SEED);
+  static frame_t s_first_frames[MAX_FRAMES];
+  size_t num_first_frames = s_num_frames;
+  memcpy(s_first_frames, s_frames, sizeof(s_frames));
+
+  run(TEST_SEED);
+  TEST_ASSERT_EQUAL(num_first_frames, s_num_frames);
+  for (size_t i = 0; i < s_num_frames; ++i) {
+    TEST_ASSERT_EQUAL_INT64(s_first_frames[i].shown_us, s_frames[i].shown_us);
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(s_first_frames[i].digits, s_frames[i].digits,
+                                  NUM_TUBES);
+  }
+
+  run(TEST_SEED + 1);
+  TEST_ASSERT_FALSE(num_first_frames == s_num_frames &&
+                    memcmp(s_first_frames, s_frames,
+                           num_first_frames * sizeof(frame_t)) == 0);
+}
+
+// Every tube settles by its lock time and the run ends with the last one. The
+// roll before the locking one always shows a new digit, and comes at most a
+// stagger before it. The leftmost tube only locks on 0 or 1, and each tube's
+// final digit turns up about as often as the others
+static void test_every_seed_locks_in_time() {
+  size_t final_digit_counts[NUM_TUBES][10] = {};
+
+  for (uint32_t seed = 1; seed <= NUM_SWEEP_SEEDS; ++seed) {
+    run(seed);
+    for (size_t tube = 0; tube < NUM_TUBES; ++tube) {
+      int64_t last_change_us = get_last_change_us(tube);
+      TEST_ASSERT_TRUE(last_change_us < get_lock_us(tube));
+      TEST_ASSERT_TRUE(last_change_us >= get_lock_us(tube) - 2 * STAGGER_US);
+      ++final_digit_counts[tube][s_frames[s_num_frames - 1].digits[tube]];
+    }
+    TEST_ASSERT_TRUE(s_frames[s_num_frames - 1].shown_us <
+                     get_lock_us(NUM_TUBES - 1));
+  }
+
+  TEST_ASSERT_EQUAL(NUM_SWEEP_SEEDS,
+                    final_digit_counts[0][0] + final_digit_counts[0][1]);
+  for (size_t digit = 0; digit < 2; ++digit) {
+    TEST_ASSERT_TRUE(final_digit_counts[0][digit] > NUM_SWEEP_SEEDS / 3);
+  }
+  for (size_t tube = 1; tube < NUM_TUBES; ++tube) {
+    for (size_t digit = 0; digit < 10; ++digit) {
+      TEST_ASSERT_TRUE(final_digit_counts[tube][digit] > NUM_SWEEP_SEEDS / 20);
+    }
+  }
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_fixed_seed_locks_left_to_right);
+  RUN_TEST(test_same_seed_shows_the_same_frames);
+  RUN_TEST(test_every_seed_locks_in_time);
+  return UNITY_END();
+}
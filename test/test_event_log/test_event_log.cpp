@@ -0,0 +1,270 @@
+// Writes the log to a partition in memory that behaves like NOR flash, with
+// restarts and failed writes in between, and checks that no write crosses a
+// page
+#include <unity.h>
+
+#include "../../src/event_log.cpp"
+#include "util.h"
+
+#define TEST_NUM_SECTORS 4
+// The header takes the first slot
+#define RECORDS_PER_SECTOR (EVENT_LOG_SECTOR_SIZE / EVENT_LOG_RECORD_SIZE - 1)
+
+#define MAX_VISITED (TEST_NUM_SECTORS * RECORDS_PER_SECTOR)
+
+static const esp_partition_t c_partition = {
+    ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, 0,
+    TEST_NUM_SECTORS * EVENT_LOG_SECTOR_SIZE, EVENT_LOG_PARTITION_LABEL,
+    false};
+
+static uint8_t s_flash[TEST_NUM_SECTORS * EVENT_LOG_SECTOR_SIZE];
+static size_t s_num_failing_writes;
+// Programming a bit that is already programmed
+static size_t s_num_reprograms;
+static size_t s_last_write_offset;
+static size_t s_last_write_size;
+static size_t s_num_flushes_due;
+
+static executor_t s_executor;
+
+static int32_t s_visited[MAX_VISITED];
+static size_t s_num_visited;
+
+const esp_partition_t* esp_partition_find_first(esp_partition_type_t type,
+                                                esp_partition_subtype_t subtype,
+                                                const char* label) {
+  return &c_partition;
+}
+
+esp_err_t esp_partition_read(const esp_partition_t* partition,
+                             size_t src_offset, void* dst, size_t size) {
+  TEST_ASSERT_TRUE(src_offset + size <= sizeof(s_flash));
+  memcpy(dst, s_flash + src_offset, size);
+  return ESP_OK;
+}
+
+// Programming only clears bits. A failed write programs nothing
+esp_err_t esp_partition_write(const esp_partition_t* partition,
+                              size_t dst_offset, const void* src,
+                              size_t size) {
+  TEST_ASSERT_TRUE(dst_offset + size <= sizeof(s_flash));
+  TEST_ASSERT_EQUAL(dst_offset / EVENT_LOG_PAGE_SIZE,
+                    (dst_offset + size - 1) / EVENT_LOG_PAGE_SIZE);
+  if (s_num_failing_writes) {
+    --s_num_failing_writes;
+    return ESP_FAIL;
+  }
+
+  const uint8_t* bytes = static_cast<const uint8_t*>(src);
+  for (size_t i = 0; i < size; ++i) {
+    if (s_flash[dst_offset + i] != 0xff) {
+      ++s_num_reprograms;
+    }
+    s_flash[dst_offset + i] &= bytes[i];
+  }
+  s_last_write_offset = dst_offset;
+  s_last_write_size = size;
+  return ESP_OK;
+}
+
+esp_err_t esp_partition_erase_range(const esp_partition_t* partition,
+                                    size_t offset, size_t size) {
+  TEST_ASSERT_EQUAL(0, offset % EVENT_LOG_SECTOR_SIZE);
+  TEST_ASSERT_EQUAL(0, size % EVENT_LOG_SECTOR_SIZE);
+  memset(s_flash + offset, 0xff, size);
+  return ESP_OK;
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex() { return NULL; }
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t timeout) {
+  return pdTRUE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore) { return pdTRUE; }
+
+// The test flushes by hand, and counts the flushes asked for straight away
+void add_job(executor_t* executor, executor_job_t* job, uint32_t phase_ms) {
+  job->executor = executor;
+}
+
+void schedule_job(executor_job_t* job, uint32_t delay_ms) {
+  s_num_flushes_due += delay_ms == 0;
+}
+
+bool is_job_active(const executor_job_t* job) { return false; }
+
+// Forget everything but the flash, as a reset would
+static void restart() {
+  s_partition = NULL;
+  s_num_sectors = 0;
+  s_sector = 0;
+  s_sequence = 0;
+  s_write_offset = 0;
+  s_num_buffered = 0;
+  s_num_dropped = 0;
+  s_job_flush_event_log.executor = NULL;
+  setup_event_log(&s_executor);
+}
+
+static void visit(const event_log_record_t& record, void* context) {
+  TEST_ASSERT_EQUAL(EVENT_NTP_SYNCED, record.event_id);
+  TEST_ASSERT_TRUE(s_num_visited < MAX_VISITED);
+  s_visited[s_num_visited++] = record.args[0];
+}
+
+// Events first to last, each with its number as the argument
+static void log_events(int32_t first, int32_t last) {
+  for (int32_t i = first; i <= last; ++i) {
+    log_event(EVENT_NTP_SYNCED, i);
+    if (s_num_buffered == EVENT_LOG_BUFFER_RECORDS) {
+      flush_event_log();
+    }
+  }
+  flush_event_log();
+}
+
+// Events from first on, one at a time until a flush is due straight away.
+// Returns how many were logged
+static size_t log_until_flush_due(int32_t first) {
+  s_num_flushes_due = 0;
+  size_t count = 0;
+  while (!s_num_flushes_due) {
+    TEST_ASSERT_TRUE(count < EVENT_LOG_BUFFER_RECORDS);
+    log_event(EVENT_NTP_SYNCED, first + count++);
+  }
+  return count;
+}
+
+// Read back as runs of consecutive event numbers, given as first and last
+static void assert_log_holds(const int32_t* runs, size_t num_runs) {
+  s_num_visited = 0;
+  size_t num_expected = 0;
+  for (size_t i = 0; i < num_runs; ++i) {
+    num_expected += runs[2 * i + 1] - runs[2 * i] + 1;
+  }
+  TEST_ASSERT_EQUAL(num_expected, read_event_log(visit, NULL));
+  TEST_ASSERT_EQUAL(num_expected, s_num_visited);
+
+  size_t visited = 0;
+  for (size_t i = 0; i < num_runs; ++i) {
+    for (int32_t event = runs[2 * i]; event <= runs[2 * i + 1]; ++event) {
+      TEST_ASSERT_EQUAL_INT32(event, s_visited[visited++]);
+    }
+  }
+  TEST_ASSERT_EQUAL(0, s_num_reprograms);
+}
+
+void setUp(void) {
+  memset(s_flash, 0xff, sizeof(s_flash));
+  s_num_failing_writes = 0;
+  s_num_reprograms = 0;
+  restart();
+}
+
+void tearDown(void) {}
+
+static void test_records_survive_a_restart() {
+  log_events(1, 3);
+  static const int32_t c_first[] = {1, 3};
+  assert_log_holds(c_first, 1);
+
+  restart();
+  assert_log_holds(c_first, 1);
+
+  log_events(4, 5);
+  static const int32_t c_appended[] = {1, 5};
+  assert_log_holds(c_appended, 1);
+}
+
+// The records after the failed write are still read, and the end is found
+// past them, so none of the slots is programmed twice
+static void test_failed_write_leaves_a_skipped_hole() {
+  log_events(1, 2);
+  s_num_failing_writes = 1;
+  log_events(3, 4);
+  log_events(5, 6);
+  static const int32_t c_runs[] = {1, 2, 5, 6};
+  assert_log_holds(c_runs, 2);
+
+  restart();
+  assert_log_holds(c_runs, 2);
+
+  log_events(7, 8);
+  static const int32_t c_appended[] = {1, 2, 5, 8};
+  assert_log_holds(c_appended, 2);
+}
+
+// A failed last write looks unwritten after a restart. Its slots are used
+// again, which is safe since nothing was programmed in them
+static void test_trailing_hole_is_reused_after_a_restart() {
+  log_events(1, RECORDS_PER_SECTOR - 1);
+  s_num_failing_writes = 1;
+  log_events(RECORDS_PER_SECTOR, RECORDS_PER_SECTOR);
+
+  restart();
+  log_events(RECORDS_PER_SECTOR + 1, RECORDS_PER_SECTOR + 2);
+  TEST_ASSERT_EQUAL(1, s_sector);
+  static const int32_t c_runs[] = {1, RECORDS_PER_SECTOR - 1,
+                                   RECORDS_PER_SECTOR + 1,
+                                   RECORDS_PER_SECTOR + 2};
+  assert_log_holds(c_runs, 2);
+}
+
+// Once around the ring and a bit, so the oldest sector has been overwritten
+static void test_ring_overwrites_the_oldest_sector() {
+  const int32_t last = TEST_NUM_SECTORS * RECORDS_PER_SECTOR + 10;
+  log_events(1, last);
+  TEST_ASSERT_EQUAL(0, s_sector);
+  TEST_ASSERT_EQUAL(TEST_NUM_SECTORS + 1, s_sequence);
+
+  const int32_t c_runs[] = {RECORDS_PER_SECTOR + 1, last};
+  assert_log_holds(c_runs, 1);
+
+  restart();
+  TEST_ASSERT_EQUAL(0, s_sector);
+  assert_log_holds(c_runs, 1);
+}
+
+// A flush is due as soon as the events would finish the page being written,
+// so the pages after it are written whole, each in one write
+static void test_flushes_finish_the_page() {
+  TEST_ASSERT_EQUAL(EVENT_LOG_RECORDS_PER_PAGE - 1, log_until_flush_due(1));
+  flush_event_log();
+  TEST_ASSERT_EQUAL(EVENT_LOG_PAGE_SIZE,
+                    s_last_write_offset + s_last_write_size);
+
+  // After a delayed flush of a few
+  log_events(16, 18);
+  TEST_ASSERT_EQUAL(EVENT_LOG_RECORDS_PER_PAGE - 3, log_until_flush_due(19));
+  flush_event_log();
+  TEST_ASSERT_EQUAL(2 * EVENT_LOG_PAGE_SIZE,
+                    s_last_write_offset + s_last_write_size);
+
+  TEST_ASSERT_EQUAL(EVENT_LOG_RECORDS_PER_PAGE, log_until_flush_due(32));
+  flush_event_log();
+  TEST_ASSERT_EQUAL(2 * EVENT_LOG_PAGE_SIZE, s_last_write_offset);
+  TEST_ASSERT_EQUAL(EVENT_LOG_PAGE_SIZE, s_last_write_size);
+
+  // The next sector's header comes first
+  log_events(48, RECORDS_PER_SECTOR);
+  TEST_ASSERT_EQUAL(EVENT_LOG_RECORDS_PER_PAGE - 1,
+                    log_until_flush_due(RECORDS_PER_SECTOR + 1));
+  flush_event_log();
+  TEST_ASSERT_EQUAL(EVENT_LOG_SECTOR_SIZE + EVENT_LOG_PAGE_SIZE,
+                    s_last_write_offset + s_last_write_size);
+
+  static const int32_t c_runs[] = {
+      1, RECORDS_PER_SECTOR + EVENT_LOG_RECORDS_PER_PAGE - 1};
+  assert_log_holds(c_runs, 1);
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_records_survive_a_restart);
+  RUN_TEST(test_failed_write_leaves_a_skipped_hole);
+  RUN_TEST(test_trailing_hole_is_reused_after_a_restart);
+  RUN_TEST(test_ring_overwrites_the_oldest_sector);
+  RUN_TEST(test_flushes_finish_the_page);
+  return UNITY_END();
+}
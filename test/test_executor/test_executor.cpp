@@ -0,0 +1,254 @@
+// Drives the timer wheel with a fake clock. The worker loop runs for real:
+// waiting advances the clock by the timeout, and the test ends when the
+// worker waits past the end of the run
+#include <unity.h>
+
+#include "../../src/executor.cpp"
+#include "util.h"
+
+#define TICK_US ((int64_t)EXECUTOR_TICK_MS * 1000)
+#define HOUR_MS (60 * 60 * 1000)
+
+// A wait ends on the first FreeRTOS tick after the executor tick
+#define MAX_LATE_US (portTICK_PERIOD_MS * 1000)
+
+#define MAX_RUNS 2000
+
+struct run_end_t {};
+
+typedef struct {
+  executor_job_t job;
+  uint32_t period_ms;
+  uint32_t busy_ms;
+  size_t num_runs;
+  int64_t runs_us[MAX_RUNS];
+} test_job_t;
+
+static executor_t s_executor;
+static int64_t s_end_us;
+
+static int s_order[8];
+static size_t s_order_size;
+
+TaskHandle_t xTaskGetCurrentTaskHandle() { return &s_executor; }
+
+void xTaskNotifyGive(TaskHandle_t task) {}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear_on_exit, TickType_t timeout) {
+  if (timeout == portMAX_DELAY ||
+      g_fake_esp_timer_us + timeout * portTICK_PERIOD_MS * 1000 > s_end_us) {
+    throw run_end_t();
+  }
+  g_fake_esp_timer_us += timeout * portTICK_PERIOD_MS * 1000;
+  return 0;
+}
+
+void heartbeat() {}
+
+TickType_t get_heartbeat_timeout() { return portMAX_DELAY; }
+
+static uint32_t job_record_run(void* argument) {
+  test_job_t* test_job = static_cast<test_job_t*>(argument);
+  if (test_job->num_runs < MAX_RUNS) {
+    test_job->runs_us[test_job->num_runs] = g_fake_esp_timer_us;
+  }
+  ++test_job->num_runs;
+  if (s_order_size < 8) {
+    s_order[s_order_size++] = test_job->job.priority;
+  }
+
+  g_fake_esp_timer_us += (int64_t)test_job->busy_ms * 1000;
+  return test_job->period_ms;
+}
+
+static void init_test_job(test_job_t* test_job, uint32_t period_ms,
+                          uint8_t priority) {
+  memset(test_job, 0, sizeof(*test_job));
+  test_job->job.function = job_record_run;
+  test_job->job.argument = test_job;
+  test_job->job.name = "test";
+  test_job->job.priority = priority;
+  test_job->period_ms = period_ms;
+}
+
+static void start_at_tick(uint32_t tick) {
+  g_fake_esp_timer_us = (int64_t)tick * TICK_US;
+  setup_executor(&s_executor, "test");
+  s_order_size = 0;
+}
+
+static void run_for_ms(int64_t duration_ms) {
+  s_end_us = g_fake_esp_timer_us + duration_ms * 1000;
+  try {
+    run_executor(&s_executor);
+  } catch (run_end_t&) {
+  }
+}
+
+static void assert_ran_at(const test_job_t& test_job, size_t run,
+                          int64_t due_us) {
+  TEST_ASSERT_GREATER_OR_EQUAL(due_us, test_job.runs_us[run]);
+  TEST_ASSERT_LESS_OR_EQUAL(due_us + MAX_LATE_US, test_job.runs_us[run]);
+}
+
+void setUp(void) {}
+
+void tearDown(void) {}
+
+// Each delay lands on a different level, so the longer ones cascade down
+// before they run
+static void test_one_shot_jobs_run_on_time_at_every_level() {
+  static const uint32_t c_delays_ms[] = {
+      100,                  // Level 0
+      6 * 1000,             // Level 0, last slot
+      6500,                 // Level 1
+      7 * 60 * 1000,        // Level 2
+      7 * HOUR_MS,          // Level 2, near the span
+      7 * HOUR_MS + 12345,  // Level 2, not on a tick
+  };
+  static test_job_t jobs[NUM_ELEMENTS(c_delays_ms)];
+
+  // Not at a revolution of any level
+  start_at_tick(1000003);
+  int64_t start_us = g_fake_esp_timer_us;
+  for (size_t i = 0; i < NUM_ELEMENTS(c_delays_ms); ++i) {
+    init_test_job(&jobs[i], EXECUTOR_JOB_STOP, 1);
+    add_job(&s_executor, &jobs[i].job, c_delays_ms[i]);
+  }
+
+  run_for_ms(8 * HOUR_MS);
+
+  for (size_t i = 0; i < NUM_ELEMENTS(c_delays_ms); ++i) {
+    TEST_ASSERT_EQUAL(1, jobs[i].num_runs);
+    int64_t due_us =
+        start_us + ms_to_ticks(c_delays_ms[i]) * (int64_t)TICK_US;
+    assert_ran_at(jobs[i], 0, due_us);
+  }
+}
+
+// Longer than the wheel holds, so the job is parked in the top level and
+// cascaded again each time it comes round
+static void test_parked_jobs_wait_for_their_tick() {
+  static test_job_t day_job;
+  static test_job_t month_job;
+
+  start_at_tick(5);
+  int64_t start_us = g_fake_esp_timer_us;
+  init_test_job(&day_job, EXECUTOR_JOB_STOP, 1);
+  init_test_job(&month_job, EXECUTOR_JOB_STOP, 1);
+  add_job(&s_executor, &day_job.job, 30 * HOUR_MS);
+  add_job(&s_executor, &month_job.job, 31 * 24 * (uint32_t)HOUR_MS);
+
+  run_for_ms(32 * 24 * (int64_t)HOUR_MS);
+
+  TEST_ASSERT_EQUAL(1, day_job.num_runs);
+  assert_ran_at(day_job, 0, start_us + 30 * (int64_t)HOUR_MS * 1000);
+  TEST_ASSERT_EQUAL(1, month_job.num_runs);
+  assert_ran_at(month_job, 0,
+                start_us + 31 * 24 * (int64_t)HOUR_MS * 1000);
+}
+
+// The tick count wraps after about 13 years of uptime. Periodic and parked
+// jobs keep their schedule across it
+static void test_jobs_keep_their_schedule_across_the_tick_wrap() {
+  static test_job_t second_job;
+  static test_job_t minute_job;
+  static test_job_t parked_job;
+
+  start_at_tick(UINT32_MAX - 600);
+  int64_t start_us = g_fake_esp_timer_us;
+  init_test_job(&second_job, 1000, 1);
+  init_test_job(&minute_job, 60 * 1000, 2);
+  init_test_job(&parked_job, EXECUTOR_JOB_STOP, 3);
+  add_job(&s_executor, &second_job.job, 1000);
+  add_job(&s_executor, &minute_job.job, 60 * 1000);
+  add_job(&s_executor, &parked_job.job, 10 * HOUR_MS);
+
+  run_for_ms(11 * HOUR_MS + 1000);
+
+  // Every run lands on its period, before and after the wrap
+  TEST_ASSERT_GREATER_OR_EQUAL(MAX_RUNS, second_job.num_runs);
+  for (size_t i = 0; i < MAX_RUNS; ++i) {
+    assert_ran_at(second_job, i, start_us + (i + 1) * 1000 * 1000LL);
+  }
+  TEST_ASSERT_EQUAL(11 * 60, minute_job.num_runs);
+  for (size_t i = 0; i < minute_job.num_runs; ++i) {
+    assert_ran_at(minute_job, i, start_us + (i + 1) * 60 * 1000 * 1000LL);
+  }
+  TEST_ASSERT_EQUAL(1, parked_job.num_runs);
+  assert_ran_at(parked_job, 0, start_us + 10 * (int64_t)HOUR_MS * 1000);
+}
+
+static void test_jobs_due_on_the_same_tick_run_by_priority() {
+  static test_job_t jobs[4];
+  static const uint8_t c_priorities[] = {3, 17, 9, 12};
+
+  start_at_tick(100);
+  for (size_t i = 0; i < NUM_ELEMENTS(jobs); ++i) {
+    init_test_job(&jobs[i], EXECUTOR_JOB_STOP, c_priorities[i]);
+    add_job(&s_executor, &jobs[i].job, 500);
+  }
+
+  run_for_ms(1000);
+
+  TEST_ASSERT_EQUAL(4, s_order_size);
+  TEST_ASSERT_EQUAL(17, s_order[0]);
+  TEST_ASSERT_EQUAL(12, s_order[1]);
+  TEST_ASSERT_EQUAL(9, s_order[2]);
+  TEST_ASSERT_EQUAL(3, s_order[3]);
+}
+
+// A run that overruns its period skips the missed runs rather than running
+// them back to back
+static void test_missed_runs_are_skipped() {
+  static test_job_t job;
+
+  start_at_tick(100);
+  int64_t start_us = g_fake_esp_timer_us;
+  init_test_job(&job, 1000, 1);
+  job.busy_ms = 3500;
+  add_job(&s_executor, &job.job, 1000);
+
+  run_for_ms(20 * 1000);
+
+  TEST_ASSERT_GREATER_THAN(1, job.num_runs);
+  assert_ran_at(job, 0, start_us + 1000 * 1000);
+  for (size_t i = 1; i < job.num_runs; ++i) {
+    assert_ran_at(job, i, job.runs_us[i - 1] + (3500 + 1000) * 1000);
+  }
+}
+
+static void test_cancelled_and_rescheduled_jobs() {
+  static test_job_t cancelled_job;
+  static test_job_t rescheduled_job;
+
+  start_at_tick(100);
+  int64_t start_us = g_fake_esp_timer_us;
+  init_test_job(&cancelled_job, EXECUTOR_JOB_STOP, 1);
+  init_test_job(&rescheduled_job, EXECUTOR_JOB_STOP, 1);
+  add_job(&s_executor, &cancelled_job.job, 10 * 1000);
+  add_job(&s_executor, &rescheduled_job.job, 10 * 1000);
+  TEST_ASSERT_TRUE(is_job_active(&cancelled_job.job));
+
+  cancel_job(&cancelled_job.job);
+  schedule_job(&rescheduled_job.job, 60 * 60 * 1000);
+  TEST_ASSERT_FALSE(is_job_active(&cancelled_job.job));
+
+  run_for_ms(2 * HOUR_MS);
+
+  TEST_ASSERT_EQUAL(0, cancelled_job.num_runs);
+  TEST_ASSERT_EQUAL(1, rescheduled_job.num_runs);
+  assert_ran_at(rescheduled_job, 0, start_us + (int64_t)HOUR_MS * 1000);
+  TEST_ASSERT_FALSE(is_job_active(&rescheduled_job.job));
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_one_shot_jobs_run_on_time_at_every_level);
+  RUN_TEST(test_parked_jobs_wait_for_their_tick);
+  RUN_TEST(test_jobs_keep_their_schedule_across_the_tick_wrap);
+  RUN_TEST(test_jobs_due_on_the_same_tick_run_by_priority);
+  RUN_TEST(test_missed_runs_are_skipped);
+  RUN_TEST(test_cancelled_and_rescheduled_jobs);
+  return UNITY_END();
+}
@@ -0,0 +1,286 @@
+// Renders /metrics and /status with every task registered and checks that
+// they parse, as Prometheus text and as JSON, and that a response that
+// doesn't fit is refused rather than cut short
+#include <ArduinoJson.h>
+#include <ctype.h>
+#include <stdlib.h>
+#include <unity.h>
+
+#include "../../src/boot_phases.cpp"
+#include "../../src/metrics.cpp"
+#include "status_server.h"
+
+#define TEST_UPTIME_US 123456789000LL
+
+#define TEST_HEAP_FREE 100000
+#define TEST_HEAP_MIN_FREE 80000
+#define TEST_HEAP_LARGEST_FREE_BLOCK 60000
+
+#define LONGEST_TASK_NAME "long_task_nam"  // And two digits
+
+#define MAX_FAMILIES 64
+#define MAX_METRIC_NAME_LENGTH 64
+
+// The firmware's tasks, and then as many more with names as long as FreeRTOS
+// allows
+static const char* const c_firmware_task_names[] = {
+    "supervisor",   "buzzer",       "ui",           "display_jobs",
+    "network_jobs", "display_time", "deferred_log", "httpd"};
+static char s_task_names[MAX_METRICS_TASKS][configMAX_TASK_NAME_LEN];
+
+static const char* const c_heartbeat_names[NUM_HEARTBEATS] = {
+    "time_service", "display_time", "ui",
+    "display_jobs", "network_jobs", "tubes_off"};
+
+static bool s_power_management;
+
+static char s_response[STATUS_SERVER_BUFFER_SIZE];
+static char s_short_response[STATUS_SERVER_BUFFER_SIZE];
+
+// Only reached by the renderers. Each task's handle is its index plus one,
+// and its stack margin is a hundred times that
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t task) {
+  return 100 * reinterpret_cast<uintptr_t>(task);
+}
+
+size_t heap_caps_get_free_size(uint32_t caps) { return TEST_HEAP_FREE; }
+
+size_t heap_caps_get_minimum_free_size(uint32_t caps) {
+  return TEST_HEAP_MIN_FREE;
+}
+
+size_t heap_caps_get_largest_free_block(uint32_t caps) {
+  return TEST_HEAP_LARGEST_FREE_BLOCK;
+}
+
+bool get_heartbeat_stats(heartbeat_id_t id, heartbeat_stats_t* stats) {
+  stats->deadline_ms = 3000;
+  stats->max_gap_us = 1000 * (id + 1);
+  stats->gap_us = 0;
+  return true;
+}
+
+const char* get_heartbeat_name(heartbeat_id_t id) {
+  return c_heartbeat_names[id];
+}
+
+bool get_power_residency(power_residency_t* residency) {
+  residency->max_frequency_us = 1000000;
+  residency->scaled_frequency_us = 2000000;
+  residency->light_sleep_us = 3000000;
+  return s_power_management;
+}
+
+uint32_t get_deferred_log_dropped() { return 3; }
+
+// A metric or label name
+static const char* parse_name(const char* p, char* name) {
+  size_t length = 0;
+  while (isalnum(p[length]) || p[length] == '_' || p[length] == ':') {
+    TEST_ASSERT_TRUE(length < MAX_METRIC_NAME_LENGTH - 1);
+    name[length] = p[length];
+    ++length;
+  }
+  TEST_ASSERT_TRUE(length > 0 && !isdigit(p[0]));
+  name[length] = '\0';
+  return p + length;
+}
+
+// Every line is a TYPE comment or a sample of the family the last TYPE
+// comment declared. Each family is declared once, samples have well formed
+// labels and a number for their value, and the output ends with a newline
+static void assert_valid_prometheus_text(const char* text) {
+  static char s_families[MAX_FAMILIES][MAX_METRIC_NAME_LENGTH];
+  size_t num_families = 0;
+  char name[MAX_METRIC_NAME_LENGTH];
+
+  TEST_ASSERT_TRUE(strlen(text) > 0);
+  TEST_ASSERT_EQUAL('\n', text[strlen(text) - 1]);
+
+  for (const char* line = text; *line;) {
+    const char* end = strchr(line, '\n');
+    const char* p = line;
+
+    if (strncmp(p, "# TYPE ", 7) == 0) {
+      p = parse_name(p + 7, name);
+      TEST_ASSERT_TRUE(strncmp(p, " gauge\n", 7) == 0 ||
+                       strncmp(p, " counter\n", 9) == 0);
+      for (size_t i = 0; i < num_families; ++i) {
+        TEST_ASSERT_TRUE(strcmp(s_families[i], name) != 0);
+      }
+      TEST_ASSERT_TRUE(num_families < MAX_FAMILIES);
+      strcpy(s_families[num_families++], name);
+    } else {
+      p = parse_name(p, name);
+      TEST_ASSERT_TRUE(num_families > 0);
+      TEST_ASSERT_EQUAL_STRING(s_families[num_families - 1], name);
+
+      if (*p == '{') {
+        do {
+          char label[MAX_METRIC_NAME_LENGTH];
+          p = parse_name(p + 1, label);
+          TEST_ASSERT_TRUE(p[0] == '=' && p[1] == '"');
+          p = strchr(p + 2, '"');
+          TEST_ASSERT_TRUE(p && p < end);
+          ++p;
+        } while (*p == ',');
+        TEST_ASSERT_EQUAL('}', *p);
+        ++p;
+      }
+
+      TEST_ASSERT_EQUAL(' ', *p);
+      char* value_end;
+      strtod(p + 1, &value_end);
+      TEST_ASSERT_TRUE(value_end > p + 1);
+      TEST_ASSERT_TRUE(value_end == end);
+    }
+
+    line = end + 1;
+  }
+}
+
+void setUp(void) {
+  g_fake_esp_timer_us = 0;
+  s_metrics = {};
+  s_num_tasks = 0;
+  s_power_management = true;
+  for (size_t i = 0; i < NUM_BOOT_PHASES; ++i) {
+    s_boot_phase_us[i] = -1;
+  }
+}
+
+void tearDown(void) {}
+
+// Busy counters, both jitter loads and every boot phase, as much as the
+// responses ever hold
+static void record_everything() {
+  for (size_t i = 0; i < MAX_METRICS_TASKS; ++i) {
+    if (i < NUM_ELEMENTS(c_firmware_task_names)) {
+      strcpy(s_task_names[i], c_firmware_task_names[i]);
+    } else {
+      snprintf(s_task_names[i], sizeof(s_task_names[i]), "%s%02u",
+               LONGEST_TASK_NAME, (unsigned)i);
+    }
+    register_task_metrics(s_task_names[i],
+                          reinterpret_cast<TaskHandle_t>(i + 1));
+  }
+
+  for (size_t i = 0; i < NUM_BOOT_PHASES; ++i) {
+    g_fake_esp_timer_us += 250000;
+    mark_boot_phase((boot_phase_t)i);
+  }
+  g_fake_esp_timer_us = TEST_UPTIME_US;
+
+  record_ntp_sync(true, -123456);
+  record_ntp_sync(false, 0);
+  record_weather_fetch(true, 71.25);
+  record_sensor_hub_datagram(true, -40.5);
+  record_sensor_hub_datagram(false, 0);
+
+  jitter_stats_t idle = {4000000000u, -2147483647, 2147483647, 1234567890};
+  jitter_stats_t weather_fetch = {60, -5, 700, 1200};
+  record_transition_jitter(idle, weather_fetch);
+}
+
+// With every task registered, so the buffer is large enough
+static void test_metrics_are_valid_prometheus_text() {
+  record_everything();
+
+  size_t length = render_metrics(s_response, sizeof(s_response));
+  TEST_ASSERT_TRUE(length > 0);
+  TEST_ASSERT_EQUAL(strlen(s_response), length);
+  assert_valid_prometheus_text(s_response);
+
+  TEST_ASSERT_NOT_NULL(strstr(s_response, "nixie_ntp_syncs_total 1\n"));
+  TEST_ASSERT_NOT_NULL(
+      strstr(s_response, "nixie_ntp_last_offset_seconds -0.123456\n"));
+  TEST_ASSERT_NOT_NULL(
+      strstr(s_response, "nixie_temperature_fahrenheit -40.50\n"));
+  TEST_ASSERT_NOT_NULL(strstr(
+      s_response,
+      "nixie_task_stack_free_bytes{task=\"" LONGEST_TASK_NAME "19\"} 2000\n"));
+  TEST_ASSERT_NOT_NULL(strstr(
+      s_response, "nixie_boot_phase_seconds{phase=\"ntp_synced\"} 1.500\n"));
+}
+
+// Not claimed as max_frequency, nor as scaled down or idle
+static void test_residency_without_power_management() {
+  render_metrics(s_response, sizeof(s_response));
+  TEST_ASSERT_NOT_NULL(
+      strstr(s_response, "nixie_power_management_enabled 1\n"));
+  TEST_ASSERT_NOT_NULL(
+      strstr(s_response,
+             "nixie_power_residency_seconds{state=\"light_sleep\"} 3.000\n"));
+
+  s_power_management = false;
+  TEST_ASSERT_TRUE(render_metrics(s_response, sizeof(s_response)) > 0);
+  assert_valid_prometheus_text(s_response);
+  TEST_ASSERT_NOT_NULL(
+      strstr(s_response, "nixie_power_management_enabled 0\n"));
+  TEST_ASSERT_NULL(strstr(s_response, "nixie_power_residency_seconds{"));
+}
+
+static void test_status_is_valid_json() {
+  record_everything();
+
+  size_t length = render_status(s_response, sizeof(s_response));
+  TEST_ASSERT_TRUE(length > 0);
+  TEST_ASSERT_EQUAL(strlen(s_response), length);
+
+  StaticJsonDocument<STATUS_SERVER_BUFFER_SIZE> doc;
+  TEST_ASSERT_FALSE(deserializeJson(doc, s_response, length));
+
+  TEST_ASSERT_EQUAL_INT64(TEST_UPTIME_US / 1000000,
+                          doc["uptime_s"].as<int64_t>());
+  TEST_ASSERT_EQUAL(1, doc["ntp"]["syncs"].as<int>());
+  TEST_ASSERT_EQUAL(1, doc["ntp"]["failures"].as<int>());
+  TEST_ASSERT_EQUAL_INT64(-123456, doc["ntp"]["last_offset_us"].as<int64_t>());
+  TEST_ASSERT_DOUBLE_WITHIN(1e-9, -40.5,
+                            doc["weather"]["temperature_f"].as<double>());
+  TEST_ASSERT_EQUAL(1, doc["sensor_hub"]["rejected"].as<int>());
+  JsonObject jitter = doc["transition_jitter_us"];
+  TEST_ASSERT_EQUAL_UINT32(4000000000u, jitter["samples"].as<uint32_t>());
+  TEST_ASSERT_EQUAL(-2147483647, jitter["min"].as<int32_t>());
+  TEST_ASSERT_EQUAL(TEST_HEAP_LARGEST_FREE_BLOCK,
+                    doc["heap"]["largest_free_block"].as<int>());
+
+  JsonObject stacks = doc["task_stack_free"];
+  TEST_ASSERT_EQUAL(MAX_METRICS_TASKS, stacks.size());
+  for (size_t i = 0; i < MAX_METRICS_TASKS; ++i) {
+    TEST_ASSERT_EQUAL(100 * (i + 1), stacks[s_task_names[i]].as<int>());
+  }
+}
+
+// Every buffer size up to the full response is refused with an empty buffer,
+// which the status server turns into a 500. One byte more is enough
+static void assert_refused_until_it_fits(size_t (*render)(char*, size_t)) {
+  size_t full_length = render(s_response, sizeof(s_response));
+  TEST_ASSERT_TRUE(full_length > 0);
+
+  for (size_t size = 0; size <= full_length; ++size) {
+    memset(s_short_response, 'x', sizeof(s_short_response));
+    TEST_ASSERT_EQUAL(0, render(s_short_response, size));
+    if (size) {
+      TEST_ASSERT_EQUAL('\0', s_short_response[0]);
+    }
+    TEST_ASSERT_EQUAL('x', s_short_response[size]);
+  }
+
+  TEST_ASSERT_EQUAL(full_length, render(s_short_response, full_length + 1));
+  TEST_ASSERT_EQUAL_STRING(s_response, s_short_response);
+}
+
+static void test_truncated_responses_are_refused() {
+  record_everything();
+  assert_refused_until_it_fits(render_metrics);
+  assert_refused_until_it_fits(render_status);
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_metrics_are_valid_prometheus_text);
+  RUN_TEST(test_residency_without_power_management);
+  RUN_TEST(test_status_is_valid_json);
+  RUN_TEST(test_truncated_responses_are_refused);
+  return UNITY_END();
+}
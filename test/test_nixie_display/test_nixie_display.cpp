@@ -0,0 +1,228 @@
+// Lays out fixed-point numbers for the tubes from a table of values and
+// formats, including the extremes of int32_t
+#include <unity.h>
+
+#include "../../src/Nixie_Display.cpp"
+#include "../../src/time_zone.cpp"
+
+typedef Nixie_Display::Display_Buffer Display_Buffer;
+typedef Nixie_Display::Number_Format Number_Format;
+
+#define NEGATIVE_DOTS NIXIE_DOTS_TOP_LEFT
+#define OVERFLOW_DOTS NIXIE_DOTS_TOP_RIGHT
+
+static const Number_Format c_integer = {0, 1, NEGATIVE_DOTS, OVERFLOW_DOTS};
+static const Number_Format c_padded_integer = {0, 4, NEGATIVE_DOTS,
+                                               OVERFLOW_DOTS};
+static const Number_Format c_all_blank_zero = {0, 0, NEGATIVE_DOTS,
+                                               OVERFLOW_DOTS};
+static const Number_Format c_two_places = {2, 1, NEGATIVE_DOTS, OVERFLOW_DOTS};
+static const Number_Format c_four_places = {4, 1, NEGATIVE_DOTS,
+                                            OVERFLOW_DOTS};
+
+typedef struct {
+  int32_t value;
+  uint8_t value_places;
+  const Number_Format* format;
+  const char* digits;  // '_' for a blank tube
+  uint8_t dots;
+  nixie_number_result_t result;
+} render_case_t;
+
+// Only reached by the display's animations and transitions
+uint32_t esp_random() { return 4; }
+
+SemaphoreHandle_t xSemaphoreCreateMutex() { return NULL; }
+
+void Deadline_Timer::sleep_until(int64_t deadline_us) {
+  g_fake_esp_timer_us = deadline_us;
+}
+
+void heartbeat() {}
+
+void acquire_power_lock(power_lock_t lock) {}
+
+void release_power_lock(power_lock_t lock) {}
+
+int get_animation_operand_size(uint8_t opcode) { return -1; }
+
+animation_error_t validate_animation(const uint8_t* program, size_t size,
+                                     animation_info_t* info) {
+  return ANIMATION_ERROR_BAD_HEADER;
+}
+
+static void format_digits(const Display_Buffer& buffer, char* digits) {
+  for (size_t i = 0; i < Nixie_Display::num_display_digits; ++i) {
+    digits[i] = buffer.digits[i] == NIXIE_BLANK_POS ? '_'
+                                                     : '0' + buffer.digits[i];
+  }
+  digits[Nixie_Display::num_display_digits] = '\0';
+}
+
+static void assert_renders(const render_case_t& render_case) {
+  char message[64];
+  snprintf(message, sizeof(message), "%d / 10^%u", (int)render_case.value,
+           render_case.value_places);
+
+  Display_Buffer buffer;
+  TEST_ASSERT_EQUAL_MESSAGE(
+      render_case.result,
+      Nixie_Display::render_number(render_case.value, render_case.value_places,
+                                   *render_case.format, &buffer),
+      message);
+  char digits[Nixie_Display::num_display_digits + 1];
+  format_digits(buffer, digits);
+  TEST_ASSERT_EQUAL_STRING_MESSAGE(render_case.digits, digits, message);
+  TEST_ASSERT_EQUAL_HEX8_MESSAGE(render_case.dots, buffer.dots, message);
+}
+
+void setUp(void) {}
+
+void tearDown(void) {}
+
+static void test_integers() {
+  static const render_case_t c_cases[] = {
+      {0, 0, &c_integer, "_____0", NIXIE_DOTS_NONE, NIXIE_NUMBER_OK},
+      {42, 0, &c_integer, "____42", NIXIE_DOTS_NONE, NIXIE_NUMBER_OK},
+      {-42, 0, &c_integer, "____42", NEGATIVE_DOTS, NIXIE_NUMBER_OK},
+      {105, 0, &c_integer, "___105", NIXIE_DOTS_NONE, NIXIE_NUMBER_OK},
+      {999999, 0, &c_integer, "999999", NIXIE_DOTS_NONE, NIXIE_NUMBER_OK},
+      {42, 0, &c_padded_integer, "__0042", NIXIE_DOTS_NONE, NIXIE_NUMBER_OK},
+      {0, 0, &c_all_blank_zero, "______", NIXIE_DOTS_NONE, NIXIE_NUMBER_OK},
+  };
+
+  for (size_t i = 0; i < NUM_ELEMENTS(c_cases); ++i) {
+    assert_renders(c_cases[i]);
+  }
+}
+
+// The decimal point is a bottom dot, and at least one integer digit is kept
+static void test_decimal_places() {
+  static const render_case_t c_cases[] = {
+      {2150, 2, &c_two_places, "__2150", NIXIE_DOTS_BOTTOM_RIGHT,
+       NIXIE_NUMBER_OK},
+      {5, 2, &c_two_places, "___005", NIXIE_DOTS_BOTTOM_RIGHT,
+       NIXIE_NUMBER_OK},
+      {-5, 2, &c_two_places, "___005",
+       NIXIE_DOTS_BOTTOM_RIGHT | NEGATIVE_DOTS, NIXIE_NUMBER_OK},
+      // Scaled up to the format's places
+      {7, 0, &c_four_places, "_70000", NIXIE_DOTS_BOTTOM_LEFT,
+       NIXIE_NUMBER_OK},
+      {123456, 4, &c_four_places, "123456", NIXIE_DOTS_BOTTOM_LEFT,
+       NIXIE_NUMBER_OK},
+  };
+
+  for (size_t i = 0; i < NUM_ELEMENTS(c_cases); ++i) {
+    assert_renders(c_cases[i]);
+  }
+}
+
+// Half away from zero, and without a sign once the value rounds to zero
+static void test_rounding() {
+  static const render_case_t c_cases[] = {
+      {2155, 3, &c_two_places, "___216", NIXIE_DOTS_BOTTOM_RIGHT,
+       NIXIE_NUMBER_OK},
+      {2154, 3, &c_two_places, "___215", NIXIE_DOTS_BOTTOM_RIGHT,
+       NIXIE_NUMBER_OK},
+      {-2155, 3, &c_two_places, "___216",
+       NIXIE_DOTS_BOTTOM_RIGHT | NEGATIVE_DOTS, NIXIE_NUMBER_OK},
+      {-4, 3, &c_two_places, "___000", NIXIE_DOTS_BOTTOM_RIGHT,
+       NIXIE_NUMBER_OK},
+      {-5, 3, &c_two_places, "___001",
+       NIXIE_DOTS_BOTTOM_RIGHT | NEGATIVE_DOTS, NIXIE_NUMBER_OK},
+      {-499, 3, &c_integer, "_____0", NIXIE_DOTS_NONE, NIXIE_NUMBER_OK},
+      {9999994, 1, &c_integer, "999999", NIXIE_DOTS_NONE, NIXIE_NUMBER_OK},
+  };
+
+  for (size_t i = 0; i < NUM_ELEMENTS(c_cases); ++i) {
+    assert_renders(c_cases[i]);
+  }
+}
+
+// Saturated at 9s, with both the sign and the overflow shown
+static void test_overflow_and_int32_extremes() {
+  static const render_case_t c_cases[] = {
+      {1000000, 0, &c_integer, "999999", OVERFLOW_DOTS,
+       NIXIE_NUMBER_OVERFLOW},
+      {9999995, 1, &c_two_places, "999999",
+       NIXIE_DOTS_BOTTOM_RIGHT | OVERFLOW_DOTS, NIXIE_NUMBER_OVERFLOW},
+      {INT32_MAX, 0, &c_integer, "999999", OVERFLOW_DOTS,
+       NIXIE_NUMBER_OVERFLOW},
+      {INT32_MIN, 0, &c_integer, "999999", NEGATIVE_DOTS | OVERFLOW_DOTS,
+       NIXIE_NUMBER_OVERFLOW},
+      // Scaling up by 10^4 mustn't wrap
+      {INT32_MAX, 0, &c_four_places, "999999",
+       NIXIE_DOTS_BOTTOM_LEFT | OVERFLOW_DOTS, NIXIE_NUMBER_OVERFLOW},
+      {INT32_MIN, 0, &c_four_places, "999999",
+       NIXIE_DOTS_BOTTOM_LEFT | NEGATIVE_DOTS | OVERFLOW_DOTS,
+       NIXIE_NUMBER_OVERFLOW},
+      // And fits once scaled down: -2.147483648
+      {INT32_MIN, 9, &c_four_places, "_21475",
+       NIXIE_DOTS_BOTTOM_LEFT | NEGATIVE_DOTS, NIXIE_NUMBER_OK},
+      {INT32_MAX, 9, &c_four_places, "_21475", NIXIE_DOTS_BOTTOM_LEFT,
+       NIXIE_NUMBER_OK},
+  };
+
+  for (size_t i = 0; i < NUM_ELEMENTS(c_cases); ++i) {
+    assert_renders(c_cases[i]);
+  }
+}
+
+// The frame is left as it was
+static void test_bad_formats_are_rejected() {
+  static const Number_Format c_bad_formats[] = {
+      {1, 1, NEGATIVE_DOTS, OVERFLOW_DOTS},
+      {3, 1, NEGATIVE_DOTS, OVERFLOW_DOTS},
+      {6, 0, NEGATIVE_DOTS, OVERFLOW_DOTS},
+      // More integer digits than there are tubes left of the point
+      {4, 3, NEGATIVE_DOTS, OVERFLOW_DOTS},
+      {0, 7, NEGATIVE_DOTS, OVERFLOW_DOTS},
+  };
+
+  for (size_t i = 0; i < NUM_ELEMENTS(c_bad_formats); ++i) {
+    Display_Buffer buffer;
+    memset(&buffer, 0xaa, sizeof(buffer));
+    TEST_ASSERT_EQUAL(NIXIE_NUMBER_BAD_FORMAT,
+                      Nixie_Display::render_number(42, 0, c_bad_formats[i],
+                                                   &buffer));
+    TEST_ASSERT_EACH_EQUAL_HEX8(0xaa, &buffer, sizeof(buffer));
+  }
+
+  // 10^10 doesn't fit in 32 bits
+  Display_Buffer buffer;
+  TEST_ASSERT_EQUAL(NIXIE_NUMBER_BAD_FORMAT,
+                    Nixie_Display::render_number(42, 10, c_integer, &buffer));
+  TEST_ASSERT_EQUAL(NIXIE_NUMBER_OK,
+                    Nixie_Display::render_number(42, 9, c_integer, &buffer));
+}
+
+// Only a valid number reaches the tubes
+static void test_display_number_publishes_the_frame() {
+  Nixie_Display& display = Nixie_Display::get_instance();
+  TEST_ASSERT_EQUAL(NIXIE_NUMBER_OK, display.display_number(-2150, 2,
+                                                            c_two_places));
+  Display_Buffer front = Nixie_Display::read_front_buffer();
+  char digits[Nixie_Display::num_display_digits + 1];
+  format_digits(front, digits);
+  TEST_ASSERT_EQUAL_STRING("__2150", digits);
+  TEST_ASSERT_EQUAL_HEX8(NIXIE_DOTS_BOTTOM_RIGHT | NEGATIVE_DOTS, front.dots);
+
+  static const Number_Format c_bad_format = {3, 1, NEGATIVE_DOTS,
+                                             OVERFLOW_DOTS};
+  TEST_ASSERT_EQUAL(NIXIE_NUMBER_BAD_FORMAT,
+                    display.display_number(7, 0, c_bad_format));
+  front = Nixie_Display::read_front_buffer();
+  format_digits(front, digits);
+  TEST_ASSERT_EQUAL_STRING("__2150", digits);
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_integers);
+  RUN_TEST(test_decimal_places);
+  RUN_TEST(test_rounding);
+  RUN_TEST(test_overflow_and_int32_extremes);
+  RUN_TEST(test_bad_formats_are_rejected);
+  RUN_TEST(test_display_number_publishes_the_frame);
+  return UNITY_END();
+}
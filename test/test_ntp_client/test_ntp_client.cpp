@@ -0,0 +1,356 @@
+// Parses hand built server responses and runs the selection on sets of
+// samples with falsetickers, then queries servers answering on loopback
+#include <unistd.h>
+#include <unity.h>
+
+#include <atomic>
+#include <thread>
+
+// The servers of test_query_loopback_servers(). The last is the first again,
+// which mustn't get a second vote
+#define LOOPBACK_PORT 12390
+#define NTP_SERVERS                                           \
+  "127.0.0.1:12390", "127.0.0.1:12391", "127.0.0.1:12392",    \
+      "127.0.0.1:12393", "127.0.0.1:12394", "localhost:12390"
+
+#include "../../src/ntp_client.cpp"
+
+// 2026-01-01 and the same in NTP era 0 seconds
+#define TEST_UNIX_S 1767225600LL
+#define TEST_NTP_S ((uint64_t)(TEST_UNIX_S + NTP_UNIX_EPOCH_OFFSET_S))
+
+#define TEST_COOKIE 0x0123456789abcdefULL
+
+#define LOOPBACK_OFFSET_US 250000
+#define LOOPBACK_REQUEST_DELAY_US 200000
+#define LOOPBACK_ROOT_DISPERSION 0x42  // About 1 ms
+#define LOOPBACK_POLL_MS 50
+#define LOOPBACK_TOLERANCE_US 10000
+
+typedef struct {
+  int64_t offset_us;  // Of its clock from ours
+  // Each request is held up this long on its way in, except on the fast
+  // round, which is the one sample worth keeping
+  int64_t request_delay_us;
+  int fast_round;
+  bool kiss_of_death;
+} loopback_server_t;
+
+// Truechimers fast on a middle round, so keeping the first or the last
+// sample is caught, a falseticker and a server telling us to go away. All of
+// them answer every request: the fake clock stands still, so the response
+// timeout never expires
+static const loopback_server_t c_loopback_servers[] = {
+    {LOOPBACK_OFFSET_US, LOOPBACK_REQUEST_DELAY_US, 1, false},
+    {LOOPBACK_OFFSET_US, LOOPBACK_REQUEST_DELAY_US, 2, false},
+    {LOOPBACK_OFFSET_US, LOOPBACK_REQUEST_DELAY_US, 1, false},
+    {LOOPBACK_OFFSET_US + 5000000, 0, 0, false},
+    {LOOPBACK_OFFSET_US, 0, 0, true},
+};
+
+static std::atomic<bool> s_stop_loopback_servers;
+
+// Only reached by query_ntp_servers()
+uint32_t esp_random() { return 4; }
+
+TickType_t xTaskGetTickCount() { return 0; }
+
+void vTaskDelayUntil(TickType_t* previous_wake_time, TickType_t increment) {}
+
+static void write_u32(uint8_t* p, uint32_t value) {
+  for (int i = 3; i >= 0; --i) {
+    p[i] = value & 0xff;
+    value >>= 8;
+  }
+}
+
+// A response with the receive and transmit timestamps in Unix microseconds,
+// and the root delay and dispersion in 16.16 seconds
+static void build_response(int64_t t2_us, int64_t t3_us, uint32_t root_delay,
+                           uint32_t root_dispersion, uint8_t* packet) {
+  memset(packet, 0, NTP_PACKET_SIZE);
+  packet[0] = (NTP_VERSION << 3) | NTP_MODE_SERVER;
+  packet[1] = 2;
+  write_u32(packet + 4, root_delay);
+  write_u32(packet + 8, root_dispersion);
+  write_u64(packet + 24, TEST_COOKIE);
+
+  int64_t timestamps_us[] = {t2_us, t3_us};
+  for (size_t i = 0; i < 2; ++i) {
+    uint64_t seconds = timestamps_us[i] / 1000000 + NTP_UNIX_EPOCH_OFFSET_S;
+    uint64_t fraction = ((uint64_t)(timestamps_us[i] % 1000000) << 32) /
+                        1000000;
+    // Rounded up, so the conversion back truncates to the same microsecond
+    write_u64(packet + 32 + 8 * i, ((seconds << 32) | fraction) + 1);
+  }
+}
+
+static ntp_sample_t make_sample(int64_t offset_us, int64_t root_distance_us) {
+  ntp_sample_t sample;
+  memset(&sample, 0, sizeof(sample));
+  sample.offset_us = offset_us;
+  sample.root_distance_us = root_distance_us;
+  sample.stratum = 2;
+  return sample;
+}
+
+void setUp(void) {}
+
+void tearDown(void) {}
+
+// The server's clock is 250 ms ahead. The request takes 10 ms each way and
+// the server holds it for 3 ms
+static void test_response_gives_offset_and_delay() {
+  int64_t t1_us = TEST_UNIX_S * 1000000;
+  int64_t t2_us = t1_us + 10000 + 250000;
+  int64_t t3_us = t2_us + 3000;
+  int64_t t4_us = t3_us - 250000 + 10000;
+
+  uint8_t packet[NTP_PACKET_SIZE];
+  // About 8 ms of root delay and 2 ms of root dispersion
+  build_response(t2_us, t3_us, 524, 131, packet);
+  ntp_sample_t sample;
+  TEST_ASSERT_TRUE(parse_ntp_response(packet, sizeof(packet), TEST_COOKIE,
+                                      t1_us, t4_us, &sample));
+  TEST_ASSERT_EQUAL_INT64(250000, sample.offset_us);
+  TEST_ASSERT_EQUAL_INT64(20000, sample.delay_us);
+  TEST_ASSERT_EQUAL_INT64(2, sample.stratum);
+  // Half the round trip, half the root delay and the dispersion
+  TEST_ASSERT_EQUAL_INT64(10000 + 7995 / 2 + 1998, sample.root_distance_us);
+}
+
+static void test_unusable_responses_are_rejected() {
+  int64_t t1_us = TEST_UNIX_S * 1000000;
+  uint8_t packet[NTP_PACKET_SIZE];
+  ntp_sample_t sample;
+
+  build_response(t1_us, t1_us, 0, 0, packet);
+  TEST_ASSERT_TRUE(parse_ntp_response(packet, sizeof(packet), TEST_COOKIE,
+                                      t1_us, t1_us, &sample));
+  TEST_ASSERT_FALSE(parse_ntp_response(packet, NTP_PACKET_SIZE - 1,
+                                       TEST_COOKIE, t1_us, t1_us, &sample));
+  // Not the request in flight
+  TEST_ASSERT_FALSE(parse_ntp_response(packet, sizeof(packet),
+                                       TEST_COOKIE + 1, t1_us, t1_us,
+                                       &sample));
+
+  // Unsynchronized
+  packet[0] |= NTP_LEAP_NOT_SYNCHRONIZED << 6;
+  TEST_ASSERT_FALSE(parse_ntp_response(packet, sizeof(packet), TEST_COOKIE,
+                                       t1_us, t1_us, &sample));
+
+  // Kiss-o'-death
+  build_response(t1_us, t1_us, 0, 0, packet);
+  packet[1] = 0;
+  TEST_ASSERT_FALSE(parse_ntp_response(packet, sizeof(packet), TEST_COOKIE,
+                                       t1_us, t1_us, &sample));
+
+  // A client packet
+  build_response(t1_us, t1_us, 0, 0, packet);
+  packet[0] = (NTP_VERSION << 3) | NTP_MODE_CLIENT;
+  TEST_ASSERT_FALSE(parse_ntp_response(packet, sizeof(packet), TEST_COOKIE,
+                                       t1_us, t1_us, &sample));
+
+  // Too far away to bound the offset: 2 s of root dispersion
+  build_response(t1_us, t1_us, 0, 2 << 16, packet);
+  TEST_ASSERT_FALSE(parse_ntp_response(packet, sizeof(packet), TEST_COOKIE,
+                                       t1_us, t1_us, &sample));
+}
+
+// Timestamps from 2036 on have the top bit of the seconds clear
+static void test_era_1_timestamps() {
+  TEST_ASSERT_EQUAL_INT64(TEST_UNIX_S * 1000000,
+                          ntp_timestamp_to_us(TEST_NTP_S << 32));
+  TEST_ASSERT_EQUAL_INT64(((1LL << 32) - NTP_UNIX_EPOCH_OFFSET_S) * 1000000,
+                          ntp_timestamp_to_us(0));
+  TEST_ASSERT_EQUAL_INT64(
+      ((1LL << 32) + 1 - NTP_UNIX_EPOCH_OFFSET_S) * 1000000 + 500000,
+      ntp_timestamp_to_us((1ULL << 32) | 0x80000000));
+}
+
+static void test_agreeing_samples_are_all_truechimers() {
+  ntp_sample_t samples[] = {make_sample(1000, 5000), make_sample(3000, 5000),
+                            make_sample(2000, 5000)};
+  ntp_selection_t selection;
+  TEST_ASSERT_TRUE(select_ntp_offset(samples, 3, &selection));
+  TEST_ASSERT_EQUAL(3, selection.num_samples);
+  TEST_ASSERT_EQUAL(3, selection.num_truechimers);
+  TEST_ASSERT_EQUAL_INT64(2000, selection.offset_us);
+  TEST_ASSERT_EQUAL_INT64(-2000, selection.low_us);
+  TEST_ASSERT_EQUAL_INT64(6000, selection.high_us);
+}
+
+static void test_falseticker_is_dropped() {
+  ntp_sample_t samples[] = {make_sample(1000, 5000), make_sample(900000, 5000),
+                            make_sample(3000, 5000), make_sample(2000, 5000)};
+  ntp_selection_t selection;
+  TEST_ASSERT_TRUE(select_ntp_offset(samples, 4, &selection));
+  TEST_ASSERT_EQUAL(3, selection.num_truechimers);
+  TEST_ASSERT_EQUAL_INT64(2000, selection.offset_us);
+  TEST_ASSERT_EQUAL_INT64(-2000, selection.low_us);
+  TEST_ASSERT_EQUAL_INT64(6000, selection.high_us);
+}
+
+// Two falsetickers that agree with each other are still outvoted
+static void test_agreeing_falsetickers_are_outvoted() {
+  ntp_sample_t samples[] = {
+      make_sample(-500000, 5000), make_sample(0, 5000),
+      make_sample(-502000, 5000), make_sample(1000, 5000),
+      make_sample(2000, 5000),
+  };
+  ntp_selection_t selection;
+  TEST_ASSERT_TRUE(select_ntp_offset(samples, 5, &selection));
+  TEST_ASSERT_EQUAL(3, selection.num_truechimers);
+  TEST_ASSERT_EQUAL_INT64(1000, selection.offset_us);
+  TEST_ASSERT_EQUAL_INT64(-3000, selection.low_us);
+  TEST_ASSERT_EQUAL_INT64(5000, selection.high_us);
+}
+
+static void test_no_majority_is_rejected() {
+  ntp_selection_t selection;
+
+  // Two against two
+  ntp_sample_t split[] = {make_sample(0, 5000), make_sample(1000, 5000),
+                          make_sample(500000, 5000),
+                          make_sample(501000, 5000)};
+  TEST_ASSERT_FALSE(select_ntp_offset(split, 4, &selection));
+
+  // All apart
+  ntp_sample_t apart[] = {make_sample(0, 5000), make_sample(100000, 5000),
+                          make_sample(200000, 5000)};
+  TEST_ASSERT_FALSE(select_ntp_offset(apart, 3, &selection));
+  TEST_ASSERT_EQUAL(0, selection.num_truechimers);
+
+  TEST_ASSERT_FALSE(select_ntp_offset(apart, 0, &selection));
+
+  ntp_sample_t too_many[NTP_MAX_SERVERS + 1];
+  for (size_t i = 0; i < NUM_ELEMENTS(too_many); ++i) {
+    too_many[i] = make_sample(0, 5000);
+  }
+  TEST_ASSERT_FALSE(
+      select_ntp_offset(too_many, NUM_ELEMENTS(too_many), &selection));
+}
+
+// A single server is its own majority. Two intervals that only touch still
+// intersect
+static void test_single_and_touching_intervals() {
+  ntp_selection_t selection;
+  ntp_sample_t single = make_sample(-7000, 3000);
+  TEST_ASSERT_TRUE(select_ntp_offset(&single, 1, &selection));
+  TEST_ASSERT_EQUAL_INT64(-7000, selection.offset_us);
+  TEST_ASSERT_EQUAL_INT64(-10000, selection.low_us);
+  TEST_ASSERT_EQUAL_INT64(-4000, selection.high_us);
+
+  ntp_sample_t touching[] = {make_sample(0, 5000), make_sample(10000, 5000)};
+  TEST_ASSERT_TRUE(select_ntp_offset(touching, 2, &selection));
+  TEST_ASSERT_EQUAL(2, selection.num_truechimers);
+  TEST_ASSERT_EQUAL_INT64(5000, selection.low_us);
+  TEST_ASSERT_EQUAL_INT64(5000, selection.high_us);
+}
+
+// The tighter bound counts for more
+static void test_truechimers_are_weighted_by_root_distance() {
+  ntp_sample_t samples[] = {make_sample(0, 999), make_sample(4000, 9999)};
+  ntp_selection_t selection;
+  TEST_ASSERT_TRUE(select_ntp_offset(samples, 2, &selection));
+  TEST_ASSERT_EQUAL_INT64(364, selection.offset_us);
+}
+
+static int open_loopback_socket(uint16_t port) {
+  int socket_fd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+  if (socket_fd < 0) {
+    return -1;
+  }
+
+  struct sockaddr_in address;
+  memset(&address, 0, sizeof(address));
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  address.sin_port = htons(port);
+  struct timeval timeout = {0, LOOPBACK_POLL_MS * 1000};
+  if (bind(socket_fd, (struct sockaddr*)&address, sizeof(address)) != 0 ||
+      setsockopt(socket_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout,
+                 sizeof(timeout)) != 0) {
+    close(socket_fd);
+    return -1;
+  }
+  return socket_fd;
+}
+
+// Answers requests until told to stop, on its own thread, so it mustn't
+// assert
+static void serve_loopback_requests(const loopback_server_t* server,
+                                    int socket_fd) {
+  for (int round = 0; !s_stop_loopback_servers;) {
+    uint8_t packet[NTP_PACKET_SIZE];
+    struct sockaddr_in client;
+    socklen_t client_length = sizeof(client);
+    if (recvfrom(socket_fd, packet, sizeof(packet), 0,
+                 (struct sockaddr*)&client,
+                 &client_length) != NTP_PACKET_SIZE) {
+      continue;
+    }
+
+    if (round++ != server->fast_round) {
+      usleep(server->request_delay_us);
+    }
+    int64_t t2_us = get_epoch_us() + server->offset_us;
+    uint64_t origin = read_u64(packet + 40);
+    build_response(t2_us, get_epoch_us() + server->offset_us, 0,
+                   LOOPBACK_ROOT_DISPERSION, packet);
+    write_u64(packet + 24, origin);
+    if (server->kiss_of_death) {
+      packet[1] = 0;
+      memcpy(packet + 12, "RATE", 4);
+    }
+    sendto(socket_fd, packet, sizeof(packet), 0, (struct sockaddr*)&client,
+           client_length);
+  }
+}
+
+// The falseticker is dropped and the kiss of death gives no sample. Each
+// truechimer's fast round is kept: any other is off by half its 200 ms
+static void test_query_loopback_servers() {
+  const size_t num_servers = NUM_ELEMENTS(c_loopback_servers);
+  int sockets[num_servers];
+  std::thread threads[num_servers];
+  s_stop_loopback_servers = false;
+  for (size_t i = 0; i < num_servers; ++i) {
+    sockets[i] = open_loopback_socket(LOOPBACK_PORT + i);
+    TEST_ASSERT_TRUE(sockets[i] >= 0);
+    threads[i] = std::thread(serve_loopback_requests, &c_loopback_servers[i],
+                             sockets[i]);
+  }
+
+  ntp_selection_t selection;
+  bool selected = query_ntp_servers(&selection);
+
+  s_stop_loopback_servers = true;
+  for (size_t i = 0; i < num_servers; ++i) {
+    threads[i].join();
+    close(sockets[i]);
+  }
+
+  TEST_ASSERT_TRUE(selected);
+  TEST_ASSERT_EQUAL(num_servers - 1, selection.num_samples);
+  TEST_ASSERT_EQUAL(num_servers - 2, selection.num_truechimers);
+  TEST_ASSERT_INT64_WITHIN(LOOPBACK_TOLERANCE_US, LOOPBACK_OFFSET_US,
+                           selection.offset_us);
+  TEST_ASSERT_TRUE(selection.low_us <= LOOPBACK_OFFSET_US &&
+                   LOOPBACK_OFFSET_US <= selection.high_us);
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_response_gives_offset_and_delay);
+  RUN_TEST(test_unusable_responses_are_rejected);
+  RUN_TEST(test_era_1_timestamps);
+  RUN_TEST(test_agreeing_samples_are_all_truechimers);
+  RUN_TEST(test_falseticker_is_dropped);
+  RUN_TEST(test_agreeing_falsetickers_are_outvoted);
+  RUN_TEST(test_no_majority_is_rejected);
+  RUN_TEST(test_single_and_touching_intervals);
+  RUN_TEST(test_truechimers_are_weighted_by_root_distance);
+  RUN_TEST(test_query_loopback_servers);
+  return UNITY_END();
+}
@@ -0,0 +1,325 @@
+// Parses datagrams in both formats and feeds readings through the
+// acceptance rules with a fake clock, then sends both formats to the socket
+// over the loopback interface
+#include <unity.h>
+
+#include "../../src/sensor_hub.cpp"
+#include "util.h"
+
+#define SECOND_US 1000000LL
+
+// Long enough for a datagram on the loopback interface to arrive
+#define LOOPBACK_TIMEOUT_MS 1000
+
+static size_t s_num_accepted;
+static size_t s_num_rejected;
+
+// Only reached by receive_sensor_hub_reading()
+void record_sensor_hub_datagram(bool accepted, double temperature) {
+  ++(accepted ? s_num_accepted : s_num_rejected);
+}
+
+static void build_binary(uint32_t sequence, int16_t hundredths,
+                         uint16_t age_s, uint8_t* datagram) {
+  datagram[0] = SENSOR_HUB_MAGIC_0;
+  datagram[1] = SENSOR_HUB_MAGIC_1;
+  datagram[2] = SENSOR_HUB_VERSION;
+  datagram[3] = 0;
+  for (int i = 0; i < 4; ++i) {
+    datagram[4 + i] = sequence >> (8 * i);
+  }
+  datagram[8] = (uint16_t)hundredths & 0xff;
+  datagram[9] = (uint16_t)hundredths >> 8;
+  datagram[10] = age_s & 0xff;
+  datagram[11] = age_s >> 8;
+}
+
+static bool parse_json(const char* json, sensor_hub_reading_t* reading) {
+  return parse_sensor_hub_datagram(reinterpret_cast<const uint8_t*>(json),
+                                   strlen(json), reading);
+}
+
+static sensor_hub_reading_t make_reading(uint32_t sequence, double temperature,
+                                         uint16_t age_s) {
+  sensor_hub_reading_t reading;
+  reading.sequence = sequence;
+  reading.temperature = temperature;
+  reading.age_s = age_s;
+  return reading;
+}
+
+static void send_to_sensor_hub(const void* datagram, size_t size) {
+  int sender = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+  TEST_ASSERT_TRUE(sender >= 0);
+
+  struct sockaddr_in address;
+  memset(&address, 0, sizeof(address));
+  address.sin_family = AF_INET;
+  address.sin_port = htons(SENSOR_HUB_PORT);
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  TEST_ASSERT_EQUAL(size, sendto(sender, datagram, size, 0,
+                                 (struct sockaddr*)&address, sizeof(address)));
+  close(sender);
+}
+
+static void send_json_to_sensor_hub(const char* json) {
+  send_to_sensor_hub(json, strlen(json));
+}
+
+static void advance_s(int64_t seconds) {
+  g_fake_esp_timer_us += seconds * SECOND_US;
+}
+
+void setUp(void) {
+  // Well past boot, so readings can be backdated by their age
+  g_fake_esp_timer_us = 3600 * SECOND_US;
+  s_has_reading = false;
+  s_last_sequence = 0;
+  s_last_reading_us = 0;
+  s_temperature = 0;
+  s_num_accepted = 0;
+  s_num_rejected = 0;
+}
+
+void tearDown(void) { close_sensor_hub_socket(); }
+
+static void test_binary_datagrams() {
+  uint8_t datagram[SENSOR_HUB_BINARY_SIZE];
+  sensor_hub_reading_t reading;
+
+  build_binary(0x12345678, 7125, 3, datagram);
+  TEST_ASSERT_TRUE(
+      parse_sensor_hub_datagram(datagram, sizeof(datagram), &reading));
+  TEST_ASSERT_EQUAL_UINT32(0x12345678, reading.sequence);
+  TEST_ASSERT_DOUBLE_WITHIN(1e-9, 71.25, reading.temperature);
+  TEST_ASSERT_EQUAL(3, reading.age_s);
+
+  build_binary(1, -1050, 0, datagram);
+  TEST_ASSERT_TRUE(
+      parse_sensor_hub_datagram(datagram, sizeof(datagram), &reading));
+  TEST_ASSERT_DOUBLE_WITHIN(1e-9, -10.5, reading.temperature);
+
+  // Truncated, padded, and with a bad magic or version
+  TEST_ASSERT_FALSE(
+      parse_sensor_hub_datagram(datagram, sizeof(datagram) - 1, &reading));
+  uint8_t padded[SENSOR_HUB_BINARY_SIZE + 1] = {0};
+  memcpy(padded, datagram, sizeof(datagram));
+  TEST_ASSERT_FALSE(
+      parse_sensor_hub_datagram(padded, sizeof(padded), &reading));
+  for (size_t i = 0; i < 3; ++i) {
+    build_binary(1, 7000, 0, datagram);
+    ++datagram[i];
+    TEST_ASSERT_FALSE(
+        parse_sensor_hub_datagram(datagram, sizeof(datagram), &reading));
+  }
+  TEST_ASSERT_FALSE(parse_sensor_hub_datagram(datagram, 0, &reading));
+}
+
+static void test_json_datagrams() {
+  sensor_hub_reading_t reading;
+
+  TEST_ASSERT_TRUE(
+      parse_json("{\"seq\": 42, \"temp_f\": 71.25, \"age_s\": 3}", &reading));
+  TEST_ASSERT_EQUAL_UINT32(42, reading.sequence);
+  TEST_ASSERT_DOUBLE_WITHIN(1e-9, 71.25, reading.temperature);
+  TEST_ASSERT_EQUAL(3, reading.age_s);
+
+  // Celsius, and the age defaults to 0
+  TEST_ASSERT_TRUE(parse_json("{\"seq\": 4294967295, \"temp_c\": -40}",
+                              &reading));
+  TEST_ASSERT_EQUAL_UINT32(4294967295u, reading.sequence);
+  TEST_ASSERT_DOUBLE_WITHIN(1e-9, -40, reading.temperature);
+  TEST_ASSERT_EQUAL(0, reading.age_s);
+  TEST_ASSERT_TRUE(parse_json("{\"temp_c\": 21.5, \"seq\": 1}", &reading));
+  TEST_ASSERT_DOUBLE_WITHIN(1e-9, 70.7, reading.temperature);
+
+  static const char* const c_invalid[] = {
+      "{\"temp_f\": 70}",
+      "{\"seq\": 1}",
+      "{\"seq\": -1, \"temp_f\": 70}",
+      "{\"seq\": 1.5, \"temp_f\": 70}",
+      "{\"seq\": \"1\", \"temp_f\": 70}",
+      "{\"seq\": 1, \"temp_f\": \"70\"}",
+      "{\"seq\": 1, \"temp_f\": 70, \"age_s\": 65536}",
+      "{\"seq\": 1, \"temp_f\": 70, \"age_s\": -1}",
+      "{\"seq\": 1, \"temp_f\": 70",
+      "{}",
+      "{",
+  };
+  for (size_t i = 0; i < NUM_ELEMENTS(c_invalid); ++i) {
+    TEST_ASSERT_FALSE_MESSAGE(parse_json(c_invalid[i], &reading),
+                              c_invalid[i]);
+  }
+}
+
+// Both formats, at and just past each end of the range
+static void test_temperature_range() {
+  uint8_t datagram[SENSOR_HUB_BINARY_SIZE];
+  sensor_hub_reading_t reading;
+
+  static const struct {
+    int16_t hundredths;
+    bool valid;
+  } c_cases[] = {
+      {-10000, true},  {20000, true},     {-10001, false},
+      {20001, false},  {INT16_MIN, false}, {INT16_MAX, false},
+  };
+  for (size_t i = 0; i < NUM_ELEMENTS(c_cases); ++i) {
+    build_binary(1, c_cases[i].hundredths, 0, datagram);
+    TEST_ASSERT_EQUAL(
+        c_cases[i].valid,
+        parse_sensor_hub_datagram(datagram, sizeof(datagram), &reading));
+  }
+
+  TEST_ASSERT_TRUE(parse_json("{\"seq\": 1, \"temp_f\": -100}", &reading));
+  TEST_ASSERT_TRUE(parse_json("{\"seq\": 1, \"temp_f\": 200}", &reading));
+  TEST_ASSERT_FALSE(parse_json("{\"seq\": 1, \"temp_f\": 200.5}", &reading));
+  TEST_ASSERT_FALSE(parse_json("{\"seq\": 1, \"temp_c\": 100}", &reading));
+  TEST_ASSERT_FALSE(parse_json("{\"seq\": 1, \"temp_c\": -80}", &reading));
+}
+
+static void test_old_readings_are_rejected() {
+  double temperature;
+  TEST_ASSERT_FALSE(get_sensor_hub_temperature(&temperature));
+
+  TEST_ASSERT_FALSE(accept_sensor_hub_reading(
+      make_reading(1, 70, SENSOR_HUB_MAX_AGE_S + 1)));
+  TEST_ASSERT_FALSE(get_sensor_hub_temperature(&temperature));
+
+  // Expires by when it was taken, not when it arrived
+  TEST_ASSERT_TRUE(accept_sensor_hub_reading(make_reading(1, 70, 100)));
+  TEST_ASSERT_TRUE(get_sensor_hub_temperature(&temperature));
+  TEST_ASSERT_DOUBLE_WITHIN(1e-9, 70, temperature);
+  advance_s(SENSOR_HUB_MAX_AGE_S - 101);
+  TEST_ASSERT_TRUE(get_sensor_hub_temperature(&temperature));
+  advance_s(1);
+  TEST_ASSERT_FALSE(get_sensor_hub_temperature(&temperature));
+}
+
+static void test_sequence_must_advance() {
+  double temperature;
+  TEST_ASSERT_TRUE(accept_sensor_hub_reading(make_reading(10, 70, 0)));
+  TEST_ASSERT_FALSE(accept_sensor_hub_reading(make_reading(10, 71, 0)));
+  TEST_ASSERT_FALSE(accept_sensor_hub_reading(make_reading(9, 72, 0)));
+  TEST_ASSERT_TRUE(accept_sensor_hub_reading(make_reading(12, 73, 0)));
+  TEST_ASSERT_TRUE(get_sensor_hub_temperature(&temperature));
+  TEST_ASSERT_DOUBLE_WITHIN(1e-9, 73, temperature);
+}
+
+// Serial number arithmetic, so newer is within half the sequence space ahead
+static void test_sequence_wraps() {
+  double temperature;
+  TEST_ASSERT_TRUE(
+      accept_sensor_hub_reading(make_reading(UINT32_MAX - 2, 73, 0)));
+  TEST_ASSERT_TRUE(accept_sensor_hub_reading(make_reading(UINT32_MAX, 74, 0)));
+  TEST_ASSERT_TRUE(accept_sensor_hub_reading(make_reading(0, 75, 0)));
+  TEST_ASSERT_TRUE(accept_sensor_hub_reading(make_reading(3, 76, 0)));
+  TEST_ASSERT_FALSE(
+      accept_sensor_hub_reading(make_reading(UINT32_MAX - 1, 77, 0)));
+  TEST_ASSERT_TRUE(get_sensor_hub_temperature(&temperature));
+  TEST_ASSERT_DOUBLE_WITHIN(1e-9, 76, temperature);
+}
+
+// A restarted hub counts from 0 again, which is accepted once the last
+// reading has expired
+static void test_restarted_hub_resyncs_after_expiry() {
+  double temperature;
+  TEST_ASSERT_TRUE(accept_sensor_hub_reading(make_reading(5000, 70, 60)));
+
+  advance_s(SENSOR_HUB_MAX_AGE_S - 61);
+  TEST_ASSERT_FALSE(accept_sensor_hub_reading(make_reading(1, 71, 0)));
+  TEST_ASSERT_TRUE(get_sensor_hub_temperature(&temperature));
+  TEST_ASSERT_DOUBLE_WITHIN(1e-9, 70, temperature);
+
+  advance_s(1);
+  TEST_ASSERT_TRUE(accept_sensor_hub_reading(make_reading(1, 71, 0)));
+  TEST_ASSERT_TRUE(get_sensor_hub_temperature(&temperature));
+  TEST_ASSERT_DOUBLE_WITHIN(1e-9, 71, temperature);
+}
+
+// Each datagram is accepted or rejected as it would be when parsed, and every
+// one of them is counted in the metrics
+static void test_loopback_datagrams() {
+  sensor_hub_reading_t reading;
+  TEST_ASSERT_FALSE(receive_sensor_hub_reading(0, &reading));
+  TEST_ASSERT_TRUE(open_sensor_hub_socket());
+  TEST_ASSERT_TRUE(open_sensor_hub_socket());
+
+  uint8_t datagram[SENSOR_HUB_BINARY_SIZE];
+  build_binary(7, 7125, 3, datagram);
+  send_to_sensor_hub(datagram, sizeof(datagram));
+  TEST_ASSERT_TRUE(receive_sensor_hub_reading(LOOPBACK_TIMEOUT_MS, &reading));
+  TEST_ASSERT_EQUAL_UINT32(7, reading.sequence);
+  TEST_ASSERT_DOUBLE_WITHIN(1e-9, 71.25, reading.temperature);
+
+  send_json_to_sensor_hub("{\"seq\": 8, \"temp_c\": 21.5}");
+  TEST_ASSERT_TRUE(receive_sensor_hub_reading(LOOPBACK_TIMEOUT_MS, &reading));
+  double temperature;
+  TEST_ASSERT_TRUE(get_sensor_hub_temperature(&temperature));
+  TEST_ASSERT_DOUBLE_WITHIN(1e-9, 70.7, temperature);
+
+  // Replayed, malformed, out of range and too long to be read whole
+  send_to_sensor_hub(datagram, sizeof(datagram));
+  TEST_ASSERT_FALSE(receive_sensor_hub_reading(LOOPBACK_TIMEOUT_MS, &reading));
+  send_json_to_sensor_hub("{\"seq\": 9, \"temp_f\": 70");
+  TEST_ASSERT_FALSE(receive_sensor_hub_reading(LOOPBACK_TIMEOUT_MS, &reading));
+  send_json_to_sensor_hub("{\"seq\": 10, \"temp_f\": 250}");
+  TEST_ASSERT_FALSE(receive_sensor_hub_reading(LOOPBACK_TIMEOUT_MS, &reading));
+  char long_json[SENSOR_HUB_MAX_DATAGRAM_SIZE + 32];
+  int length = snprintf(long_json, sizeof(long_json),
+                        "{\"seq\": 11, \"temp_f\": 70, \"pad\": \"%*s\"}",
+                        SENSOR_HUB_MAX_DATAGRAM_SIZE, "");
+  send_to_sensor_hub(long_json, length);
+  TEST_ASSERT_FALSE(receive_sensor_hub_reading(LOOPBACK_TIMEOUT_MS, &reading));
+
+  TEST_ASSERT_TRUE(get_sensor_hub_temperature(&temperature));
+  TEST_ASSERT_DOUBLE_WITHIN(1e-9, 70.7, temperature);
+  TEST_ASSERT_EQUAL(2, s_num_accepted);
+  TEST_ASSERT_EQUAL(4, s_num_rejected);
+}
+
+// As the sensor hub job polls: a zero timeout takes the datagrams already
+// waiting, one at a time, and returns straight away once there are none
+static void test_loopback_poll_without_waiting() {
+  sensor_hub_reading_t reading;
+  TEST_ASSERT_TRUE(open_sensor_hub_socket());
+  TEST_ASSERT_FALSE(receive_sensor_hub_reading(0, &reading));
+
+  uint8_t datagram[SENSOR_HUB_BINARY_SIZE];
+  build_binary(1, 7000, 0, datagram);
+  send_to_sensor_hub(datagram, sizeof(datagram));
+  send_json_to_sensor_hub("{\"seq\": 2, \"temp_f\": 71}");
+  send_json_to_sensor_hub("{\"seq\": 3}");
+
+  TEST_ASSERT_TRUE(receive_sensor_hub_reading(0, &reading));
+  TEST_ASSERT_EQUAL_UINT32(1, reading.sequence);
+  TEST_ASSERT_TRUE(receive_sensor_hub_reading(0, &reading));
+  TEST_ASSERT_EQUAL_UINT32(2, reading.sequence);
+  TEST_ASSERT_FALSE(receive_sensor_hub_reading(0, &reading));
+  TEST_ASSERT_FALSE(receive_sensor_hub_reading(0, &reading));
+  TEST_ASSERT_EQUAL(2, s_num_accepted);
+  TEST_ASSERT_EQUAL(1, s_num_rejected);
+
+  // Nothing is received once the socket is closed, and it opens again
+  close_sensor_hub_socket();
+  TEST_ASSERT_FALSE(receive_sensor_hub_reading(0, &reading));
+  TEST_ASSERT_TRUE(open_sensor_hub_socket());
+  build_binary(4, 7000, 0, datagram);
+  send_to_sensor_hub(datagram, sizeof(datagram));
+  TEST_ASSERT_TRUE(receive_sensor_hub_reading(LOOPBACK_TIMEOUT_MS, &reading));
+  TEST_ASSERT_EQUAL_UINT32(4, reading.sequence);
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_binary_datagrams);
+  RUN_TEST(test_json_datagrams);
+  RUN_TEST(test_temperature_range);
+  RUN_TEST(test_old_readings_are_rejected);
+  RUN_TEST(test_sequence_must_advance);
+  RUN_TEST(test_sequence_wraps);
+  RUN_TEST(test_restarted_hub_resyncs_after_expiry);
+  RUN_TEST(test_loopback_datagrams);
+  RUN_TEST(test_loopback_poll_without_waiting);
+  return UNITY_END();
+}
@@ -0,0 +1,288 @@
+// Compares the fixed point sunrise equation with NOAA's solar calculator
+// algorithm in double precision, which includes the terms the firmware leaves
+// out (nutation, the eccentricity's drift), over 2000 to 2060
+#include <math.h>
+#include <unity.h>
+
+#include "../../src/solar.cpp"
+#include "../../src/time_zone.cpp"
+#include "util.h"
+
+// The header promises about a minute between the polar circles. Near the
+// poles the Sun grazes the horizon, so the same error in altitude moves the
+// event by more
+#define MAX_ERROR_S 60
+#define MAX_POLAR_ERROR_S 180
+
+// Days on which the type may differ from NOAA's, either side of the first
+// and last days of polar night and midnight sun
+#define POLAR_EDGE_DAYS 2
+
+typedef struct {
+  const char* name;
+  int16_t latitude;
+  int16_t longitude;
+} city_t;
+
+static const city_t c_cities[] = {
+    {"Singapore", 135, 10382},
+    {"Quito", -18, -7847},
+    {"Honolulu", 2131, -15786},
+    {"Sydney", -3387, 15121},
+    {"Auckland", -3685, 17476},
+    {"New York", 4071, -7401},
+    {"London", 5151, -13},
+    {"Ushuaia", -5480, -6830},
+    {"Anchorage", 6122, -14990},
+    {"Reykjavik", 6415, -2194},
+};
+
+static const city_t c_polar_cities[] = {
+    {"Murmansk", 6897, 3309},
+    {"Tromso", 6965, 1896},
+    {"Longyearbyen", 7822, 1565},
+    {"McMurdo", -7785, 16667},
+};
+
+static double radians(double degrees) { return degrees * M_PI / 180; }
+
+static double degrees(double radians) { return radians * 180 / M_PI; }
+
+// NOAA's algorithm, iterated on the time of the event. Returns false if the
+// Sun doesn't cross the horizon that day
+static bool get_noaa_event(int64_t day, double latitude, double longitude,
+                           bool sunrise, double* event) {
+  double time = day * 86400.0 + 43200 - longitude / 360 * 86400;
+  for (int i = 0; i < 5; ++i) {
+    double centuries = (time / 86400 - 10957.5) / 36525;
+    double mean_longitude =
+        fmod(280.46646 + centuries * (36000.76983 + centuries * 0.0003032),
+             360);
+    double mean_anomaly =
+        357.52911 + centuries * (35999.05029 - 0.0001537 * centuries);
+    double eccentricity =
+        0.016708634 - centuries * (0.000042037 + 0.0000001267 * centuries);
+    double center =
+        sin(radians(mean_anomaly)) *
+            (1.914602 - centuries * (0.004817 + 0.000014 * centuries)) +
+        sin(radians(2 * mean_anomaly)) * (0.019993 - 0.000101 * centuries) +
+        sin(radians(3 * mean_anomaly)) * 0.000289;
+    double node = radians(125.04 - 1934.136 * centuries);
+    double apparent_longitude =
+        mean_longitude + center - 0.00569 - 0.00478 * sin(node);
+    double mean_obliquity =
+        23 + (26 + (21.448 - centuries * (46.815 +
+                                          centuries * (0.00059 -
+                                                       centuries * 0.001813))) /
+                       60) /
+                 60;
+    double obliquity = mean_obliquity + 0.00256 * cos(node);
+    double declination =
+        asin(sin(radians(obliquity)) * sin(radians(apparent_longitude)));
+
+    double y = tan(radians(obliquity / 2));
+    y *= y;
+    double l = radians(mean_longitude);
+    double m = radians(mean_anomaly);
+    double equation_of_time_min =
+        4 * degrees(y * sin(2 * l) - 2 * eccentricity * sin(m) +
+                    4 * eccentricity * y * sin(m) * cos(2 * l) -
+                    0.5 * y * y * sin(4 * l) -
+                    1.25 * eccentricity * eccentricity * sin(2 * m));
+
+    double cos_hour_angle =
+        cos(radians(90.833)) /
+            (cos(radians(latitude)) * cos(declination)) -
+        tan(radians(latitude)) * tan(declination);
+    if (cos_hour_angle < -1 || cos_hour_angle > 1) {
+      return false;
+    }
+    double hour_angle_min = 4 * degrees(acos(cos_hour_angle));
+    double noon_min = 720 - 4 * longitude - equation_of_time_min;
+    time = day * 86400.0 +
+           (noon_min + (sunrise ? -hour_angle_min : hour_angle_min)) * 60;
+  }
+  *event = time;
+  return true;
+}
+
+static bool get_noaa_day(int64_t day, const city_t& city, double* sunrise,
+                         double* sunset) {
+  return get_noaa_event(day, city.latitude / 100.0, city.longitude / 100.0,
+                        true, sunrise) &&
+         get_noaa_event(day, city.latitude / 100.0, city.longitude / 100.0,
+                        false, sunset);
+}
+
+static bool is_near_polar_edge(int64_t day, const city_t& city) {
+  double sunrise;
+  double sunset;
+  bool normal = get_noaa_day(day, city, &sunrise, &sunset);
+  for (int64_t offset = -POLAR_EDGE_DAYS; offset <= POLAR_EDGE_DAYS;
+       ++offset) {
+    if (get_noaa_day(day + offset, city, &sunrise, &sunset) != normal) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static void assert_event_near(const city_t& city, int year, int month, int day,
+                              const char* event, time_t actual,
+                              double expected, double max_error_s) {
+  if (fabs(actual - expected) > max_error_s) {
+    char message[128];
+    snprintf(message, sizeof(message), "%s %04d-%02d-%02d %s off by %.0f s",
+             city.name, year, month, day, event, actual - expected);
+    TEST_FAIL_MESSAGE(message);
+  }
+}
+
+// Every third day of each month, every fourth year
+static void check_against_noaa(const city_t& city, double max_error_s) {
+  for (int year = 2000; year <= 2060; year += 4) {
+    for (int month = 1; month <= 12; ++month) {
+      for (int day = 1; day <= 28; day += 3) {
+        solar_day_t solar_day;
+        compute_solar_day(year, month, day, city.latitude, city.longitude,
+                          &solar_day);
+
+        int64_t days = days_from_civil(year, month, day);
+        double sunrise;
+        double sunset;
+        bool normal = get_noaa_day(days, city, &sunrise, &sunset);
+        if (normal != (solar_day.type == SOLAR_DAY_NORMAL)) {
+          TEST_ASSERT_TRUE_MESSAGE(is_near_polar_edge(days, city), city.name);
+          continue;
+        }
+        if (!normal) {
+          continue;
+        }
+
+        assert_event_near(city, year, month, day, "sunrise", solar_day.sunrise,
+                          sunrise, max_error_s);
+        assert_event_near(city, year, month, day, "sunset", solar_day.sunset,
+                          sunset, max_error_s);
+      }
+    }
+  }
+}
+
+// In UTC, which the tests set as the time zone
+static time_t set_tm(int year, int month, int day, int hour, int minute,
+                     struct tm* time_info) {
+  time_t utc =
+      days_from_civil(year, month, day) * 86400 + hour * 3600 + minute * 60;
+  local_time(utc, time_info);
+  return utc;
+}
+
+void setUp(void) {
+  EEPROM.clear();
+  s_cache.year = -1;
+  set_time_zone("UTC0");
+}
+
+void tearDown(void) {}
+
+static void test_matches_noaa_between_the_polar_circles() {
+  for (size_t i = 0; i < NUM_ELEMENTS(c_cities); ++i) {
+    check_against_noaa(c_cities[i], MAX_ERROR_S);
+  }
+}
+
+static void test_matches_noaa_near_the_poles() {
+  for (size_t i = 0; i < NUM_ELEMENTS(c_polar_cities); ++i) {
+    check_against_noaa(c_polar_cities[i], MAX_POLAR_ERROR_S);
+  }
+}
+
+static void test_polar_night_and_midnight_sun() {
+  static const struct {
+    int16_t latitude;
+    int month;
+    solar_day_type_t type;
+  } c_cases[] = {
+      {6965, 12, SOLAR_DAY_POLAR_NIGHT},  {6965, 6, SOLAR_DAY_MIDNIGHT_SUN},
+      {-7785, 6, SOLAR_DAY_POLAR_NIGHT},  {-7785, 12, SOLAR_DAY_MIDNIGHT_SUN},
+      {9000, 12, SOLAR_DAY_POLAR_NIGHT},  {9000, 6, SOLAR_DAY_MIDNIGHT_SUN},
+      {-9000, 6, SOLAR_DAY_POLAR_NIGHT},  {-9000, 12, SOLAR_DAY_MIDNIGHT_SUN},
+      // Refraction lifts the Sun above the horizon there at midsummer
+      {6500, 12, SOLAR_DAY_NORMAL},       {6500, 6, SOLAR_DAY_NORMAL},
+  };
+
+  for (size_t i = 0; i < NUM_ELEMENTS(c_cases); ++i) {
+    solar_day_t solar_day;
+    compute_solar_day(2026, c_cases[i].month, 21, c_cases[i].latitude, 0,
+                      &solar_day);
+    TEST_ASSERT_EQUAL(c_cases[i].type, solar_day.type);
+  }
+}
+
+static void test_location_is_written_only_when_it_moves() {
+  int16_t latitude;
+  int16_t longitude;
+  TEST_ASSERT_FALSE(get_location(&latitude, &longitude));
+
+  set_location(-3387, 15121);
+  set_location(-3387, 15121);
+  TEST_ASSERT_EQUAL(1, EEPROM.num_commits);
+  TEST_ASSERT_TRUE(get_location(&latitude, &longitude));
+  TEST_ASSERT_EQUAL(-3387, latitude);
+  TEST_ASSERT_EQUAL(15121, longitude);
+
+  set_location(-3387, 15122);
+  TEST_ASSERT_EQUAL(2, EEPROM.num_commits);
+}
+
+static void assert_remaining_near(const struct tm& time_info, time_t now,
+                                  double event) {
+  int64_t remaining_us;
+  TEST_ASSERT_TRUE(get_next_solar_event_remaining(time_info, &remaining_us));
+  TEST_ASSERT_INT64_WITHIN(MAX_ERROR_S * 1000000LL,
+                           llround((event - now) * 1000000), remaining_us);
+}
+
+static void test_sun_down_follows_the_cached_location() {
+  struct tm time_info;
+  int64_t remaining_us;
+  set_tm(2026, 6, 21, 0, 0, &time_info);
+  TEST_ASSERT_FALSE(is_sun_down(time_info));
+  TEST_ASSERT_FALSE(get_next_solar_event_remaining(time_info, &remaining_us));
+
+  // London at midsummer
+  const city_t london = {"London", 5151, -13};
+  set_location(london.latitude, london.longitude);
+  double sunrise;
+  double sunset;
+  TEST_ASSERT_TRUE(
+      get_noaa_day(days_from_civil(2026, 6, 21), london, &sunrise, &sunset));
+
+  time_t now = set_tm(2026, 6, 21, 2, 30, &time_info);
+  TEST_ASSERT_TRUE(is_sun_down(time_info));
+  assert_remaining_near(time_info, now, sunrise);
+
+  now = set_tm(2026, 6, 21, 12, 0, &time_info);
+  TEST_ASSERT_FALSE(is_sun_down(time_info));
+  assert_remaining_near(time_info, now, sunset);
+
+  set_tm(2026, 6, 21, 21, 0, &time_info);
+  TEST_ASSERT_TRUE(is_sun_down(time_info));
+  TEST_ASSERT_FALSE(get_next_solar_event_remaining(time_info, &remaining_us));
+
+  // Polar night all day, with no event to wait for
+  set_location(7822, 1565);
+  set_tm(2026, 12, 21, 12, 0, &time_info);
+  TEST_ASSERT_TRUE(is_sun_down(time_info));
+  TEST_ASSERT_FALSE(get_next_solar_event_remaining(time_info, &remaining_us));
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_matches_noaa_between_the_polar_circles);
+  RUN_TEST(test_matches_noaa_near_the_poles);
+  RUN_TEST(test_polar_night_and_midnight_sun);
+  RUN_TEST(test_location_is_written_only_when_it_moves);
+  RUN_TEST(test_sun_down_follows_the_cached_location);
+  return UNITY_END();
+}
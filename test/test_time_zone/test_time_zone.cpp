@@ -0,0 +1,222 @@
+// Compares the transition table conversion with glibc's localtime_r(), which
+// reads the same POSIX TZ strings, over 1999 to 2100
+#include <string.h>
+#include <unity.h>
+
+#include <chrono>
+
+#include "../../src/time_zone.cpp"
+#include "util.h"
+
+#define FIRST_UTC 915148800LL  // 1999-01-01
+#define END_UTC 4133980800LL   // 2101-01-01
+
+// Coprime with the hour and the day, so the sweep drifts through every
+// minute of the day over the years
+#define SWEEP_STEP_S 3607
+
+#define BENCHMARK_CONVERSIONS 2000000
+
+static const char* const c_zones[] = {
+    // Northern hemisphere, transitions at 02:00 and 03:00
+    "EST5EDT,M3.2.0,M11.1.0",
+    "CET-1CEST,M3.5.0,M10.5.0/3",
+    // Southern hemisphere, in DST over New Year
+    "AEST-10AEDT,M10.1.0,M4.1.0/3",
+    "NZST-12NZDT,M9.5.0,M4.1.0/3",
+    // Transitions the day before, by negative times
+    "<-03>3<-02>,M3.5.0/-2,M10.5.0/-1",
+    // Julian days never count Feb 29, zero based days do, and a transition
+    // time past midnight
+    "XXX3YYY,J60/1,J300/-1",
+    "XXX3YYY,59,300/26",
+    // Fixed offsets, including a half hour one
+    "UTC0",
+    "<+0330>-3:30",
+    "<-0930>9:30",
+};
+
+static bool is_same_time(const struct tm& a, const struct tm& b) {
+  return a.tm_sec == b.tm_sec && a.tm_min == b.tm_min &&
+         a.tm_hour == b.tm_hour && a.tm_mday == b.tm_mday &&
+         a.tm_mon == b.tm_mon && a.tm_year == b.tm_year &&
+         a.tm_wday == b.tm_wday && a.tm_yday == b.tm_yday &&
+         a.tm_isdst == b.tm_isdst;
+}
+
+static void assert_matches_glibc(const char* zone, time_t utc) {
+  struct tm expected;
+  struct tm actual;
+  memset(&expected, 0, sizeof(expected));
+  memset(&actual, 0, sizeof(actual));
+  localtime_r(&utc, &expected);
+  local_time(utc, &actual);
+
+  if (!is_same_time(expected, actual)) {
+    char message[160];
+    snprintf(message, sizeof(message),
+             "%s at %lld: %04d-%02d-%02d %02d:%02d:%02d dst %d, expected "
+             "%04d-%02d-%02d %02d:%02d:%02d dst %d",
+             zone, (long long)utc, actual.tm_year + 1900, actual.tm_mon + 1,
+             actual.tm_mday, actual.tm_hour, actual.tm_min, actual.tm_sec,
+             actual.tm_isdst, expected.tm_year + 1900, expected.tm_mon + 1,
+             expected.tm_mday, expected.tm_hour, expected.tm_min,
+             expected.tm_sec, expected.tm_isdst);
+    TEST_FAIL_MESSAGE(message);
+  }
+}
+
+void setUp(void) {}
+
+void tearDown(void) {}
+
+static void test_zones_parse() {
+  for (size_t i = 0; i < NUM_ELEMENTS(c_zones); ++i) {
+    time_zone_t zone;
+    TEST_ASSERT_TRUE_MESSAGE(parse_time_zone(c_zones[i], &zone), c_zones[i]);
+  }
+}
+
+static void test_invalid_zones_are_rejected() {
+  static const char* const c_invalid_zones[] = {
+      "",
+      "EST",
+      "ES5",
+      "EST25",
+      "<+03",
+      "EST5EDT,M3.2.0",
+      "EST5EDT,M13.2.0,M11.1.0",
+      "EST5EDT,M3.6.0,M11.1.0",
+      "EST5EDT,J0,J300",
+      "EST5EDT,M3.2.0,M11.1.0/168",
+      "EST5EDT,M3.2.0,M11.1.0x",
+  };
+
+  for (size_t i = 0; i < NUM_ELEMENTS(c_invalid_zones); ++i) {
+    time_zone_t zone;
+    TEST_ASSERT_FALSE_MESSAGE(parse_time_zone(c_invalid_zones[i], &zone),
+                              c_invalid_zones[i]);
+  }
+}
+
+// glibc takes the rules of a zone that names DST without them from its
+// posixrules file. The parser follows newlib, which uses the US rules
+static void test_dst_without_rules_uses_the_us_rules() {
+  time_zone_t implicit_zone;
+  time_zone_t explicit_zone;
+  TEST_ASSERT_TRUE(parse_time_zone("ABC5DEF", &implicit_zone));
+  TEST_ASSERT_TRUE(parse_time_zone("ABC5DEF,M3.2.0,M11.1.0", &explicit_zone));
+
+  for (int64_t utc = FIRST_UTC; utc < END_UTC; utc += 7 * 86400 + 3607) {
+    time_zone_span_t implicit_span;
+    time_zone_span_t explicit_span;
+    get_time_zone_span(implicit_zone, utc, &implicit_span);
+    get_time_zone_span(explicit_zone, utc, &explicit_span);
+    TEST_ASSERT_EQUAL_INT64(explicit_span.valid_from,
+                            implicit_span.valid_from);
+    TEST_ASSERT_EQUAL_INT64(explicit_span.valid_until,
+                            implicit_span.valid_until);
+    TEST_ASSERT_EQUAL_INT(explicit_span.offset_s, implicit_span.offset_s);
+  }
+}
+
+static void test_sweep_matches_glibc() {
+  for (size_t i = 0; i < NUM_ELEMENTS(c_zones); ++i) {
+    set_time_zone(c_zones[i]);
+    for (int64_t utc = FIRST_UTC; utc < END_UTC; utc += SWEEP_STEP_S) {
+      assert_matches_glibc(c_zones[i], utc);
+    }
+  }
+}
+
+// Each span ends at a DST transition or at New Year. The seconds either side
+// of the end must agree with glibc, in both directions of conversion order
+static void test_transitions_match_glibc() {
+  for (size_t i = 0; i < NUM_ELEMENTS(c_zones); ++i) {
+    time_zone_t zone;
+    TEST_ASSERT_TRUE(parse_time_zone(c_zones[i], &zone));
+    set_time_zone(c_zones[i]);
+
+    int64_t utc = FIRST_UTC;
+    while (utc < END_UTC) {
+      time_zone_span_t span;
+      get_time_zone_span(zone, utc, &span);
+      TEST_ASSERT_TRUE(span.valid_from <= utc && utc < span.valid_until);
+      if (span.valid_until >= END_UTC) {
+        break;
+      }
+
+      for (int64_t delta = -2; delta <= 1; ++delta) {
+        assert_matches_glibc(c_zones[i], span.valid_until + delta);
+      }
+      for (int64_t delta = 1; delta >= -2; --delta) {
+        assert_matches_glibc(c_zones[i], span.valid_until + delta);
+      }
+      utc = span.valid_until;
+    }
+  }
+}
+
+// Feb 29 and the last day of leap and common years, including the
+// centuries 2000 (leap) and 2100 (not)
+static void test_leap_days_match_glibc() {
+  static const int64_t c_years[] = {1999, 2000, 2001, 2004, 2096, 2099, 2100};
+
+  set_time_zone("CET-1CEST,M3.5.0,M10.5.0/3");
+  for (size_t i = 0; i < NUM_ELEMENTS(c_years); ++i) {
+    int64_t days[] = {days_from_civil(c_years[i], 2, 28),
+                      days_from_civil(c_years[i], 3, 1) - 1,
+                      days_from_civil(c_years[i], 3, 1),
+                      days_from_civil(c_years[i], 12, 31)};
+    for (size_t j = 0; j < NUM_ELEMENTS(days); ++j) {
+      for (int64_t second = 0; second < 86400; second += 3599) {
+        assert_matches_glibc("CET", days[j] * 86400 + second);
+      }
+    }
+  }
+}
+
+// Seconds in a row, as the time service converts them. Only reported, since
+// the host's speed says little about the ESP32's
+static void test_benchmark_against_glibc() {
+  typedef std::chrono::steady_clock clock;
+  set_time_zone("EST5EDT,M3.2.0,M11.1.0");
+
+  struct tm time_info;
+  int64_t checksum = 0;
+  clock::time_point start = clock::now();
+  for (time_t utc = 1700000000; utc < 1700000000 + BENCHMARK_CONVERSIONS;
+       ++utc) {
+    local_time(utc, &time_info);
+    checksum += time_info.tm_sec;
+  }
+  clock::time_point middle = clock::now();
+  for (time_t utc = 1700000000; utc < 1700000000 + BENCHMARK_CONVERSIONS;
+       ++utc) {
+    localtime_r(&utc, &time_info);
+    checksum -= time_info.tm_sec;
+  }
+  clock::time_point end = clock::now();
+  TEST_ASSERT_EQUAL_INT64(0, checksum);
+
+  char message[96];
+  snprintf(message, sizeof(message),
+           "local_time: %.1f ns, localtime_r: %.1f ns per conversion",
+           std::chrono::duration<double, std::nano>(middle - start).count() /
+               BENCHMARK_CONVERSIONS,
+           std::chrono::duration<double, std::nano>(end - middle).count() /
+               BENCHMARK_CONVERSIONS);
+  TEST_MESSAGE(message);
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_zones_parse);
+  RUN_TEST(test_invalid_zones_are_rejected);
+  RUN_TEST(test_dst_without_rules_uses_the_us_rules);
+  RUN_TEST(test_sweep_matches_glibc);
+  RUN_TEST(test_transitions_match_glibc);
+  RUN_TEST(test_leap_days_match_glibc);
+  RUN_TEST(test_benchmark_against_glibc);
+  return UNITY_END();
+}
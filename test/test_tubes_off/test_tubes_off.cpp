@@ -0,0 +1,386 @@
+// Simulates a day of the tubes off window on a fake clock: the window opens
+// while a network job still holds the radio, the switch is pressed twice in
+// the night, and the window ends in the morning. The time in each power
+// state gives the average supply current for the day
+#include <time.h>
+#include <unity.h>
+
+#include "../../src/tubes_off.cpp"
+#include "../../src/util.cpp"
+
+#define SECOND_US 1000000LL
+
+// 2026-01-15 00:00:00 UTC. The clock runs in UTC, so there are no DST changes
+#define TEST_DAY_UNIX_S 1768435200LL
+
+#define TEST_WINDOW_START_HOUR 23
+#define TEST_WINDOW_END_HOUR 7
+#define TEST_WAKE_DURATION_S 10
+#define TEST_DAY_BRIGHTNESS 8
+#define TEST_NIGHT_BRIGHTNESS 3
+
+// The last NTP sync of the day is still running when the window opens
+#define TEST_RADIO_OFF_S 20
+
+// Supply current in each state, at the board's 5 V input. The ESP32 is fed
+// through a linear regulator, so its current is the same at the input. From
+// the ESP32 datasheet (v4.2, "Power Consumption by Power Modes"):
+//  - Light sleep: 0.8 mA
+//  - Awake with the radio off, both cores at up to 240 MHz: 30-68 mA, taken
+//    as 50 mA
+//  - Awake with the radio receiving, as it does while it is associated: 95-100
+//    mA for the radio, taken as 120 mA with the CPU
+// The tubes draw on top of that while lit. Taken as 2 mA a tube at 170 V,
+// from 5 V through an 80% efficient boost converter: 6 * 2 mA * 170 V / 5 V /
+// 0.8 = 510 mA at full brightness, and in proportion at lower levels
+#define LIGHT_SLEEP_UA 800
+#define AWAKE_UA 50000
+#define RADIO_ON_UA 120000
+#define FULL_BRIGHTNESS_TUBES_UA 510000
+
+// The night's average is dominated by light sleep. A window that stayed
+// awake would average more than the CPU's own current
+#define MAX_WINDOW_AVERAGE_UA 1500
+
+typedef enum {
+  POWER_STATE_LIGHT_SLEEP,
+  POWER_STATE_AWAKE,     // Tubes dark, radio off
+  POWER_STATE_RADIO_ON,  // Tubes dark
+  POWER_STATE_TUBES_LIT,
+  NUM_POWER_STATES,
+} power_state_t;
+
+static const char* const c_power_state_names[NUM_POWER_STATES] = {
+    "light sleep", "awake", "radio on", "tubes lit"};
+
+#define MAX_PRESSES 4
+
+static int64_t s_presses_us[MAX_PRESSES];
+static size_t s_num_presses;
+static size_t s_next_press;
+
+static uint8_t s_brightness;
+static bool s_asleep;
+static bool s_supervision_paused;
+static bool s_gpio_wakeup_enabled;
+static uint64_t s_timer_wakeup_us;
+static esp_sleep_wakeup_cause_t s_wakeup_cause;
+static size_t s_num_times_shown;
+
+static int64_t s_state_us[NUM_POWER_STATES];
+// In microamp microseconds
+static int64_t s_charge;
+
+const int c_rotary_encoder_switch_pin = 16;
+SemaphoreHandle_t g_semaphore_configure = NULL;
+
+WiFiClass WiFi;
+
+static int64_t get_test_time_us(int64_t hour, int64_t minute, int64_t second) {
+  return ((hour * 60 + minute) * 60 + second) * SECOND_US;
+}
+
+static power_state_t get_power_state() {
+  if (s_asleep) {
+    return POWER_STATE_LIGHT_SLEEP;
+  }
+  if (s_brightness) {
+    return POWER_STATE_TUBES_LIT;
+  }
+  return WiFi.getMode() == WIFI_OFF ? POWER_STATE_AWAKE
+                                    : POWER_STATE_RADIO_ON;
+}
+
+static int64_t get_lit_ua(uint8_t brightness) {
+  return AWAKE_UA +
+         (int64_t)FULL_BRIGHTNESS_TUBES_UA * brightness / NIXIE_MAX_BRIGHTNESS;
+}
+
+static int64_t get_current_ua() {
+  switch (get_power_state()) {
+    case POWER_STATE_LIGHT_SLEEP:
+      return LIGHT_SLEEP_UA;
+    case POWER_STATE_AWAKE:
+      return AWAKE_UA;
+    case POWER_STATE_RADIO_ON:
+      return RADIO_ON_UA;
+    default:
+      return get_lit_ua(s_brightness);
+  }
+}
+
+// Charges the time up to the deadline to the current state
+static void advance_clock(int64_t deadline_us) {
+  TEST_ASSERT_TRUE(deadline_us >= g_fake_esp_timer_us);
+  int64_t elapsed_us = deadline_us - g_fake_esp_timer_us;
+
+  // The radio goes off part way through a step
+  int64_t radio_off_us =
+      get_test_time_us(TEST_WINDOW_START_HOUR, 0, TEST_RADIO_OFF_S);
+  if (g_fake_esp_timer_us < radio_off_us && deadline_us > radio_off_us) {
+    advance_clock(radio_off_us);
+    advance_clock(deadline_us);
+    return;
+  }
+
+  s_state_us[get_power_state()] += elapsed_us;
+  s_charge += get_current_ua() * elapsed_us;
+  advance_fake_esp_timer(deadline_us);
+}
+
+wifi_mode_t WiFiClass::getMode() {
+  return g_fake_esp_timer_us <
+                 get_test_time_us(TEST_WINDOW_START_HOUR, 0, TEST_RADIO_OFF_S)
+             ? WIFI_STA
+             : WIFI_OFF;
+}
+
+static bool get_test_local_time(struct tm* time_info) {
+  time_t now = TEST_DAY_UNIX_S + g_fake_esp_timer_us / SECOND_US;
+  gmtime_r(&now, time_info);
+  return true;
+}
+
+bool get_current_local_time(struct tm* time_info) {
+  return get_test_local_time(time_info);
+}
+
+bool get_snapshot_local_time(struct tm* time_info) {
+  return get_test_local_time(time_info);
+}
+
+uint8_t get_scheduled_brightness(const struct tm& time_info) {
+  return is_hour_in_window(time_info.tm_hour, TEST_WINDOW_START_HOUR,
+                           TEST_WINDOW_END_HOUR)
+             ? TEST_NIGHT_BRIGHTNESS
+             : TEST_DAY_BRIGHTNESS;
+}
+
+// The ramp isn't modelled: the tubes draw at the new level straight away
+void Nixie_Display::set_brightness(uint8_t level, size_t ramp_time_ms) {
+  s_brightness = level;
+}
+
+void Nixie_Display::display_time(const struct tm& time_info,
+                                 bool twelve_hour_format, uint8_t nixie_dots) {
+  ++s_num_times_shown;
+}
+
+// Only reached by the tubes off window, with no timers, alarms or solar
+// schedule
+bool get_next_countdown_timer_remaining(int64_t* remaining_us) {
+  return false;
+}
+
+bool get_next_alarm_remaining(int64_t* remaining_us) { return false; }
+
+bool get_location(int16_t* latitude, int16_t* longitude) { return false; }
+
+bool is_sun_down(const struct tm& time_info) { return true; }
+
+bool get_next_solar_event_remaining(const struct tm& time_info,
+                                    int64_t* remaining_us) {
+  return false;
+}
+
+void heartbeat() { TEST_ASSERT_FALSE(s_supervision_paused); }
+
+void pause_supervision() {
+  TEST_ASSERT_FALSE(s_supervision_paused);
+  s_supervision_paused = true;
+}
+
+void resume_supervision() {
+  TEST_ASSERT_TRUE(s_supervision_paused);
+  s_supervision_paused = false;
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t timeout) {
+  return pdFALSE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore) { return pdTRUE; }
+
+SemaphoreHandle_t xSemaphoreCreateBinaryStatic(StaticSemaphore_t* buffer) {
+  return NULL;
+}
+
+TickType_t xTaskGetTickCount() {
+  return g_fake_esp_timer_us / (portTICK_PERIOD_MS * 1000);
+}
+
+void vTaskDelay(TickType_t ticks) {
+  advance_clock(g_fake_esp_timer_us + (int64_t)ticks * portTICK_PERIOD_MS *
+                                          1000);
+}
+
+void vTaskDelayUntil(TickType_t* previous_wake_time, TickType_t increment) {
+  *previous_wake_time += increment;
+  advance_clock((int64_t)*previous_wake_time * portTICK_PERIOD_MS * 1000);
+}
+
+esp_err_t gpio_set_intr_type(gpio_num_t gpio_num, gpio_int_type_t intr_type) {
+  return ESP_OK;
+}
+
+esp_err_t gpio_wakeup_enable(gpio_num_t gpio_num, gpio_int_type_t intr_type) {
+  TEST_ASSERT_EQUAL(c_rotary_encoder_switch_pin, gpio_num);
+  TEST_ASSERT_EQUAL(GPIO_INTR_LOW_LEVEL, intr_type);
+  s_gpio_wakeup_enabled = true;
+  return ESP_OK;
+}
+
+esp_err_t gpio_wakeup_disable(gpio_num_t gpio_num) {
+  s_gpio_wakeup_enabled = false;
+  return ESP_OK;
+}
+
+esp_err_t esp_sleep_enable_timer_wakeup(uint64_t time_in_us) {
+  s_timer_wakeup_us = time_in_us;
+  return ESP_OK;
+}
+
+esp_err_t esp_sleep_enable_gpio_wakeup() { return ESP_OK; }
+
+esp_err_t esp_sleep_disable_wakeup_source(esp_sleep_source_t source) {
+  TEST_ASSERT_EQUAL(ESP_SLEEP_WAKEUP_ALL, source);
+  s_timer_wakeup_us = 0;
+  return ESP_OK;
+}
+
+// Until the timer wake up or the next press, whichever comes first. Sleeping
+// with the radio on would drop the connection
+esp_err_t esp_light_sleep_start() {
+  TEST_ASSERT_TRUE(s_supervision_paused);
+  TEST_ASSERT_EQUAL(WIFI_OFF, WiFi.getMode());
+  TEST_ASSERT_TRUE(s_timer_wakeup_us > 0);
+
+  int64_t wake_us = g_fake_esp_timer_us + s_timer_wakeup_us;
+  s_wakeup_cause = ESP_SLEEP_WAKEUP_TIMER;
+  if (s_gpio_wakeup_enabled && s_next_press < s_num_presses &&
+      s_presses_us[s_next_press] < wake_us) {
+    wake_us = s_presses_us[s_next_press++];
+    s_wakeup_cause = ESP_SLEEP_WAKEUP_GPIO;
+  }
+
+  s_asleep = true;
+  advance_clock(wake_us);
+  s_asleep = false;
+  return ESP_OK;
+}
+
+esp_sleep_wakeup_cause_t esp_sleep_get_wakeup_cause() {
+  return s_wakeup_cause;
+}
+
+static void press_at(int64_t press_us) {
+  TEST_ASSERT_TRUE(s_num_presses < MAX_PRESSES);
+  s_presses_us[s_num_presses++] = press_us;
+}
+
+static void report(const char* label, int64_t total_us) {
+  char message[128];
+  for (size_t i = 0; i < NUM_POWER_STATES; ++i) {
+    snprintf(message, sizeof(message), "%s: %s: %.1f s (%.3f%%)", label,
+             c_power_state_names[i], s_state_us[i] / 1e6,
+             100.0 * s_state_us[i] / total_us);
+    TEST_MESSAGE(message);
+  }
+  snprintf(message, sizeof(message), "%s: average current: %.3f mA", label,
+           (double)s_charge / total_us / 1000);
+  TEST_MESSAGE(message);
+}
+
+void setUp(void) {
+  EEPROM.clear();
+  EEPROM.write(EEPROM_TUBES_OFF_START_HOUR_ADDRESS, TEST_WINDOW_START_HOUR);
+  EEPROM.write(EEPROM_TUBES_OFF_END_HOUR_ADDRESS, TEST_WINDOW_END_HOUR);
+  EEPROM.write(EEPROM_TUBES_OFF_WAKE_DURATION_ADDRESS, TEST_WAKE_DURATION_S);
+  EEPROM.write(EEPROM_12_HOUR_FORMAT_ADDRESS, 0);
+  EEPROM.write(EEPROM_SOLAR_SCHEDULE_ADDRESS, 0);
+
+  g_num_fake_esp_timers = 0;
+  g_fake_esp_timer_us = 0;
+  s_num_presses = 0;
+  s_next_press = 0;
+  s_brightness = TEST_DAY_BRIGHTNESS;
+  s_asleep = false;
+  s_supervision_paused = false;
+  s_gpio_wakeup_enabled = false;
+  s_timer_wakeup_us = 0;
+  s_num_times_shown = 0;
+  s_light_sleep_time_us = 0;
+  memset(s_state_us, 0, sizeof(s_state_us));
+  s_charge = 0;
+}
+
+void tearDown(void) {}
+
+// From the end of one window to the end of the next. The tubes are lit at the
+// day's level until the window opens, as the display jobs would have them.
+// The radio's use during the day isn't modelled
+static void test_day_with_wake_presses() {
+  const int64_t day_start_us = get_test_time_us(TEST_WINDOW_END_HOUR, 0, 0);
+  const int64_t window_start_us =
+      get_test_time_us(TEST_WINDOW_START_HOUR, 0, 0);
+  const int64_t window_end_us =
+      get_test_time_us(24 + TEST_WINDOW_END_HOUR, 0, 0);
+  press_at(get_test_time_us(24 + 1, 30, 0));
+  press_at(get_test_time_us(24 + 4, 45, 20) + SECOND_US / 2);
+
+  g_fake_esp_timer_us = day_start_us;
+  advance_clock(window_start_us);
+  run_tubes_off_window();
+
+  // The sleep to the end of the window is counted in whole seconds, so it
+  // ends at the last press's fraction of a second. The tubes come back on at
+  // the day's level
+  const int64_t end_us = g_fake_esp_timer_us;
+  TEST_ASSERT_EQUAL_INT64(window_end_us + SECOND_US / 2, end_us);
+  TEST_ASSERT_EQUAL(TEST_DAY_BRIGHTNESS, s_brightness);
+  TEST_ASSERT_FALSE(s_supervision_paused);
+  TEST_ASSERT_FALSE(s_gpio_wakeup_enabled);
+
+  // Each press shows the time every second for the wake duration, then the
+  // tubes ramp down before the clock goes back to sleep. The window opens
+  // with the radio on, and sleeps as soon as it goes off
+  TEST_ASSERT_EQUAL(2, s_next_press);
+  TEST_ASSERT_EQUAL(2 * TEST_WAKE_DURATION_S, s_num_times_shown);
+
+  const int64_t day_us = window_start_us - day_start_us;
+  const int64_t window_us = end_us - window_start_us;
+  const int64_t radio_on_us = TEST_RADIO_OFF_S * SECOND_US;
+  const int64_t ramp_us = NIXIE_BRIGHTNESS_RAMP_TIME_MS * 1000LL;
+  const int64_t wake_us = TEST_WAKE_DURATION_S * SECOND_US;
+  const int64_t asleep_us = window_us - radio_on_us - 2 * (wake_us + ramp_us);
+  TEST_ASSERT_EQUAL_INT64(radio_on_us, s_state_us[POWER_STATE_RADIO_ON]);
+  TEST_ASSERT_EQUAL_INT64(2 * ramp_us, s_state_us[POWER_STATE_AWAKE]);
+  TEST_ASSERT_EQUAL_INT64(day_us + 2 * wake_us,
+                          s_state_us[POWER_STATE_TUBES_LIT]);
+  TEST_ASSERT_EQUAL_INT64(asleep_us, s_state_us[POWER_STATE_LIGHT_SLEEP]);
+  TEST_ASSERT_EQUAL_INT64(asleep_us, get_light_sleep_time_us());
+
+  const int64_t day_charge = day_us * get_lit_ua(TEST_DAY_BRIGHTNESS);
+  const int64_t window_charge =
+      radio_on_us * RADIO_ON_UA + 2 * ramp_us * AWAKE_UA +
+      2 * wake_us * get_lit_ua(TEST_NIGHT_BRIGHTNESS) +
+      asleep_us * LIGHT_SLEEP_UA;
+  TEST_ASSERT_EQUAL_INT64(day_charge + window_charge, s_charge);
+  report("Day", day_us + window_us);
+
+  // The window on its own
+  s_charge = window_charge;
+  s_state_us[POWER_STATE_TUBES_LIT] -= day_us;
+  report("Window", window_us);
+  TEST_ASSERT_TRUE(window_charge / window_us < MAX_WINDOW_AVERAGE_UA);
+}
+
+int main(int argc, char** argv) {
+  // mktime() works in the local time zone, which the clock doesn't use
+  setenv("TZ", "UTC0", 1);
+  tzset();
+
+  UNITY_BEGIN();
+  RUN_TEST(test_day_with_wake_presses);
+  return UNITY_END();
+}
@@ -0,0 +1,243 @@
+#!/usr/bin/env python3
+"""Assemble, validate and time nixie display animations on the host.
+
+The binary format is documented in include/animation.h and the rules checked
+here mirror validate_animation() in src/animation.cpp.
+
+Source files have one instruction per line and # comments:
+
+    frame D D D D D D DOTS          show a frame
+    hold MS                         hold the current frame
+    fade D D D D D D DOTS T T T T T T   fade each tube over T ms
+    dots DOTS                       set the dot separators
+    loop COUNT ... end_loop         repeat the enclosed instructions
+    random MASK                     random digits on the masked tubes
+    cycle MASK                      advance the digits on the masked tubes
+
+Digits are 0-9, b for blank or - to keep the tube as it is. Numbers may be
+written in any Python integer notation (e.g. 0b0101 for dots). Tube masks
+have bit i set for tube i, where tube 0 is the leftmost tube.
+
+Usage:
+    animation_tool.py assemble SOURCE OUTPUT [--c-array NAME]
+    animation_tool.py check ANIMATION
+"""
+
+import argparse
+import sys
+
+MAGIC = b"NA"
+VERSION = 1
+HEADER_SIZE = 3
+
+NUM_TUBES = 6
+ALL_TUBES = 0x3F
+BLANK = 10
+KEEP = 0xFF
+DOTS_ALL = 0x0F
+MAX_LOOP_DEPTH = 4
+FADE_UNIT_MS = 10
+MAX_FILE_SIZE = 512
+
+OPCODES = {
+    "end": (0x00, 0),
+    "frame": (0x01, NUM_TUBES + 1),
+    "hold": (0x02, 2),
+    "fade": (0x03, 2 * NUM_TUBES + 1),
+    "dots": (0x04, 1),
+    "loop": (0x05, 1),
+    "end_loop": (0x06, 0),
+    "random": (0x07, 1),
+    "cycle": (0x08, 1),
+}
+NAMES = {code: name for name, (code, _) in OPCODES.items()}
+OPERAND_SIZES = {code: size for code, size in OPCODES.values()}
+
+
+class AnimationError(Exception):
+    pass
+
+
+def parse_digit(token):
+    if token == "b":
+        return BLANK
+    if token == "-":
+        return KEEP
+    digit = int(token)
+    if not 0 <= digit <= 9:
+        raise AnimationError("bad digit: " + token)
+    return digit
+
+
+def assemble(source):
+    program = bytearray(MAGIC + bytes([VERSION]))
+    for line_number, line in enumerate(source.splitlines(), 1):
+        tokens = line.split("#", 1)[0].split()
+        if not tokens:
+            continue
+        name, args = tokens[0], tokens[1:]
+        if name not in OPCODES or name == "end":
+            raise AnimationError("line %d: unknown instruction %s"
+                                 % (line_number, name))
+        try:
+            if name in ("frame", "fade"):
+                operands = [parse_digit(t) for t in args[:NUM_TUBES]]
+                operands += [int(t, 0) for t in args[NUM_TUBES:NUM_TUBES + 1]]
+                if name == "fade":
+                    for t in args[NUM_TUBES + 1:]:
+                        fade_ms = int(t, 0)
+                        if fade_ms % FADE_UNIT_MS:
+                            raise AnimationError(
+                                "fade of %d ms is not a multiple of %d ms"
+                                % (fade_ms, FADE_UNIT_MS))
+                        operands.append(fade_ms // FADE_UNIT_MS)
+            elif name == "hold":
+                operands = list(int(args[0], 0).to_bytes(2, "little"))
+            else:
+                operands = [int(t, 0) for t in args]
+        except (ValueError, IndexError, OverflowError) as e:
+            raise AnimationError("line %d: %s" % (line_number, e))
+
+        opcode, operand_size = OPCODES[name]
+        if len(operands) != operand_size:
+            raise AnimationError("line %d: %s takes %d operand bytes, got %d"
+                                 % (line_number, name, operand_size,
+                                    len(operands)))
+        if any(not 0 <= b <= 0xFF for b in operands):
+            raise AnimationError("line %d: operand out of range" % line_number)
+        program.append(opcode)
+        program.extend(operands)
+
+    program.append(OPCODES["end"][0])
+    return bytes(program)
+
+
+def validate(program):
+    """Returns a listing of (offset, text, start_ms, repeats), the duration in
+    milliseconds and the number of instructions executed"""
+    if len(program) < HEADER_SIZE or program[:2] != MAGIC:
+        raise AnimationError("bad header")
+    if program[2] != VERSION:
+        raise AnimationError("unsupported version %d" % program[2])
+    if len(program) > MAX_FILE_SIZE:
+        raise AnimationError("%d bytes is larger than the %d byte limit"
+                             % (len(program), MAX_FILE_SIZE))
+
+    # Duration and instruction count of the body of each open loop, with the
+    # top level of the program first
+    durations = [0]
+    counts = [0]
+    loop_counts = [1]
+    listing = []
+
+    pc = HEADER_SIZE
+    while pc < len(program):
+        opcode = program[pc]
+        if opcode not in OPERAND_SIZES:
+            raise AnimationError("bad opcode 0x%02x at %d" % (opcode, pc))
+        size = OPERAND_SIZES[opcode]
+        operands = program[pc + 1:pc + 1 + size]
+        if len(operands) < size:
+            raise AnimationError("truncated instruction at %d" % pc)
+
+        name = NAMES[opcode]
+        repeats = 1
+        for count in loop_counts:
+            repeats *= count
+        listing.append((pc, name + " " + " ".join(str(b) for b in operands),
+                        sum(durations), repeats))
+        counts[-1] += 1
+
+        if name == "end":
+            if len(durations) != 1:
+                raise AnimationError("unterminated loop")
+            return listing, durations[0], counts[0]
+        elif name in ("frame", "fade"):
+            if any(d > BLANK and d != KEEP for d in operands[:NUM_TUBES]):
+                raise AnimationError("bad digit at %d" % pc)
+            if operands[NUM_TUBES] > DOTS_ALL:
+                raise AnimationError("bad dots at %d" % pc)
+            if name == "fade":
+                durations[-1] += max(operands[NUM_TUBES + 1:]) * FADE_UNIT_MS
+        elif name == "hold":
+            durations[-1] += int.from_bytes(operands, "little")
+        elif name == "dots":
+            if operands[0] > DOTS_ALL:
+                raise AnimationError("bad dots at %d" % pc)
+        elif name in ("random", "cycle"):
+            if operands[0] > ALL_TUBES:
+                raise AnimationError("bad tube mask at %d" % pc)
+        elif name == "loop":
+            if operands[0] == 0:
+                raise AnimationError("zero loop count at %d" % pc)
+            if len(durations) > MAX_LOOP_DEPTH:
+                raise AnimationError("loops nested too deeply at %d" % pc)
+            durations.append(0)
+            counts.append(0)
+            loop_counts.append(operands[0])
+        elif name == "end_loop":
+            if len(durations) == 1:
+                raise AnimationError("unmatched end_loop at %d" % pc)
+            count = loop_counts.pop()
+            body_duration = durations.pop()
+            body_count = counts.pop()
+            durations[-1] += body_duration * count
+            counts[-1] += body_count * count
+            if durations[-1] > 0xFFFFFFFF or counts[-1] > 0xFFFFFFFF:
+                raise AnimationError("animation is too long")
+
+        pc += 1 + size
+
+    raise AnimationError("missing end")
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n")[0])
+    subparsers = parser.add_subparsers(dest="command", required=True)
+
+    assemble_parser = subparsers.add_parser("assemble")
+    assemble_parser.add_argument("source")
+    assemble_parser.add_argument("output")
+    assemble_parser.add_argument(
+        "--c-array", metavar="NAME",
+        help="write a C array to compile into flash instead of a binary")
+
+    check_parser = subparsers.add_parser("check")
+    check_parser.add_argument("animation")
+
+    args = parser.parse_args()
+
+    try:
+        if args.command == "assemble":
+            with open(args.source) as f:
+                program = assemble(f.read())
+            validate(program)
+            if args.c_array:
+                with open(args.output, "w") as f:
+                    f.write("const uint8_t %s[] = {\n" % args.c_array)
+                    for i in range(0, len(program), 12):
+                        f.write("    " + ", ".join(
+                            "0x%02x" % b for b in program[i:i + 12]) + ",\n")
+                    f.write("};\n")
+            else:
+                with open(args.output, "wb") as f:
+                    f.write(program)
+            print("%d bytes" % len(program))
+        else:
+            with open(args.animation, "rb") as f:
+                program = f.read()
+            listing, duration_ms, num_instructions = validate(program)
+            print("offset  start_ms  repeats  instruction")
+            for offset, text, start_ms, repeats in listing:
+                print("%6d  %8d  %7d  %s" % (offset, start_ms, repeats, text))
+            print("%d bytes, %d ms, %d instructions executed"
+                  % (len(program), duration_ms, num_instructions))
+    except AnimationError as e:
+        print("error: %s" % e, file=sys.stderr)
+        return 1
+
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
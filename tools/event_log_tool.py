@@ -0,0 +1,186 @@
+#!/usr/bin/env python3
+"""Decode the clock's persistent event log into text.
+
+The format is documented in include/event_log.h. Read the eventlog partition
+(see partitions.csv) with
+
+    esptool.py read_flash 0x3e0000 0x10000 eventlog.bin
+
+and decode it with
+
+    event_log_tool.py decode eventlog.bin
+
+The output of the serial console's "events raw" command can be decoded too:
+
+    event_log_tool.py decode --hex console_capture.txt
+"""
+
+import argparse
+import datetime
+import struct
+import sys
+
+MAGIC = 0x4C45584E
+VERSION = 1
+SECTOR_SIZE = 4096
+HEADER = struct.Struct("<IIHHHH")
+RECORD = struct.Struct("<IiiHH")
+MIN_EPOCH = 1600000000
+
+# Keep in sync with event_id_t
+EVENT_NAMES = {
+    1: "boot",
+    2: "log_dropped",
+    3: "wifi_connect_failed",
+    4: "ntp_synced",
+    5: "ntp_sync_failed",
+    6: "weather_http_error",
+    7: "task_stalled",
+}
+
+# Keep in sync with heartbeat_id_t
+HEARTBEAT_NAMES = {
+    0: "time_service", 1: "display_time", 2: "ui", 3: "display_jobs",
+    4: "network_jobs", 5: "tubes_off",
+}
+
+# esp_reset_reason_t
+RESET_REASONS = {
+    0: "unknown", 1: "power_on", 2: "external", 3: "software", 4: "panic",
+    5: "int_wdt", 6: "task_wdt", 7: "wdt", 8: "deep_sleep", 9: "brownout",
+    10: "sdio",
+}
+
+
+def crc16_ccitt(data):
+    crc = 0xFFFF
+    for byte in data:
+        crc ^= byte << 8
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x1021) if crc & 0x8000 else crc << 1
+            crc &= 0xFFFF
+    return crc
+
+
+def parse_record(data):
+    """Returns (timestamp, event_id, arg0, arg1) or None for a torn record."""
+    timestamp, arg0, arg1, event_id, crc = RECORD.unpack(data)
+    if crc != crc16_ccitt(data[:RECORD.size - 2]):
+        return None
+    return timestamp, event_id, arg0, arg1
+
+
+def read_partition(image):
+    """Yields the records of a partition image, oldest first."""
+    sectors = []
+    for offset in range(0, len(image) - SECTOR_SIZE + 1, SECTOR_SIZE):
+        header = image[offset:offset + HEADER.size]
+        magic, sequence, version, record_size, _, crc = HEADER.unpack(header)
+        if (magic != MAGIC or version != VERSION or
+                record_size != RECORD.size or
+                crc != crc16_ccitt(header[:HEADER.size - 2])):
+            continue
+        sectors.append((sequence, offset))
+
+    if not sectors:
+        return
+
+    # Sequence numbers may wrap, so they are compared as serial numbers
+    latest = sectors[0][0]
+    for sequence, _ in sectors:
+        if ((sequence - latest) & 0xFFFFFFFF) < 0x80000000:
+            latest = sequence
+
+    def age(sector):
+        return (latest - sector[0]) & 0xFFFFFFFF
+
+    torn = 0
+    for _, offset in sorted(sectors, key=age, reverse=True):
+        for record_offset in range(offset + HEADER.size, offset + SECTOR_SIZE,
+                                   RECORD.size):
+            data = image[record_offset:record_offset + RECORD.size]
+            if data == b"\xff" * RECORD.size:
+                break
+            record = parse_record(data)
+            if record is None:
+                torn += 1
+            else:
+                yield record
+
+    if torn:
+        print(f"{torn} torn records skipped", file=sys.stderr)
+
+
+def read_hex(lines):
+    """Yields the records of the console's "events raw" output."""
+    for line in lines:
+        line = line.strip()
+        if len(line) != 2 * RECORD.size:
+            continue
+        try:
+            data = bytes.fromhex(line)
+        except ValueError:
+            continue
+        record = parse_record(data)
+        if record is not None:
+            yield record
+
+
+def format_record(record, utc):
+    timestamp, event_id, arg0, arg1 = record
+    if timestamp >= MIN_EPOCH:
+        if utc:
+            time = datetime.datetime.fromtimestamp(timestamp,
+                                                   datetime.timezone.utc)
+        else:
+            time = datetime.datetime.fromtimestamp(timestamp)
+        when = time.strftime("%Y-%m-%d %H:%M:%S")
+    else:
+        when = f"boot+{timestamp}s"
+
+    name = EVENT_NAMES.get(event_id, f"event_{event_id}")
+    if event_id == 1:
+        details = f"reset reason: {RESET_REASONS.get(arg0, arg0)}"
+    elif event_id == 4:
+        details = f"step: {arg0} ms"
+    elif event_id == 6:
+        request = "location" if arg0 == 0 else "weather"
+        details = f"{request} request, status {arg1}"
+    elif event_id == 7:
+        details = (f"{HEARTBEAT_NAMES.get(arg0, arg0)}, no heartbeat for "
+                   f"{arg1} ms")
+    else:
+        details = f"{arg0} {arg1}"
+
+    return f"{when}\t{name}\t{details}"
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    subparsers = parser.add_subparsers(dest="command", required=True)
+
+    decode = subparsers.add_parser("decode", help="print the events")
+    decode.add_argument("file")
+    decode.add_argument("--hex", action="store_true",
+                        help="the file is \"events raw\" console output")
+    decode.add_argument("--utc", action="store_true",
+                        help="print times in UTC rather than local time")
+
+    args = parser.parse_args()
+
+    if args.hex:
+        with open(args.file) as f:
+            records = list(read_hex(f))
+    else:
+        with open(args.file, "rb") as f:
+            records = list(read_partition(f.read()))
+
+    for record in records:
+        print(format_record(record, args.utc))
+    print(f"{len(records)} events", file=sys.stderr)
+
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,255 @@
+#!/usr/bin/env python3
+"""Stand-in NTP servers, with injected delays and falsetickers.
+
+The clock's SNTP client (include/ntp_client.h) queries several servers and
+only trusts a majority whose time agrees. This runs a few local servers to
+try it against, each on its own port:
+
+    ntp_tool.py serve --server offset=0 --server offset=0,delay=80 \\
+        --server offset=0,delay=5,jitter=40 --server offset=3600
+
+serves four servers on ports 12300 to 12303, the last one an hour out (a
+falseticker). Build the clock with
+    -D 'NTP_SERVERS="HOST:12300", "HOST:12301", "HOST:12302", "HOST:12303"'
+to use them. Each server is given as comma-separated key=value pairs:
+
+    offset   seconds added to the host's time (default 0)
+    delay    round trip network delay in milliseconds (default 0)
+    jitter   random extra delay in milliseconds, up to this (default 0)
+    asym     fraction of the delay on the way to the server, 0.5 for a
+             symmetric path (default 0.5)
+    drop     probability of not answering (default 0)
+    stratum  (default 2). 0 sends kiss-o'-death responses
+    leap     3 to claim to be unsynchronized (default 0)
+
+The servers can be checked from the host, with the same selection as the
+clock's:
+
+    ntp_tool.py query 127.0.0.1:12300 127.0.0.1:12301 ...
+"""
+
+import argparse
+import os
+import random
+import select
+import socket
+import struct
+import sys
+import threading
+import time
+
+NTP_EPOCH_OFFSET = 2208988800
+PACKET = struct.Struct("!BBbbIIIQQQQ")
+DEFAULT_PORT = 12300
+MAX_ROOT_DISTANCE = 1.5
+
+
+def to_ntp(unix_time):
+    seconds = int(unix_time) + NTP_EPOCH_OFFSET
+    fraction = int((unix_time % 1) * (1 << 32))
+    return ((seconds & 0xFFFFFFFF) << 32) | fraction
+
+
+def from_ntp(timestamp):
+    seconds = timestamp >> 32
+    if not seconds & 0x80000000:
+        seconds += 1 << 32  # Era 1, after 2036
+    return seconds - NTP_EPOCH_OFFSET + (timestamp & 0xFFFFFFFF) / (1 << 32)
+
+
+def parse_server_spec(spec):
+    settings = {"offset": 0.0, "delay": 0.0, "jitter": 0.0, "asym": 0.5,
+                "drop": 0.0, "stratum": 2, "leap": 0}
+    if spec:
+        for item in spec.split(","):
+            key, _, value = item.partition("=")
+            if key not in settings:
+                raise ValueError(f"unknown setting {key}")
+            settings[key] = type(settings[key])(value)
+    return settings
+
+
+def answer(sock, request, source, settings):
+    if len(request) < PACKET.size or request[0] & 0x7 != 3:
+        return
+    if random.random() < settings["drop"]:
+        return
+
+    delay = (settings["delay"] + random.uniform(0, settings["jitter"])) / 1000
+    # The request spends part of the delay on the way in, the response the
+    # rest of it on the way out
+    time.sleep(delay * settings["asym"])
+    receive = time.time() + settings["offset"]
+
+    transmit_of_request = PACKET.unpack(request[:PACKET.size])[10]
+    version = (request[0] >> 3) & 0x7
+    stratum = settings["stratum"]
+    reference_id = 0x52415445 if stratum == 0 else 0x7F000001  # "RATE"
+    header = (settings["leap"] << 6) | (version << 3) | 4
+    response = PACKET.pack(
+        header, stratum, 6, -20, 0x00000100, 0x00000200, reference_id,
+        to_ntp(receive - 16), transmit_of_request, to_ntp(receive),
+        to_ntp(time.time() + settings["offset"]))
+    time.sleep(delay * (1 - settings["asym"]))
+    sock.sendto(response, source)
+
+
+def serve(sock, settings):
+    while True:
+        request, source = sock.recvfrom(512)
+        # Responses are delayed on their own threads, so a slow one doesn't
+        # hold up the next request
+        threading.Thread(target=answer, args=(sock, request, source, settings),
+                         daemon=True).start()
+
+
+def command_serve(args):
+    specs = args.server or [""]
+    threads = []
+    for i, spec in enumerate(specs):
+        settings = parse_server_spec(spec)
+        sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+        sock.bind((args.host, args.port + i))
+        print(f"{args.host}:{args.port + i} {settings}")
+        thread = threading.Thread(target=serve, args=(sock, settings),
+                                  daemon=True)
+        thread.start()
+        threads.append(thread)
+
+    try:
+        while True:
+            time.sleep(1)
+    except KeyboardInterrupt:
+        pass
+    return 0
+
+
+def query(sock, address):
+    """Returns (offset, delay, root distance, stratum) or None."""
+    cookie = int.from_bytes(os.urandom(8), "big")
+    request = PACKET.pack((4 << 3) | 3, 0, 0, 0, 0, 0, 0, 0, 0, 0, cookie)
+    t1 = time.time()
+    sock.sendto(request, address)
+
+    deadline = t1 + 1.5
+    while True:
+        remaining = deadline - time.time()
+        if remaining <= 0 or not select.select([sock], [], [], remaining)[0]:
+            return None
+        response, source = sock.recvfrom(512)
+        t4 = time.time()
+        if source == address and len(response) >= PACKET.size:
+            break
+
+    (header, stratum, _, _, root_delay, root_dispersion, _, _, origin,
+     receive, transmit) = PACKET.unpack(response[:PACKET.size])
+    if (header & 0x7 != 4 or header >> 6 == 3 or not 1 <= stratum <= 15 or
+            origin != cookie):
+        return None
+
+    t2 = from_ntp(receive)
+    t3 = from_ntp(transmit)
+    offset = ((t2 - t1) + (t3 - t4)) / 2
+    delay = max((t4 - t1) - (t3 - t2), 0)
+    distance = delay / 2 + root_delay / (1 << 17) + root_dispersion / (1 << 16)
+    if distance > MAX_ROOT_DISTANCE:
+        return None
+    return offset, delay, distance, stratum
+
+
+def select_offset(samples):
+    """Marzullo's intersection, as in select_ntp_offset() in ntp_client.cpp.
+    Returns (offset, low, high, truechimers) or None."""
+    endpoints = sorted(
+        [(offset - distance, -1) for offset, _, distance, _ in samples] +
+        [(offset + distance, 1) for offset, _, distance, _ in samples])
+    n = len(samples)
+    for falsetickers in range((n + 1) // 2):
+        needed = n - falsetickers
+        low = high = None
+        count = 0
+        for value, kind in endpoints:
+            count -= kind
+            if count >= needed:
+                low = value
+                break
+        count = 0
+        for value, kind in reversed(endpoints):
+            count += kind
+            if count >= needed:
+                high = value
+                break
+        if low is not None and high is not None and low <= high:
+            break
+    else:
+        return None
+
+    truechimers = [(offset, distance) for offset, _, distance, _ in samples
+                   if offset + distance >= low and offset - distance <= high]
+    weights = [1 / (distance + 1e-6) for _, distance in truechimers]
+    offset = sum(w * o for w, (o, _) in zip(weights, truechimers)) / sum(
+        weights)
+    return offset, low, high, len(truechimers)
+
+
+def parse_address(text):
+    host, _, port = text.partition(":")
+    return socket.gethostbyname(host), int(port) if port else 123
+
+
+def command_query(args):
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    samples = []
+    for server in args.servers:
+        address = parse_address(server)
+        best = None
+        for _ in range(args.samples):
+            sample = query(sock, address)
+            if sample and (best is None or sample[1] < best[1]):
+                best = sample
+        if best is None:
+            print(f"{server}: no usable answer")
+            continue
+        offset, delay, distance, stratum = best
+        print(f"{server}: offset {offset * 1e3:.3f} ms, delay "
+              f"{delay * 1e3:.3f} ms, distance {distance * 1e3:.3f} ms, "
+              f"stratum {stratum}")
+        samples.append(best)
+
+    selection = select_offset(samples) if samples else None
+    if selection is None:
+        print("no majority agrees")
+        return 1
+    offset, low, high, truechimers = selection
+    print(f"offset {offset * 1e3:.3f} ms within [{low * 1e3:.3f}, "
+          f"{high * 1e3:.3f}] ms, {truechimers} of {len(samples)} servers")
+    return 0
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description=__doc__.splitlines()[0],
+        formatter_class=argparse.RawDescriptionHelpFormatter,
+        epilog="\n".join(__doc__.splitlines()[2:]))
+    subparsers = parser.add_subparsers(dest="command", required=True)
+
+    serve_parser = subparsers.add_parser("serve", help="run the servers")
+    serve_parser.add_argument("--server", action="append", metavar="SPEC",
+                              help="a server's settings, repeat for more")
+    serve_parser.add_argument("--host", default="0.0.0.0")
+    serve_parser.add_argument("--port", type=int, default=DEFAULT_PORT,
+                              help="port of the first server")
+
+    query_parser = subparsers.add_parser(
+        "query", help="sample servers and select an offset")
+    query_parser.add_argument("servers", nargs="+", metavar="HOST[:PORT]")
+    query_parser.add_argument("--samples", type=int, default=4)
+
+    args = parser.parse_args()
+    if args.command == "serve":
+        return command_serve(args)
+    return command_query(args)
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,105 @@
+#!/usr/bin/env python3
+"""Send sensor hub temperature readings to the clock from the host.
+
+The datagram formats are documented in include/sensor_hub.h. This stands in
+for a sensor hub on the LAN when trying out the clock's UDP listener.
+
+Usage:
+    sensor_hub_tool.py send TEMP_F [--seq N] [--age S] [--json]
+                       [--host HOST] [--port PORT]
+    sensor_hub_tool.py stream TEMP_F [--interval S] [--count N] [--json]
+                       [--host HOST] [--port PORT]
+
+Readings are broadcast unless a host is given.
+"""
+
+import argparse
+import json
+import socket
+import struct
+import sys
+import time
+
+MAGIC = b"NT"
+VERSION = 1
+DEFAULT_PORT = 4210
+MAX_AGE_S = 10 * 60
+
+
+def encode_binary(sequence, temperature_f, age_s):
+    return MAGIC + struct.pack(
+        "<BBIhH", VERSION, 0, sequence & 0xFFFFFFFF,
+        round(temperature_f * 100), age_s)
+
+
+def encode_json(sequence, temperature_f, age_s):
+    return json.dumps(
+        {"seq": sequence & 0xFFFFFFFF, "temp_f": temperature_f,
+         "age_s": age_s},
+        separators=(",", ":")).encode()
+
+
+def make_socket(host):
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    if host == "<broadcast>":
+        sock.setsockopt(socket.SOL_SOCKET, socket.SO_BROADCAST, 1)
+    return sock
+
+
+def send_reading(sock, args, sequence, temperature_f):
+    encode = encode_json if args.json else encode_binary
+    datagram = encode(sequence, temperature_f, args.age)
+    sock.sendto(datagram, (args.host, args.port))
+    print(f"seq {sequence}: {temperature_f:.2f} F ({len(datagram)} bytes)")
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    subparsers = parser.add_subparsers(dest="command", required=True)
+
+    send = subparsers.add_parser("send", help="send a single reading")
+    send.add_argument("--seq", type=int, default=int(time.time()))
+
+    stream = subparsers.add_parser(
+        "stream", help="send a reading every interval, drifting by 0.1 F")
+    stream.add_argument("--interval", type=float, default=30)
+    stream.add_argument("--count", type=int, default=0,
+                        help="number of readings, 0 for no limit")
+
+    for subparser in (send, stream):
+        subparser.add_argument("temperature", type=float, metavar="TEMP_F")
+        subparser.add_argument("--age", type=int, default=0,
+                               help="age of the reading in seconds")
+        subparser.add_argument("--json", action="store_true")
+        subparser.add_argument("--host", default="<broadcast>")
+        subparser.add_argument("--port", type=int, default=DEFAULT_PORT)
+
+    args = parser.parse_args()
+
+    if not 0 <= args.age <= 0xFFFF:
+        parser.error("the age must fit in 16 bits")
+    if args.age > MAX_AGE_S:
+        print(f"warning: readings older than {MAX_AGE_S} s are rejected",
+              file=sys.stderr)
+
+    sock = make_socket(args.host)
+
+    if args.command == "send":
+        send_reading(sock, args, args.seq, args.temperature)
+        return 0
+
+    sequence = int(time.time())
+    temperature_f = args.temperature
+    sent = 0
+    while args.count == 0 or sent < args.count:
+        send_reading(sock, args, sequence, temperature_f)
+        sent += 1
+        sequence += 1
+        temperature_f += 0.1
+        time.sleep(args.interval)
+
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())